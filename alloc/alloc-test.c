@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs with the plugin linked in, so that its malloc and free are called
+ * rather than the C library's. Also samples from a profiling timer signal
+ * while the main thread allocates, as the sampler does, and measures the
+ * cost the plugin adds to each call against the C library's own functions.
+ */
+
+#define _GNU_SOURCE
+
+#include <malloc.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "allinea_metric_plugin_api.h"
+#include "alloc_blocks.h"
+
+void allinea_set_plugin_error_messagef(plugin_id_t id, int error_code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void allinea_set_metric_error_messagef(metric_id_t id, int error_code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+extern int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused);
+extern int allinea_plugin_cleanup(plugin_id_t id, void *unused);
+extern int allinea_allocRate(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_allocBytes(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_allocLiveGrowth(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_allocTimeFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_allocMedianSize(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+
+/* The C library's own functions, to measure the cost of counting against */
+extern void *__libc_malloc(size_t size);
+extern void __libc_free(void *ptr);
+
+#define NUM_BLOCKS 1000
+#define NUM_THREADS 4
+#define THREAD_ALLOCS 10000
+#define BENCHMARK_CALLS 2000000
+#define BENCHMARK_ROUNDS 9
+
+/* Counting must add under 10 ns to each call, in the median of the rounds, so
+   that a round slowed by other work on the machine does not fail the test */
+#define MAX_OVERHEAD_NS 10.0
+
+struct sample {
+    uint64_t allocs;
+    uint64_t bytes;
+    double liveGrowth;
+    double timeFraction;
+    uint64_t medianSize;
+};
+
+static struct sample take_sample(int seconds, int print)
+{
+    struct timespec sampleTime = { seconds, 0 };
+    struct sample s;
+    if (allinea_allocRate(1, &sampleTime, &s.allocs) != 0 ||
+        allinea_allocBytes(2, &sampleTime, &s.bytes) != 0 ||
+        allinea_allocLiveGrowth(3, &sampleTime, &s.liveGrowth) != 0 ||
+        allinea_allocTimeFraction(4, &sampleTime, &s.timeFraction) != 0 ||
+        allinea_allocMedianSize(5, &sampleTime, &s.medianSize) != 0) {
+        fprintf(stderr, "FAIL: sampling at %d s failed\n", seconds);
+        abort();
+    }
+    if (print)
+        fprintf(stderr, "%d s: %llu allocations, %llu bytes, live growth %.0f B/s, allocator %.2f%%, median %llu B\n",
+                seconds, (unsigned long long) s.allocs, (unsigned long long) s.bytes, s.liveGrowth, s.timeFraction,
+                (unsigned long long) s.medianSize);
+    return s;
+}
+
+static void check(int ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        abort();
+    }
+}
+
+/*! The entry of \a table for the block at \a start, copied into a static buffer, or NULL. */
+static const struct alloc_block *find_block(const struct alloc_blocks *table, uintptr_t start)
+{
+    static struct alloc_block copy;
+    for (size_t i = 0; i < ALLOC_BLOCKS_CAPACITY; ++i)
+        if (alloc_blocks_read(table, i, &copy) && copy.start == start)
+            return &copy;
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    const double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Keeps the compiler from removing a malloc and free of the same block */
+static void *volatile sink;
+
+static void *allocate_in_thread(void *unused)
+{
+    for (int i = 0; i < THREAD_ALLOCS; ++i) {
+        sink = malloc(2000);
+        free(sink);
+    }
+    return NULL;
+}
+
+/* Samples from the signal handler, as the sampler does, whatever the allocating thread is doing */
+static volatile int signalSamples = 0;
+
+static void sample_from_signal(int signal)
+{
+    take_sample(1000 + signalSamples++, 0);
+}
+
+int main(void)
+{
+    static void *blocks[NUM_BLOCKS];
+
+    check(allinea_plugin_initialize(1, NULL) == 0, "allinea_plugin_initialize failed");
+    take_sample(1, 1);
+
+    /* 1000 live blocks of 100 bytes */
+    for (int i = 0; i < NUM_BLOCKS; ++i)
+        blocks[i] = malloc(100);
+    struct sample s = take_sample(2, 1);
+    check(s.allocs == NUM_BLOCKS, "expected 1000 allocations");
+    check(s.bytes == NUM_BLOCKS * 100, "expected 100000 bytes");
+    check(s.liveGrowth > 0.0, "expected the live heap to grow");
+    check(s.medianSize == 128, "expected a median size of up to 128 bytes");
+
+    for (int i = 0; i < NUM_BLOCKS; ++i)
+        free(blocks[i]);
+    s = take_sample(3, 1);
+    check(s.allocs == 0, "expected no allocations while freeing");
+    check(s.liveGrowth < 0.0, "expected the live heap to shrink");
+
+    /* Each of these is one allocation */
+    void *p = calloc(10, 100);
+    p = realloc(p, 5000);
+    void *q;
+    check(posix_memalign(&q, 64, 3000) == 0, "posix_memalign failed");
+    void *r = aligned_alloc(4096, 4096);
+    s = take_sample(4, 1);
+    check(s.allocs == 4, "expected calloc, realloc, posix_memalign and aligned_alloc to be 4 allocations");
+    check(s.bytes == 1000 + 5000 + 3000 + 4096, "expected the bytes asked for by each");
+    free(p);
+    free(q);
+    free(r);
+
+    /* A calloc whose size overflows fails, and asks for no bytes */
+    volatile size_t huge = SIZE_MAX / 2 + 1;
+    check(calloc(huge, 2) == NULL, "expected calloc to fail when the size overflows");
+    s = take_sample(5, 1);
+    check(s.allocs == 1 && s.bytes == 0, "expected a failed calloc to be 1 allocation of 0 bytes");
+
+    /* Once asked for, the large blocks are kept with where they were allocated from */
+    const struct alloc_blocks *table = alloc_blocks_open();
+    check(table != NULL, "expected map_alloc_blocks to be found");
+    void *large = malloc(1 << 20);
+    void *small = malloc(1000);
+    check(find_block(table, (uintptr_t) large) != NULL && find_block(table, (uintptr_t) large)->size >= 1 << 20 &&
+          find_block(table, (uintptr_t) large)->site != 0, "expected the large block with its size and site");
+    check(find_block(table, (uintptr_t) small) == NULL, "expected no small blocks");
+    large = realloc(large, 2 << 20);
+    check(find_block(table, (uintptr_t) large) != NULL && find_block(table, (uintptr_t) large)->size >= 2 << 20,
+          "expected the reallocated block with its new size");
+    const uintptr_t freed = (uintptr_t) large;
+    free(large);
+    free(small);
+    check(find_block(table, freed) == NULL, "expected a freed block to be removed");
+    /* Many more than fit, which are dropped rather than waited for */
+    static void *many[2 * ALLOC_BLOCKS_CAPACITY];
+    for (int i = 0; i < 2 * ALLOC_BLOCKS_CAPACITY; ++i)
+        many[i] = malloc(ALLOC_BLOCKS_MIN_SIZE);
+    for (int i = 0; i < 2 * ALLOC_BLOCKS_CAPACITY; ++i)
+        free(many[i]);
+    large = malloc(1 << 20);
+    check(find_block(table, (uintptr_t) large) != NULL, "expected blocks to be tracked after the table was full");
+    free(large);
+    take_sample(6, 1);
+
+    /* The threads each have their own counters, which are all added up */
+    take_sample(7, 1);
+    pthread_t threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; ++i)
+        pthread_create(&threads[i], NULL, allocate_in_thread, NULL);
+    for (int i = 0; i < NUM_THREADS; ++i)
+        pthread_join(threads[i], NULL);
+    s = take_sample(8, 1);
+    /* Creating the threads allocates their stacks, and maybe more */
+    check(s.allocs >= NUM_THREADS * THREAD_ALLOCS && s.allocs < NUM_THREADS * THREAD_ALLOCS + 100,
+          "expected the allocations of every thread");
+    check(s.medianSize == 2048, "expected a median size of up to 2048 bytes");
+    check(s.timeFraction > 0.0, "expected some time in the allocator");
+
+    /* Samples taken in a signal handler part way through allocating must not deadlock or allocate */
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sample_from_signal;
+    sigaction(SIGPROF, &action, NULL);
+    struct itimerval timer = { { 0, 200 }, { 0, 200 } };
+    setitimer(ITIMER_PROF, &timer, NULL);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (seconds_since(&start) < 0.5) {
+        sink = malloc(64);
+        free(sink);
+    }
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    check(signalSamples > 10, "expected samples from the signal handler");
+
+    /* The cost of counting, against the C library's functions, in the median of several rounds of each */
+    double libcNs[BENCHMARK_ROUNDS], overheadNs[BENCHMARK_ROUNDS];
+    for (int round = 0; round < BENCHMARK_ROUNDS; ++round) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < BENCHMARK_CALLS; ++i) {
+            sink = __libc_malloc(32);
+            __libc_free(sink);
+        }
+        const double libcRound = seconds_since(&start);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < BENCHMARK_CALLS; ++i) {
+            sink = malloc(32);
+            free(sink);
+        }
+        const double countedRound = seconds_since(&start);
+        libcNs[round] = libcRound * 1e9 / (2.0 * BENCHMARK_CALLS);
+        overheadNs[round] = (countedRound - libcRound) * 1e9 / (2.0 * BENCHMARK_CALLS);
+    }
+    qsort(libcNs, BENCHMARK_ROUNDS, sizeof(double), compare_doubles);
+    qsort(overheadNs, BENCHMARK_ROUNDS, sizeof(double), compare_doubles);
+    const double medianOverheadNs = overheadNs[BENCHMARK_ROUNDS / 2];
+    fprintf(stderr, "%.1f ns per call in the C library, %.1f ns added by counting (%d signal samples)\n",
+            libcNs[BENCHMARK_ROUNDS / 2], medianOverheadNs, signalSamples);
+    check(medianOverheadNs < MAX_OVERHEAD_NS, "expected less than 10 ns added to each call");
+
+    allinea_plugin_cleanup(1, NULL);
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,768 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Heap allocation metrics: allocation and byte rates, growth of the live
+ * heap, the time spent in the allocator and the median allocation size.
+ *
+ * The library defines malloc, calloc, realloc, free, posix_memalign,
+ * aligned_alloc and memalign, which count the call and call the next
+ * definition, so it must be preloaded into the program (see README.txt).
+ * Each thread counts into its own slot, found through one thread-local
+ * variable, with relaxed atomic stores that the sampler reads with relaxed
+ * atomic loads, so neither takes a lock and the sampler never allocates.
+ *
+ * Reading the clock twice would cost more than the rest of the counting, so
+ * only one call in TIME_SAMPLE_PERIOD is timed, and the time in the allocator
+ * is estimated from those.
+ *
+ * Once another plugin asks for them through map_alloc_blocks, the blocks of
+ * at least ALLOC_BLOCKS_MIN_SIZE bytes are also kept in a table with the
+ * address they were allocated from (see ../common/alloc_blocks.h).
+ */
+
+#define _GNU_SOURCE
+
+#include "allinea_metric_plugin_api.h"
+#include "alloc_blocks.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*! Threads beyond this many share one slot, which they update with atomic additions. */
+#define MAX_THREADS 1024
+
+/*! One call in this many is timed. Must be a power of 2. */
+#define TIME_SAMPLE_PERIOD 64
+
+/*! Allocation sizes are counted in power of 2 size classes up to 2^(NUM_SIZE_CLASSES - 1) bytes and over. */
+#define NUM_SIZE_CLASSES 32
+
+/*! The size of the buffer that allocations are made from while the real allocator is being looked up. */
+#define BOOTSTRAP_BUFFER_SIZE 8192
+
+/*! The allocations of one thread. */
+struct thread_allocs {
+    /*! Calls that allocate, including realloc. Not counted by the calls, as it is the sum of \a sizeClasses. */
+    uint64_t allocs;
+    uint64_t frees;
+    /*! The bytes asked for by the calls that allocate. */
+    uint64_t bytes;
+    /*! The usable size of the blocks allocated and freed, whose difference is the live heap. */
+    uint64_t usableAllocated;
+    uint64_t usableFreed;
+    /*! The calls that were timed, and the time they took. */
+    uint64_t timedCalls;
+    uint64_t timedNs;
+    uint64_t sizeClasses[NUM_SIZE_CLASSES];
+} __attribute__((aligned(64)));
+
+static struct thread_allocs threadAllocs[MAX_THREADS + 1];
+
+/*! The slot shared by the threads beyond \a MAX_THREADS. */
+#define SHARED_SLOT MAX_THREADS
+
+/*! How many entries of \a threadAllocs have been handed out, which may be more than \a MAX_THREADS. */
+static uint32_t numThreads = 0;
+
+/*! What the functions keep for the calling thread, together so that each call looks it up once. */
+struct thread_state {
+    /*! The slot of the thread, or NULL until its first call. */
+    struct thread_allocs *allocs;
+    /*! How many of the functions the thread is in, so that calls from the allocator itself are not counted. */
+    uint32_t depth;
+    /*! The calls counted, to choose the ones to time. */
+    uint32_t calls;
+};
+
+/*! The state of the calling thread. Initial-exec, so that using it never allocates. */
+static __thread struct thread_state myState __attribute__((tls_model("initial-exec")));
+
+/*! The large blocks, for map_alloc_blocks. None are tracked while \a minSize is UINT64_MAX, so until asked for they cost one comparison. */
+static struct alloc_blocks allocBlocks = { UINT64_MAX, { { 0, 0, 0 } } };
+
+/*! The next definitions of the functions, normally those of the C library. */
+static void *(*realMalloc)(size_t);
+static void *(*realCalloc)(size_t, size_t);
+static void *(*realRealloc)(void *, size_t);
+static void (*realFree)(void *);
+static int (*realPosixMemalign)(void **, size_t, size_t);
+static void *(*realAlignedAlloc)(size_t, size_t);
+static void *(*realMemalign)(size_t, size_t);
+static size_t (*realUsableSize)(void *);
+
+/*! Set if the next allocator keeps the size of each block in the word before it, as the C library's does. */
+static int sizeInHeader = 0;
+
+/*! Set while the real functions are being looked up, as dlsym can allocate. */
+static int lookingUp = 0;
+
+static char bootstrapBuffer[BOOTSTRAP_BUFFER_SIZE] __attribute__((aligned(16)));
+static size_t bootstrapUsed = 0;
+
+/*! The totals of each thread at the last sample, so that each sample reports the calls since the last. */
+static struct thread_allocs lastTotals[MAX_THREADS + 1];
+
+/*! The time \a now_ns adds to a timed call, measured at initialization and taken off each. */
+static uint64_t clockOverheadNs = 0;
+
+/*! When the last sample was taken, in the clock of \a now_ns. */
+static uint64_t lastSampleNs;
+
+/*! The metrics for the last sample. */
+static uint64_t allocsLastSample;
+static uint64_t bytesLastSample;
+static double liveGrowthLastSample;
+static double allocatorFractionLastSample;
+static uint64_t medianSizeLastSample;
+
+/*! Time of the last sample. */
+/*!
+ *  If the time of the current sample is different from the time of the last
+ *  then we assume it is a new sample and we need to recalculate the metrics.
+ */
+static struct timespec lastSampleTime;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+/*! Allocates from \a bootstrapBuffer, for dlsym while the real functions are being looked up. */
+/*!
+ *  \param alignment a power of 2. Blocks are aligned to at least 16 bytes,
+ *  as malloc's are
+ */
+static void *bootstrap_alloc(size_t size, size_t alignment)
+{
+    if ((alignment & (alignment - 1)) != 0 || size > sizeof(bootstrapBuffer) || alignment > sizeof(bootstrapBuffer))
+        return NULL;
+    if (alignment < 16)
+        alignment = 16;
+    /* Enough for the block to be aligned wherever it starts */
+    size = ((size + 15) & ~(size_t) 15) + alignment - 16;
+    size_t used = __atomic_fetch_add(&bootstrapUsed, size, __ATOMIC_RELAXED);
+    if (used + size > sizeof(bootstrapBuffer))
+        return NULL;
+    return (void *) (((uintptr_t) (bootstrapBuffer + used) + alignment - 1) & ~(uintptr_t) (alignment - 1));
+}
+
+static int is_bootstrap(const void *ptr)
+{
+    return (const char *) ptr >= bootstrapBuffer && (const char *) ptr < bootstrapBuffer + sizeof(bootstrapBuffer);
+}
+
+/*! Looks up the next definitions of the functions. */
+static void find_real_functions(void)
+{
+    lookingUp = 1;
+    realMalloc = (void *(*)(size_t)) dlsym(RTLD_NEXT, "malloc");
+    realCalloc = (void *(*)(size_t, size_t)) dlsym(RTLD_NEXT, "calloc");
+    realRealloc = (void *(*)(void *, size_t)) dlsym(RTLD_NEXT, "realloc");
+    realFree = (void (*)(void *)) dlsym(RTLD_NEXT, "free");
+    realPosixMemalign = (int (*)(void **, size_t, size_t)) dlsym(RTLD_NEXT, "posix_memalign");
+    realAlignedAlloc = (void *(*)(size_t, size_t)) dlsym(RTLD_NEXT, "aligned_alloc");
+    realMemalign = (void *(*)(size_t, size_t)) dlsym(RTLD_NEXT, "memalign");
+    realUsableSize = (size_t (*)(void *)) dlsym(RTLD_NEXT, "malloc_usable_size");
+    lookingUp = 0;
+}
+
+/*! The usable size of a block, as malloc_usable_size of the C library would return. */
+/*!
+ *  Calling malloc_usable_size on every call costs about as much as all the
+ *  rest of the counting, so if the allocator is the C library's the size is
+ *  read from its header instead: the chunk size, less the header, and less
+ *  the footer for the mmapped chunks that have one.
+ */
+static inline size_t usable_size(void *ptr)
+{
+    if (!sizeInHeader)
+        return realUsableSize(ptr);
+    const size_t header = ((const size_t *) ptr)[-1];
+    return (header & ~(size_t) 7) - (header & 2 ? 2 : 1) * sizeof(size_t);
+}
+
+/*! Sets \a sizeInHeader if reading the header agrees with malloc_usable_size for small, large and mmapped blocks. */
+static void check_size_in_header(void)
+{
+    static const size_t sizes[] = { 1, 24, 100, 4000, 100000, 4 << 20 };
+    if (realMalloc == NULL || realFree == NULL || realUsableSize == NULL)
+        return;
+    int agree = 1;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        void *ptr = realMalloc(sizes[i]);
+        if (ptr == NULL)
+            return;
+        sizeInHeader = 1;
+        agree = agree && usable_size(ptr) == realUsableSize(ptr);
+        sizeInHeader = 0;
+        realFree(ptr);
+    }
+    sizeInHeader = agree;
+}
+
+__attribute__((constructor)) static void init_alloc(void)
+{
+    if (realMalloc == NULL)
+        find_real_functions();
+    check_size_in_header();
+}
+
+/*! Hands out a slot to a thread not seen before. */
+__attribute__((noinline, cold)) static struct thread_allocs *new_thread_allocs(struct thread_state *state)
+{
+    uint32_t index = __atomic_fetch_add(&numThreads, 1, __ATOMIC_RELAXED);
+    state->allocs = &threadAllocs[index < MAX_THREADS ? index : SHARED_SLOT];
+    return state->allocs;
+}
+
+/*! Adds \a value to a counter of the calling thread's slot. */
+/*!
+ *  Only the thread writes to its own slot, so a relaxed store is enough for
+ *  the sampler to read it whole. The threads that share a slot need an atomic
+ *  addition, which the calls of the other threads do not pay for, as the
+ *  counting of each call checks for the shared slot once (see \a
+ *  count_shared).
+ */
+static inline void add(uint64_t *counter, uint64_t value)
+{
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static inline int size_class(size_t size)
+{
+    if (size <= 1)
+        return 0;
+    const int sizeClass = 64 - __builtin_clzll((unsigned long long) size - 1);
+    return sizeClass < NUM_SIZE_CLASSES ? sizeClass : NUM_SIZE_CLASSES - 1;
+}
+
+/*
+ * Timing is out of line, so that the untimed calls do not pay for the
+ * registers it needs.
+ */
+__attribute__((noinline, cold)) static uint64_t start_timing(void)
+{
+    return now_ns();
+}
+
+/*! Adds to the counters of the slot shared by the threads beyond \a MAX_THREADS. */
+__attribute__((noinline, cold)) static void count_shared(uint64_t allocs, uint64_t frees, uint64_t bytes,
+                                                         uint64_t usableAllocated, uint64_t usableFreed, int sizeClass)
+{
+    struct thread_allocs *shared = &threadAllocs[SHARED_SLOT];
+    __atomic_fetch_add(&shared->frees, frees, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shared->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shared->usableAllocated, usableAllocated, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shared->usableFreed, usableFreed, __ATOMIC_RELAXED);
+    if (allocs != 0)
+        __atomic_fetch_add(&shared->sizeClasses[sizeClass], allocs, __ATOMIC_RELAXED);
+}
+
+__attribute__((noinline, cold)) static void end_timing(struct thread_allocs *allocs, uint64_t start)
+{
+    const uint64_t ns = now_ns() - start;
+    if (allocs == &threadAllocs[SHARED_SLOT]) {
+        __atomic_fetch_add(&allocs->timedNs, ns, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&allocs->timedCalls, 1, __ATOMIC_RELAXED);
+    } else {
+        add(&allocs->timedNs, ns);
+        add(&allocs->timedCalls, 1);
+    }
+}
+
+/*! Starts counting a call. */
+/*!
+ *  \return the slot of the thread, or NULL if the call is not to be counted
+ *  because it is made from inside another. \a end_call must be called either
+ *  way. \a start is set to the time to time the call from, or 0.
+ */
+static inline struct thread_allocs *begin_call(struct thread_state *state, uint64_t *start)
+{
+    *start = 0;
+    if (state->depth++ > 0)
+        return NULL;
+    struct thread_allocs *allocs = state->allocs;
+    if (__builtin_expect(allocs == NULL, 0))
+        allocs = new_thread_allocs(state);
+    /* Not the first call, which may set up the thread's arena */
+    if (__builtin_expect((++state->calls & (TIME_SAMPLE_PERIOD - 1)) == 0, 0))
+        *start = start_timing();
+    return allocs;
+}
+
+static inline void end_call(struct thread_state *state, struct thread_allocs *allocs, uint64_t start)
+{
+    if (__builtin_expect(start != 0, 0))
+        end_timing(allocs, start);
+    state->depth--;
+}
+
+/*! Adds a large block to \a allocBlocks, unless every entry it may use is taken. */
+__attribute__((noinline, cold)) static void add_block(void *ptr, uint64_t usable, const void *site)
+{
+    const uintptr_t start = (uintptr_t) ptr;
+    const size_t first = alloc_blocks_hash(start);
+    for (size_t probe = 0; probe < ALLOC_BLOCKS_MAX_PROBES; ++probe) {
+        struct alloc_block *block = &allocBlocks.blocks[(first + probe) & (ALLOC_BLOCKS_CAPACITY - 1)];
+        uintptr_t old = __atomic_load_n(&block->start, __ATOMIC_RELAXED);
+        if (old > ALLOC_BLOCKS_REMOVED ||
+            !__atomic_compare_exchange_n(&block->start, &old, start, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            continue;
+        /* The size last, as readers take an entry with no size to be changing */
+        __atomic_store_n(&block->site, (uintptr_t) site, __ATOMIC_RELAXED);
+        __atomic_store_n(&block->size, usable, __ATOMIC_RELEASE);
+        return;
+    }
+}
+
+/*! Removes a large block from \a allocBlocks, before it is freed so that its address cannot be allocated again first. */
+__attribute__((noinline, cold)) static void remove_block(void *ptr)
+{
+    const uintptr_t start = (uintptr_t) ptr;
+    const size_t first = alloc_blocks_hash(start);
+    for (size_t probe = 0; probe < ALLOC_BLOCKS_MAX_PROBES; ++probe) {
+        struct alloc_block *block = &allocBlocks.blocks[(first + probe) & (ALLOC_BLOCKS_CAPACITY - 1)];
+        const uintptr_t entry = __atomic_load_n(&block->start, __ATOMIC_ACQUIRE);
+        /* An addition takes the first free entry, so the block cannot be past one never used */
+        if (entry == 0)
+            return;
+        if (entry == start) {
+            __atomic_store_n(&block->size, 0, __ATOMIC_RELEASE);
+            __atomic_store_n(&block->start, ALLOC_BLOCKS_REMOVED, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+}
+
+/*! Counts an allocation of \a size bytes, before it is made, so that the size need not be kept across the call. */
+static inline void count_alloc(struct thread_allocs *allocs, size_t size)
+{
+    const int sizeClass = size_class(size);
+    if (__builtin_expect(allocs == &threadAllocs[SHARED_SLOT], 0)) {
+        count_shared(1, 0, size, 0, 0, sizeClass);
+        return;
+    }
+    add(&allocs->bytes, size);
+    add(&allocs->sizeClasses[sizeClass], 1);
+}
+
+/*! Counts the block \a ptr returned by an allocation called from \a site, if it succeeded. */
+static inline void count_block(struct thread_allocs *allocs, void *ptr, const void *site)
+{
+    const uint64_t usable = ptr != NULL ? usable_size(ptr) : 0;
+    if (__builtin_expect(usable >= __atomic_load_n(&allocBlocks.minSize, __ATOMIC_RELAXED), 0))
+        add_block(ptr, usable, site);
+    if (__builtin_expect(allocs == &threadAllocs[SHARED_SLOT], 0)) {
+        count_shared(0, 0, 0, usable, 0, 0);
+        return;
+    }
+    add(&allocs->usableAllocated, usable);
+}
+
+/*! Counts a free of a block of \a usable bytes. */
+static inline void count_free(struct thread_allocs *allocs, size_t usable)
+{
+    if (__builtin_expect(allocs == &threadAllocs[SHARED_SLOT], 0)) {
+        count_shared(0, 1, 0, 0, usable, 0);
+        return;
+    }
+    add(&allocs->usableFreed, usable);
+    add(&allocs->frees, 1);
+}
+
+void *malloc(size_t size)
+{
+    if (realMalloc == NULL) {
+        if (lookingUp)
+            return bootstrap_alloc(size, 16);
+        find_real_functions();
+    }
+    struct thread_state *state = &myState;
+    uint64_t start;
+    struct thread_allocs *allocs = begin_call(state, &start);
+    if (allocs != NULL)
+        count_alloc(allocs, size);
+    void *ptr = realMalloc(size);
+    if (allocs != NULL)
+        count_block(allocs, ptr, __builtin_return_address(0));
+    end_call(state, allocs, start);
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    /* A product that overflows fails without asking for any memory */
+    size_t bytes;
+    if (__builtin_mul_overflow(count, size, &bytes))
+        bytes = 0;
+    if (realCalloc == NULL) {
+        if (lookingUp) {
+            /* The buffer is static, so already zeroed */
+            return bytes == 0 && count != 0 && size != 0 ? NULL : bootstrap_alloc(bytes, 16);
+        }
+        find_real_functions();
+    }
+    struct thread_state *state = &myState;
+    uint64_t start;
+    struct thread_allocs *allocs = begin_call(state, &start);
+    if (allocs != NULL)
+        count_alloc(allocs, bytes);
+    void *ptr = realCalloc(count, size);
+    if (allocs != NULL)
+        count_block(allocs, ptr, __builtin_return_address(0));
+    end_call(state, allocs, start);
+    return ptr;
+}
+
+void *realloc(void *old, size_t size)
+{
+    if (realRealloc == NULL && !lookingUp)
+        find_real_functions();
+    if (realRealloc == NULL || is_bootstrap(old)) {
+        /* Moved out of the bootstrap buffer, as the real allocator does not know about it. While
+           the real functions are being looked up, nothing but the buffer has been allocated */
+        void *ptr = malloc(size);
+        if (ptr != NULL && old != NULL)
+            memcpy(ptr, old, size < (size_t) (bootstrapBuffer + sizeof(bootstrapBuffer) - (char *) old) ?
+                   size : (size_t) (bootstrapBuffer + sizeof(bootstrapBuffer) - (char *) old));
+        return ptr;
+    }
+    struct thread_state *state = &myState;
+    uint64_t start;
+    struct thread_allocs *allocs = begin_call(state, &start);
+    const size_t oldUsable = allocs != NULL && old != NULL ? usable_size(old) : 0;
+    /* Removed first, as once reallocated its address may be allocated again by another thread */
+    const int oldTracked = oldUsable >= __atomic_load_n(&allocBlocks.minSize, __ATOMIC_RELAXED);
+    if (__builtin_expect(oldTracked, 0))
+        remove_block(old);
+    const int allocates = size != 0 || old == NULL;
+    if (allocs != NULL && allocates)
+        count_alloc(allocs, size);
+    void *ptr = realRealloc(old, size);
+    if (allocs != NULL) {
+        /* The old block is only freed if the reallocation succeeded, or the size was 0 */
+        if (old != NULL && (ptr != NULL || size == 0))
+            count_free(allocs, oldUsable);
+        else if (__builtin_expect(oldTracked, 0))
+            add_block(old, oldUsable, __builtin_return_address(0));
+        if (allocates)
+            count_block(allocs, ptr, __builtin_return_address(0));
+    }
+    end_call(state, allocs, start);
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || is_bootstrap(ptr))
+        return;
+    if (realFree == NULL) {
+        /* Only the bootstrap buffer can have been allocated */
+        if (lookingUp)
+            return;
+        find_real_functions();
+    }
+    struct thread_state *state = &myState;
+    uint64_t start;
+    struct thread_allocs *allocs = begin_call(state, &start);
+    if (allocs != NULL) {
+        const size_t usable = usable_size(ptr);
+        if (__builtin_expect(usable >= __atomic_load_n(&allocBlocks.minSize, __ATOMIC_RELAXED), 0))
+            remove_block(ptr);
+        count_free(allocs, usable);
+    }
+    if (__builtin_expect(start == 0, 1)) {
+        /* Counted already, so unless it is timed the real free is a tail call. It
+           frees without allocating, so nothing it calls is counted in its place */
+        state->depth--;
+        realFree(ptr);
+        return;
+    }
+    realFree(ptr);
+    end_call(state, allocs, start);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (realPosixMemalign == NULL) {
+        if (lookingUp) {
+            *memptr = bootstrap_alloc(size, alignment);
+            return *memptr != NULL ? 0 : ENOMEM;
+        }
+        find_real_functions();
+    }
+    struct thread_state *state = &myState;
+    uint64_t start;
+    struct thread_allocs *allocs = begin_call(state, &start);
+    if (allocs != NULL)
+        count_alloc(allocs, size);
+    int ret = realPosixMemalign(memptr, alignment, size);
+    if (allocs != NULL)
+        count_block(allocs, ret == 0 ? *memptr : NULL, __builtin_return_address(0));
+    end_call(state, allocs, start);
+    return ret;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    if (realAlignedAlloc == NULL) {
+        if (lookingUp)
+            return bootstrap_alloc(size, alignment);
+        find_real_functions();
+    }
+    struct thread_state *state = &myState;
+    uint64_t start;
+    struct thread_allocs *allocs = begin_call(state, &start);
+    if (allocs != NULL)
+        count_alloc(allocs, size);
+    void *ptr = realAlignedAlloc(alignment, size);
+    if (allocs != NULL)
+        count_block(allocs, ptr, __builtin_return_address(0));
+    end_call(state, allocs, start);
+    return ptr;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    if (realMemalign == NULL) {
+        if (lookingUp)
+            return bootstrap_alloc(size, alignment);
+        find_real_functions();
+    }
+    struct thread_state *state = &myState;
+    uint64_t start;
+    struct thread_allocs *allocs = begin_call(state, &start);
+    if (allocs != NULL)
+        count_alloc(allocs, size);
+    void *ptr = realMemalign(alignment, size);
+    if (allocs != NULL)
+        count_block(allocs, ptr, __builtin_return_address(0));
+    end_call(state, allocs, start);
+    return ptr;
+}
+
+/*! Returns the table of large blocks, and starts tracking them. See ../common/alloc_blocks.h. */
+const struct alloc_blocks *map_alloc_blocks(void)
+{
+    __atomic_store_n(&allocBlocks.minSize, ALLOC_BLOCKS_MIN_SIZE, __ATOMIC_RELAXED);
+    return &allocBlocks;
+}
+
+/*! Reads the totals of a thread into \a totals. */
+static void read_thread_allocs(const struct thread_allocs *allocs, struct thread_allocs *totals)
+{
+    totals->frees = __atomic_load_n(&allocs->frees, __ATOMIC_RELAXED);
+    totals->bytes = __atomic_load_n(&allocs->bytes, __ATOMIC_RELAXED);
+    totals->usableAllocated = __atomic_load_n(&allocs->usableAllocated, __ATOMIC_RELAXED);
+    totals->usableFreed = __atomic_load_n(&allocs->usableFreed, __ATOMIC_RELAXED);
+    totals->timedCalls = __atomic_load_n(&allocs->timedCalls, __ATOMIC_RELAXED);
+    totals->timedNs = __atomic_load_n(&allocs->timedNs, __ATOMIC_RELAXED);
+    totals->allocs = 0;
+    for (int i = 0; i < NUM_SIZE_CLASSES; ++i) {
+        totals->sizeClasses[i] = __atomic_load_n(&allocs->sizeClasses[i], __ATOMIC_RELAXED);
+        totals->allocs += totals->sizeClasses[i];
+    }
+}
+
+/*! Returns how much \a total has increased since \a last, and updates \a last. */
+static uint64_t delta(uint64_t total, uint64_t *last)
+{
+    if (total <= *last)
+        return 0;
+    const uint64_t d = total - *last;
+    *last = total;
+    return d;
+}
+
+/*! Called once per sample to calculate the metrics from the slots of every thread. */
+static void update(void)
+{
+    const uint64_t now = now_ns();
+    const uint64_t elapsed = now - lastSampleNs;
+    lastSampleNs = now;
+
+    uint32_t numSlots = __atomic_load_n(&numThreads, __ATOMIC_RELAXED);
+    if (numSlots > MAX_THREADS)
+        numSlots = MAX_THREADS + 1;
+
+    struct thread_allocs sum;
+    memset(&sum, 0, sizeof(sum));
+    uint32_t allocatingThreads = 0;
+    for (uint32_t i = 0; i < numSlots; ++i) {
+        /* The shared slot is the last one, and is only used once the others have been handed out */
+        const uint32_t slot = i < MAX_THREADS ? i : SHARED_SLOT;
+        struct thread_allocs totals;
+        struct thread_allocs *last = &lastTotals[slot];
+        read_thread_allocs(&threadAllocs[slot], &totals);
+        sum.bytes += delta(totals.bytes, &last->bytes);
+        sum.usableAllocated += delta(totals.usableAllocated, &last->usableAllocated);
+        sum.usableFreed += delta(totals.usableFreed, &last->usableFreed);
+        sum.timedCalls += delta(totals.timedCalls, &last->timedCalls);
+        sum.timedNs += delta(totals.timedNs, &last->timedNs);
+        const uint64_t allocs = delta(totals.allocs, &last->allocs);
+        const uint64_t frees = delta(totals.frees, &last->frees);
+        sum.allocs += allocs;
+        sum.frees += frees;
+        allocatingThreads += allocs + frees > 0;
+        for (int c = 0; c < NUM_SIZE_CLASSES; ++c)
+            sum.sizeClasses[c] += delta(totals.sizeClasses[c], &last->sizeClasses[c]);
+    }
+
+    allocsLastSample = sum.allocs;
+    bytesLastSample = sum.bytes;
+    const double seconds = (double) elapsed / 1e9;
+    liveGrowthLastSample = elapsed == 0 ? 0.0 : ((double) sum.usableAllocated - (double) sum.usableFreed) / seconds;
+    /* The mean time of the timed calls, less reading the clock, for every call */
+    const double overheadNs = (double) sum.timedCalls * (double) clockOverheadNs;
+    const double timedNs = (double) sum.timedNs > overheadNs ? (double) sum.timedNs - overheadNs : 0.0;
+    const double allocatorNs = sum.timedCalls == 0 ? 0.0 : timedNs * (double) (sum.allocs + sum.frees) / (double) sum.timedCalls;
+    /* Of the time of the threads that allocated, so that it is at most 100% however many there are */
+    allocatorFractionLastSample = elapsed == 0 || allocatingThreads == 0 ? 0.0 :
+        100.0 * allocatorNs / ((double) elapsed * allocatingThreads);
+
+    medianSizeLastSample = 0;
+    uint64_t seen = 0;
+    for (int c = 0; c < NUM_SIZE_CLASSES && sum.allocs > 0; ++c) {
+        seen += sum.sizeClasses[c];
+        if (2 * seen >= sum.allocs) {
+            medianSizeLastSample = (uint64_t) 1 << c;
+            break;
+        }
+    }
+}
+
+/*! This function is called when the metric plugin is loaded. */
+/*!
+ *  We do not have to restrict ourselves to async-signal-safe functions because
+ *  the initialization function will be called without any locks held.
+ *
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused)
+{
+    (void) unused; /* unused variable */
+
+    if (realMalloc == NULL || realUsableSize == NULL) {
+        allinea_set_plugin_error_messagef(plugin_id, ENOSYS, "Could not find the C library's malloc and malloc_usable_size");
+        errno = ENOSYS;
+        return -1;
+    }
+
+    /* The least of several readings, as the first may miss in the cache */
+    clockOverheadNs = UINT64_MAX;
+    for (int i = 0; i < 16; ++i) {
+        const uint64_t start = now_ns();
+        const uint64_t ns = now_ns() - start;
+        if (ns < clockOverheadNs)
+            clockOverheadNs = ns;
+    }
+
+    /* Only the allocations from now on are reported */
+    lastSampleNs = now_ns();
+    for (uint32_t slot = 0; slot <= MAX_THREADS; ++slot)
+        read_thread_allocs(&threadAllocs[slot], &lastTotals[slot]);
+
+    lastSampleTime.tv_sec = 0;
+    lastSampleTime.tv_nsec = 0;
+    return 0;
+}
+
+/*! This function is called when the metric plugin is unloaded. */
+/*!
+ *  We do not have to restrict ourselves to async-signal-safe functions because
+ *  the cleanup function will be called without any locks held.
+ *
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_cleanup(plugin_id_t plugin_id, void *unused)
+{
+    (void) plugin_id; /* unused variable */
+    (void) unused; /* unused variable */
+    return 0;
+}
+
+/*! Recalculates the metrics if this is a new sample (\a lastSampleTime != \a inCurrentSampleTime). */
+static void update_if_new_sample(const struct timespec *inCurrentSampleTime)
+{
+    if (lastSampleTime.tv_sec  == inCurrentSampleTime->tv_sec &&
+        lastSampleTime.tv_nsec == inCurrentSampleTime->tv_nsec)
+        return;
+    lastSampleTime.tv_sec  = inCurrentSampleTime->tv_sec;
+    lastSampleTime.tv_nsec = inCurrentSampleTime->tv_nsec;
+    update();
+}
+
+/*! Get the current value of the given metric. */
+/*!
+ *  \param metricId the ID of the metric to get the value for
+ *  \param inCurrentSampleTime [in] the time the metric was sampled
+ *  \param inValue pointer to where the metric is stored
+ *  \param outValue [out] value will be written here.
+ */
+static int getMetricValue(metric_id_t metricId, const struct timespec *inCurrentSampleTime, uint64_t *inValue, uint64_t *outValue)
+{
+    (void) metricId; /* unused variable */
+    update_if_new_sample(inCurrentSampleTime);
+    *outValue = *inValue;
+    return 0;
+}
+
+/*! Get the current value of the given metric. See \a getMetricValue. */
+static int getMetricValueDouble(metric_id_t metricId, const struct timespec *inCurrentSampleTime, double *inValue, double *outValue)
+{
+    (void) metricId; /* unused variable */
+    update_if_new_sample(inCurrentSampleTime);
+    *outValue = *inValue;
+    return 0;
+}
+
+int allinea_allocRate(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &allocsLastSample, outValue);
+}
+
+int allinea_allocBytes(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &bytesLastSample, outValue);
+}
+
+int allinea_allocLiveGrowth(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &liveGrowthLastSample, outValue);
+}
+
+int allinea_allocTimeFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &allocatorFractionLastSample, outValue);
+}
+
+int allinea_allocMedianSize(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &medianSizeLastSample, outValue);
+}
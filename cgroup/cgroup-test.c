@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_FIXTURE_PLUGIN
+#include "test_fixture.h"
+
+extern int allinea_cgroupCpuUsage(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_cgroupCpuThrottled(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_cgroupCpuThrottledPeriods(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_cgroupCpuPressure(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_cgroupMemoryPressureSome(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_cgroupMemoryPressureFull(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_cgroupIoPressureSome(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_cgroupIoPressureFull(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_cgroupMemoryAnon(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_cgroupMemoryFile(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_cgroupMemoryReclaimed(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_cgroupMemoryRefaults(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_cgroupMemoryHighEvents(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_cgroupMemoryMaxEvents(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_cgroupMemoryOomKills(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_cgroupIoRead(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_cgroupIoWrite(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+
+#define JOB_CGROUP "/system.slice/job-42"
+
+/* The files of the cgroup when the plugin is initialised */
+static const char *CPU_STAT_0 =
+    "usage_usec 1000000\n"
+    "user_usec 900000\n"
+    "system_usec 100000\n"
+    "nr_periods 100\n"
+    "nr_throttled 10\n"
+    "throttled_usec 50000\n";
+
+static const char *MEMORY_STAT_0 =
+    "anon 1048576\n"
+    "file 2097152\n"
+    "file_mapped 4096\n"
+    "pgsteal 100\n"
+    "workingset_refault_anon 5\n"
+    "workingset_refault_file 5\n";
+
+static const char *MEMORY_EVENTS_0 =
+    "low 0\n"
+    "high 3\n"
+    "max 1\n"
+    "oom 0\n"
+    "oom_kill 0\n";
+
+static const char *IO_STAT_0 =
+    "8:0 rbytes=1000 wbytes=2000 rios=1 wios=2 dbytes=0 dios=0\n"
+    "8:16 rbytes=3000 wbytes=4000 rios=3 wios=4 dbytes=0 dios=0\n";
+
+static const char *CPU_PRESSURE_0 =
+    "some avg10=0.00 avg60=0.00 avg300=0.00 total=100000\n";
+
+static const char *MEMORY_PRESSURE_0 =
+    "some avg10=0.00 avg60=0.00 avg300=0.00 total=20000\n"
+    "full avg10=0.00 avg60=0.00 avg300=0.00 total=10000\n";
+
+static const char *IO_PRESSURE_0 =
+    "some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n"
+    "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n";
+
+/* The files at the first and second samples, 2 s apart */
+static const char *CPU_STAT_1 =
+    "usage_usec 5000000\n"
+    "user_usec 4500000\n"
+    "system_usec 500000\n"
+    "nr_periods 120\n"
+    "nr_throttled 25\n"
+    "throttled_usec 550000\n";
+
+static const char *CPU_STAT_2 =
+    "usage_usec 9000000\n"
+    "user_usec 8100000\n"
+    "system_usec 900000\n"
+    "nr_periods 140\n"
+    "nr_throttled 40\n"
+    "throttled_usec 1050000\n";
+
+/* Older kernels have one refault counter */
+static const char *MEMORY_STAT_2 =
+    "anon 3145728\n"
+    "file 1048576\n"
+    "file_mapped 4096\n"
+    "pgsteal 612\n"
+    "workingset_refault 110\n";
+
+static const char *MEMORY_EVENTS_2 =
+    "low 0\n"
+    "high 13\n"
+    "max 3\n"
+    "oom 1\n"
+    "oom_kill 1\n";
+
+static const char *IO_STAT_2 =
+    "8:0 rbytes=1001000 wbytes=2000 rios=11 wios=2 dbytes=0 dios=0\n"
+    "8:16 rbytes=3000 wbytes=2004000 rios=3 wios=14 dbytes=0 dios=0\n";
+
+static const char *CPU_PRESSURE_2 =
+    "some avg10=25.00 avg60=5.00 avg300=1.00 total=600000\n";
+
+static const char *MEMORY_PRESSURE_2 =
+    "some avg10=40.00 avg60=8.00 avg300=2.00 total=820000\n"
+    "full avg10=20.00 avg60=4.00 avg300=1.00 total=410000\n";
+
+static const char *IO_PRESSURE_2 =
+    "some avg10=5.00 avg60=1.00 avg300=0.20 total=100000\n"
+    "full avg10=2.50 avg60=0.50 avg300=0.10 total=50000\n";
+
+static void make_dir(const char *path)
+{
+    if (mkdir(path, 0700) != 0)
+        FAIL("mkdir %s: %s", path, strerror(errno));
+}
+
+/*! Checks the values parsed from a fake cgroup tree, and their changes between samples. */
+static void test_fixture(void)
+{
+    char root[] = "/tmp/cgroup-test-XXXXXX";
+    if (mkdtemp(root) == NULL)
+        FAIL("mkdtemp: %s", strerror(errno));
+    char proc[256], slice[256], job[256];
+    snprintf(proc, sizeof(proc), "%s/proc", root);
+    snprintf(slice, sizeof(slice), "%s/system.slice", root);
+    snprintf(job, sizeof(job), "%s%s", root, JOB_CGROUP);
+    make_dir(proc);
+    make_dir(slice);
+    make_dir(job);
+    write_file(proc, "cgroup", "12:memory:/v1/only\n0::" JOB_CGROUP "\n");
+    write_file(job, "cpu.stat", CPU_STAT_0);
+    write_file(job, "memory.stat", MEMORY_STAT_0);
+    write_file(job, "memory.events", MEMORY_EVENTS_0);
+    write_file(job, "io.stat", IO_STAT_0);
+    write_file(job, "cpu.pressure", CPU_PRESSURE_0);
+    write_file(job, "memory.pressure", MEMORY_PRESSURE_0);
+    write_file(job, "io.pressure", IO_PRESSURE_0);
+    setenv("ARM_MAP_CGROUP_ROOT", root, 1);
+    setenv("ARM_MAP_CGROUP_PROC_DIR", proc, 1);
+
+    initialize();
+
+    /* The first sample is of the changes since initialisation, of unknown length, so the percentages are 0 */
+    write_file(job, "cpu.stat", CPU_STAT_1);
+    struct timespec sampleTime = { 10, 0 };
+    uint64_t value;
+    double percentage;
+    int ret;
+
+    ret = allinea_cgroupCpuThrottledPeriods(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupCpuThrottledPeriods", ret, value, 15);
+    ret = allinea_cgroupCpuThrottled(1, &sampleTime, &percentage);
+    expect_double("allinea_cgroupCpuThrottled", ret, percentage, 0.0);
+    ret = allinea_cgroupMemoryAnon(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupMemoryAnon", ret, value, 1048576);
+    ret = allinea_cgroupIoRead(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupIoRead", ret, value, 0);
+
+    /* The second sample, 2 s later */
+    write_file(job, "cpu.stat", CPU_STAT_2);
+    write_file(job, "memory.stat", MEMORY_STAT_2);
+    write_file(job, "memory.events", MEMORY_EVENTS_2);
+    write_file(job, "io.stat", IO_STAT_2);
+    write_file(job, "cpu.pressure", CPU_PRESSURE_2);
+    write_file(job, "memory.pressure", MEMORY_PRESSURE_2);
+    write_file(job, "io.pressure", IO_PRESSURE_2);
+    sampleTime.tv_sec = 12;
+
+    ret = allinea_cgroupCpuUsage(1, &sampleTime, &percentage);
+    expect_double("allinea_cgroupCpuUsage", ret, percentage, 200.0);
+    ret = allinea_cgroupCpuThrottled(1, &sampleTime, &percentage);
+    expect_double("allinea_cgroupCpuThrottled", ret, percentage, 25.0);
+    ret = allinea_cgroupCpuThrottledPeriods(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupCpuThrottledPeriods", ret, value, 15);
+    ret = allinea_cgroupCpuPressure(1, &sampleTime, &percentage);
+    expect_double("allinea_cgroupCpuPressure", ret, percentage, 25.0);
+    ret = allinea_cgroupMemoryPressureSome(1, &sampleTime, &percentage);
+    expect_double("allinea_cgroupMemoryPressureSome", ret, percentage, 40.0);
+    ret = allinea_cgroupMemoryPressureFull(1, &sampleTime, &percentage);
+    expect_double("allinea_cgroupMemoryPressureFull", ret, percentage, 20.0);
+    ret = allinea_cgroupIoPressureSome(1, &sampleTime, &percentage);
+    expect_double("allinea_cgroupIoPressureSome", ret, percentage, 5.0);
+    ret = allinea_cgroupIoPressureFull(1, &sampleTime, &percentage);
+    expect_double("allinea_cgroupIoPressureFull", ret, percentage, 2.5);
+    ret = allinea_cgroupMemoryAnon(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupMemoryAnon", ret, value, 3145728);
+    ret = allinea_cgroupMemoryFile(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupMemoryFile", ret, value, 1048576);
+    ret = allinea_cgroupMemoryReclaimed(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupMemoryReclaimed", ret, value, 512 * (uint64_t) sysconf(_SC_PAGESIZE));
+    ret = allinea_cgroupMemoryRefaults(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupMemoryRefaults", ret, value, 100);
+    ret = allinea_cgroupMemoryHighEvents(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupMemoryHighEvents", ret, value, 10);
+    ret = allinea_cgroupMemoryMaxEvents(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupMemoryMaxEvents", ret, value, 2);
+    ret = allinea_cgroupMemoryOomKills(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupMemoryOomKills", ret, value, 1);
+    ret = allinea_cgroupIoRead(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupIoRead", ret, value, 1000000);
+    ret = allinea_cgroupIoWrite(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupIoWrite", ret, value, 2000000);
+
+    allinea_plugin_cleanup(1, NULL);
+
+    /* A cgroup given explicitly, with only some of the files */
+    char step[512];
+    snprintf(step, sizeof(step), "%s/step-0", job);
+    make_dir(step);
+    write_file(step, "cpu.stat", CPU_STAT_0);
+    setenv("ARM_MAP_CGROUP_PATH", JOB_CGROUP "/step-0", 1);
+    initialize();
+    write_file(step, "cpu.stat", CPU_STAT_1);
+    sampleTime.tv_sec = 20;
+    ret = allinea_cgroupCpuThrottledPeriods(1, &sampleTime, &value);
+    expect_u64("allinea_cgroupCpuThrottledPeriods", ret, value, 15);
+    ret = allinea_cgroupMemoryPressureSome(1, &sampleTime, &percentage);
+    expect_double("allinea_cgroupMemoryPressureSome", ret, percentage, 0.0);
+    allinea_plugin_cleanup(1, NULL);
+
+    /* A directory that is not a cgroup */
+    setenv("ARM_MAP_CGROUP_PATH", "/system.slice", 1);
+    if (allinea_plugin_initialize(1, NULL) == 0)
+        FAIL("allinea_plugin_initialize: expected to fail without cgroup files");
+    if (strstr(test_last_error, "//") != NULL || strstr(test_last_error, "/system.slice") == NULL)
+        FAIL("expected the cgroup directory to be <root>/system.slice in the error");
+
+    char path[4096];
+    const char *names[] = { "cpu.stat", "memory.stat", "memory.events", "io.stat", "cpu.pressure", "memory.pressure", "io.pressure" };
+    unlink(strcat(strcpy(path, step), "/cpu.stat"));
+    rmdir(step);
+    for (int i = 0; i < 7; ++i) {
+        snprintf(path, sizeof(path), "%s/%s", job, names[i]);
+        unlink(path);
+    }
+    rmdir(job);
+    rmdir(slice);
+    unlink(strcat(strcpy(path, proc), "/cgroup"));
+    rmdir(proc);
+    rmdir(root);
+    unsetenv("ARM_MAP_CGROUP_ROOT");
+    unsetenv("ARM_MAP_CGROUP_PROC_DIR");
+    unsetenv("ARM_MAP_CGROUP_PATH");
+}
+
+static void sample_cpu_usage(struct timespec *sampleTime)
+{
+    double percentage;
+    expect_success("allinea_cgroupCpuUsage", allinea_cgroupCpuUsage(1, sampleTime, &percentage));
+}
+
+/*! Reads the cgroup of this process, if it is in a cgroup v2 hierarchy, and prints the time per sample. */
+static void test_own_cgroup(void)
+{
+    if (allinea_plugin_initialize(1, NULL) != 0) {
+        printf("\nNo cgroup v2 hierarchy: not testing the cgroup of this process.\n");
+        return;
+    }
+
+    struct timespec sampleTime = { 1, 0 };
+    double percentage;
+    int ret = allinea_cgroupCpuUsage(1, &sampleTime, &percentage);
+    expect_success("allinea_cgroupCpuUsage", ret);
+
+    print_sample_cost(sample_cpu_usage, 2);
+
+    allinea_plugin_cleanup(1, NULL);
+}
+
+int main(void)
+{
+    test_fixture();
+    test_own_cgroup();
+    printf("PASS\n");
+    return 0;
+}
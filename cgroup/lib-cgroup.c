@@ -0,0 +1,587 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Resource pressure metrics of the cgroup (v2) the process runs in: CPU time
+ * throttled by the quota, memory reclaim and limit events, I/O, and the
+ * pressure stall information (PSI) of the CPU, memory and I/O.
+ *
+ * All of the files are opened once at initialisation and re-read with pread
+ * into a static buffer on each sample by a parser that does not allocate.
+ * Most of the counters in them are totals since the cgroup was created, so
+ * the metrics are their changes over the sample period.
+ *
+ * The cgroup is the one given for the process by the "0::" line of
+ * /proc/self/cgroup, under the cgroup2 mount point. ARM_MAP_CGROUP_PATH gives
+ * another cgroup instead, e.g. that of the whole job rather than of one job
+ * step. ARM_MAP_CGROUP_ROOT and ARM_MAP_CGROUP_PROC_DIR change where the
+ * cgroup tree and the cgroup file of the process are read from, for testing.
+ */
+
+#define _GNU_SOURCE
+
+#include "allinea_metric_plugin_api.h"
+#include "procfs_parse.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ERROR_INITIALIZATION_FAILED 100
+
+/*! Where the cgroup of the process is read from. Can be changed with ARM_MAP_CGROUP_PROC_DIR for testing. */
+#define DEFAULT_PROC_DIR "/proc/self"
+
+/*! The cgroup2 mount points tried in turn if ARM_MAP_CGROUP_ROOT is not set: the unified hierarchy, then the hybrid one. */
+static const char *const DEFAULT_CGROUP_ROOTS[] = { "/sys/fs/cgroup", "/sys/fs/cgroup/unified" };
+
+/*! The files of the cgroup that are read on each sample. */
+/*!
+ *  All of them are optional: which are present depends on the controllers
+ *  enabled for the cgroup, and the pressure files on the kernel being built
+ *  with PSI.
+ */
+enum cgroup_file {
+    CPU_STAT = 0,
+    MEMORY_STAT,
+    MEMORY_EVENTS,
+    IO_STAT,
+    CPU_PRESSURE,
+    MEMORY_PRESSURE,
+    IO_PRESSURE,
+    NUM_FILES
+};
+static const char *const FILE_NAMES[NUM_FILES] = {
+    "cpu.stat", "memory.stat", "memory.events", "io.stat", "cpu.pressure", "memory.pressure", "io.pressure"
+};
+
+/*! File descriptors for the files above, or -1 for those not present. */
+static int fds[NUM_FILES] = { -1, -1, -1, -1, -1, -1, -1 };
+
+/*! Non-zero once the files are open. */
+static int cgroupOpen = 0;
+
+/*! The resources with pressure stall information, in the order of their files. */
+enum resource { RESOURCE_CPU = 0, RESOURCE_MEMORY, RESOURCE_IO, NUM_RESOURCES };
+
+/*! The counters read from the files. All but the memory sizes are totals since the cgroup was created. */
+struct cgroup_counters {
+    uint64_t cpuUsageUsec;
+    uint64_t cpuThrottledUsec;
+    uint64_t cpuThrottledPeriods;
+    uint64_t memoryAnon;
+    uint64_t memoryFile;
+    uint64_t memoryReclaimedPages;
+    uint64_t memoryRefaults;
+    uint64_t memoryHighEvents;
+    uint64_t memoryMaxEvents;
+    uint64_t memoryOomKills;
+    uint64_t ioReadBytes;
+    uint64_t ioWriteBytes;
+    /*! The microseconds in which some, or all, of the tasks were stalled on each resource. */
+    uint64_t stallSomeUsec[NUM_RESOURCES];
+    uint64_t stallFullUsec[NUM_RESOURCES];
+};
+
+/*! The counters as of the last sample, or of initialisation before the first. */
+static struct cgroup_counters lastCounters;
+
+/*! The buffer the files are read into. io.stat has a line per device, so may be long. */
+static char sampleBuffer[16384];
+
+static uint64_t pageSize = 4096;
+
+/*! The CPU time used by the cgroup this sample, as a percentage of one CPU. */
+static double cpuUsageLastSample;
+
+/*! The time the cgroup was throttled by its CPU quota this sample, as a percentage of the sample. */
+static double cpuThrottledLastSample;
+
+/*! The number of CPU quota periods in which the cgroup was throttled this sample. */
+static uint64_t cpuThrottledPeriodsLastSample;
+
+/*! The time some, or all, of the tasks of the cgroup were stalled on each resource this sample, as a percentage of the sample. */
+static double stallSomeLastSample[NUM_RESOURCES];
+static double stallFullLastSample[NUM_RESOURCES];
+
+/*! The anonymous and page cache memory of the cgroup in bytes this sample. */
+static uint64_t memoryAnonLastSample;
+static uint64_t memoryFileLastSample;
+
+/*! The bytes of memory reclaimed from the cgroup this sample. */
+static uint64_t memoryReclaimedLastSample;
+
+/*! The number of reclaimed pages faulted back in this sample. */
+static uint64_t memoryRefaultsLastSample;
+
+/*! The number of times the cgroup went over memory.high, and hit memory.max, and of processes killed by the OOM killer, this sample. */
+static uint64_t memoryHighEventsLastSample;
+static uint64_t memoryMaxEventsLastSample;
+static uint64_t memoryOomKillsLastSample;
+
+/*! The bytes read and written by the cgroup this sample, over all devices. */
+static uint64_t ioReadBytesLastSample;
+static uint64_t ioWriteBytesLastSample;
+
+/*! Time of the last sample. */
+/*!
+ *  If the time of the current sample is different from the time of the last
+ *  then we assume it is a new sample and we need to re-read the files.
+ */
+static struct timespec lastSampleTime;
+
+/*! Time of the sample \a lastCounters were read at, or 0 if they were read at initialisation. */
+static struct timespec lastCountersTime;
+
+static void close_cgroup_files(void)
+{
+    cgroupOpen = 0;
+    for (int i = 0; i < NUM_FILES; ++i) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+}
+
+/*! Finds the cgroup2 mount point: ARM_MAP_CGROUP_ROOT, or the first of the default roots with a cgroup.controllers file. */
+static const char *find_cgroup_root(void)
+{
+    const char *root = getenv("ARM_MAP_CGROUP_ROOT");
+    if (root != NULL && *root != '\0')
+        return root;
+    for (size_t i = 0; i < sizeof(DEFAULT_CGROUP_ROOTS) / sizeof(DEFAULT_CGROUP_ROOTS[0]); ++i) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/cgroup.controllers", DEFAULT_CGROUP_ROOTS[i]);
+        if (access(path, R_OK) == 0)
+            return DEFAULT_CGROUP_ROOTS[i];
+    }
+    return NULL;
+}
+
+/*! Gets the path of the cgroup of the process under the cgroup2 root: ARM_MAP_CGROUP_PATH, or the "0::" line of the cgroup file. */
+/*!
+ *  \return 0 on success; -1 on failure and set errno
+ */
+static int find_cgroup_path(char *path, size_t size)
+{
+    const char *configured = getenv("ARM_MAP_CGROUP_PATH");
+    if (configured != NULL && *configured != '\0') {
+        snprintf(path, size, "%s", configured);
+        return 0;
+    }
+    const char *procDir = getenv("ARM_MAP_CGROUP_PROC_DIR");
+    if (procDir == NULL || *procDir == '\0')
+        procDir = DEFAULT_PROC_DIR;
+    char file[4096];
+    snprintf(file, sizeof(file), "%s/cgroup", procDir);
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    ssize_t len = procfs_pread(fd, sampleBuffer, sizeof(sampleBuffer));
+    close(fd);
+    if (len < 0)
+        return -1;
+    const char *p = procfs_find_key(sampleBuffer, (size_t) len, "0::");
+    if (p == NULL) {
+        /* Only in cgroup v1 hierarchies */
+        errno = ENOENT;
+        return -1;
+    }
+    const char *end = memchr(p, '\n', (size_t) (sampleBuffer + len - p));
+    if (end == NULL)
+        end = sampleBuffer + len;
+    snprintf(path, size, "%.*s", (int) (end - p), p);
+    return 0;
+}
+
+/*! Reads one of the cgroup files into \a sampleBuffer. */
+/*!
+ *  \return the number of bytes read, which is 0 for a file that is not
+ *  present, or -1 on error with errno set
+ */
+static ssize_t read_cgroup_file(enum cgroup_file file)
+{
+    if (fds[file] == -1) {
+        sampleBuffer[0] = '\0';
+        return 0;
+    }
+    return procfs_pread(fds[file], sampleBuffer, sizeof(sampleBuffer));
+}
+
+/*! Adds up the bytes read and written over the devices of io.stat. */
+/*!
+ *  A line gives the counters of one device as "name=value" fields, e.g.
+ *  "8:0 rbytes=1048576 wbytes=4096 rios=256 wios=1 dbytes=0 dios=0"
+ */
+static void parse_io_stat(const char *buffer, size_t len, uint64_t *readBytes, uint64_t *writeBytes)
+{
+    const char *end = buffer + len;
+    const char *line = buffer;
+    while (line < end) {
+        uint64_t value;
+        if (procfs_find_field_u64(line, end, "rbytes=", &value) == 0)
+            *readBytes += value;
+        if (procfs_find_field_u64(line, end, "wbytes=", &value) == 0)
+            *writeBytes += value;
+        const char *newline = memchr(line, '\n', (size_t) (end - line));
+        if (newline == NULL)
+            break;
+        line = newline + 1;
+    }
+}
+
+/*! Gets the total stall times of a pressure file. */
+/*!
+ *  The file has a line for some and one for all (full) of the tasks stalled,
+ *  e.g. "some avg10=0.00 avg60=0.00 avg300=0.00 total=12345". The CPU has no
+ *  full line before Linux 5.13.
+ */
+static void parse_pressure(const char *buffer, size_t len, uint64_t *someUsec, uint64_t *fullUsec)
+{
+    const char *end = buffer + len;
+    const char *p = procfs_find_key(buffer, len, "some ");
+    if (p != NULL)
+        procfs_find_field_u64(p, end, "total=", someUsec);
+    p = procfs_find_key(buffer, len, "full ");
+    if (p != NULL)
+        procfs_find_field_u64(p, end, "total=", fullUsec);
+}
+
+/*! Reads the counters from all of the files. Counters in files that are not present are 0. */
+/*!
+ *  \return 0 on success; -1 on failure and set errno
+ */
+static int read_counters(struct cgroup_counters *c)
+{
+    memset(c, 0, sizeof(*c));
+    ssize_t len;
+
+    if ((len = read_cgroup_file(CPU_STAT)) < 0)
+        return -1;
+    /* The keys include the separator, so that one is not taken for the start of another */
+    procfs_find_u64(sampleBuffer, (size_t) len, "usage_usec ", &c->cpuUsageUsec);
+    procfs_find_u64(sampleBuffer, (size_t) len, "nr_throttled ", &c->cpuThrottledPeriods);
+    procfs_find_u64(sampleBuffer, (size_t) len, "throttled_usec ", &c->cpuThrottledUsec);
+
+    if ((len = read_cgroup_file(MEMORY_STAT)) < 0)
+        return -1;
+    procfs_find_u64(sampleBuffer, (size_t) len, "anon ", &c->memoryAnon);
+    procfs_find_u64(sampleBuffer, (size_t) len, "file ", &c->memoryFile);
+    procfs_find_u64(sampleBuffer, (size_t) len, "pgsteal ", &c->memoryReclaimedPages);
+    /* Split into anonymous and file pages since Linux 5.9 */
+    if (procfs_find_u64(sampleBuffer, (size_t) len, "workingset_refault ", &c->memoryRefaults) != 0) {
+        uint64_t anon = 0, file = 0;
+        procfs_find_u64(sampleBuffer, (size_t) len, "workingset_refault_anon ", &anon);
+        procfs_find_u64(sampleBuffer, (size_t) len, "workingset_refault_file ", &file);
+        c->memoryRefaults = anon + file;
+    }
+
+    if ((len = read_cgroup_file(MEMORY_EVENTS)) < 0)
+        return -1;
+    procfs_find_u64(sampleBuffer, (size_t) len, "high ", &c->memoryHighEvents);
+    procfs_find_u64(sampleBuffer, (size_t) len, "max ", &c->memoryMaxEvents);
+    procfs_find_u64(sampleBuffer, (size_t) len, "oom_kill ", &c->memoryOomKills);
+
+    if ((len = read_cgroup_file(IO_STAT)) < 0)
+        return -1;
+    parse_io_stat(sampleBuffer, (size_t) len, &c->ioReadBytes, &c->ioWriteBytes);
+
+    for (int r = 0; r < NUM_RESOURCES; ++r) {
+        if ((len = read_cgroup_file(CPU_PRESSURE + r)) < 0)
+            return -1;
+        parse_pressure(sampleBuffer, (size_t) len, &c->stallSomeUsec[r], &c->stallFullUsec[r]);
+    }
+    return 0;
+}
+
+/*! This function is called when the metric plugin is loaded. */
+/*!
+ *  We do not have to restrict ourselves to async-signal-safe functions because
+ *  the initialization function will be called without any locks held.
+ *
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused)
+{
+    (void)unused; /* unused variable */
+
+    const char *root = find_cgroup_root();
+    if (root == NULL) {
+        allinea_set_plugin_error_messagef(plugin_id, ERROR_INITIALIZATION_FAILED, "No cgroup v2 hierarchy found. Set ARM_MAP_CGROUP_ROOT to its mount point");
+        errno = ENOENT;
+        return -1;
+    }
+    char cgroupPath[4096];
+    if (find_cgroup_path(cgroupPath, sizeof(cgroupPath)) != 0) {
+        int saved_errno = errno;
+        allinea_set_plugin_error_messagef(plugin_id, ERROR_INITIALIZATION_FAILED, "Could not find the cgroup v2 of the process: %s", strerror(saved_errno));
+        errno = saved_errno;
+        return -1;
+    }
+
+    /* The path from /proc/self/cgroup starts with a '/', and is just "/" for
+       the root cgroup */
+    char dir[8192];
+    snprintf(dir, sizeof(dir), "%s%s%s", root, cgroupPath[0] == '/' ? "" : "/", cgroupPath);
+    size_t dirLen = strlen(dir);
+    while (dirLen > 1 && dir[dirLen - 1] == '/')
+        dir[--dirLen] = '\0';
+
+    int numOpen = 0;
+    for (int i = 0; i < NUM_FILES; ++i) {
+        char path[8400];
+        snprintf(path, sizeof(path), "%s/%s", dir, FILE_NAMES[i]);
+        fds[i] = open(path, O_RDONLY | O_CLOEXEC);
+        if (fds[i] != -1)
+            numOpen++;
+    }
+    if (numOpen == 0) {
+        allinea_set_plugin_error_messagef(plugin_id, ERROR_INITIALIZATION_FAILED, "%s: no cgroup statistics files", dir);
+        errno = ENOENT;
+        return -1;
+    }
+
+    const long size = sysconf(_SC_PAGESIZE);
+    pageSize = size > 0 ? (uint64_t) size : 4096;
+
+    /* The first sample is of the changes since now */
+    if (read_counters(&lastCounters) != 0) {
+        int saved_errno = errno;
+        allinea_set_plugin_error_messagef(plugin_id, ERROR_INITIALIZATION_FAILED, "%s: %s", dir, strerror(saved_errno));
+        close_cgroup_files();
+        errno = saved_errno;
+        return -1;
+    }
+
+    lastSampleTime.tv_sec = 0;
+    lastSampleTime.tv_nsec = 0;
+    lastCountersTime = lastSampleTime;
+    cgroupOpen = 1;
+    return 0;
+}
+
+/*! This function is called when the metric plugin is unloaded. */
+/*!
+ *  We do not have to restrict ourselves to async-signal-safe functions because
+ *  the cleanup function will be called without any locks held.
+ *
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_cleanup(plugin_id_t id, void *unused)
+{
+    (void) id;  // Unused parameter
+    (void)unused; /* unused variable */
+
+    close_cgroup_files();
+    return 0;
+}
+
+/*! Returns the change in a total counter, or 0 if it went back, e.g. because its file could not be read. */
+static uint64_t delta(uint64_t current, uint64_t last)
+{
+    return current >= last ? current - last : 0;
+}
+
+/*! Returns \a usec as a percentage of \a seconds, or 0 if the length of the sample is not known. */
+static double percentage(uint64_t usec, double seconds)
+{
+    return seconds <= 0.0 ? 0.0 : 100.0 * (double) usec / (seconds * 1e6);
+}
+
+/*! Called once per sample to read the metrics from the cgroup files. */
+/*!
+ *  The percentages need the length of the sample, so they are 0 for the
+ *  first sample, which is measured from initialisation.
+ */
+static int update(const struct timespec *sampleTime)
+{
+    struct cgroup_counters c;
+    if (read_counters(&c) != 0)
+        return -1;
+
+    const double seconds = lastCountersTime.tv_sec == 0 && lastCountersTime.tv_nsec == 0 ? 0.0 :
+        (double) (sampleTime->tv_sec - lastCountersTime.tv_sec) +
+        (double) (sampleTime->tv_nsec - lastCountersTime.tv_nsec) / 1e9;
+
+    /* The CPU time is summed over the CPUs, so may be over 100% */
+    cpuUsageLastSample = percentage(delta(c.cpuUsageUsec, lastCounters.cpuUsageUsec), seconds);
+    cpuThrottledLastSample = percentage(delta(c.cpuThrottledUsec, lastCounters.cpuThrottledUsec), seconds);
+    cpuThrottledPeriodsLastSample = delta(c.cpuThrottledPeriods, lastCounters.cpuThrottledPeriods);
+    for (int r = 0; r < NUM_RESOURCES; ++r) {
+        stallSomeLastSample[r] = percentage(delta(c.stallSomeUsec[r], lastCounters.stallSomeUsec[r]), seconds);
+        stallFullLastSample[r] = percentage(delta(c.stallFullUsec[r], lastCounters.stallFullUsec[r]), seconds);
+    }
+    memoryAnonLastSample = c.memoryAnon;
+    memoryFileLastSample = c.memoryFile;
+    memoryReclaimedLastSample = delta(c.memoryReclaimedPages, lastCounters.memoryReclaimedPages) * pageSize;
+    memoryRefaultsLastSample = delta(c.memoryRefaults, lastCounters.memoryRefaults);
+    memoryHighEventsLastSample = delta(c.memoryHighEvents, lastCounters.memoryHighEvents);
+    memoryMaxEventsLastSample = delta(c.memoryMaxEvents, lastCounters.memoryMaxEvents);
+    memoryOomKillsLastSample = delta(c.memoryOomKills, lastCounters.memoryOomKills);
+    ioReadBytesLastSample = delta(c.ioReadBytes, lastCounters.ioReadBytes);
+    ioWriteBytesLastSample = delta(c.ioWriteBytes, lastCounters.ioWriteBytes);
+
+    lastCounters = c;
+    lastCountersTime = *sampleTime;
+    return 0;
+}
+
+/*! Returns non-zero if this is a new sample, in which case \a update must be called. */
+static int is_new_sample(const struct timespec *inCurrentSampleTime)
+{
+    if (lastSampleTime.tv_sec  == inCurrentSampleTime->tv_sec &&
+        lastSampleTime.tv_nsec == inCurrentSampleTime->tv_nsec)
+        return 0;
+    lastSampleTime.tv_sec  = inCurrentSampleTime->tv_sec;
+    lastSampleTime.tv_nsec = inCurrentSampleTime->tv_nsec;
+    return 1;
+}
+
+/*! Get the current value of the given metric. */
+/*!
+ *  \param metricId the ID of the metric to get the value for
+ *  \param inCurrentSampleTime [in] the time the metric was sampled
+ *  \param inValue pointer to where the metric is stored
+ *  \param outValue [out] value will be written here.
+ *
+ *  If this is a new sample (\a lastSampleTime != \a inCurrentsampleTime)
+ *  then \a update is called to re-read the files.
+ */
+static int getMetricValue(metric_id_t metricId, const struct timespec *inCurrentSampleTime, uint64_t *inValue, uint64_t *outValue)
+{
+    if (!cgroupOpen)
+        return 0;
+
+    if (is_new_sample(inCurrentSampleTime) && update(inCurrentSampleTime) != 0) {
+        allinea_set_metric_error_messagef(metricId, errno, "Could not read the cgroup statistics: %s", strerror(errno));
+        return -1;
+    }
+
+    *outValue = *inValue;
+
+    return 0;
+}
+
+/*! Get the current value of the given metric. See \a getMetricValue. */
+static int getMetricValueDouble(metric_id_t metricId, const struct timespec *inCurrentSampleTime, double *inValue, double *outValue)
+{
+    if (!cgroupOpen)
+        return 0;
+
+    if (is_new_sample(inCurrentSampleTime) && update(inCurrentSampleTime) != 0) {
+        allinea_set_metric_error_messagef(metricId, errno, "Could not read the cgroup statistics: %s", strerror(errno));
+        return -1;
+    }
+
+    *outValue = *inValue;
+
+    return 0;
+}
+
+int allinea_cgroupCpuUsage(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &cpuUsageLastSample, outValue);
+}
+
+int allinea_cgroupCpuThrottled(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &cpuThrottledLastSample, outValue);
+}
+
+int allinea_cgroupCpuThrottledPeriods(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &cpuThrottledPeriodsLastSample, outValue);
+}
+
+int allinea_cgroupCpuPressure(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &stallSomeLastSample[RESOURCE_CPU], outValue);
+}
+
+int allinea_cgroupMemoryPressureSome(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &stallSomeLastSample[RESOURCE_MEMORY], outValue);
+}
+
+int allinea_cgroupMemoryPressureFull(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &stallFullLastSample[RESOURCE_MEMORY], outValue);
+}
+
+int allinea_cgroupIoPressureSome(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &stallSomeLastSample[RESOURCE_IO], outValue);
+}
+
+int allinea_cgroupIoPressureFull(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &stallFullLastSample[RESOURCE_IO], outValue);
+}
+
+int allinea_cgroupMemoryAnon(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &memoryAnonLastSample, outValue);
+}
+
+int allinea_cgroupMemoryFile(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &memoryFileLastSample, outValue);
+}
+
+int allinea_cgroupMemoryReclaimed(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &memoryReclaimedLastSample, outValue);
+}
+
+int allinea_cgroupMemoryRefaults(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &memoryRefaultsLastSample, outValue);
+}
+
+int allinea_cgroupMemoryHighEvents(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &memoryHighEventsLastSample, outValue);
+}
+
+int allinea_cgroupMemoryMaxEvents(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &memoryMaxEventsLastSample, outValue);
+}
+
+int allinea_cgroupMemoryOomKills(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &memoryOomKillsLastSample, outValue);
+}
+
+int allinea_cgroupIoRead(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &ioReadBytesLastSample, outValue);
+}
+
+int allinea_cgroupIoWrite(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &ioWriteBytesLastSample, outValue);
+}
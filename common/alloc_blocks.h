@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Alloc blocks: the large heap blocks that are allocated, with where they
+ * were allocated from, so that a plugin can attribute what it samples at a
+ * data address to the allocation that contains it.
+ *
+ * The table is kept by ../alloc/lib-alloc.so, which sees every allocation,
+ * when it is preloaded. Another plugin finds it through the function
+ * ALLOC_BLOCKS_FUNCTION, looked up in the process when the plugin is
+ * initialised, so nothing depends on lib-alloc.so being there. Blocks are
+ * only tracked from the first call of that function, and only those of at
+ * least minSize bytes, as they are the few that hold the arrays a program
+ * spends its memory time in, and tracking them costs nothing next to
+ * allocating them.
+ *
+ * The allocating threads add and remove blocks with atomic operations and
+ * never wait. A reader copies the table while it changes, so a block freed
+ * and allocated again while it is being read can be missed or seen with the
+ * site of its last allocation.
+ *
+ * Everything here is header only and usable from both C and C++ plugins.
+ */
+
+#ifndef ALLOC_BLOCKS_H
+#define ALLOC_BLOCKS_H
+
+#include <dlfcn.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! The number of entries in the table, a power of 2. Blocks that do not fit are not tracked. */
+#define ALLOC_BLOCKS_CAPACITY 4096
+
+/*! The most entries an addition or removal looks at. */
+#define ALLOC_BLOCKS_MAX_PROBES 32
+
+/*! The smallest block that is tracked. */
+#define ALLOC_BLOCKS_MIN_SIZE 65536
+
+/*! The name of the function that returns the table and starts tracking. */
+#define ALLOC_BLOCKS_FUNCTION "map_alloc_blocks"
+
+/*! The start of an entry that was freed, which an addition can reuse. */
+#define ALLOC_BLOCKS_REMOVED ((uintptr_t) 1)
+
+/*! A block: 0 for an entry that has never been used. */
+struct alloc_block {
+    uintptr_t start;
+    /*! The usable size, 0 while the entry is being added or removed. */
+    uint64_t size;
+    /*! The return address of the call that allocated the block. */
+    uintptr_t site;
+};
+
+struct alloc_blocks {
+    uint64_t minSize;
+    struct alloc_block blocks[ALLOC_BLOCKS_CAPACITY];
+};
+
+typedef const struct alloc_blocks *(*alloc_blocks_function)(void);
+
+/*! Finds the table of the allocator in the process, and starts tracking. Not async-signal-safe. */
+/*!
+ *  \return the table, or NULL if lib-alloc.so is not preloaded
+ */
+static inline const struct alloc_blocks *alloc_blocks_open(void)
+{
+    alloc_blocks_function function = (alloc_blocks_function) dlsym(RTLD_DEFAULT, ALLOC_BLOCKS_FUNCTION);
+    return function != NULL ? function() : NULL;
+}
+
+/*! Copies entry \a i of the table, if it holds a block. */
+/*!
+ *  \return 1 if \a copy is a block, or 0 if the entry is free or changed
+ *  while it was read
+ */
+static inline int alloc_blocks_read(const struct alloc_blocks *table, size_t i, struct alloc_block *copy)
+{
+    const struct alloc_block *block = &table->blocks[i];
+    copy->start = __atomic_load_n(&block->start, __ATOMIC_ACQUIRE);
+    if (copy->start <= ALLOC_BLOCKS_REMOVED)
+        return 0;
+    copy->size = __atomic_load_n(&block->size, __ATOMIC_ACQUIRE);
+    copy->site = __atomic_load_n(&block->site, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return copy->size != 0 && __atomic_load_n(&block->start, __ATOMIC_RELAXED) == copy->start;
+}
+
+/*! The entry to look at first for the block at \a start. */
+static inline size_t alloc_blocks_hash(uintptr_t start)
+{
+    /* Large blocks are page aligned, plus the allocator's header */
+    return (size_t) ((start >> 12) * 0x9e3779b97f4a7c15ULL >> 32) & (ALLOC_BLOCKS_CAPACITY - 1);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLOC_BLOCKS_H */
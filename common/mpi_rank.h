@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The MPI rank of a process, from the environment variables that the common
+ * MPI launchers set. Plugins are initialised before MPI_Init, and must not
+ * depend on MPI, so this is all they have to go on to print messages once per
+ * job or to label what they publish.
+ *
+ * Everything here is header only and usable from both C and C++ plugins.
+ */
+
+#ifndef MPI_RANK_H
+#define MPI_RANK_H
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! The MPI rank of this process, or -1 if it was not started by a known launcher. */
+/*!
+ *  Launcher specific variables come first, as a program started by an MPI
+ *  launcher under srun or aprun sees those of the scheduler too.
+ */
+static inline int mpi_rank(void)
+{
+    static const char *const variables[] = {
+        "OMPI_COMM_WORLD_RANK", "MV2_COMM_WORLD_RANK", "PMI_RANK", "PMIX_RANK", "SLURM_PROCID", "ALPS_APP_PE"
+    };
+    for (size_t i = 0; i < sizeof(variables) / sizeof(variables[0]); ++i) {
+        const char *value = getenv(variables[i]);
+        if (value != NULL && *value != '\0')
+            return atoi(value);
+    }
+    return -1;
+}
+
+/*! Whether this process is rank 0, or not part of an MPI job, so should print messages for the job. */
+static inline int mpi_rank_is_root(void)
+{
+    return mpi_rank() <= 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MPI_RANK_H */
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The MUSCLE2 message trace: a file per process that the MUSCLE2 plugin
+ * writes with ARM_MAP_MUSCLE2_TRACE set, and tools/critpath/map-critpath
+ * reads after the run.
+ *
+ * A file is a header, then records in the order the process made its calls.
+ * A record of a send or receive says when the call started, how long it took,
+ * the bytes and the conduit, by a number that is only meaningful within the
+ * file. The first record of each conduit is preceded by a conduit record,
+ * followed by MUSCLE2_TRACE_NAME_SIZE bytes of its name, nul padded, so a
+ * file cut short by a crash can still be read up to where it stops.
+ *
+ * Times are CLOCK_REALTIME, so that the files of processes on different
+ * nodes can be compared, as well as the clocks of the nodes agree.
+ *
+ * Everything here is header only and usable from both C and C++.
+ */
+
+#ifndef MUSCLE2_TRACE_H
+#define MUSCLE2_TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MUSCLE2_TRACE_MAGIC 0x5432434du /* "MC2T" */
+#define MUSCLE2_TRACE_VERSION 1
+
+/*! The bytes of a conduit, host or program name, including the terminator. Longer names are truncated. */
+#define MUSCLE2_TRACE_NAME_SIZE 64
+
+enum muscle2_trace_kind {
+    MUSCLE2_TRACE_SEND = 1,
+    MUSCLE2_TRACE_RECEIVE = 2,
+    /*! Names the conduit of the record; its name follows the record. */
+    MUSCLE2_TRACE_CONDUIT = 3
+};
+
+struct muscle2_trace_header {
+    /*! \a MUSCLE2_TRACE_MAGIC, written last when the file is closed, so 0 in a file cut short. */
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    /*! The MPI rank, from the environment of the launcher, or -1. */
+    int32_t rank;
+    /*! The records lost because the process made calls faster than they could be written. */
+    uint64_t dropped;
+    char host[MUSCLE2_TRACE_NAME_SIZE];
+    /*! The MUSCLE2 kernel name, or the program name if the process made no calls. */
+    char program[MUSCLE2_TRACE_NAME_SIZE];
+};
+
+struct muscle2_trace_record {
+    /*! When the call started, in ns since the epoch. */
+    uint64_t startNs;
+    uint64_t durationNs;
+    /*! The bytes sent or received, from the MUSCLE2 size counters. */
+    uint64_t bytes;
+    uint32_t conduit;
+    /*! A \a muscle2_trace_kind. */
+    uint32_t kind;
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Helpers for metric plugins that share data between the processes on a node
+ * through POSIX shared memory.
+ *
+ * Sources that are per node or per socket (uncore counters, energy counters)
+ * only need to be read by one process, which is elected by holding an
+ * exclusive lock. The elected process publishes what it reads into a shared
+ * memory segment under a seqlock, and the other processes read it from there
+ * without taking any locks.
+ *
+ * Everything here is header only and usable from both C and C++ plugins.
+ */
+
+#ifndef NODE_SHM_H
+#define NODE_SHM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Builds the name of a per-user shared memory object, e.g. "/prefix-1000-s0" */
+static inline int node_shm_name(char *buffer, size_t size, const char *prefix, int index)
+{
+    int n = snprintf(buffer, size, "/%s-%u-%d", prefix, (unsigned) getuid(), index);
+    return (n > 0 && (size_t) n < size) ? 0 : -1;
+}
+
+/*! Opens (creating if needed) and maps a shared memory object of \a size bytes. */
+/*!
+ *  A newly created object is zero filled, so a zeroed layout must be a valid
+ *  "nothing published yet" state.
+ *
+ *  \return the mapping, or NULL on failure with errno set
+ */
+static inline void *node_shm_map(const char *name, size_t size)
+{
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd == -1)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ((size_t) st.st_size < size && ftruncate(fd, size) != 0)) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return NULL;
+    }
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return addr == MAP_FAILED ? NULL : addr;
+}
+
+/*! Unmaps a mapping returned by \a node_shm_map. The object itself is left for the other processes. */
+static inline void node_shm_unmap(void *addr, size_t size)
+{
+    if (addr != NULL)
+        munmap(addr, size);
+}
+
+/*! Counts this process as a user of the object \a name, whose count of users is at \a users. */
+/*!
+ *  Called once the object is mapped with \a node_shm_map, so that the last
+ *  process to call \a node_shm_detach removes it. A process that is killed
+ *  before it detaches leaves the object for the next job to reuse.
+ *
+ *  \return the users before this one
+ */
+static inline uint32_t node_shm_attach(uint32_t *users)
+{
+    return __atomic_fetch_add(users, 1, __ATOMIC_ACQ_REL);
+}
+
+/*! Stops counting this process as a user, and removes the object and its election lock if it was the last. */
+/*!
+ *  \return non-zero if the object was removed. The mapping is left for the
+ *  caller to unmap.
+ */
+static inline int node_shm_detach(const char *name, uint32_t *users)
+{
+    if (__atomic_sub_fetch(users, 1, __ATOMIC_ACQ_REL) != 0)
+        return 0;
+    shm_unlink(name);
+    char path[256];
+    int n = snprintf(path, sizeof(path), "/dev/shm%s.lock", name);
+    if (n > 0 && (size_t) n < sizeof(path))
+        unlink(path);
+    return 1;
+}
+
+/*! Tries to become the one process that reads the source called \a name. */
+/*!
+ *  The election is an exclusive lock on a file in the shared memory
+ *  filesystem, so it is released by the kernel when the elected process exits.
+ *  Never blocks.
+ *
+ *  \return the lock file descriptor, which must be kept open while this process
+ *  is the reader, or -1 if another process is the reader
+ */
+static inline int node_shm_elect(const char *name)
+{
+    char path[256];
+    int n = snprintf(path, sizeof(path), "/dev/shm%s.lock", name);
+    if (n <= 0 || (size_t) n >= sizeof(path))
+        return -1;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return -1;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*! Gives up being the reader. */
+static inline void node_shm_resign(int lock_fd)
+{
+    if (lock_fd != -1) {
+        flock(lock_fd, LOCK_UN);
+        close(lock_fd);
+    }
+}
+
+/*
+ * Seqlock over a block of shared memory with a single writer. The sequence is
+ * odd while a write is in progress. Readers retry until they see the same even
+ * sequence before and after copying the data.
+ *
+ * A writer may die part way through a write, leaving the sequence odd, so
+ * readers give up after a bounded number of tries and treat the data as
+ * stale, and the next writer rounds the sequence up to even.
+ */
+
+/* How many times a reader checks for a write in progress before giving up */
+#define NODE_SHM_READ_TRIES 1000
+
+static inline void node_shm_write_begin(uint32_t *seq)
+{
+    uint32_t s = (__atomic_load_n(seq, __ATOMIC_RELAXED) + 1) & ~(uint32_t) 1;
+    __atomic_store_n(seq, s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void node_shm_write_end(uint32_t *seq)
+{
+    uint32_t s = __atomic_load_n(seq, __ATOMIC_RELAXED);
+    __atomic_store_n(seq, s + 1, __ATOMIC_RELEASE);
+}
+
+/*! Waits for a write in progress to finish, and starts reading. */
+/*!
+ *  \return 0 with the sequence to pass to \a node_shm_read_retry in \a start,
+ *  or -1 if a write was in progress on all NODE_SHM_READ_TRIES checks
+ */
+static inline int node_shm_read_begin(const uint32_t *seq, uint32_t *start)
+{
+    for (int i = 0; i < NODE_SHM_READ_TRIES; ++i) {
+        uint32_t s = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        if ((s & 1) == 0) {
+            *start = s;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*! \return non-zero if the data read since \a node_shm_read_begin must be read again */
+static inline int node_shm_read_retry(const uint32_t *seq, uint32_t start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+/*! The time used to stamp published data. It is the same clock in every process on the node. */
+static inline uint64_t node_shm_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NODE_SHM_H */
@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Node statistics: every process of a job on a node writes the values of its
+ * latest sample into its own slot of an array in shared memory, and reads the
+ * slots of the others to report the minimum, mean, maximum and coefficient of
+ * variation of each value over the node. A high mean with a low variation is
+ * a node saturating a shared resource; a high maximum with a high variation
+ * is a few processes doing more than the rest.
+ *
+ * Each plugin has its own array, /dev/shm/arm-map-node-stats-<plugin>-<uid>-<job>,
+ * where the job is hashed from the job id of the batch system, so that jobs
+ * sharing a node are not mixed up. No MPI is needed.
+ *
+ * A process only ever writes its own slot, under a seqlock, so writing is a
+ * fixed number of stores and never waits. Readers give up on a slot that is
+ * being written rather than wait for it, and skip the slots of processes that
+ * have not written for longer than two of their own sample intervals.
+ *
+ * Node statistics are off unless ARM_MAP_NODE_STATS=1 is set. Then they cost
+ * a read of each slot in use per sample. Off, every statistic is the value of
+ * the process itself, with a variation of 0.
+ *
+ * Everything here is header only and usable from both C and C++ plugins.
+ */
+
+#ifndef NODE_STATS_H
+#define NODE_STATS_H
+
+#include "node_shm.h"
+
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NODE_STATS_MAGIC 0x534e414du /* "MANS" */
+#define NODE_STATS_VERSION 1
+#define NODE_STATS_PREFIX "arm-map-node-stats"
+
+/*! The most processes of a job on one node. Those over it only see the others. */
+#define NODE_STATS_MAX_SLOTS 512
+
+#define NODE_STATS_MAX_VALUES 6
+
+/*! The shortest time a slot is current for, for the first samples, which are a few ms apart. */
+#define NODE_STATS_MIN_CURRENT_NS 200000000ULL
+
+/*! The latest values of one process, on a cache line of its own. */
+struct node_stats_slot {
+    /*! The process writing the slot, or 0 if it is free. Claimed by compare and swap. */
+    int32_t pid;
+    uint32_t seq;
+    /*! When the values were written, in the clock of \a node_shm_now_ns, or 0 if never. */
+    uint64_t updatedNs;
+    /*! How long the values are current for: two sample intervals of the writer. */
+    uint64_t currentNs;
+    /*! The bits of each value, which is a double. */
+    uint64_t bits[NODE_STATS_MAX_VALUES];
+} __attribute__((aligned(64)));
+
+/*! The layout of the array. A newly created array is zero filled, with every slot free. */
+struct node_stats_array {
+    /*! \a NODE_STATS_MAGIC, set last when the array is first opened. */
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numValues;
+    /*! One past the highest slot ever claimed, so that readers need not look at them all. */
+    uint32_t numSlots;
+    struct node_stats_slot slots[NODE_STATS_MAX_SLOTS];
+};
+
+/*! The minimum, mean, maximum and coefficient of variation of one value over the processes of the node. */
+struct node_stats_summary {
+    /*! The processes with a current value, including this one. */
+    unsigned count;
+    double min;
+    double mean;
+    double max;
+    /*! The standard deviation over the mean, or 0 if the mean is 0. */
+    double cv;
+};
+
+/*! One process's view of the array of a plugin. */
+struct node_stats {
+    /*! The array, or NULL if node statistics are off or it could not be opened. */
+    struct node_stats_array *array;
+    /*! The slot of this process, or -1 if it has none. */
+    int slot;
+    unsigned numValues;
+    char name[128];
+    /*! The values this process wrote last, which are used without the array. */
+    double values[NODE_STATS_MAX_VALUES];
+    /*! The sample time of the last write, in ns. */
+    uint64_t lastSampleNs;
+};
+
+/*! A hash of the job from the variables the common batch systems set, or ARM_MAP_NODE_STATS_JOB, else the parent process. */
+/*!
+ *  The processes of a job on a node are usually all started by the same
+ *  launcher process, so without a batch system they share a parent.
+ */
+static inline unsigned node_stats_job(void)
+{
+    static const char *const variables[] = { "ARM_MAP_NODE_STATS_JOB", "SLURM_JOB_ID", "PBS_JOBID", "LSB_JOBID", "JOB_ID" };
+    const char *job = NULL;
+    for (size_t i = 0; i < sizeof(variables) / sizeof(variables[0]) && job == NULL; ++i) {
+        const char *value = getenv(variables[i]);
+        if (value != NULL && *value != '\0')
+            job = value;
+    }
+    if (job == NULL)
+        return (unsigned) getppid();
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    for (; *job != '\0'; ++job)
+        hash = (hash ^ (unsigned char) *job) * 16777619u;
+    return hash & 0x7fffffffu;
+}
+
+/*! \return non-zero if the process that claimed a slot has gone */
+static inline int node_stats_gone(int32_t pid)
+{
+    return kill((pid_t) pid, 0) != 0 && errno == ESRCH;
+}
+
+/*! Opens the array of \a plugin and claims a slot of it for this process. */
+/*!
+ *  Called from allinea_plugin_initialize, not the sampler. A slot left by a
+ *  process that was killed is claimed again once no free slot is left.
+ *
+ *  \return 0 if node statistics are on, else -1, in which case the summaries
+ *  are of this process alone
+ */
+static inline int node_stats_open(struct node_stats *stats, const char *plugin, unsigned numValues)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->slot = -1;
+    stats->numValues = numValues > NODE_STATS_MAX_VALUES ? NODE_STATS_MAX_VALUES : numValues;
+    const char *enabled = getenv("ARM_MAP_NODE_STATS");
+    if (enabled == NULL || strcmp(enabled, "1") != 0)
+        return -1;
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%s-%s", NODE_STATS_PREFIX, plugin);
+    if (node_shm_name(stats->name, sizeof(stats->name), prefix, (int) node_stats_job()) != 0)
+        return -1;
+    struct node_stats_array *array = (struct node_stats_array *) node_shm_map(stats->name, sizeof(struct node_stats_array));
+    if (array == NULL)
+        return -1;
+    if (__atomic_load_n(&array->magic, __ATOMIC_ACQUIRE) != NODE_STATS_MAGIC) {
+        /* Any process of the job may be first; they all write the same */
+        array->version = NODE_STATS_VERSION;
+        array->numValues = stats->numValues;
+        __atomic_store_n(&array->magic, NODE_STATS_MAGIC, __ATOMIC_RELEASE);
+    } else if (array->version != NODE_STATS_VERSION || array->numValues != stats->numValues) {
+        node_shm_unmap(array, sizeof(struct node_stats_array));
+        return -1;
+    }
+
+    const int32_t self = (int32_t) getpid();
+    for (int pass = 0; pass < 2 && stats->slot == -1; ++pass) {
+        for (int s = 0; s < NODE_STATS_MAX_SLOTS; ++s) {
+            int32_t owner = __atomic_load_n(&array->slots[s].pid, __ATOMIC_RELAXED);
+            /* Free slots first, then those of processes that are gone */
+            if ((pass == 0 && owner != 0) || (pass == 1 && (owner == 0 || !node_stats_gone(owner))))
+                continue;
+            if (__atomic_compare_exchange_n(&array->slots[s].pid, &owner, self, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                stats->slot = s;
+                break;
+            }
+        }
+    }
+    if (stats->slot != -1) {
+        struct node_stats_slot *slot = &array->slots[stats->slot];
+        __atomic_store_n(&slot->updatedNs, 0, __ATOMIC_RELAXED);
+        /* A process that died part way through a write left the sequence odd */
+        const uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->seq, (seq + 1) & ~(uint32_t) 1, __ATOMIC_RELEASE);
+        uint32_t numSlots = __atomic_load_n(&array->numSlots, __ATOMIC_RELAXED);
+        while (numSlots < (uint32_t) stats->slot + 1 &&
+               !__atomic_compare_exchange_n(&array->numSlots, &numSlots, (uint32_t) stats->slot + 1, 0,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    stats->array = array;
+    return 0;
+}
+
+/*! Frees the slot of this process and unmaps the array, and removes it if no other process has a slot. */
+static inline void node_stats_close(struct node_stats *stats)
+{
+    if (stats->array == NULL)
+        return;
+    if (stats->slot != -1) {
+        struct node_stats_slot *slot = &stats->array->slots[stats->slot];
+        __atomic_store_n(&slot->updatedNs, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->pid, 0, __ATOMIC_RELEASE);
+    }
+    const uint32_t numSlots = __atomic_load_n(&stats->array->numSlots, __ATOMIC_ACQUIRE);
+    int inUse = 0;
+    for (uint32_t s = 0; s < numSlots && s < NODE_STATS_MAX_SLOTS && !inUse; ++s)
+        inUse = __atomic_load_n(&stats->array->slots[s].pid, __ATOMIC_ACQUIRE) != 0;
+    if (!inUse)
+        shm_unlink(stats->name);
+    node_shm_unmap(stats->array, sizeof(struct node_stats_array));
+    stats->array = NULL;
+    stats->slot = -1;
+}
+
+/*! Writes the values of this process for the sample at \a sampleTime. Called from the sampler; never waits. */
+static inline void node_stats_write(struct node_stats *stats, const double *values, const struct timespec *sampleTime)
+{
+    const uint64_t sampleNs = (uint64_t) sampleTime->tv_sec * 1000000000ULL + (uint64_t) sampleTime->tv_nsec;
+    uint64_t currentNs = stats->lastSampleNs != 0 && sampleNs > stats->lastSampleNs ? 2 * (sampleNs - stats->lastSampleNs) : 0;
+    if (currentNs < NODE_STATS_MIN_CURRENT_NS)
+        currentNs = NODE_STATS_MIN_CURRENT_NS;
+    stats->lastSampleNs = sampleNs;
+    memcpy(stats->values, values, stats->numValues * sizeof(double));
+    if (stats->array == NULL || stats->slot == -1)
+        return;
+    struct node_stats_slot *slot = &stats->array->slots[stats->slot];
+    node_shm_write_begin(&slot->seq);
+    for (unsigned v = 0; v < stats->numValues; ++v) {
+        uint64_t bits;
+        memcpy(&bits, &values[v], sizeof(bits));
+        __atomic_store_n(&slot->bits[v], bits, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&slot->currentNs, currentNs, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->updatedNs, node_shm_now_ns(), __ATOMIC_RELAXED);
+    node_shm_write_end(&slot->seq);
+}
+
+/*! Summarises each value over the processes of the node with a current value. Called from the sampler after \a node_stats_write. */
+/*!
+ *  The values of this process are always included, as written, so a summary
+ *  always has a count of at least 1.
+ */
+static inline void node_stats_summarize(const struct node_stats *stats, struct node_stats_summary *summaries)
+{
+    double sums[NODE_STATS_MAX_VALUES], squares[NODE_STATS_MAX_VALUES];
+    for (unsigned v = 0; v < stats->numValues; ++v) {
+        summaries[v].count = 1;
+        summaries[v].min = summaries[v].max = sums[v] = stats->values[v];
+        squares[v] = stats->values[v] * stats->values[v];
+    }
+    if (stats->array != NULL) {
+        const uint64_t now = node_shm_now_ns();
+        const uint32_t numSlots = __atomic_load_n(&stats->array->numSlots, __ATOMIC_ACQUIRE);
+        for (uint32_t s = 0; s < numSlots && s < NODE_STATS_MAX_SLOTS; ++s) {
+            const struct node_stats_slot *slot = &stats->array->slots[s];
+            if ((int) s == stats->slot || __atomic_load_n(&slot->pid, __ATOMIC_RELAXED) == 0)
+                continue;
+            /* One retry: a slot written to twice while it is read is skipped this sample */
+            double values[NODE_STATS_MAX_VALUES];
+            int found = 0;
+            for (int tries = 0; tries < 2 && !found; ++tries) {
+                const uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+                if (seq & 1)
+                    continue;
+                const uint64_t updatedNs = __atomic_load_n(&slot->updatedNs, __ATOMIC_RELAXED);
+                const uint64_t currentNs = __atomic_load_n(&slot->currentNs, __ATOMIC_RELAXED);
+                for (unsigned v = 0; v < stats->numValues; ++v) {
+                    const uint64_t bits = __atomic_load_n(&slot->bits[v], __ATOMIC_RELAXED);
+                    memcpy(&values[v], &bits, sizeof(bits));
+                }
+                if (node_shm_read_retry(&slot->seq, seq))
+                    continue;
+                /* Never written, or by a process that has stopped sampling */
+                if (updatedNs == 0 || (now > updatedNs && now - updatedNs > currentNs))
+                    break;
+                found = 1;
+            }
+            if (!found)
+                continue;
+            for (unsigned v = 0; v < stats->numValues; ++v) {
+                ++summaries[v].count;
+                summaries[v].min = values[v] < summaries[v].min ? values[v] : summaries[v].min;
+                summaries[v].max = values[v] > summaries[v].max ? values[v] : summaries[v].max;
+                sums[v] += values[v];
+                squares[v] += values[v] * values[v];
+            }
+        }
+    }
+    for (unsigned v = 0; v < stats->numValues; ++v) {
+        const double n = (double) summaries[v].count;
+        summaries[v].mean = sums[v] / n;
+        const double variance = squares[v] / n - summaries[v].mean * summaries[v].mean;
+        summaries[v].cv = summaries[v].mean == 0.0 || variance <= 0.0 ? 0.0 : sqrt(variance) / fabs(summaries[v].mean);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NODE_STATS_H */
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Helpers for metric plugins that read procfs, sysfs and cgroup files while
+ * sampling.
+ *
+ * The files are opened once when the plugin is initialised, and re-read from
+ * the start with pread into a buffer owned by the caller on each sample. The
+ * parsers work in place on that buffer and never allocate, so everything here
+ * is async-signal-safe.
+ *
+ * Everything here is header only and usable from both C and C++ plugins.
+ */
+
+#ifndef PROCFS_PARSE_H
+#define PROCFS_PARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Reads the whole of an open file into \a buffer, which is NUL terminated. */
+/*!
+ *  procfs files are generated as they are read, so a file may take more than
+ *  one read, which ends at the first short read. A file that does not fit is
+ *  truncated to \a size - 1 bytes.
+ *
+ *  \return the number of bytes read, or -1 on error with errno set
+ */
+static inline ssize_t procfs_pread(int fd, char *buffer, size_t size)
+{
+    size_t used = 0;
+    while (used + 1 < size) {
+        const size_t wanted = size - 1 - used;
+        ssize_t len = pread(fd, buffer + used, wanted, (off_t) used);
+        if (len < 0)
+            return -1;
+        used += (size_t) len;
+        /* A short read is the end of the file. Reading again to see 0 would
+           make the kernel generate the whole file a second time */
+        if ((size_t) len < wanted)
+            break;
+    }
+    buffer[used] = '\0';
+    return (ssize_t) used;
+}
+
+/*! Parses the unsigned decimal number at \a p, skipping any leading blanks. */
+/*!
+ *  \return a pointer to the first character after the number, or NULL if there
+ *  is no number before \a end
+ */
+static inline const char *procfs_parse_u64(const char *p, const char *end, uint64_t *value)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    if (p == end || *p < '0' || *p > '9')
+        return NULL;
+    uint64_t v = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+        v = v * 10 + (uint64_t) (*p++ - '0');
+    *value = v;
+    return p;
+}
+
+/*! Skips \a count blank separated fields of the line at \a p, and the blanks before them. */
+/*!
+ *  \return a pointer to the start of the next field, or NULL if the line ends
+ *  first
+ */
+static inline const char *procfs_skip_fields(const char *p, const char *end, int count)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    for (int i = 0; i < count; ++i) {
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\n')
+            p++;
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+    }
+    if (p == end || *p == '\n')
+        return NULL;
+    return p;
+}
+
+/*! Finds the line of \a buffer that starts with \a key, e.g. "VmRSS:". */
+/*!
+ *  \return a pointer to the character after the key, or NULL if there is no such
+ *  line
+ */
+static inline const char *procfs_find_key(const char *buffer, size_t len, const char *key)
+{
+    const size_t keyLen = strlen(key);
+    const char *end = buffer + len;
+    const char *line = buffer;
+    while (line < end) {
+        if ((size_t) (end - line) >= keyLen && memcmp(line, key, keyLen) == 0)
+            return line + keyLen;
+        const char *newline = (const char *) memchr(line, '\n', (size_t) (end - line));
+        if (newline == NULL)
+            break;
+        line = newline + 1;
+    }
+    return NULL;
+}
+
+/*! Gets the number after \a key in a "Key: value [kB]" file such as /proc/self/status. */
+/*!
+ *  Values given in kB are converted to bytes.
+ *
+ *  \return 0 on success, or -1 if the key was not found
+ */
+static inline int procfs_find_u64(const char *buffer, size_t len, const char *key, uint64_t *value)
+{
+    const char *end = buffer + len;
+    const char *p = procfs_find_key(buffer, len, key);
+    if (p == NULL || (p = procfs_parse_u64(p, end, value)) == NULL)
+        return -1;
+    if (end - p >= 3 && memcmp(p, " kB", 3) == 0)
+        *value *= 1024;
+    return 0;
+}
+
+/*! Gets the number of the "name=value" field \a name, e.g. "total=", in the line at \a p. */
+/*!
+ *  The fields are blank separated, as in the cgroup io.stat and pressure
+ *  files, e.g. "some avg10=0.00 avg60=0.00 avg300=0.00 total=12345".
+ *
+ *  \return 0 on success, or -1 if the line has no such field
+ */
+static inline int procfs_find_field_u64(const char *p, const char *end, const char *name, uint64_t *value)
+{
+    const size_t nameLen = strlen(name);
+    while (p < end && *p != '\n') {
+        const char *field = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\n')
+            p++;
+        if ((size_t) (p - field) > nameLen && memcmp(field, name, nameLen) == 0)
+            return procfs_parse_u64(field + nameLen, p, value) != NULL ? 0 : -1;
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+    }
+    return -1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROCFS_PARSE_H */
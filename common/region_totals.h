@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Region totals: a plugin adds what it counts in each sample to the
+ * innermost region that the sampled thread is in (see ../regions), and
+ * prints the totals and ratios of each region at cleanup.
+ *
+ * The region functions are looked up in the program when the plugin is
+ * initialised, so a program that does not mark regions pays nothing and
+ * the plugin does not depend on libmapregions.so. The totals are added
+ * with relaxed atomic additions, so samples of several threads never lock.
+ *
+ * Everything here is header only and usable from both C and C++ plugins.
+ */
+
+#ifndef REGION_TOTALS_H
+#define REGION_TOTALS_H
+
+#include "../regions/map_regions.h"
+
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REGION_TOTALS_MAX_COUNTERS 24
+
+/*! A ratio of two counters to report for each region. */
+struct region_ratio {
+    const char *name;
+    unsigned numerator;
+    unsigned denominator;
+    /*! Multiplies the ratio, e.g. 1000 for a count per thousand. */
+    double scale;
+};
+
+struct region_totals {
+    /*! The functions of libmapregions.so, or NULL if the program does not mark regions. */
+    int (*current)(void);
+    const char *(*name)(int);
+    int (*count)(void);
+    unsigned numCounters;
+    const char *counterNames[REGION_TOTALS_MAX_COUNTERS];
+    uint64_t samples[MAP_REGIONS_MAX];
+    uint64_t totals[MAP_REGIONS_MAX][REGION_TOTALS_MAX_COUNTERS];
+};
+
+/*! Looks up the region functions in the program and clears the totals of \a numCounters counters. */
+/*!
+ *  Called from allinea_plugin_initialize, not the sampler.
+ *
+ *  \return 0 if the program marks regions, else -1, in which case the other
+ *  functions do nothing
+ */
+static inline int region_totals_open(struct region_totals *t, unsigned numCounters, const char *const *counterNames)
+{
+    memset(t, 0, sizeof(*t));
+    if (numCounters > REGION_TOTALS_MAX_COUNTERS)
+        numCounters = REGION_TOTALS_MAX_COUNTERS;
+    t->numCounters = numCounters;
+    for (unsigned c = 0; c < numCounters; ++c)
+        t->counterNames[c] = counterNames[c];
+    /* Through a union, as ISO C does not allow converting void * to a function pointer */
+    union { void *symbol; int (*current)(void); const char *(*name)(int); int (*count)(void); } f;
+    f.symbol = dlsym(RTLD_DEFAULT, "map_region_current");
+    t->current = f.current;
+    f.symbol = dlsym(RTLD_DEFAULT, "map_region_name");
+    t->name = f.name;
+    f.symbol = dlsym(RTLD_DEFAULT, "map_region_count");
+    t->count = f.count;
+    if (t->current == NULL || t->name == NULL || t->count == NULL) {
+        t->current = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*! \return non-zero if the program marks regions */
+static inline int region_totals_enabled(const struct region_totals *t)
+{
+    return t->current != NULL;
+}
+
+/*! \return the innermost region of the calling thread, or 0. Async-signal-safe. */
+static inline int region_totals_current(const struct region_totals *t)
+{
+    if (t->current == NULL)
+        return 0;
+    const int region = t->current();
+    return region >= 0 && region < MAP_REGIONS_MAX ? region : 0;
+}
+
+/*! Adds the counts of one sample, \a deltas, to \a region. Async-signal-safe. */
+static inline void region_totals_add(struct region_totals *t, int region, const uint64_t *deltas)
+{
+    if (t->current == NULL)
+        return;
+    __atomic_fetch_add(&t->samples[region], 1, __ATOMIC_RELAXED);
+    for (unsigned c = 0; c < t->numCounters; ++c)
+        __atomic_fetch_add(&t->totals[region][c], deltas[c], __ATOMIC_RELAXED);
+}
+
+/*! Prints the totals and \a ratios of every region with samples, under \a title. */
+static inline void region_totals_print(const struct region_totals *t, FILE *out, const char *title,
+                                       const struct region_ratio *ratios, unsigned numRatios)
+{
+    if (t->current == NULL)
+        return;
+    uint64_t allSamples = 0;
+    const int numRegions = t->count();
+    for (int r = 0; r < numRegions && r < MAP_REGIONS_MAX; ++r)
+        allSamples += t->samples[r];
+    if (allSamples == 0)
+        return;
+    fprintf(out, "%s by region: %llu samples\n", title, (unsigned long long) allSamples);
+    for (int r = 0; r < numRegions && r < MAP_REGIONS_MAX; ++r) {
+        if (t->samples[r] == 0)
+            continue;
+        fprintf(out, "  %s: %llu samples (%.1f%%)\n", t->name(r), (unsigned long long) t->samples[r],
+                100.0 * (double) t->samples[r] / (double) allSamples);
+        for (unsigned c = 0; c < t->numCounters; ++c)
+            fprintf(out, "    %-40s %20llu\n", t->counterNames[c], (unsigned long long) t->totals[r][c]);
+        for (unsigned i = 0; i < numRatios; ++i) {
+            const uint64_t denominator = t->totals[r][ratios[i].denominator];
+            if (denominator == 0)
+                fprintf(out, "    %-40s %20s\n", ratios[i].name, "-");
+            else
+                fprintf(out, "    %-40s %20.4f\n", ratios[i].name,
+                        ratios[i].scale * (double) t->totals[r][ratios[i].numerator] / (double) denominator);
+        }
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REGION_TOTALS_H */
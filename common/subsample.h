@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sub-sampling: a background thread reads a plugin's source many times per
+ * MAP sample, so that bursts shorter than a sample are not averaged away. At
+ * each MAP sample the plugin reports the minimum, maximum, mean and last of
+ * the values read since the last.
+ *
+ * The thread passes what it reads to the sampler through a ring with a
+ * single producer and a single consumer, which neither locks. Each entry of
+ * the ring is itself an aggregate of one or more reads: if the sampler falls
+ * so far behind that the ring is full, the thread folds its reads into the
+ * entry it has not yet pushed rather than dropping them or waiting, so the
+ * extremes are never lost however long a MAP sample is; they are reported
+ * with the next sample instead.
+ *
+ * Sub-sampling is off unless ARM_MAP_SUBSAMPLE_HZ is set to the rate to read
+ * at, up to SUBSAMPLE_MAX_HZ.
+ *
+ * Everything here is header only and usable from both C and C++ plugins.
+ */
+
+#ifndef SUBSAMPLE_H
+#define SUBSAMPLE_H
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! The most reads per second, above which the thread would cost more than it shows. */
+#define SUBSAMPLE_MAX_HZ 10000
+
+#define SUBSAMPLE_MAX_CHANNELS 4
+
+/*! Entries in the ring, a power of 2. 4096 holds 0.4 s of reads at the highest rate before they are folded together. */
+#define SUBSAMPLE_RING_SIZE 4096
+
+/*! Reads the source. Called from the background thread. */
+/*!
+ *  \param arg the argument given to \a subsample_start
+ *  \param nowNs the time of the read, in the clock of \a subsample_now_ns
+ *  \param values [out] the value of each channel, typically the rate since the last read
+ *  \return 0 on success, or non-zero to skip this read
+ */
+typedef int (*subsample_read_fn)(void *arg, uint64_t nowNs, double *values);
+
+/*! The reads of one or more sub-samples. */
+struct subsample_entry {
+    uint32_t count;
+    double min[SUBSAMPLE_MAX_CHANNELS];
+    double max[SUBSAMPLE_MAX_CHANNELS];
+    double sum[SUBSAMPLE_MAX_CHANNELS];
+    double last[SUBSAMPLE_MAX_CHANNELS];
+};
+
+/*! The minimum, maximum, mean and last of the reads in one MAP sample. */
+struct subsample_window {
+    /*! The reads in the window. If 0, every statistic is the last value read before it. */
+    uint64_t count;
+    double min[SUBSAMPLE_MAX_CHANNELS];
+    double max[SUBSAMPLE_MAX_CHANNELS];
+    double mean[SUBSAMPLE_MAX_CHANNELS];
+    double last[SUBSAMPLE_MAX_CHANNELS];
+};
+
+struct subsampler {
+    pthread_t thread;
+    int running;
+    int stop;
+    unsigned numChannels;
+    uint64_t periodNs;
+    subsample_read_fn read;
+    void *arg;
+    /*! Entries are pushed at \a head by the thread and popped at \a tail by the sampler. */
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    struct subsample_entry ring[SUBSAMPLE_RING_SIZE];
+    /*! The thread's reads that have not been pushed yet. Only used by the thread. */
+    struct subsample_entry pending;
+    /*! The last values the sampler saw, for windows with no reads. Only used by the sampler. */
+    double lastSeen[SUBSAMPLE_MAX_CHANNELS];
+};
+
+static inline uint64_t subsample_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/*! The rate set by ARM_MAP_SUBSAMPLE_HZ, at most \a SUBSAMPLE_MAX_HZ, or 0 if sub-sampling is off. */
+static inline unsigned subsample_hz_from_env(void)
+{
+    const char *value = getenv("ARM_MAP_SUBSAMPLE_HZ");
+    if (value == NULL)
+        return 0;
+    const long hz = strtol(value, NULL, 10);
+    if (hz <= 0)
+        return 0;
+    return hz > SUBSAMPLE_MAX_HZ ? SUBSAMPLE_MAX_HZ : (unsigned) hz;
+}
+
+static inline void subsample_entry_add(struct subsample_entry *entry, unsigned numChannels, const double *values)
+{
+    for (unsigned c = 0; c < numChannels; ++c) {
+        if (entry->count == 0 || values[c] < entry->min[c])
+            entry->min[c] = values[c];
+        if (entry->count == 0 || values[c] > entry->max[c])
+            entry->max[c] = values[c];
+        entry->sum[c] = (entry->count == 0 ? 0.0 : entry->sum[c]) + values[c];
+        entry->last[c] = values[c];
+    }
+    ++entry->count;
+}
+
+/*! Pushes the pending reads if there is room in the ring, else leaves them pending to be added to. */
+static inline void subsample_push(struct subsampler *s)
+{
+    const uint64_t head = s->head;
+    if (head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE) >= SUBSAMPLE_RING_SIZE)
+        return;
+    s->ring[head & (SUBSAMPLE_RING_SIZE - 1)] = s->pending;
+    __atomic_store_n(&s->head, head + 1, __ATOMIC_RELEASE);
+    s->pending.count = 0;
+}
+
+static inline void *subsample_thread(void *arg)
+{
+    struct subsampler *s = (struct subsampler *) arg;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    double values[SUBSAMPLE_MAX_CHANNELS];
+    while (!__atomic_load_n(&s->stop, __ATOMIC_RELAXED)) {
+        if (s->read(s->arg, subsample_now_ns(), values) == 0) {
+            subsample_entry_add(&s->pending, s->numChannels, values);
+            subsample_push(s);
+        }
+        /* Absolute times, so that the time taken to read does not slow the rate */
+        next.tv_nsec += (long) s->periodNs;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            ++next.tv_sec;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    return NULL;
+}
+
+/*! Starts a thread that calls \a read \a hz times a second. */
+/*!
+ *  Called from allinea_plugin_initialize, not the sampler. The thread blocks
+ *  every signal, so that it is never interrupted to take a sample of its own.
+ *
+ *  \return 0 on success, or -1 if the thread could not be started
+ */
+static inline int subsample_start(struct subsampler *s, unsigned hz, unsigned numChannels,
+                                  subsample_read_fn read, void *arg)
+{
+    memset(s, 0, sizeof(*s));
+    if (hz == 0 || numChannels == 0 || numChannels > SUBSAMPLE_MAX_CHANNELS)
+        return -1;
+    s->numChannels = numChannels;
+    s->periodNs = 1000000000ULL / (hz > SUBSAMPLE_MAX_HZ ? SUBSAMPLE_MAX_HZ : hz);
+    s->read = read;
+    s->arg = arg;
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    const int ret = pthread_create(&s->thread, NULL, subsample_thread, s);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (ret != 0)
+        return -1;
+    s->running = 1;
+    return 0;
+}
+
+static inline void subsample_stop(struct subsampler *s)
+{
+    if (!s->running)
+        return;
+    __atomic_store_n(&s->stop, 1, __ATOMIC_RELAXED);
+    pthread_join(s->thread, NULL);
+    s->running = 0;
+}
+
+/*! Takes the reads since the last window out of the ring. Called from the sampler; never blocks or allocates. */
+static inline void subsample_window(struct subsampler *s, struct subsample_window *window)
+{
+    struct subsample_entry sum;
+    sum.count = 0;
+    window->count = 0;
+    const uint64_t head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = s->tail;
+    for (; tail != head; ++tail) {
+        const struct subsample_entry *entry = &s->ring[tail & (SUBSAMPLE_RING_SIZE - 1)];
+        for (unsigned c = 0; c < s->numChannels; ++c) {
+            sum.min[c] = sum.count == 0 || entry->min[c] < sum.min[c] ? entry->min[c] : sum.min[c];
+            sum.max[c] = sum.count == 0 || entry->max[c] > sum.max[c] ? entry->max[c] : sum.max[c];
+            sum.sum[c] = (sum.count == 0 ? 0.0 : sum.sum[c]) + entry->sum[c];
+            sum.last[c] = entry->last[c];
+        }
+        sum.count += entry->count;
+        window->count += entry->count;
+    }
+    __atomic_store_n(&s->tail, tail, __ATOMIC_RELEASE);
+    for (unsigned c = 0; c < s->numChannels; ++c) {
+        if (window->count == 0) {
+            window->min[c] = window->max[c] = window->mean[c] = window->last[c] = s->lastSeen[c];
+        } else {
+            window->min[c] = sum.min[c];
+            window->max[c] = sum.max[c];
+            window->mean[c] = sum.sum[c] / (double) window->count;
+            window->last[c] = s->lastSeen[c] = sum.last[c];
+        }
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SUBSAMPLE_H */
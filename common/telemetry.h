@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Live telemetry: plugins publish the values of each sample to a page of
+ * shared memory per process, /dev/shm/arm-map-telemetry-<uid>-<pid>, which
+ * tools/telemetry/map-telemetry reads while the program runs.
+ *
+ * The page has a value for every metric in telemetry_ids.h, which is generated
+ * from the XML definitions, so every plugin in a process shares the one page
+ * and a reader knows what each value is. The plugins publish from the sampler,
+ * never from the program's own threads, under the seqlock of node_shm.h; the
+ * sampler is the only writer, so the plugins of a process do not race.
+ *
+ * Publishing is off unless ARM_MAP_TELEMETRY=1 is set, and then costs a few
+ * stores per metric per sample.
+ *
+ * Everything here is header only and usable from both C and C++ plugins.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "mpi_rank.h"
+#include "node_shm.h"
+#include "telemetry_ids.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TELEMETRY_MAGIC 0x5450414du /* "MAPT" */
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_PREFIX "arm-map-telemetry"
+
+/*! The last published value of one metric. */
+struct telemetry_value {
+    /*! The value, or the bits of the value if it is a double. */
+    uint64_t bits;
+    /*! The sample time passed to the metric function, in ns, or 0 if never published. */
+    uint64_t sampleNs;
+    /*! The time since the previous sample of the metric in ns, or 0 for the first. */
+    uint64_t intervalNs;
+};
+
+/*! The layout of a telemetry page. A newly created page is zero filled, which is "nothing published yet". */
+struct telemetry_page {
+    /*! \a TELEMETRY_MAGIC, set last when the page is first opened. */
+    uint32_t magic;
+    uint32_t version;
+    /*! \a TELEMETRY_TABLE_HASH of the plugins that publish to the page. */
+    uint32_t tableHash;
+    uint32_t numMetrics;
+    int32_t pid;
+    /*! The MPI rank, from the environment of the launcher, or -1. */
+    int32_t rank;
+    /*! The plugins that have the page open; the last to close it removes it. */
+    uint32_t users;
+    uint32_t seq;
+    /*! When the page was last published to, in the clock of \a node_shm_now_ns. */
+    uint64_t updatedNs;
+    struct telemetry_value values[TELEMETRY_NUM_METRICS];
+};
+
+/*! Builds the name of the telemetry page of process \a pid. */
+static inline int telemetry_name(char *buffer, size_t size, pid_t pid)
+{
+    return node_shm_name(buffer, size, TELEMETRY_PREFIX, (int) pid);
+}
+
+/*! Opens the telemetry page of this process, creating it if this is the first plugin to. */
+/*!
+ *  Called from allinea_plugin_initialize, not the sampler.
+ *
+ *  \return the page, or NULL if ARM_MAP_TELEMETRY=1 is not set or the page
+ *  could not be opened, in which case the other functions do nothing
+ */
+static inline struct telemetry_page *telemetry_open(void)
+{
+    const char *enabled = getenv("ARM_MAP_TELEMETRY");
+    if (enabled == NULL || strcmp(enabled, "1") != 0)
+        return NULL;
+    char name[64];
+    if (telemetry_name(name, sizeof(name), getpid()) != 0)
+        return NULL;
+    struct telemetry_page *page = (struct telemetry_page *) node_shm_map(name, sizeof(struct telemetry_page));
+    if (page == NULL)
+        return NULL;
+    if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != TELEMETRY_MAGIC) {
+        page->version = TELEMETRY_VERSION;
+        page->tableHash = TELEMETRY_TABLE_HASH;
+        page->numMetrics = TELEMETRY_NUM_METRICS;
+        page->pid = (int32_t) getpid();
+        page->rank = mpi_rank();
+        __atomic_store_n(&page->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+    } else if (page->tableHash != TELEMETRY_TABLE_HASH) {
+        /* Another plugin of this process was built from different metric definitions */
+        node_shm_unmap(page, sizeof(struct telemetry_page));
+        return NULL;
+    }
+    __atomic_fetch_add(&page->users, 1, __ATOMIC_RELAXED);
+    return page;
+}
+
+/*! Closes the page, and removes it if no other plugin of the process has it open. */
+static inline void telemetry_close(struct telemetry_page *page)
+{
+    if (page == NULL)
+        return;
+    if (__atomic_sub_fetch(&page->users, 1, __ATOMIC_ACQ_REL) == 0) {
+        char name[64];
+        if (telemetry_name(name, sizeof(name), getpid()) == 0)
+            shm_unlink(name);
+    }
+    node_shm_unmap(page, sizeof(struct telemetry_page));
+}
+
+/*! Starts publishing the values of a sample. Called from the sampler. */
+static inline void telemetry_publish_begin(struct telemetry_page *page)
+{
+    if (page != NULL)
+        node_shm_write_begin(&page->seq);
+}
+
+/*! Publishes the value of metric \a id for the sample at \a sampleTime. */
+static inline void telemetry_set_uint64(struct telemetry_page *page, enum telemetry_metric_id id, uint64_t value,
+                                        const struct timespec *sampleTime)
+{
+    if (page == NULL)
+        return;
+    struct telemetry_value *slot = &page->values[id];
+    const uint64_t sampleNs = (uint64_t) sampleTime->tv_sec * 1000000000ULL + (uint64_t) sampleTime->tv_nsec;
+    const uint64_t lastNs = slot->sampleNs;
+    __atomic_store_n(&slot->bits, value, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->intervalNs, lastNs != 0 && sampleNs > lastNs ? sampleNs - lastNs : 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->sampleNs, sampleNs, __ATOMIC_RELAXED);
+}
+
+static inline void telemetry_set_double(struct telemetry_page *page, enum telemetry_metric_id id, double value,
+                                        const struct timespec *sampleTime)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    telemetry_set_uint64(page, id, bits, sampleTime);
+}
+
+/*! Finishes publishing the values of a sample. */
+static inline void telemetry_publish_end(struct telemetry_page *page)
+{
+    if (page == NULL)
+        return;
+    __atomic_store_n(&page->updatedNs, node_shm_now_ns(), __ATOMIC_RELAXED);
+    node_shm_write_end(&page->seq);
+}
+
+/*! Copies the values of a page consistently, for readers. */
+/*!
+ *  Unlike \a node_shm_read_begin this gives up rather than waiting, as the
+ *  process may have died part way through publishing.
+ *
+ *  \return 0 on success, or -1 if the page was being written to on every try
+ */
+static inline int telemetry_read(const struct telemetry_page *page, struct telemetry_page *copy, int tries)
+{
+    /* Written before the magic and never again */
+    copy->magic = __atomic_load_n(&page->magic, __ATOMIC_ACQUIRE);
+    copy->version = page->version;
+    copy->tableHash = page->tableHash;
+    copy->numMetrics = page->numMetrics;
+    copy->pid = page->pid;
+    copy->rank = page->rank;
+    for (int i = 0; i < tries; ++i) {
+        const uint32_t seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if ((seq & 1) == 0) {
+            copy->updatedNs = __atomic_load_n(&page->updatedNs, __ATOMIC_RELAXED);
+            for (int m = 0; m < TELEMETRY_NUM_METRICS; ++m) {
+                copy->values[m].bits = __atomic_load_n(&page->values[m].bits, __ATOMIC_RELAXED);
+                copy->values[m].sampleNs = __atomic_load_n(&page->values[m].sampleNs, __ATOMIC_RELAXED);
+                copy->values[m].intervalNs = __atomic_load_n(&page->values[m].intervalNs, __ATOMIC_RELAXED);
+            }
+            if (!node_shm_read_retry(&page->seq, seq))
+                return 0;
+        }
+        usleep(100);
+    }
+    return -1;
+}
+
+/*! \return non-zero if the process that published to \a page is still running */
+static inline int telemetry_publisher_alive(const struct telemetry_page *page)
+{
+    return kill((pid_t) page->pid, 0) == 0 || errno == EPERM;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TELEMETRY_H */
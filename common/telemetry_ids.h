@@ -0,0 +1,415 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The metrics that can be published to a telemetry page, one for each metric
+ * of every plugin's XML definitions, in the order of the files and of the
+ * metrics in them.
+ *
+ * Generated by tools/telemetry/gen-telemetry-ids.sh. Do not edit; run
+ * make ids in tools/telemetry after changing the metric definitions.
+ */
+
+#ifndef TELEMETRY_IDS_H
+#define TELEMETRY_IDS_H
+
+/*! Changes whenever a metric is added, removed, moved or changes type. */
+#define TELEMETRY_TABLE_HASH 1582183313u
+
+enum telemetry_metric_id {
+    TELEMETRY_ALLOC_RATE = 0,
+    TELEMETRY_ALLOC_BYTES,
+    TELEMETRY_ALLOC_LIVE_GROWTH,
+    TELEMETRY_ALLOC_TIME_FRACTION,
+    TELEMETRY_ALLOC_MEDIAN_SIZE,
+    TELEMETRY_CGROUP_CPU_USAGE,
+    TELEMETRY_CGROUP_CPU_THROTTLED,
+    TELEMETRY_CGROUP_CPU_THROTTLED_PERIODS,
+    TELEMETRY_CGROUP_CPU_PRESSURE,
+    TELEMETRY_CGROUP_MEMORY_PRESSURE_SOME,
+    TELEMETRY_CGROUP_MEMORY_PRESSURE_FULL,
+    TELEMETRY_CGROUP_IO_PRESSURE_SOME,
+    TELEMETRY_CGROUP_IO_PRESSURE_FULL,
+    TELEMETRY_CGROUP_MEMORY_ANON,
+    TELEMETRY_CGROUP_MEMORY_FILE,
+    TELEMETRY_CGROUP_MEMORY_RECLAIMED,
+    TELEMETRY_CGROUP_MEMORY_REFAULTS,
+    TELEMETRY_CGROUP_MEMORY_HIGH_EVENTS,
+    TELEMETRY_CGROUP_MEMORY_MAX_EVENTS,
+    TELEMETRY_CGROUP_MEMORY_OOM_KILLS,
+    TELEMETRY_CGROUP_IO_READ,
+    TELEMETRY_CGROUP_IO_WRITE,
+    TELEMETRY_GPFS_IO_CYCLES,
+    TELEMETRY_GPFS_IO_CYCLES_TOTAL,
+    TELEMETRY_GPFS_INODE_LOOKUPS,
+    TELEMETRY_GPFS_INODE_LOOKUPS_TOTAL,
+    TELEMETRY_GPFS_OPENS,
+    TELEMETRY_GPFS_OPENS_TOTAL,
+    TELEMETRY_GPFS_READS,
+    TELEMETRY_GPFS_READS_TOTAL,
+    TELEMETRY_GPFS_WRITES,
+    TELEMETRY_GPFS_WRITES_TOTAL,
+    TELEMETRY_GPFS_IOPS,
+    TELEMETRY_GPFS_IOPS_TOTAL,
+    TELEMETRY_GPFS_CYCLES_PER_IOP,
+    TELEMETRY_GPFS_IOPS_MIN,
+    TELEMETRY_GPFS_IOPS_MAX,
+    TELEMETRY_GPFS_IOPS_MEAN,
+    TELEMETRY_GPFS_IOPS_LAST,
+    TELEMETRY_GPFS_METADATA_MIN,
+    TELEMETRY_GPFS_METADATA_MAX,
+    TELEMETRY_GPFS_METADATA_MEAN,
+    TELEMETRY_GPFS_METADATA_LAST,
+    TELEMETRY_GPFS_FILE_READ_BYTES,
+    TELEMETRY_GPFS_FILE_WRITE_BYTES,
+    TELEMETRY_GPFS_FILE_LATENCY_MEAN,
+    TELEMETRY_GPFS_FILE_LATENCY_P99,
+    TELEMETRY_GPFS_FILE_SMALL_IO,
+    TELEMETRY_HASWELL_PAPI_ACTIVE_CYCLES,
+    TELEMETRY_HASWELL_PAPI_PRODUCTIVE_CYCLES,
+    TELEMETRY_HASWELL_PAPI_STALL_CYCLES,
+    TELEMETRY_HASWELL_PAPI_STORE_BUFFER_STALL_CYCLES,
+    TELEMETRY_HASWELL_PAPI_L1D_PENDING_STALL_CYCLES,
+    TELEMETRY_HASWELL_PAPI_MEMORY_BOUND,
+    TELEMETRY_HASWELL_PAPI_L1D_PEND_MISS_FB_FULL_CYCLES,
+    TELEMETRY_HASWELL_PAPI_OFFCORE_REQUESTS_BUFFER_SQ_CYCLES,
+    TELEMETRY_HASWELL_PAPI_BANDWIDTH_BOUND,
+    TELEMETRY_HASWELL_PAPI_SIBLING_ACTIVE,
+    TELEMETRY_HASWELL_PAPI_CONTENTION_STALL_CYCLES,
+    TELEMETRY_HASWELL_PAPI_DRAM_BANDWIDTH,
+    TELEMETRY_HASWELL_PAPI_FLOPS,
+    TELEMETRY_HASWELL_PAPI_ARITHMETIC_INTENSITY,
+    TELEMETRY_HASWELL_PAPI_ROOFLINE_ATTAINABLE,
+    TELEMETRY_HASWELL_PAPI_L1D_MPKI,
+    TELEMETRY_HASWELL_PAPI_L2_MPKI,
+    TELEMETRY_HASWELL_PAPI_L3_MPKI,
+    TELEMETRY_HASWELL_PAPI_L3_HIT_RATIO,
+    TELEMETRY_HASWELL_PAPI_DTLB_LOAD_WALK_CYCLES,
+    TELEMETRY_HASWELL_PAPI_DTLB_STORE_WALK_CYCLES,
+    TELEMETRY_HASWELL_PAPI_PAGE_WALK_CYCLES,
+    TELEMETRY_HASWELL_PAPI_PORT0_UTILIZATION,
+    TELEMETRY_HASWELL_PAPI_PORT1_UTILIZATION,
+    TELEMETRY_HASWELL_PAPI_PORT2_UTILIZATION,
+    TELEMETRY_HASWELL_PAPI_PORT3_UTILIZATION,
+    TELEMETRY_HASWELL_PAPI_PORT4_UTILIZATION,
+    TELEMETRY_HASWELL_PAPI_PORT5_UTILIZATION,
+    TELEMETRY_HASWELL_PAPI_PORT6_UTILIZATION,
+    TELEMETRY_HASWELL_PAPI_PORT7_UTILIZATION,
+    TELEMETRY_HASWELL_PAPI_CYCLES_0_PORTS,
+    TELEMETRY_HASWELL_PAPI_CYCLES_1_PORT,
+    TELEMETRY_HASWELL_PAPI_CYCLES_2_PORTS,
+    TELEMETRY_HASWELL_PAPI_CYCLES_3_PORTS,
+    TELEMETRY_HASWELL_PAPI_FP_SCALAR,
+    TELEMETRY_HASWELL_PAPI_FP_128B_PACKED,
+    TELEMETRY_HASWELL_PAPI_FP_256B_PACKED,
+    TELEMETRY_HASWELL_PAPI_LOCAL_DRAM_LOADS,
+    TELEMETRY_HASWELL_PAPI_REMOTE_DRAM_LOADS,
+    TELEMETRY_HASWELL_PAPI_REMOTE_DRAM_RATIO,
+    TELEMETRY_HASWELL_PAPI_LOAD_LATENCY_SAMPLES,
+    TELEMETRY_HASWELL_PAPI_LOAD_LATENCY_MEAN,
+    TELEMETRY_HASWELL_PAPI_LOAD_LATENCY_TOP1,
+    TELEMETRY_HASWELL_PAPI_LOAD_LATENCY_TOP2,
+    TELEMETRY_HASWELL_PAPI_LOAD_LATENCY_TOP3,
+    TELEMETRY_HASWELL_PAPI_EFFECTIVE_FREQUENCY,
+    TELEMETRY_HASWELL_PAPI_TURBO_RATIO,
+    TELEMETRY_HASWELL_PAPI_THROTTLED_TIME,
+    TELEMETRY_HASWELL_PAPI_THROTTLE_EVENTS,
+    TELEMETRY_HASWELL_PAPI_NODE_MEMORY_BOUND_MIN,
+    TELEMETRY_HASWELL_PAPI_NODE_MEMORY_BOUND_MEAN,
+    TELEMETRY_HASWELL_PAPI_NODE_MEMORY_BOUND_MAX,
+    TELEMETRY_HASWELL_PAPI_NODE_MEMORY_BOUND_CV,
+    TELEMETRY_HASWELL_PAPI_NODE_BANDWIDTH_BOUND_MIN,
+    TELEMETRY_HASWELL_PAPI_NODE_BANDWIDTH_BOUND_MEAN,
+    TELEMETRY_HASWELL_PAPI_NODE_BANDWIDTH_BOUND_MAX,
+    TELEMETRY_HASWELL_PAPI_NODE_BANDWIDTH_BOUND_CV,
+    TELEMETRY_HASWELL_RAPL_PACKAGE_POWER,
+    TELEMETRY_HASWELL_RAPL_DRAM_POWER,
+    TELEMETRY_HASWELL_RAPL_PACKAGE_ENERGY,
+    TELEMETRY_HASWELL_RAPL_DRAM_ENERGY,
+    TELEMETRY_HASWELL_RAPL_ENERGY_PER_INSTRUCTION,
+    TELEMETRY_HASWELL_UNCORE_READ_BANDWIDTH,
+    TELEMETRY_HASWELL_UNCORE_WRITE_BANDWIDTH,
+    TELEMETRY_HASWELL_UNCORE_UTILIZATION,
+    TELEMETRY_MEMORY_RSS,
+    TELEMETRY_MEMORY_ANONYMOUS,
+    TELEMETRY_MEMORY_ANON_HUGE_PAGES,
+    TELEMETRY_MEMORY_THP_COVERAGE,
+    TELEMETRY_MEMORY_SWAP,
+    TELEMETRY_MEMORY_NUMA_REMOTE,
+    TELEMETRY_MEMORY_NUMA_REMOTE_FRACTION,
+    TELEMETRY_MPI_P2P_MESSAGES,
+    TELEMETRY_MPI_P2P_BYTES,
+    TELEMETRY_MPI_COLLECTIVE_CALLS,
+    TELEMETRY_MPI_WAIT_FRACTION,
+    TELEMETRY_MPI_LATE_SENDER_FRACTION,
+    TELEMETRY_MPI_LATE_RECEIVER_FRACTION,
+    TELEMETRY_MPI_BARRIER_FRACTION,
+    TELEMETRY_MPI_BCAST_FRACTION,
+    TELEMETRY_MPI_REDUCE_FRACTION,
+    TELEMETRY_MPI_ALLTOALL_FRACTION,
+    TELEMETRY_MPI_GATHER_FRACTION,
+    TELEMETRY_MPI_UNEXPECTED_QUEUE_LENGTH,
+    TELEMETRY_MPI_POSTED_QUEUE_LENGTH,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_RATE,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_CALLS,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_DURATION,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_DURATION_CUM,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_RATE,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_CALLS,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_DURATION,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_DURATION_CUM,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_BARRIER_CALLS,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_BARRIER_DURATION,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_BARRIER_DURATION_CUM,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_RATE_MIN,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_RATE_MAX,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_RATE_MEAN,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_RATE_LAST,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_RATE_MIN,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_RATE_MAX,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_RATE_MEAN,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_RATE_LAST,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_NODE_SEND_TIME_MIN,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_NODE_SEND_TIME_MEAN,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_NODE_SEND_TIME_MAX,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_NODE_SEND_TIME_CV,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_NODE_RECEIVE_TIME_MIN,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_NODE_RECEIVE_TIME_MEAN,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_NODE_RECEIVE_TIME_MAX,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_NODE_RECEIVE_TIME_CV,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_NODE_BARRIER_TIME_MIN,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_NODE_BARRIER_TIME_MEAN,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_NODE_BARRIER_TIME_MAX,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_NODE_BARRIER_TIME_CV,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_ITERATION_RATE,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_ITERATION_DURATION,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_ITERATION_RECEIVE_WAIT,
+    TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_ITERATION_COMPUTE,
+    TELEMETRY_OPENMP_IMBALANCE,
+    TELEMETRY_OPENMP_BARRIER_FRACTION,
+    TELEMETRY_OPENMP_TASKWAIT_FRACTION,
+    TELEMETRY_OPENMP_SERIAL_FRACTION,
+    TELEMETRY_OPENMP_ACTIVE_THREADS,
+    TELEMETRY_PERF_SW_CONTEXT_SWITCHES,
+    TELEMETRY_PERF_SW_CPU_MIGRATIONS,
+    TELEMETRY_PERF_SW_MINOR_FAULTS,
+    TELEMETRY_PERF_SW_MAJOR_FAULTS,
+    TELEMETRY_PERF_SW_ALIGNMENT_FAULTS,
+    TELEMETRY_MAP_REGION,
+    TELEMETRY_MAP_REGION_DEPTH,
+    TELEMETRY_NUM_METRICS
+};
+
+#ifdef TELEMETRY_METRIC_TABLE
+
+/*! The definition of a metric, for readers of telemetry pages. */
+struct telemetry_metric {
+    const char *id;
+    const char *displayName;
+    const char *units;
+    /*! Non-zero if the value is a double, else a uint64_t. */
+    int isDouble;
+    /*! Non-zero if the value is a count to be divided by the sample time to give a rate. */
+    int divideBySampleTime;
+};
+
+static const struct telemetry_metric telemetryMetrics[TELEMETRY_NUM_METRICS] = {
+    { "alloc_rate", "Allocations", "/s", 0, 1 },
+    { "alloc_bytes", "Allocated bytes", "B/s", 0, 1 },
+    { "alloc_live_growth", "Live heap growth", "B/s", 1, 0 },
+    { "alloc_time_fraction", "Allocator time", "%", 1, 0 },
+    { "alloc_median_size", "Median allocation size", "B", 0, 0 },
+    { "cgroup_cpu_usage", "Cgroup CPU usage", "%", 1, 0 },
+    { "cgroup_cpu_throttled", "Cgroup CPU throttled", "%", 1, 0 },
+    { "cgroup_cpu_throttled_periods", "Cgroup throttled periods", "/s", 0, 1 },
+    { "cgroup_cpu_pressure", "Cgroup CPU pressure", "%", 1, 0 },
+    { "cgroup_memory_pressure_some", "Cgroup memory pressure (some)", "%", 1, 0 },
+    { "cgroup_memory_pressure_full", "Cgroup memory pressure (full)", "%", 1, 0 },
+    { "cgroup_io_pressure_some", "Cgroup I/O pressure (some)", "%", 1, 0 },
+    { "cgroup_io_pressure_full", "Cgroup I/O pressure (full)", "%", 1, 0 },
+    { "cgroup_memory_anon", "Cgroup anonymous memory", "B", 0, 0 },
+    { "cgroup_memory_file", "Cgroup page cache", "B", 0, 0 },
+    { "cgroup_memory_reclaimed", "Cgroup memory reclaimed", "B/s", 0, 1 },
+    { "cgroup_memory_refaults", "Cgroup refaults", "/s", 0, 1 },
+    { "cgroup_memory_high_events", "Cgroup memory.high events", "/s", 0, 1 },
+    { "cgroup_memory_max_events", "Cgroup memory.max events", "/s", 0, 1 },
+    { "cgroup_memory_oom_kills", "Cgroup OOM kills", "", 0, 0 },
+    { "cgroup_io_read", "Cgroup I/O read", "B/s", 0, 1 },
+    { "cgroup_io_write", "Cgroup I/O write", "B/s", 0, 1 },
+    { "gpfs_io_cycles", "GPFS IO cycles", "/s", 0, 1 },
+    { "gpfs_io_cycles_total", "GPFS IO cycles", "", 0, 0 },
+    { "gpfs_inode_lookups", "GPFS inode lookups", "/s", 0, 1 },
+    { "gpfs_inode_lookups_total", "GPFS inode lookups", "", 0, 0 },
+    { "gpfs_opens", "GPFS file opens", "/s", 0, 1 },
+    { "gpfs_opens_total", "GPFS file opens", "", 0, 0 },
+    { "gpfs_reads", "GPFS file reads", "/s", 0, 1 },
+    { "gpfs_reads_total", "GPFS file reads", "", 0, 0 },
+    { "gpfs_writes", "GPFS file writes", "/s", 0, 1 },
+    { "gpfs_writes_total", "GPFS file writes", "", 0, 0 },
+    { "gpfs_iops", "GPFS IO operations", "/s", 0, 1 },
+    { "gpfs_iops_total", "GPFS IO operations", "", 0, 0 },
+    { "gpfs_cycles_per_iop", "GPFS cycles per IO  operation", "", 1, 0 },
+    { "gpfs_iops_min", "GPFS IO operations (min)", "/s", 1, 0 },
+    { "gpfs_iops_max", "GPFS IO operations (max)", "/s", 1, 0 },
+    { "gpfs_iops_mean", "GPFS IO operations (mean)", "/s", 1, 0 },
+    { "gpfs_iops_last", "GPFS IO operations (last)", "/s", 1, 0 },
+    { "gpfs_metadata_min", "GPFS metadata operations (min)", "/s", 1, 0 },
+    { "gpfs_metadata_max", "GPFS metadata operations (max)", "/s", 1, 0 },
+    { "gpfs_metadata_mean", "GPFS metadata operations (mean)", "/s", 1, 0 },
+    { "gpfs_metadata_last", "GPFS metadata operations (last)", "/s", 1, 0 },
+    { "gpfs_file_read_bytes", "GPFS file reads", "B/s", 0, 1 },
+    { "gpfs_file_write_bytes", "GPFS file writes", "B/s", 0, 1 },
+    { "gpfs_file_latency_mean", "GPFS file I/O latency (mean)", "s", 1, 0 },
+    { "gpfs_file_latency_p99", "GPFS file I/O latency (99th percentile)", "s", 1, 0 },
+    { "gpfs_file_small_io", "GPFS small file I/O", "%", 1, 0 },
+    { "haswell.papi.active_cycles", "Active cycles", "Cycles/s", 0, 1 },
+    { "haswell.papi.productive_cycles", "Productive cycles", "", 1, 0 },
+    { "haswell.papi.stall_cycles", "Stall cycles", "", 1, 0 },
+    { "haswell.papi.store_buffer_stall_cycles", "Store buffer stall cycles", "", 1, 0 },
+    { "haswell.papi.l1d_pending_stall_cycles", "L1D pending stall cycles", "", 1, 0 },
+    { "haswell.papi.memory_bound", "Cycles memory bound", "", 1, 0 },
+    { "haswell.papi.l1d_pend_miss_fb_full_cycles", "L1D fill buffer unavailable stall cycles", "", 1, 0 },
+    { "haswell.papi.offcore_requests_buffer_sq_cycles", "Offcore requests buffer full stall cycles", "", 1, 0 },
+    { "haswell.papi.bandwidth_bound", "Cycles bandwidth bound", "", 1, 0 },
+    { "haswell.papi.sibling_active", "Sibling thread active", "", 1, 0 },
+    { "haswell.papi.contention_stall_cycles", "Contention stall cycles", "", 1, 0 },
+    { "haswell.papi.dram_bandwidth", "DRAM bandwidth", "B/s", 0, 1 },
+    { "haswell.papi.flops", "FP operations", "FLOPS/s", 0, 1 },
+    { "haswell.papi.arithmetic_intensity", "Arithmetic intensity", "FLOPS/B", 1, 0 },
+    { "haswell.papi.roofline_attainable", "Roofline attainable", "%", 1, 0 },
+    { "haswell.papi.l1d_mpki", "L1D MPKI", "", 1, 0 },
+    { "haswell.papi.l2_mpki", "L2 MPKI", "", 1, 0 },
+    { "haswell.papi.l3_mpki", "L3 MPKI", "", 1, 0 },
+    { "haswell.papi.l3_hit_ratio", "L3 hit ratio", "", 1, 0 },
+    { "haswell.papi.dtlb_load_walk_cycles", "DTLB load page walk cycles", "Cycles/s", 0, 1 },
+    { "haswell.papi.dtlb_store_walk_cycles", "DTLB store page walk cycles", "Cycles/s", 0, 1 },
+    { "haswell.papi.page_walk_cycles", "Page walk cycles", "", 1, 0 },
+    { "haswell.papi.port0_utilization", "Port 0 utilization", "", 1, 0 },
+    { "haswell.papi.port1_utilization", "Port 1 utilization", "", 1, 0 },
+    { "haswell.papi.port2_utilization", "Port 2 utilization", "", 1, 0 },
+    { "haswell.papi.port3_utilization", "Port 3 utilization", "", 1, 0 },
+    { "haswell.papi.port4_utilization", "Port 4 utilization", "", 1, 0 },
+    { "haswell.papi.port5_utilization", "Port 5 utilization", "", 1, 0 },
+    { "haswell.papi.port6_utilization", "Port 6 utilization", "", 1, 0 },
+    { "haswell.papi.port7_utilization", "Port 7 utilization", "", 1, 0 },
+    { "haswell.papi.cycles_0_ports", "Cycles with 0 ports used", "", 1, 0 },
+    { "haswell.papi.cycles_1_port", "Cycles with 1 port used", "", 1, 0 },
+    { "haswell.papi.cycles_2_ports", "Cycles with 2 ports used", "", 1, 0 },
+    { "haswell.papi.cycles_3_ports", "Cycles with 3+ ports used", "", 1, 0 },
+    { "haswell.papi.fp_scalar", "Scalar FP instructions", "", 1, 0 },
+    { "haswell.papi.fp_128b_packed", "128-bit packed FP instructions", "", 1, 0 },
+    { "haswell.papi.fp_256b_packed", "256-bit packed FP instructions", "", 1, 0 },
+    { "haswell.papi.local_dram_loads", "Local DRAM loads", "/s", 0, 1 },
+    { "haswell.papi.remote_dram_loads", "Remote DRAM loads", "/s", 0, 1 },
+    { "haswell.papi.remote_dram_ratio", "Remote DRAM ratio", "", 1, 0 },
+    { "haswell.papi.load_latency_samples", "Load latency samples", "/s", 0, 1 },
+    { "haswell.papi.load_latency_mean", "Sampled load latency", "Cycles", 1, 0 },
+    { "haswell.papi.load_latency_top1", "Top data object 1 latency", "%", 1, 0 },
+    { "haswell.papi.load_latency_top2", "Top data object 2 latency", "%", 1, 0 },
+    { "haswell.papi.load_latency_top3", "Top data object 3 latency", "%", 1, 0 },
+    { "haswell.papi.effective_frequency", "Effective frequency", "GHz", 1, 0 },
+    { "haswell.papi.turbo_ratio", "Turbo ratio", "", 1, 0 },
+    { "haswell.papi.throttled_time", "Thermal throttled time", "%", 1, 0 },
+    { "haswell.papi.throttle_events", "Thermal throttle events", "", 0, 0 },
+    { "haswell.papi.node_memory_bound_min", "Cycles memory bound (node min)", "", 1, 0 },
+    { "haswell.papi.node_memory_bound_mean", "Cycles memory bound (node mean)", "", 1, 0 },
+    { "haswell.papi.node_memory_bound_max", "Cycles memory bound (node max)", "", 1, 0 },
+    { "haswell.papi.node_memory_bound_cv", "Cycles memory bound (node variation)", "", 1, 0 },
+    { "haswell.papi.node_bandwidth_bound_min", "Cycles bandwidth bound (node min)", "", 1, 0 },
+    { "haswell.papi.node_bandwidth_bound_mean", "Cycles bandwidth bound (node mean)", "", 1, 0 },
+    { "haswell.papi.node_bandwidth_bound_max", "Cycles bandwidth bound (node max)", "", 1, 0 },
+    { "haswell.papi.node_bandwidth_bound_cv", "Cycles bandwidth bound (node variation)", "", 1, 0 },
+    { "haswell.rapl.package_power", "Package power", "W", 1, 0 },
+    { "haswell.rapl.dram_power", "DRAM power", "W", 1, 0 },
+    { "haswell.rapl.package_energy", "Package energy", "J", 1, 0 },
+    { "haswell.rapl.dram_energy", "DRAM energy", "J", 1, 0 },
+    { "haswell.rapl.energy_per_instruction", "Energy per instruction", "nJ", 1, 0 },
+    { "haswell.uncore.read_bandwidth", "Socket memory read bandwidth", "B/s", 1, 0 },
+    { "haswell.uncore.write_bandwidth", "Socket memory write bandwidth", "B/s", 1, 0 },
+    { "haswell.uncore.utilization", "Socket memory bandwidth utilization", "%", 1, 0 },
+    { "memory_rss", "Resident memory", "B", 0, 0 },
+    { "memory_anonymous", "Anonymous memory", "B", 0, 0 },
+    { "memory_anon_huge_pages", "Anonymous huge pages", "B", 0, 0 },
+    { "memory_thp_coverage", "THP coverage", "%", 1, 0 },
+    { "memory_swap", "Swapped memory", "B", 0, 0 },
+    { "memory_numa_remote", "NUMA remote memory", "B", 0, 0 },
+    { "memory_numa_remote_fraction", "NUMA remote memory fraction", "%", 1, 0 },
+    { "mpi_p2p_messages", "MPI point-to-point messages", "/s", 0, 1 },
+    { "mpi_p2p_bytes", "MPI point-to-point bytes", "B/s", 0, 1 },
+    { "mpi_collective_calls", "MPI collective calls", "/s", 0, 1 },
+    { "mpi_wait_fraction", "MPI wait time", "%", 1, 0 },
+    { "mpi_late_sender_fraction", "MPI late sender", "%", 1, 0 },
+    { "mpi_late_receiver_fraction", "MPI late receiver", "%", 1, 0 },
+    { "mpi_barrier_fraction", "MPI barrier time", "%", 1, 0 },
+    { "mpi_bcast_fraction", "MPI broadcast time", "%", 1, 0 },
+    { "mpi_reduce_fraction", "MPI reduction time", "%", 1, 0 },
+    { "mpi_alltoall_fraction", "MPI all-to-all time", "%", 1, 0 },
+    { "mpi_gather_fraction", "MPI gather and scatter time", "%", 1, 0 },
+    { "mpi_unexpected_queue_length", "MPI unexpected queue length", "", 0, 0 },
+    { "mpi_posted_queue_length", "MPI posted receive queue length", "", 0, 0 },
+    { "com.allinea.metrics.muscle2.send_rate", "MUSCLE2 sent", "B/s", 0, 1 },
+    { "com.allinea.metrics.muscle2.send_calls", "MUSCLE2 sends", "calls/s", 0, 1 },
+    { "com.allinea.metrics.muscle2.send_duration", "MUSCLE2 send duration", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.send_duration_cum", "Total MUSCLE2 send duration", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.receive_rate", "MUSCLE2 received", "B/s", 0, 1 },
+    { "com.allinea.metrics.muscle2.receive_calls", "MUSCLE2 receives", "calls/s", 0, 1 },
+    { "com.allinea.metrics.muscle2.receive_duration", "MUSCLE2 receive duration", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.receive_duration_cum", "Total MUSCLE2 receive duration", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.barrier_calls", "MUSCLE2 barriers", "calls/s", 0, 1 },
+    { "com.allinea.metrics.muscle2.barrier_duration", "MUSCLE2 barrier duration", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.barrier_duration_cum", "Total MUSCLE2 barrier duration", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.send_rate_min", "MUSCLE2 sent (min)", "B/s", 1, 0 },
+    { "com.allinea.metrics.muscle2.send_rate_max", "MUSCLE2 sent (max)", "B/s", 1, 0 },
+    { "com.allinea.metrics.muscle2.send_rate_mean", "MUSCLE2 sent (mean)", "B/s", 1, 0 },
+    { "com.allinea.metrics.muscle2.send_rate_last", "MUSCLE2 sent (last)", "B/s", 1, 0 },
+    { "com.allinea.metrics.muscle2.receive_rate_min", "MUSCLE2 received (min)", "B/s", 1, 0 },
+    { "com.allinea.metrics.muscle2.receive_rate_max", "MUSCLE2 received (max)", "B/s", 1, 0 },
+    { "com.allinea.metrics.muscle2.receive_rate_mean", "MUSCLE2 received (mean)", "B/s", 1, 0 },
+    { "com.allinea.metrics.muscle2.receive_rate_last", "MUSCLE2 received (last)", "B/s", 1, 0 },
+    { "com.allinea.metrics.muscle2.node_send_time_min", "MUSCLE2 send time (node min)", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.node_send_time_mean", "MUSCLE2 send time (node mean)", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.node_send_time_max", "MUSCLE2 send time (node max)", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.node_send_time_cv", "MUSCLE2 send time (node variation)", "", 1, 0 },
+    { "com.allinea.metrics.muscle2.node_receive_time_min", "MUSCLE2 receive time (node min)", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.node_receive_time_mean", "MUSCLE2 receive time (node mean)", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.node_receive_time_max", "MUSCLE2 receive time (node max)", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.node_receive_time_cv", "MUSCLE2 receive time (node variation)", "", 1, 0 },
+    { "com.allinea.metrics.muscle2.node_barrier_time_min", "MUSCLE2 barrier time (node min)", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.node_barrier_time_mean", "MUSCLE2 barrier time (node mean)", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.node_barrier_time_max", "MUSCLE2 barrier time (node max)", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.node_barrier_time_cv", "MUSCLE2 barrier time (node variation)", "", 1, 0 },
+    { "com.allinea.metrics.muscle2.iteration_rate", "MUSCLE2 iteration rate", "/s", 1, 0 },
+    { "com.allinea.metrics.muscle2.iteration_duration", "MUSCLE2 iteration duration", "s", 1, 0 },
+    { "com.allinea.metrics.muscle2.iteration_receive_wait", "MUSCLE2 receive wait", "%", 1, 0 },
+    { "com.allinea.metrics.muscle2.iteration_compute", "MUSCLE2 compute", "%", 1, 0 },
+    { "openmp_imbalance", "OpenMP imbalance", "", 1, 0 },
+    { "openmp_barrier_fraction", "OpenMP barrier wait", "%", 1, 0 },
+    { "openmp_taskwait_fraction", "OpenMP taskwait", "%", 1, 0 },
+    { "openmp_serial_fraction", "OpenMP serial time", "%", 1, 0 },
+    { "openmp_active_threads", "OpenMP active threads", "", 1, 0 },
+    { "perf.sw.context_switches", "Context switches", "/s", 0, 1 },
+    { "perf.sw.cpu_migrations", "CPU migrations", "/s", 0, 1 },
+    { "perf.sw.minor_faults", "Minor page faults", "/s", 0, 1 },
+    { "perf.sw.major_faults", "Major page faults", "/s", 0, 1 },
+    { "perf.sw.alignment_faults", "Alignment faults", "/s", 0, 1 },
+    { "map_region", "Region", "", 0, 0 },
+    { "map_region_depth", "Region depth", "", 0, 0 },
+};
+
+#endif /* TELEMETRY_METRIC_TABLE */
+
+#endif /* TELEMETRY_IDS_H */
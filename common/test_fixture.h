@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * What the tests of the plugins and tools have in common: failing with a
+ * message, checking the values a metric returns, and writing the made up
+ * procfs, sysfs or cgroup files a plugin is pointed at.
+ *
+ * A test of a plugin defines TEST_FIXTURE_PLUGIN before including this, to
+ * also get the error functions of the Metrics SDK, which the test provides in
+ * place of MAP, and helpers to initialise the plugin and time its samples.
+ * Only one file of each test may then include it.
+ *
+ * Everything here is header only and usable from both C and C++ tests.
+ */
+
+#ifndef TEST_FIXTURE_H
+#define TEST_FIXTURE_H
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef TEST_FIXTURE_PLUGIN
+#include "allinea_metric_plugin_api.h"
+#endif
+
+/*! Prints FAIL: and the message, and aborts the test. */
+#define FAIL(...) do { fprintf(stderr, "FAIL: " __VA_ARGS__); fprintf(stderr, "\n"); abort(); } while (0)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! Writes \a contents to the file \a name in \a dir, replacing it. */
+static inline void write_file(const char *dir, const char *name, const char *contents)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *fh = fopen(path, "w");
+    if (fh == NULL || fputs(contents, fh) == EOF || fclose(fh) != 0)
+        FAIL("could not write %s: %s", path, strerror(errno));
+}
+
+/*! Fails unless \a ret, returned by \a name, is 0. */
+static inline void expect_success(const char *name, int ret)
+{
+    if (ret != 0)
+        FAIL("%s: failed with return value %d errno %d (%s)", name, ret, errno, strerror(errno));
+}
+
+static inline void expect_u64(const char *name, int ret, uint64_t actual, uint64_t expected)
+{
+    expect_success(name, ret);
+    if (actual != expected)
+        FAIL("%s: expected %llu != actual %llu", name, (unsigned long long) expected, (unsigned long long) actual);
+}
+
+static inline void expect_double(const char *name, int ret, double actual, double expected)
+{
+    expect_success(name, ret);
+    if (actual < expected - 1e-9 || actual > expected + 1e-9)
+        FAIL("%s: expected %f != actual %f", name, expected, actual);
+}
+
+#ifdef TEST_FIXTURE_PLUGIN
+
+/*! The last message the plugin set with allinea_set_plugin_error_messagef. */
+static char test_last_error[1024];
+
+void allinea_set_plugin_error_messagef(plugin_id_t id, int error_code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(test_last_error, sizeof(test_last_error), format, args);
+    va_end(args);
+    fprintf(stderr, "%s\n", test_last_error);
+}
+
+void allinea_set_metric_error_messagef(metric_id_t id, int error_code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+}
+
+int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused);
+int allinea_plugin_cleanup(plugin_id_t plugin_id, void *unused);
+
+/*! Initialises the plugin, failing the test if it cannot be. */
+static inline void initialize(void)
+{
+    expect_success("allinea_plugin_initialize", allinea_plugin_initialize(1, NULL));
+}
+
+/*! Takes 1000 samples after \a first_second with \a sample, and prints the mean time each took. */
+static inline void print_sample_cost(void (*sample)(struct timespec *sample_time), time_t first_second)
+{
+    const int samples = 1000;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < samples; ++i) {
+        struct timespec sample_time = { first_second + i, 0 };
+        sample(&sample_time);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("%.1f us per sample\n", ns / samples / 1000.0);
+}
+
+#endif /* TEST_FIXTURE_PLUGIN */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEST_FIXTURE_H */
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "counters-config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*! The configuration file used when ARM_MAP_COUNTERS_CONFIG is not set, relative to $HOME. */
+#define DEFAULT_CONFIG_FILE ".allinea/map/metrics/counters.conf"
+
+const char *counters_config_filename(void)
+{
+    static char filename[PATH_MAX];
+    const char *config = getenv("ARM_MAP_COUNTERS_CONFIG");
+    if (config != NULL && *config != '\0')
+        return config;
+    const char *home = getenv("HOME");
+    snprintf(filename, sizeof(filename), "%s/%s", home != NULL ? home : "", DEFAULT_CONFIG_FILE);
+    return filename;
+}
+
+/*! Copies \a value to \a field, failing if it does not fit. */
+static int set_string(char *field, size_t size, const char *value)
+{
+    if (strlen(value) >= size)
+        return -1;
+    strcpy(field, value);
+    return 0;
+}
+
+static int valid_id(const char *id)
+{
+    if (*id == '\0')
+        return 0;
+    for (const char *p = id; *p != '\0'; ++p) {
+        if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_'))
+            return 0;
+    }
+    return 1;
+}
+
+/*! Sets one name=value setting of \a config. */
+/*!
+ *  \return NULL on success, or what is wrong with the setting
+ */
+static const char *set_value(struct counter_config *config, const char *name, const char *value)
+{
+    char *end;
+    if (strcmp(name, "id") == 0) {
+        if (!valid_id(value) || set_string(config->id, sizeof(config->id), value) != 0)
+            return "the id must be letters, digits and _";
+    } else if (strcmp(name, "path") == 0) {
+        if (*value != '/' || set_string(config->path, sizeof(config->path), value) != 0)
+            return "the path must be absolute";
+    } else if (strcmp(name, "key") == 0) {
+        if (set_string(config->key, sizeof(config->key), value) != 0)
+            return "the key is too long";
+    } else if (strcmp(name, "column") == 0) {
+        long column = strtol(value, &end, 10);
+        if (*end != '\0' || column < 1 || column > 1024)
+            return "the column must be a number from 1";
+        config->column = (int) column;
+    } else if (strcmp(name, "mode") == 0) {
+        if (strcmp(value, "delta") == 0)
+            config->delta = 1;
+        else if (strcmp(value, "absolute") == 0)
+            config->delta = 0;
+        else
+            return "the mode must be delta or absolute";
+    } else if (strcmp(name, "scale") == 0) {
+        config->scale = strtod(value, &end);
+        if (*end != '\0' || end == value)
+            return "the scale must be a number";
+    } else if (strcmp(name, "units") == 0) {
+        if (set_string(config->units, sizeof(config->units), value) != 0)
+            return "the units are too long";
+    } else if (strcmp(name, "name") == 0) {
+        if (set_string(config->name, sizeof(config->name), value) != 0)
+            return "the name is too long";
+    } else if (strcmp(name, "description") == 0) {
+        if (set_string(config->description, sizeof(config->description), value) != 0)
+            return "the description is too long";
+    } else if (strcmp(name, "type") == 0) {
+        if (strcmp(value, "io") != 0 && strcmp(value, "memory") != 0 && strcmp(value, "other") != 0)
+            return "the type must be io, memory or other";
+        strcpy(config->type, value);
+    } else {
+        return "unknown setting";
+    }
+    return NULL;
+}
+
+/*! Parses one line of the configuration file into \a config, which is modified in place. */
+/*!
+ *  \return NULL on success, or what is wrong with the line
+ */
+static const char *parse_line(char *line, struct counter_config *config)
+{
+    memset(config, 0, sizeof(*config));
+    config->column = 1;
+    config->delta = 1;
+    config->scale = 1.0;
+    strcpy(config->type, "other");
+
+    char *p = line;
+    for (;;) {
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '\0' || *p == '\n' || *p == '#')
+            break;
+        const char *name = p;
+        while (*p != '=' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\0')
+            p++;
+        if (*p != '=')
+            return "expected name=value";
+        *p++ = '\0';
+        const char *value = p;
+        if (*p == '"') {
+            value = ++p;
+            while (*p != '"' && *p != '\0')
+                p++;
+            if (*p != '"')
+                return "missing closing \"";
+        } else {
+            while (*p != ' ' && *p != '\t' && *p != '\n' && *p != '\0')
+                p++;
+        }
+        const int last = *p == '\0';
+        *p = '\0';
+        const char *error = set_value(config, name, value);
+        if (error != NULL)
+            return error;
+        if (last)
+            break;
+        p++;
+    }
+
+    if (config->id[0] == '\0')
+        return "missing id";
+    if (config->path[0] == '\0')
+        return "missing path";
+    if (config->units[0] == '\0' && config->delta)
+        strcpy(config->units, "/s");
+    if (config->name[0] == '\0')
+        strcpy(config->name, config->id);
+    if (config->description[0] == '\0')
+        strcpy(config->description, config->path);
+    return NULL;
+}
+
+int counters_read_config(const char *filename, struct counter_config *configs, int maxConfigs,
+                         char *error, size_t errorSize)
+{
+    FILE *fh = fopen(filename, "r");
+    if (fh == NULL) {
+        snprintf(error, errorSize, "%s: %s", filename, strerror(errno));
+        return -1;
+    }
+
+    char line[4096];
+    int lineNumber = 0;
+    int numConfigs = 0;
+    while (fgets(line, sizeof(line), fh) != NULL) {
+        lineNumber++;
+        const char *p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '\0' || *p == '\n' || *p == '#')
+            continue;
+        if (numConfigs == maxConfigs) {
+            snprintf(error, errorSize, "%s:%d: no more than %d metrics can be configured", filename, lineNumber, maxConfigs);
+            fclose(fh);
+            return -1;
+        }
+        const char *lineError = parse_line(line, &configs[numConfigs]);
+        if (lineError != NULL) {
+            snprintf(error, errorSize, "%s:%d: %s", filename, lineNumber, lineError);
+            fclose(fh);
+            return -1;
+        }
+        for (int i = 0; i < numConfigs; ++i) {
+            if (strcmp(configs[i].id, configs[numConfigs].id) == 0) {
+                snprintf(error, errorSize, "%s:%d: duplicate id %s", filename, lineNumber, configs[i].id);
+                fclose(fh);
+                return -1;
+            }
+        }
+        numConfigs++;
+    }
+    fclose(fh);
+    return numConfigs;
+}
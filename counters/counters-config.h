@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The configuration file of the counters plugin, which is read both by the
+ * plugin and by counters-xml, which generates the matching metric definitions.
+ *
+ * Each line that is not blank or a # comment defines one metric as a list of
+ * name=value settings. Values containing blanks are written in double quotes.
+ *
+ *   id=ib_rcv_bytes path=/sys/class/infiniband/mlx5_0/ports/1/counters/port_rcv_data scale=4 units=B/s name="InfiniBand receives"
+ *
+ *   id           the metric id in the XML, letters, digits and _ (required)
+ *   path         the file to read, which may be a glob pattern, in which
+ *                case the values in all of the matching files are added up
+ *                (required)
+ *   key          the first word of the line to read the value from. Without
+ *                a key the value is read from the first line
+ *   column       which blank separated field to read: with a key, 1 is the
+ *                first field after the key, and without one 1 is the first
+ *                field on the line (default 1)
+ *   mode         delta, for counters that only increase, which are reported
+ *                as a rate per second, or absolute (default delta)
+ *   scale        the value is multiplied by this, e.g. 4 for InfiniBand data
+ *                counters, which count 4 byte words (default 1)
+ *   units        units shown in MAP (default /s for delta, none for absolute)
+ *   name         the name shown in MAP (default the id)
+ *   description  the description shown in MAP (default the path)
+ *   type         the display type in MAP: io, memory or other (default other)
+ */
+
+#ifndef COUNTERS_CONFIG_H
+#define COUNTERS_CONFIG_H
+
+#include <limits.h>
+#include <stddef.h>
+
+/*! The number of metrics that can be configured. lib-counters.c has a metric function for each. */
+#define COUNTERS_MAX_METRICS 32
+
+struct counter_config {
+    char id[64];
+    char path[PATH_MAX];
+    char key[64];
+    int column;
+    int delta;
+    double scale;
+    char units[32];
+    char name[128];
+    char description[PATH_MAX];
+    char type[16];
+};
+
+/*! The configuration file named by ARM_MAP_COUNTERS_CONFIG, or the default. */
+const char *counters_config_filename(void);
+
+/*! Reads up to \a maxConfigs metrics from \a filename. */
+/*!
+ *  \return the number of metrics, or -1 with a message in \a error
+ */
+int counters_read_config(const char *filename, struct counter_config *configs, int maxConfigs,
+                         char *error, size_t errorSize);
+
+#endif /* COUNTERS_CONFIG_H */
@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs the plugin with counters.conf.example against a fake /proc and /sys
+ * under a temporary directory.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "allinea_metric_plugin_api.h"
+
+void allinea_set_plugin_error_messagef(plugin_id_t id, int error_code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+static int metricErrors = 0;
+
+void allinea_set_metric_error_messagef(metric_id_t id, int error_code, const char *format, ...)
+{
+    metricErrors++;
+}
+
+extern int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused);
+extern int allinea_plugin_cleanup(plugin_id_t id, void *unused);
+extern int allinea_counter_0(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_counter_1(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_counter_2(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_counter_3(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_counter_4(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_counter_5(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_counter_6(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_counter_7(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+
+typedef int (*counter_function)(metric_id_t, struct timespec *, double *);
+
+static const counter_function functions[] = {
+    allinea_counter_0, allinea_counter_1, allinea_counter_2, allinea_counter_3,
+    allinea_counter_4, allinea_counter_5, allinea_counter_6
+};
+
+/* The metrics in counters.conf.example */
+static const char *names[] = {
+    "lustre_read_bytes", "lustre_write_bytes", "lustre_opens", "ib_rcv_bytes",
+    "ib_xmit_bytes", "nfs_rpc_calls", "open_files"
+};
+
+#define NUM_METRICS (sizeof(functions) / sizeof(functions[0]))
+
+static char root[] = "/tmp/counters-test-XXXXXX";
+
+static void write_file(const char *path, const char *format, ...)
+{
+    char fullPath[4096];
+    snprintf(fullPath, sizeof(fullPath), "%s%s", root, path);
+    /* Create the parent directories */
+    for (char *slash = strchr(fullPath + strlen(root) + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(fullPath, 0700);
+        *slash = '/';
+    }
+    /* Rewritten in place, as the plugin keeps the files open */
+    FILE *fh = fopen(fullPath, "w");
+    if (fh == NULL) {
+        fprintf(stderr, "FAIL: could not write %s: %s\n", fullPath, strerror(errno));
+        abort();
+    }
+    va_list args;
+    va_start(args, format);
+    vfprintf(fh, format, args);
+    va_end(args);
+    fclose(fh);
+}
+
+static void write_lustre_stats(const char *fs, uint64_t readBytes, uint64_t writeBytes, uint64_t opens)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "/proc/fs/lustre/llite/%s/stats", fs);
+    write_file(path,
+               "snapshot_time             1536756741.356012 secs.usecs\n"
+               "read_bytes                7 samples [bytes] 0 4096 %llu\n"
+               "write_bytes               3 samples [bytes] 4096 8192 %llu\n"
+               "open                      %llu samples [regs]\n"
+               "close                     %llu samples [regs]\n",
+               (unsigned long long) readBytes, (unsigned long long) writeBytes,
+               (unsigned long long) opens, (unsigned long long) opens);
+}
+
+static void write_all(uint64_t step)
+{
+    write_lustre_stats("fs-a", 1000 + 100 * step, 2000 + 200 * step, 10 + step);
+    write_lustre_stats("fs-b", 5000 + 300 * step, 6000, 20 + step);
+    write_file("/sys/class/infiniband/mlx5_0/ports/1/counters/port_rcv_data", "%llu\n", (unsigned long long) (1000 + 10 * step));
+    write_file("/sys/class/infiniband/mlx5_0/ports/1/counters/port_xmit_data", "%llu\n", (unsigned long long) (2000 + 20 * step));
+    write_file("/sys/class/infiniband/mlx5_1/ports/1/counters/port_rcv_data", "%llu\n", (unsigned long long) (3000 + 30 * step));
+    write_file("/sys/class/infiniband/mlx5_1/ports/1/counters/port_xmit_data", "%llu\n", (unsigned long long) (4000 + 40 * step));
+    write_file("/proc/net/rpc/nfs",
+               "net 0 0 0 0\n"
+               "rpc %llu 0 %llu\n"
+               "proc4 2 1 2\n",
+               (unsigned long long) (500 + 5 * step), (unsigned long long) (500 + 5 * step));
+    write_file("/proc/sys/fs/file-nr", "%llu\t0\t9223372036854775807\n", (unsigned long long) (1000 + step));
+}
+
+static void check_sample(int seconds, const double *expected)
+{
+    struct timespec sampleTime = { seconds, 0 };
+    for (size_t i = 0; i < NUM_METRICS; ++i) {
+        double value;
+        int ret = functions[i](1, &sampleTime, &value);
+        if (ret != 0) {
+            fprintf(stderr, "FAIL: %s: failed with return value %d\n", names[i], ret);
+            abort();
+        }
+        if (value != expected[i]) {
+            fprintf(stderr, "FAIL: %s at %d s: expected %f != actual %f\n", names[i], seconds, expected[i], value);
+            abort();
+        }
+    }
+}
+
+int main(void)
+{
+    if (mkdtemp(root) == NULL) {
+        fprintf(stderr, "FAIL: mkdtemp: %s\n", strerror(errno));
+        return 1;
+    }
+    setenv("ARM_MAP_COUNTERS_ROOT", root, 1);
+    setenv("ARM_MAP_COUNTERS_CONFIG", "counters.conf.example", 1);
+
+    write_all(0);
+    int ret = allinea_plugin_initialize(1, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "FAIL: allinea_plugin_initialize: failed with return value %d errno %d (%s)\n", ret, errno, strerror(errno));
+        abort();
+    }
+
+    /* Nothing has changed since initialisation */
+    const double first[] = { 0, 0, 0, 0, 0, 0, 1000 };
+    check_sample(1, first);
+
+    /* Both Lustre file systems and both InfiniBand devices are added up */
+    write_all(1);
+    const double second[] = { 400, 200, 2, 4 * 40, 4 * 60, 5, 1001 };
+    check_sample(2, second);
+
+    /* The same sample time reads nothing new */
+    write_all(3);
+    check_sample(2, second);
+    const double third[] = { 800, 400, 4, 4 * 80, 4 * 120, 10, 1003 };
+    check_sample(3, third);
+
+    /* The key is found when its line moves */
+    write_file("/proc/net/rpc/nfs", "net 0 0 0 0\nrpc_extra 1 2 3\nproc3 1 1\nrpc 520 0 520\n");
+    struct timespec sampleTime = { 4, 0 };
+    double value;
+    ret = allinea_counter_5(1, &sampleTime, &value);
+    if (ret != 0 || value != 5) {
+        fprintf(stderr, "FAIL: nfs_rpc_calls after the line moved: expected 5 != actual %f\n", value);
+        abort();
+    }
+
+    /* A counter that goes backwards has been reset, which is not a negative rate */
+    write_file("/proc/net/rpc/nfs", "rpc 10 0 10\n");
+    sampleTime.tv_sec = 5;
+    ret = allinea_counter_5(1, &sampleTime, &value);
+    if (ret != 0 || value != 0) {
+        fprintf(stderr, "FAIL: nfs_rpc_calls after a reset: expected 0 != actual %f\n", value);
+        abort();
+    }
+
+    /* A missing key is an error for that metric */
+    write_file("/proc/net/rpc/nfs", "net 0 0 0 0\n");
+    sampleTime.tv_sec = 6;
+    ret = allinea_counter_5(1, &sampleTime, &value);
+    if (ret == 0 || metricErrors != 1) {
+        fprintf(stderr, "FAIL: nfs_rpc_calls without an rpc line: expected an error\n");
+        abort();
+    }
+
+    /* A function beyond the end of the configuration is an error */
+    ret = allinea_counter_7(1, &sampleTime, &value);
+    if (ret == 0) {
+        fprintf(stderr, "FAIL: allinea_counter_7: expected an error as only 7 metrics are configured\n");
+        abort();
+    }
+
+    allinea_plugin_cleanup(1, NULL);
+
+    char command[4096];
+    snprintf(command, sizeof(command), "rm -r %s", root);
+    if (system(command) != 0)
+        fprintf(stderr, "Could not remove %s\n", root);
+    printf("PASS\n");
+    return 0;
+}
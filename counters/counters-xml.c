@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Writes the metric definitions for the counters plugin to stdout, from the
+ * same configuration file that the plugin reads:
+ *
+ *   counters-xml [counters.conf] > counters.xml
+ *
+ * The metrics are bound to the functions of lib-counters.so in the order of
+ * the configuration file, so the XML must be regenerated whenever metrics
+ * are added, removed or reordered.
+ */
+
+#include "counters-config.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*! Writes \a text with the characters that are special in XML escaped. */
+static void print_escaped(const char *text)
+{
+    for (const char *p = text; *p != '\0'; ++p) {
+        switch (*p) {
+        case '&': fputs("&amp;", stdout); break;
+        case '<': fputs("&lt;", stdout); break;
+        case '>': fputs("&gt;", stdout); break;
+        case '"': fputs("&quot;", stdout); break;
+        default: putchar(*p); break;
+        }
+    }
+}
+
+static void print_element(const char *indent, const char *element, const char *text)
+{
+    printf("%s<%s>", indent, element);
+    print_escaped(text);
+    printf("</%s>\n", element);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2 || (argc == 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0))) {
+        fprintf(stderr, "Usage: %s [counters.conf] > counters.xml\n", argv[0]);
+        fprintf(stderr, "The default configuration file is $ARM_MAP_COUNTERS_CONFIG or ~/.allinea/map/metrics/counters.conf\n");
+        return argc == 2 ? 0 : 1;
+    }
+    const char *filename = argc == 2 ? argv[1] : counters_config_filename();
+
+    static struct counter_config configs[COUNTERS_MAX_METRICS];
+    char error[PATH_MAX + 256];
+    int numConfigs = counters_read_config(filename, configs, COUNTERS_MAX_METRICS, error, sizeof(error));
+    if (numConfigs < 0) {
+        fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+
+    const char *indent = "                    ";
+    printf("<metricdefinitions version=\"1\">\n\n");
+    for (int i = 0; i < numConfigs; ++i) {
+        const struct counter_config *config = &configs[i];
+        printf("    <metric id=\"%s\">\n", config->id);
+        if (config->units[0] != '\0')
+            print_element("            ", "units", config->units);
+        printf("            <dataType>double</dataType>\n");
+        printf("            <domain>time</domain>\n");
+        printf("            <onePerNode>true</onePerNode>\n");
+        printf("            <source ref=\"counters_src\" functionName=\"allinea_counter_%d\"%s/>\n",
+               i, config->delta ? " divideBySampleTime=\"true\"" : "");
+        printf("            <display>\n");
+        print_element(indent, "description", config->description);
+        print_element(indent, "displayName", config->name);
+        print_element(indent, "type", config->type);
+        printf("%s<colour>SpecialLine8</colour>\n", indent);
+        printf("%s<autoDisplayFactor>true</autoDisplayFactor>\n", indent);
+        printf("            </display>\n");
+        printf("    </metric>\n\n");
+    }
+
+    printf("    <metricGroup id=\"counters\">\n");
+    printf("        <displayName>Counters</displayName>\n");
+    printf("        <description>Counters read from procfs and sysfs</description>\n");
+    for (int i = 0; i < numConfigs; ++i)
+        printf("        <metric ref=\"%s\"/>\n", configs[i].id);
+    printf("    </metricGroup>\n\n");
+
+    printf("    <source id=\"counters_src\">\n");
+    printf("        <sharedLibrary>lib-counters.so</sharedLibrary>\n");
+    printf("    </source>\n\n");
+    printf("</metricdefinitions>\n");
+    return 0;
+}
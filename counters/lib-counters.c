@@ -0,0 +1,419 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Metrics read from procfs and sysfs counter files, such as Lustre, NFS and
+ * InfiniBand statistics, as listed in a configuration file (see
+ * counters-config.h).
+ *
+ * When the plugin is initialised every file is opened once, and each metric
+ * is compiled into an extractor for each of the files it reads: the key to
+ * find, the column to read and where the key was last found. On each sample
+ * every file is read with one pread and all of the extractors of that file
+ * are run on the buffer, without allocating memory.
+ *
+ * MAP calls a named function for each metric, so the plugin has one function
+ * for each possible metric, allinea_counter_0 to allinea_counter_31, used in
+ * the order of the configuration file. counters-xml generates the matching
+ * metric definitions.
+ */
+
+#define _GNU_SOURCE
+
+#include "allinea_metric_plugin_api.h"
+#include "counters-config.h"
+#include "procfs_parse.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ERROR_INITIALIZATION_FAILED 100
+
+/*! The number of files that can be read altogether. */
+#define MAX_FILES 256
+
+/*! The number of files a glob pattern can match. */
+#define MAX_MATCHES 64
+
+/*! A file that is read on each sample. */
+struct counter_file {
+    char path[PATH_MAX];
+    int fd;
+    /*! The extractors of this file are extractors[firstExtractor, firstExtractor + numExtractors). */
+    int firstExtractor;
+    int numExtractors;
+};
+
+/*! Reads the value of one metric from one file. */
+struct extractor {
+    int counter;
+    int file;
+    const char *key;
+    size_t keyLen;
+    int column;
+    /*! Where the key was found last time, which is checked first. */
+    size_t hint;
+};
+
+/*! The state of each metric. */
+struct counter {
+    struct counter_config config;
+    /*! The sum of the values in all of its files this sample, and last sample. */
+    uint64_t raw;
+    uint64_t lastRaw;
+    /*! The value reported to MAP. */
+    double value;
+    /*! Non-zero if one of its files could not be read or parsed this sample. */
+    int readErrno;
+};
+
+static struct counter counters[COUNTERS_MAX_METRICS];
+static int numCounters = 0;
+
+static struct counter_file files[MAX_FILES];
+static int numFiles = 0;
+
+static struct extractor extractors[COUNTERS_MAX_METRICS * MAX_MATCHES];
+static int numExtractors = 0;
+
+/*! The buffer the files are read into on each sample. */
+static char sampleBuffer[65536];
+
+/*! Time of the last sample. */
+/*!
+ *  If the time of the current sample is different from the time of the last
+ *  then we assume it is a new sample and we need to re-read the files.
+ */
+static struct timespec lastSampleTime;
+
+static void close_files(void)
+{
+    for (int i = 0; i < numFiles; ++i) {
+        if (files[i].fd != -1)
+            close(files[i].fd);
+    }
+    numFiles = 0;
+    numExtractors = 0;
+    numCounters = 0;
+}
+
+/*! Returns the index of the file \a path, opening it if it is not already open, or -1 and sets errno. */
+static int open_file(const char *path)
+{
+    for (int i = 0; i < numFiles; ++i) {
+        if (strcmp(files[i].path, path) == 0)
+            return i;
+    }
+    if (numFiles == MAX_FILES) {
+        errno = EMFILE;
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    strcpy(files[numFiles].path, path);
+    files[numFiles].fd = fd;
+    return numFiles++;
+}
+
+/*! Opens the files of counter \a c and adds an extractor for each of them. */
+static int compile_counter(int c, const char *root, char *error, size_t errorSize)
+{
+    const struct counter_config *config = &counters[c].config;
+    char pattern[PATH_MAX];
+    if ((size_t) snprintf(pattern, sizeof(pattern), "%s%s", root, config->path) >= sizeof(pattern)) {
+        snprintf(error, errorSize, "%s: the path is too long", config->id);
+        return -1;
+    }
+
+    glob_t matches;
+    int ret = glob(pattern, GLOB_NOSORT, NULL, &matches);
+    if (ret != 0 || matches.gl_pathc == 0) {
+        snprintf(error, errorSize, "%s: no files match %s", config->id, pattern);
+        if (ret == 0)
+            globfree(&matches);
+        return -1;
+    }
+    if (matches.gl_pathc > MAX_MATCHES) {
+        snprintf(error, errorSize, "%s: more than %d files match %s", config->id, MAX_MATCHES, pattern);
+        globfree(&matches);
+        return -1;
+    }
+    for (size_t i = 0; i < matches.gl_pathc; ++i) {
+        int file = open_file(matches.gl_pathv[i]);
+        if (file == -1) {
+            snprintf(error, errorSize, "%s: %s", matches.gl_pathv[i], strerror(errno));
+            globfree(&matches);
+            return -1;
+        }
+        struct extractor *extractor = &extractors[numExtractors++];
+        extractor->counter = c;
+        extractor->file = file;
+        extractor->key = config->key;
+        extractor->keyLen = strlen(config->key);
+        extractor->column = config->column;
+        extractor->hint = 0;
+    }
+    globfree(&matches);
+    return 0;
+}
+
+static int compare_extractors(const void *a, const void *b)
+{
+    const struct extractor *lhs = a, *rhs = b;
+    if (lhs->file != rhs->file)
+        return lhs->file < rhs->file ? -1 : 1;
+    return lhs->counter < rhs->counter ? -1 : lhs->counter > rhs->counter;
+}
+
+/*! Returns non-zero if a line of \a buffer starts with the key of \a extractor at \a offset. */
+static int key_at(const struct extractor *extractor, const char *buffer, size_t len, size_t offset)
+{
+    if (offset + extractor->keyLen >= len || (offset != 0 && buffer[offset - 1] != '\n'))
+        return 0;
+    if (memcmp(buffer + offset, extractor->key, extractor->keyLen) != 0)
+        return 0;
+    /* The key is a whole word: "read" does not match "read_bytes" */
+    const char next = buffer[offset + extractor->keyLen];
+    return next == ' ' || next == '\t' || next == ':' || next == '=';
+}
+
+/*! Reads the value for \a extractor from the file in \a buffer. Async-signal-safe. */
+static int extract(struct extractor *extractor, const char *buffer, size_t len, uint64_t *value)
+{
+    const char *end = buffer + len;
+    const char *p = buffer;
+
+    if (extractor->keyLen > 0) {
+        /* The lines of counter files rarely move, so try where the key was last time first */
+        size_t offset = extractor->hint;
+        if (!key_at(extractor, buffer, len, offset)) {
+            const char *line = buffer;
+            for (;;) {
+                offset = (size_t) (line - buffer);
+                if (key_at(extractor, buffer, len, offset))
+                    break;
+                line = memchr(line, '\n', (size_t) (end - line));
+                if (line == NULL)
+                    return -1;
+                line++;
+            }
+            extractor->hint = offset;
+        }
+        p = buffer + offset + extractor->keyLen;
+        if (*p == ':' || *p == '=')
+            p++;
+    }
+
+    p = procfs_skip_fields(p, end, extractor->column - 1);
+    if (p == NULL || procfs_parse_u64(p, end, value) == NULL)
+        return -1;
+    return 0;
+}
+
+/*! Reads all of the files and updates the value of each metric. Async-signal-safe. */
+static void update(void)
+{
+    for (int c = 0; c < numCounters; ++c) {
+        counters[c].raw = 0;
+        counters[c].readErrno = 0;
+    }
+
+    for (int f = 0; f < numFiles; ++f) {
+        const struct counter_file *file = &files[f];
+        ssize_t len = procfs_pread(file->fd, sampleBuffer, sizeof(sampleBuffer));
+        for (int e = file->firstExtractor; e < file->firstExtractor + file->numExtractors; ++e) {
+            struct extractor *extractor = &extractors[e];
+            struct counter *counter = &counters[extractor->counter];
+            uint64_t value;
+            if (len < 0)
+                counter->readErrno = errno;
+            else if (extract(extractor, sampleBuffer, (size_t) len, &value) != 0)
+                counter->readErrno = EINVAL;
+            else
+                counter->raw += value;
+        }
+    }
+
+    for (int c = 0; c < numCounters; ++c) {
+        struct counter *counter = &counters[c];
+        if (counter->readErrno != 0)
+            continue;
+        if (counter->config.delta) {
+            /* A counter that went backwards was reset, e.g. when a file system was remounted */
+            const uint64_t delta = counter->raw >= counter->lastRaw ? counter->raw - counter->lastRaw : 0;
+            counter->value = (double) delta * counter->config.scale;
+        } else {
+            counter->value = (double) counter->raw * counter->config.scale;
+        }
+        counter->lastRaw = counter->raw;
+    }
+}
+
+/*! This function is called when the metric plugin is loaded. */
+/*!
+ *  We do not have to restrict ourselves to async-signal-safe functions because
+ *  the initialization function will be called without any locks held.
+ *
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused)
+{
+    (void)unused; /* unused variable */
+
+    static struct counter_config configs[COUNTERS_MAX_METRICS];
+    char error[PATH_MAX + 256];
+    numCounters = counters_read_config(counters_config_filename(), configs, COUNTERS_MAX_METRICS, error, sizeof(error));
+    if (numCounters < 0) {
+        numCounters = 0;
+        allinea_set_plugin_error_messagef(plugin_id, ERROR_INITIALIZATION_FAILED, "%s", error);
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Files are read relative to ARM_MAP_COUNTERS_ROOT, which the tests use for a fake /proc and /sys */
+    const char *root = getenv("ARM_MAP_COUNTERS_ROOT");
+    if (root == NULL)
+        root = "";
+
+    memset(counters, 0, sizeof(counters));
+    for (int c = 0; c < numCounters; ++c) {
+        counters[c].config = configs[c];
+        if (compile_counter(c, root, error, sizeof(error)) != 0) {
+            allinea_set_plugin_error_messagef(plugin_id, ERROR_INITIALIZATION_FAILED, "%s", error);
+            close_files();
+            errno = ENOENT;
+            return -1;
+        }
+    }
+
+    /* Group the extractors by file so that each file is read once per sample */
+    qsort(extractors, (size_t) numExtractors, sizeof(extractors[0]), compare_extractors);
+    for (int f = 0; f < numFiles; ++f)
+        files[f].numExtractors = 0;
+    for (int e = numExtractors - 1; e >= 0; --e) {
+        files[extractors[e].file].firstExtractor = e;
+        files[extractors[e].file].numExtractors++;
+    }
+
+    /* The first sample of a delta is the increase since now */
+    update();
+
+    lastSampleTime.tv_sec = 0;
+    lastSampleTime.tv_nsec = 0;
+    return 0;
+}
+
+/*! This function is called when the metric plugin is unloaded. */
+/*!
+ *  We do not have to restrict ourselves to async-signal-safe functions because
+ *  the cleanup function will be called without any locks held.
+ *
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_cleanup(plugin_id_t id, void *unused)
+{
+    (void) id;  // Unused parameter
+    (void)unused; /* unused variable */
+
+    close_files();
+    return 0;
+}
+
+/*! Get the current value of the given metric. */
+/*!
+ *  \param metricId the ID of the metric to get the value for
+ *  \param inCurrentSampleTime [in] the time the metric was sampled
+ *  \param index the index of the metric in the configuration file
+ *  \param outValue [out] value will be written here.
+ *
+ *  If this is a new sample (\a lastSampleTime != \a inCurrentsampleTime)
+ *  then \a update is called to re-read the files.
+ */
+static int getMetricValue(metric_id_t metricId, const struct timespec *inCurrentSampleTime, int index, double *outValue)
+{
+    if (index >= numCounters) {
+        allinea_set_metric_error_messagef(metricId, EINVAL, "The counters configuration has %d metrics, regenerate the XML with counters-xml", numCounters);
+        return -1;
+    }
+
+    if (lastSampleTime.tv_sec  != inCurrentSampleTime->tv_sec ||
+        lastSampleTime.tv_nsec != inCurrentSampleTime->tv_nsec) {
+        update();
+        lastSampleTime.tv_sec  = inCurrentSampleTime->tv_sec;
+        lastSampleTime.tv_nsec = inCurrentSampleTime->tv_nsec;
+    }
+
+    const struct counter *counter = &counters[index];
+    if (counter->readErrno != 0) {
+        allinea_set_metric_error_messagef(metricId, counter->readErrno, "Could not read %s from %s: %s",
+                                          counter->config.id, counter->config.path, strerror(counter->readErrno));
+        return -1;
+    }
+    *outValue = counter->value;
+
+    return 0;
+}
+
+#define COUNTER_FUNCTION(index) \
+int allinea_counter_##index(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue) \
+{ \
+    return getMetricValue(metricId, inOutCurrentSampleTime, index, outValue); \
+}
+
+COUNTER_FUNCTION(0)
+COUNTER_FUNCTION(1)
+COUNTER_FUNCTION(2)
+COUNTER_FUNCTION(3)
+COUNTER_FUNCTION(4)
+COUNTER_FUNCTION(5)
+COUNTER_FUNCTION(6)
+COUNTER_FUNCTION(7)
+COUNTER_FUNCTION(8)
+COUNTER_FUNCTION(9)
+COUNTER_FUNCTION(10)
+COUNTER_FUNCTION(11)
+COUNTER_FUNCTION(12)
+COUNTER_FUNCTION(13)
+COUNTER_FUNCTION(14)
+COUNTER_FUNCTION(15)
+COUNTER_FUNCTION(16)
+COUNTER_FUNCTION(17)
+COUNTER_FUNCTION(18)
+COUNTER_FUNCTION(19)
+COUNTER_FUNCTION(20)
+COUNTER_FUNCTION(21)
+COUNTER_FUNCTION(22)
+COUNTER_FUNCTION(23)
+COUNTER_FUNCTION(24)
+COUNTER_FUNCTION(25)
+COUNTER_FUNCTION(26)
+COUNTER_FUNCTION(27)
+COUNTER_FUNCTION(28)
+COUNTER_FUNCTION(29)
+COUNTER_FUNCTION(30)
+COUNTER_FUNCTION(31)
@@ -0,0 +1,899 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Traces the file I/O of the process on GPFS: the bytes, calls and time of
+ * the reads, writes and syncs of each file, the distribution of their
+ * latencies and of their sizes.
+ *
+ * The library defines open, read, write, fsync, dup, fcntl and close and their
+ * variants, including the checking ones that _FORTIFY_SOURCE calls, which
+ * call the next definition, normally the C library's, so it must be
+ * preloaded into the program (see README.txt). Each file descriptor is
+ * classified once, when it is opened: fstatfs says whether it is on GPFS, and
+ * the answer is kept in a table by descriptor, so a read or write of any
+ * other file costs one load on top of the call.
+ *
+ * As in ../alloc/lib-alloc.c, each thread counts into its own slot with
+ * relaxed atomic stores that the sampler reads with relaxed atomic loads.
+ * The totals of each file are shared between the threads that use it, and
+ * are updated with atomic additions, which cost little next to the call.
+ */
+
+#define _GNU_SOURCE
+/* The checking wrappers that the C library defines inline for read and pread would clash with the definitions here */
+#undef _FORTIFY_SOURCE
+
+#include "gpfs-io.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/statfs.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/*! Threads beyond this many share one slot, which they update with atomic additions. */
+#define MAX_THREADS 512
+
+/*! The slot shared by the threads beyond \a MAX_THREADS. */
+#define SHARED_SLOT MAX_THREADS
+
+/*! Descriptors from this on are not traced. */
+#define MAX_FDS 65536
+
+/*! The files whose totals are kept. The I/O of any more is added to the last, "(other files)". */
+#define MAX_FILES 1024
+
+/*! The last entry of \a files, which the files beyond the others share. */
+#define OTHER_FILES (MAX_FILES - 1)
+
+/*! Paths are truncated to this many bytes, including the terminator. */
+#define FILE_PATH_SIZE 256
+
+/*! Read and write sizes are counted in power of 2 size classes up to 2^(NUM_SIZE_CLASSES - 1) bytes and over. */
+#define NUM_SIZE_CLASSES 32
+
+/*! Latencies are counted in 4 buckets per power of 2 ns, up to 2^40 ns, for a 99th percentile within 12%. */
+#define NUM_LATENCY_BUCKETS 160
+
+/*! The kinds of call that are counted, with their bytes for reads and writes. */
+enum { IO_READ, IO_WRITE, IO_SYNC, NUM_IO_KINDS };
+
+/*! The traced I/O of one thread. */
+struct thread_io {
+    uint64_t calls[NUM_IO_KINDS];
+    /*! The bytes read and written, indexed by IO_READ and IO_WRITE. */
+    uint64_t bytes[2];
+    /*! The time in the calls. */
+    uint64_t ns;
+    uint64_t latency[NUM_LATENCY_BUCKETS];
+    /*! The reads and writes by the power of 2 the size asked for is no larger than. */
+    uint64_t sizeClasses[NUM_SIZE_CLASSES];
+} __attribute__((aligned(64)));
+
+static struct thread_io threadIo[MAX_THREADS + 1];
+
+/*! How many entries of \a threadIo have been handed out, which may be more than \a MAX_THREADS. */
+static uint32_t numThreads = 0;
+
+/*! The slot of the calling thread. Initial-exec, so that using it never allocates. */
+static __thread struct thread_io *myIo __attribute__((tls_model("initial-exec")));
+
+/*! The traced I/O of one file, over every descriptor it was opened as. */
+struct traced_file {
+    /*! The hash of the path, which is never 0, or 0 while the entry is free. */
+    uint64_t hash;
+    uint64_t calls[NUM_IO_KINDS];
+    uint64_t bytes[2];
+    uint64_t ns;
+    char path[FILE_PATH_SIZE];
+};
+
+static struct traced_file files[MAX_FILES];
+
+/*! The entry of \a files plus 1 that each descriptor is traced into, or 0 if it is not on GPFS. */
+static uint16_t fdFiles[MAX_FDS];
+
+/*! The f_type of the filesystem to trace, and whether it has been read from the environment yet. */
+static unsigned long traceMagic;
+static int traceMagicKnown = 0;
+
+/*! The next definitions of the functions, normally those of the C library. */
+static int (*realOpen)(const char *, int, ...);
+static int (*realOpen64)(const char *, int, ...);
+static int (*realOpenat)(int, const char *, int, ...);
+static int (*realOpenat64)(int, const char *, int, ...);
+static int (*realCreat)(const char *, mode_t);
+static int (*realCreat64)(const char *, mode_t);
+static int (*realOpen2)(const char *, int);
+static int (*realOpen64_2)(const char *, int);
+static int (*realOpenat2)(int, const char *, int);
+static int (*realOpenat64_2)(int, const char *, int);
+static ssize_t (*realRead)(int, void *, size_t);
+static ssize_t (*realWrite)(int, const void *, size_t);
+static ssize_t (*realPread)(int, void *, size_t, off_t);
+static ssize_t (*realPread64)(int, void *, size_t, off64_t);
+static ssize_t (*realReadChk)(int, void *, size_t, size_t);
+static ssize_t (*realPreadChk)(int, void *, size_t, off_t, size_t);
+static ssize_t (*realPread64Chk)(int, void *, size_t, off64_t, size_t);
+static ssize_t (*realPwrite)(int, const void *, size_t, off_t);
+static ssize_t (*realPwrite64)(int, const void *, size_t, off64_t);
+static ssize_t (*realReadv)(int, const struct iovec *, int);
+static ssize_t (*realWritev)(int, const struct iovec *, int);
+static ssize_t (*realPreadv)(int, const struct iovec *, int, off_t);
+static ssize_t (*realPreadv64)(int, const struct iovec *, int, off64_t);
+static ssize_t (*realPwritev)(int, const struct iovec *, int, off_t);
+static ssize_t (*realPwritev64)(int, const struct iovec *, int, off64_t);
+static int (*realFsync)(int);
+static int (*realFdatasync)(int);
+static int (*realDup)(int);
+static int (*realDup2)(int, int);
+static int (*realDup3)(int, int, int);
+static int (*realFcntl)(int, int, ...);
+static int (*realFcntl64)(int, int, ...);
+static int (*realClose)(int);
+
+/*! The totals of each thread at the last sample, so that each sample reports the calls since the last. */
+static struct thread_io lastTotals[MAX_THREADS + 1];
+
+/*! Reads and writes of at most this many bytes, rounded up to a power of 2, are small. */
+static uint64_t smallBytes = GPFS_SMALL_IO_BYTES;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+/*! Looks up the next definitions of the functions. */
+static void find_real_functions(void)
+{
+    realOpen = (int (*)(const char *, int, ...)) dlsym(RTLD_NEXT, "open");
+    realOpen64 = (int (*)(const char *, int, ...)) dlsym(RTLD_NEXT, "open64");
+    realOpenat = (int (*)(int, const char *, int, ...)) dlsym(RTLD_NEXT, "openat");
+    realOpenat64 = (int (*)(int, const char *, int, ...)) dlsym(RTLD_NEXT, "openat64");
+    realCreat = (int (*)(const char *, mode_t)) dlsym(RTLD_NEXT, "creat");
+    realCreat64 = (int (*)(const char *, mode_t)) dlsym(RTLD_NEXT, "creat64");
+    realOpen2 = (int (*)(const char *, int)) dlsym(RTLD_NEXT, "__open_2");
+    realOpen64_2 = (int (*)(const char *, int)) dlsym(RTLD_NEXT, "__open64_2");
+    realOpenat2 = (int (*)(int, const char *, int)) dlsym(RTLD_NEXT, "__openat_2");
+    realOpenat64_2 = (int (*)(int, const char *, int)) dlsym(RTLD_NEXT, "__openat64_2");
+    realRead = (ssize_t (*)(int, void *, size_t)) dlsym(RTLD_NEXT, "read");
+    realWrite = (ssize_t (*)(int, const void *, size_t)) dlsym(RTLD_NEXT, "write");
+    realPread = (ssize_t (*)(int, void *, size_t, off_t)) dlsym(RTLD_NEXT, "pread");
+    realPread64 = (ssize_t (*)(int, void *, size_t, off64_t)) dlsym(RTLD_NEXT, "pread64");
+    realReadChk = (ssize_t (*)(int, void *, size_t, size_t)) dlsym(RTLD_NEXT, "__read_chk");
+    realPreadChk = (ssize_t (*)(int, void *, size_t, off_t, size_t)) dlsym(RTLD_NEXT, "__pread_chk");
+    realPread64Chk = (ssize_t (*)(int, void *, size_t, off64_t, size_t)) dlsym(RTLD_NEXT, "__pread64_chk");
+    realPwrite = (ssize_t (*)(int, const void *, size_t, off_t)) dlsym(RTLD_NEXT, "pwrite");
+    realPwrite64 = (ssize_t (*)(int, const void *, size_t, off64_t)) dlsym(RTLD_NEXT, "pwrite64");
+    realReadv = (ssize_t (*)(int, const struct iovec *, int)) dlsym(RTLD_NEXT, "readv");
+    realWritev = (ssize_t (*)(int, const struct iovec *, int)) dlsym(RTLD_NEXT, "writev");
+    realPreadv = (ssize_t (*)(int, const struct iovec *, int, off_t)) dlsym(RTLD_NEXT, "preadv");
+    realPreadv64 = (ssize_t (*)(int, const struct iovec *, int, off64_t)) dlsym(RTLD_NEXT, "preadv64");
+    realPwritev = (ssize_t (*)(int, const struct iovec *, int, off_t)) dlsym(RTLD_NEXT, "pwritev");
+    realPwritev64 = (ssize_t (*)(int, const struct iovec *, int, off64_t)) dlsym(RTLD_NEXT, "pwritev64");
+    realFsync = (int (*)(int)) dlsym(RTLD_NEXT, "fsync");
+    realFdatasync = (int (*)(int)) dlsym(RTLD_NEXT, "fdatasync");
+    realDup = (int (*)(int)) dlsym(RTLD_NEXT, "dup");
+    realDup2 = (int (*)(int, int)) dlsym(RTLD_NEXT, "dup2");
+    realDup3 = (int (*)(int, int, int)) dlsym(RTLD_NEXT, "dup3");
+    realFcntl = (int (*)(int, int, ...)) dlsym(RTLD_NEXT, "fcntl");
+    realFcntl64 = (int (*)(int, int, ...)) dlsym(RTLD_NEXT, "fcntl64");
+    realClose = (int (*)(int)) dlsym(RTLD_NEXT, "close");
+}
+
+__attribute__((constructor)) static void init_gpfs_io(void)
+{
+    if (realRead == NULL)
+        find_real_functions();
+}
+
+/*! The f_type of the filesystem to trace: GPFS, or the one ARM_MAP_GPFS_IO_MAGIC gives, e.g. 0x01021994 for tmpfs. */
+static unsigned long trace_magic(void)
+{
+    if (!__atomic_load_n(&traceMagicKnown, __ATOMIC_ACQUIRE)) {
+        const char *magic = getenv("ARM_MAP_GPFS_IO_MAGIC");
+        traceMagic = magic != NULL && *magic != '\0' ? strtoul(magic, NULL, 0) : GPFS_SUPER_MAGIC;
+        __atomic_store_n(&traceMagicKnown, 1, __ATOMIC_RELEASE);
+    }
+    return traceMagic;
+}
+
+/*! FNV-1a, never 0 so that 0 can mark a free entry of \a files. */
+static uint64_t path_hash(const char *path)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *c = (const unsigned char *) path; *c != '\0'; ++c)
+        hash = (hash ^ *c) * 1099511628211ULL;
+    return hash | 1;
+}
+
+/*! Returns the entry of \a files of \a path, adding it if it is new. */
+/*!
+ *  Entries are claimed by setting their hash, so that threads opening files
+ *  at the same time never wait for each other; two paths with the same 64-bit
+ *  hash would share an entry.
+ */
+static uint32_t find_file(const char *path)
+{
+    const uint64_t hash = path_hash(path);
+    for (uint32_t i = 0; i < OTHER_FILES; ++i) {
+        const uint32_t f = (uint32_t) ((hash + i) % OTHER_FILES);
+        uint64_t found = __atomic_load_n(&files[f].hash, __ATOMIC_ACQUIRE);
+        if (found == 0) {
+            if (__atomic_compare_exchange_n(&files[f].hash, &found, hash, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                strncpy(files[f].path, path, FILE_PATH_SIZE - 1);
+                return f;
+            }
+        }
+        if (found == hash)
+            return f;
+    }
+    return OTHER_FILES;
+}
+
+/*! Classifies a descriptor that has just been opened as \a path, or as \a path relative to \a dirfd. */
+static void classify(int fd, const char *path)
+{
+    if (fd < 0 || fd >= MAX_FDS)
+        return;
+    uint16_t file = 0;
+    struct statfs fs;
+    if (fstatfs(fd, &fs) == 0 && (unsigned long) fs.f_type == trace_magic()) {
+        /* The absolute path, which the path opened may not be */
+        char link[32], resolved[FILE_PATH_SIZE];
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+        const ssize_t length = readlink(link, resolved, sizeof(resolved) - 1);
+        if (length > 0)
+            resolved[length] = '\0';
+        file = (uint16_t) (find_file(length > 0 ? resolved : path) + 1);
+    }
+    __atomic_store_n(&fdFiles[fd], file, __ATOMIC_RELAXED);
+}
+
+/*! Returns the entry of \a files plus 1 that \a fd is traced into, or 0 if it is not traced. */
+static inline uint32_t traced_file(int fd)
+{
+    if (fd < 0 || fd >= MAX_FDS)
+        return 0;
+    return __atomic_load_n(&fdFiles[fd], __ATOMIC_RELAXED);
+}
+
+/*! Gives \a newFd the classification of \a oldFd, for dup and friends. */
+static void copy_classification(int oldFd, int newFd)
+{
+    if (newFd >= 0 && newFd < MAX_FDS)
+        __atomic_store_n(&fdFiles[newFd], (uint16_t) traced_file(oldFd), __ATOMIC_RELAXED);
+}
+
+/*! Returns the slot of the calling thread, handing out a new one to a thread not seen before. */
+static struct thread_io *get_thread_io(void)
+{
+    struct thread_io *io = myIo;
+    if (io != NULL)
+        return io;
+    uint32_t index = __atomic_fetch_add(&numThreads, 1, __ATOMIC_RELAXED);
+    io = myIo = &threadIo[index < MAX_THREADS ? index : SHARED_SLOT];
+    return io;
+}
+
+/*! Adds \a value to a counter of the calling thread's slot. */
+static inline void add(struct thread_io *io, uint64_t *counter, uint64_t value)
+{
+    if (io == &threadIo[SHARED_SLOT])
+        __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static inline int size_class(size_t size)
+{
+    if (size <= 1)
+        return 0;
+    const int sizeClass = 64 - __builtin_clzll((unsigned long long) size - 1);
+    return sizeClass < NUM_SIZE_CLASSES ? sizeClass : NUM_SIZE_CLASSES - 1;
+}
+
+/*! The bucket of \a ns: itself below 4, else 4 per power of 2 from the 2 bits after the highest. */
+static inline int latency_bucket(uint64_t ns)
+{
+    if (ns < 4)
+        return (int) ns;
+    const int power = 63 - __builtin_clzll(ns);
+    const int bucket = 4 * (power - 1) + (int) ((ns >> (power - 2)) & 3);
+    return bucket < NUM_LATENCY_BUCKETS ? bucket : NUM_LATENCY_BUCKETS - 1;
+}
+
+/*! The middle of the latencies of \a bucket, in ns. */
+static double latency_of_bucket(int bucket)
+{
+    if (bucket < 4)
+        return (double) bucket;
+    const int power = bucket / 4 + 1;
+    return (4.5 + (double) (bucket % 4)) * (double) ((uint64_t) 1 << (power - 2));
+}
+
+/*! Sums the sizes of the buffers of \a iov, as asked for. */
+static size_t iov_size(const struct iovec *iov, int count)
+{
+    size_t size = 0;
+    for (int i = 0; i < count; ++i)
+        size += iov[i].iov_len;
+    return size;
+}
+
+/*! Counts a call of \a kind to the entry \a file of \a files plus 1, that asked for \a size bytes and returned \a result after starting at \a start. */
+static void count_io(uint32_t file, int kind, size_t size, ssize_t result, uint64_t start)
+{
+    const uint64_t ns = now_ns() - start;
+    const uint64_t bytes = result > 0 ? (uint64_t) result : 0;
+    struct thread_io *io = get_thread_io();
+    add(io, &io->calls[kind], 1);
+    add(io, &io->ns, ns);
+    add(io, &io->latency[latency_bucket(ns)], 1);
+    struct traced_file *traced = &files[file - 1];
+    __atomic_fetch_add(&traced->calls[kind], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&traced->ns, ns, __ATOMIC_RELAXED);
+    if (kind != IO_SYNC) {
+        add(io, &io->bytes[kind], bytes);
+        add(io, &io->sizeClasses[size_class(size)], 1);
+        __atomic_fetch_add(&traced->bytes[kind], bytes, __ATOMIC_RELAXED);
+    }
+}
+
+/*! The mode argument of open, which is only passed if the flags create a file. */
+#ifdef __OPEN_NEEDS_MODE
+#define OPEN_NEEDS_MODE(flags) __OPEN_NEEDS_MODE(flags)
+#else
+#define OPEN_NEEDS_MODE(flags) (((flags) & O_CREAT) != 0)
+#endif
+
+#define OPEN_MODE(flags, last, mode) \
+    do { \
+        if (OPEN_NEEDS_MODE(flags)) { \
+            va_list args; \
+            va_start(args, last); \
+            mode = (mode_t) va_arg(args, int); \
+            va_end(args); \
+        } \
+    } while (0)
+
+int open(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    OPEN_MODE(flags, flags, mode);
+    if (realOpen == NULL)
+        find_real_functions();
+    const int fd = realOpen(path, flags, mode);
+    classify(fd, path);
+    return fd;
+}
+
+int open64(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    OPEN_MODE(flags, flags, mode);
+    if (realOpen64 == NULL)
+        find_real_functions();
+    const int fd = realOpen64(path, flags, mode);
+    classify(fd, path);
+    return fd;
+}
+
+int openat(int dirfd, const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    OPEN_MODE(flags, flags, mode);
+    if (realOpenat == NULL)
+        find_real_functions();
+    const int fd = realOpenat(dirfd, path, flags, mode);
+    classify(fd, path);
+    return fd;
+}
+
+int openat64(int dirfd, const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    OPEN_MODE(flags, flags, mode);
+    if (realOpenat64 == NULL)
+        find_real_functions();
+    const int fd = realOpenat64(dirfd, path, flags, mode);
+    classify(fd, path);
+    return fd;
+}
+
+int creat(const char *path, mode_t mode)
+{
+    if (realCreat == NULL)
+        find_real_functions();
+    const int fd = realCreat(path, mode);
+    classify(fd, path);
+    return fd;
+}
+
+int creat64(const char *path, mode_t mode)
+{
+    if (realCreat64 == NULL)
+        find_real_functions();
+    const int fd = realCreat64(path, mode);
+    classify(fd, path);
+    return fd;
+}
+
+/* The C library's checking versions of open, which programs built with _FORTIFY_SOURCE call when the flags are not
+ * known at compile time. They take no mode, as they fail if the flags create a file */
+
+int __open_2(const char *path, int flags)
+{
+    if (realOpen2 == NULL)
+        find_real_functions();
+    const int fd = realOpen2(path, flags);
+    classify(fd, path);
+    return fd;
+}
+
+int __open64_2(const char *path, int flags)
+{
+    if (realOpen64_2 == NULL)
+        find_real_functions();
+    const int fd = realOpen64_2(path, flags);
+    classify(fd, path);
+    return fd;
+}
+
+int __openat_2(int dirfd, const char *path, int flags)
+{
+    if (realOpenat2 == NULL)
+        find_real_functions();
+    const int fd = realOpenat2(dirfd, path, flags);
+    classify(fd, path);
+    return fd;
+}
+
+int __openat64_2(int dirfd, const char *path, int flags)
+{
+    if (realOpenat64_2 == NULL)
+        find_real_functions();
+    const int fd = realOpenat64_2(dirfd, path, flags);
+    classify(fd, path);
+    return fd;
+}
+
+ssize_t read(int fd, void *buffer, size_t count)
+{
+    if (realRead == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realRead(fd, buffer, count);
+    const uint64_t start = now_ns();
+    const ssize_t result = realRead(fd, buffer, count);
+    count_io(file, IO_READ, count, result, start);
+    return result;
+}
+
+ssize_t write(int fd, const void *buffer, size_t count)
+{
+    if (realWrite == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realWrite(fd, buffer, count);
+    const uint64_t start = now_ns();
+    const ssize_t result = realWrite(fd, buffer, count);
+    count_io(file, IO_WRITE, count, result, start);
+    return result;
+}
+
+ssize_t pread(int fd, void *buffer, size_t count, off_t offset)
+{
+    if (realPread == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realPread(fd, buffer, count, offset);
+    const uint64_t start = now_ns();
+    const ssize_t result = realPread(fd, buffer, count, offset);
+    count_io(file, IO_READ, count, result, start);
+    return result;
+}
+
+ssize_t pread64(int fd, void *buffer, size_t count, off64_t offset)
+{
+    if (realPread64 == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realPread64(fd, buffer, count, offset);
+    const uint64_t start = now_ns();
+    const ssize_t result = realPread64(fd, buffer, count, offset);
+    count_io(file, IO_READ, count, result, start);
+    return result;
+}
+
+/* The checking versions of read and pread, which programs built with _FORTIFY_SOURCE call when the size of the
+ * buffer is known at compile time, with the size of the buffer last */
+
+ssize_t __read_chk(int fd, void *buffer, size_t count, size_t size)
+{
+    if (realReadChk == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realReadChk(fd, buffer, count, size);
+    const uint64_t start = now_ns();
+    const ssize_t result = realReadChk(fd, buffer, count, size);
+    count_io(file, IO_READ, count, result, start);
+    return result;
+}
+
+ssize_t __pread_chk(int fd, void *buffer, size_t count, off_t offset, size_t size)
+{
+    if (realPreadChk == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realPreadChk(fd, buffer, count, offset, size);
+    const uint64_t start = now_ns();
+    const ssize_t result = realPreadChk(fd, buffer, count, offset, size);
+    count_io(file, IO_READ, count, result, start);
+    return result;
+}
+
+ssize_t __pread64_chk(int fd, void *buffer, size_t count, off64_t offset, size_t size)
+{
+    if (realPread64Chk == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realPread64Chk(fd, buffer, count, offset, size);
+    const uint64_t start = now_ns();
+    const ssize_t result = realPread64Chk(fd, buffer, count, offset, size);
+    count_io(file, IO_READ, count, result, start);
+    return result;
+}
+
+ssize_t pwrite(int fd, const void *buffer, size_t count, off_t offset)
+{
+    if (realPwrite == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realPwrite(fd, buffer, count, offset);
+    const uint64_t start = now_ns();
+    const ssize_t result = realPwrite(fd, buffer, count, offset);
+    count_io(file, IO_WRITE, count, result, start);
+    return result;
+}
+
+ssize_t pwrite64(int fd, const void *buffer, size_t count, off64_t offset)
+{
+    if (realPwrite64 == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realPwrite64(fd, buffer, count, offset);
+    const uint64_t start = now_ns();
+    const ssize_t result = realPwrite64(fd, buffer, count, offset);
+    count_io(file, IO_WRITE, count, result, start);
+    return result;
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int count)
+{
+    if (realReadv == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realReadv(fd, iov, count);
+    const uint64_t start = now_ns();
+    const ssize_t result = realReadv(fd, iov, count);
+    count_io(file, IO_READ, iov_size(iov, count), result, start);
+    return result;
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int count)
+{
+    if (realWritev == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realWritev(fd, iov, count);
+    const uint64_t start = now_ns();
+    const ssize_t result = realWritev(fd, iov, count);
+    count_io(file, IO_WRITE, iov_size(iov, count), result, start);
+    return result;
+}
+
+ssize_t preadv(int fd, const struct iovec *iov, int count, off_t offset)
+{
+    if (realPreadv == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realPreadv(fd, iov, count, offset);
+    const uint64_t start = now_ns();
+    const ssize_t result = realPreadv(fd, iov, count, offset);
+    count_io(file, IO_READ, iov_size(iov, count), result, start);
+    return result;
+}
+
+ssize_t preadv64(int fd, const struct iovec *iov, int count, off64_t offset)
+{
+    if (realPreadv64 == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realPreadv64(fd, iov, count, offset);
+    const uint64_t start = now_ns();
+    const ssize_t result = realPreadv64(fd, iov, count, offset);
+    count_io(file, IO_READ, iov_size(iov, count), result, start);
+    return result;
+}
+
+ssize_t pwritev(int fd, const struct iovec *iov, int count, off_t offset)
+{
+    if (realPwritev == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realPwritev(fd, iov, count, offset);
+    const uint64_t start = now_ns();
+    const ssize_t result = realPwritev(fd, iov, count, offset);
+    count_io(file, IO_WRITE, iov_size(iov, count), result, start);
+    return result;
+}
+
+ssize_t pwritev64(int fd, const struct iovec *iov, int count, off64_t offset)
+{
+    if (realPwritev64 == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realPwritev64(fd, iov, count, offset);
+    const uint64_t start = now_ns();
+    const ssize_t result = realPwritev64(fd, iov, count, offset);
+    count_io(file, IO_WRITE, iov_size(iov, count), result, start);
+    return result;
+}
+
+int fsync(int fd)
+{
+    if (realFsync == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realFsync(fd);
+    const uint64_t start = now_ns();
+    const int result = realFsync(fd);
+    count_io(file, IO_SYNC, 0, result, start);
+    return result;
+}
+
+int fdatasync(int fd)
+{
+    if (realFdatasync == NULL)
+        find_real_functions();
+    const uint32_t file = traced_file(fd);
+    if (file == 0)
+        return realFdatasync(fd);
+    const uint64_t start = now_ns();
+    const int result = realFdatasync(fd);
+    count_io(file, IO_SYNC, 0, result, start);
+    return result;
+}
+
+int dup(int oldFd)
+{
+    if (realDup == NULL)
+        find_real_functions();
+    const int fd = realDup(oldFd);
+    copy_classification(oldFd, fd);
+    return fd;
+}
+
+int dup2(int oldFd, int newFd)
+{
+    if (realDup2 == NULL)
+        find_real_functions();
+    const int fd = realDup2(oldFd, newFd);
+    copy_classification(oldFd, fd);
+    return fd;
+}
+
+int dup3(int oldFd, int newFd, int flags)
+{
+    if (realDup3 == NULL)
+        find_real_functions();
+    const int fd = realDup3(oldFd, newFd, flags);
+    copy_classification(oldFd, fd);
+    return fd;
+}
+
+/*! The argument of fcntl, an int or a pointer if there is one, which is passed on as a pointer, as that holds either. */
+#define FCNTL_ARG(cmd, arg) \
+    do { \
+        va_list args; \
+        va_start(args, cmd); \
+        arg = va_arg(args, void *); \
+        va_end(args); \
+    } while (0)
+
+int fcntl(int fd, int cmd, ...)
+{
+    void *arg;
+    FCNTL_ARG(cmd, arg);
+    if (realFcntl == NULL)
+        find_real_functions();
+    const int result = realFcntl(fd, cmd, arg);
+    if (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC)
+        copy_classification(fd, result);
+    return result;
+}
+
+/* What fcntl is with 64-bit offsets since glibc 2.28 */
+int fcntl64(int fd, int cmd, ...)
+{
+    void *arg;
+    FCNTL_ARG(cmd, arg);
+    if (realFcntl64 == NULL)
+        find_real_functions();
+    const int result = realFcntl64(fd, cmd, arg);
+    if (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC)
+        copy_classification(fd, result);
+    return result;
+}
+
+int close(int fd)
+{
+    if (realClose == NULL)
+        find_real_functions();
+    /* Before the call, as Linux frees the descriptor even if it fails */
+    if (fd >= 0 && fd < MAX_FDS)
+        __atomic_store_n(&fdFiles[fd], 0, __ATOMIC_RELAXED);
+    return realClose(fd);
+}
+
+int gpfs_io_tracing(void)
+{
+    Dl_info called, here;
+    void *calledRead = dlsym(RTLD_DEFAULT, "read");
+    return calledRead != NULL && dladdr(calledRead, &called) != 0 && dladdr((void *) &classify, &here) != 0 &&
+        called.dli_fbase == here.dli_fbase;
+}
+
+/*! Reads the totals of a thread into \a totals. */
+static void read_thread_io(const struct thread_io *io, struct thread_io *totals)
+{
+    for (int k = 0; k < NUM_IO_KINDS; ++k)
+        totals->calls[k] = __atomic_load_n(&io->calls[k], __ATOMIC_RELAXED);
+    totals->bytes[IO_READ] = __atomic_load_n(&io->bytes[IO_READ], __ATOMIC_RELAXED);
+    totals->bytes[IO_WRITE] = __atomic_load_n(&io->bytes[IO_WRITE], __ATOMIC_RELAXED);
+    totals->ns = __atomic_load_n(&io->ns, __ATOMIC_RELAXED);
+    for (int b = 0; b < NUM_LATENCY_BUCKETS; ++b)
+        totals->latency[b] = __atomic_load_n(&io->latency[b], __ATOMIC_RELAXED);
+    for (int c = 0; c < NUM_SIZE_CLASSES; ++c)
+        totals->sizeClasses[c] = __atomic_load_n(&io->sizeClasses[c], __ATOMIC_RELAXED);
+}
+
+/*! Returns how much \a total has increased since \a last, and updates \a last. */
+static uint64_t delta(uint64_t total, uint64_t *last)
+{
+    if (total <= *last)
+        return 0;
+    const uint64_t d = total - *last;
+    *last = total;
+    return d;
+}
+
+void gpfs_io_start(void)
+{
+    const char *small = getenv("ARM_MAP_GPFS_SMALL_IO");
+    smallBytes = small != NULL && strtoull(small, NULL, 0) > 0 ? strtoull(small, NULL, 0) : GPFS_SMALL_IO_BYTES;
+    for (uint32_t slot = 0; slot <= MAX_THREADS; ++slot)
+        read_thread_io(&threadIo[slot], &lastTotals[slot]);
+}
+
+void gpfs_io_sample(struct gpfs_io_sample *sample)
+{
+    uint32_t numSlots = __atomic_load_n(&numThreads, __ATOMIC_RELAXED);
+    if (numSlots > MAX_THREADS)
+        numSlots = MAX_THREADS + 1;
+
+    struct thread_io sum;
+    memset(&sum, 0, sizeof(sum));
+    for (uint32_t i = 0; i < numSlots; ++i) {
+        /* The shared slot is the last one, and is only used once the others have been handed out */
+        const uint32_t slot = i < MAX_THREADS ? i : SHARED_SLOT;
+        struct thread_io totals;
+        struct thread_io *last = &lastTotals[slot];
+        read_thread_io(&threadIo[slot], &totals);
+        for (int k = 0; k < NUM_IO_KINDS; ++k)
+            sum.calls[k] += delta(totals.calls[k], &last->calls[k]);
+        sum.bytes[IO_READ] += delta(totals.bytes[IO_READ], &last->bytes[IO_READ]);
+        sum.bytes[IO_WRITE] += delta(totals.bytes[IO_WRITE], &last->bytes[IO_WRITE]);
+        sum.ns += delta(totals.ns, &last->ns);
+        for (int b = 0; b < NUM_LATENCY_BUCKETS; ++b)
+            sum.latency[b] += delta(totals.latency[b], &last->latency[b]);
+        for (int c = 0; c < NUM_SIZE_CLASSES; ++c)
+            sum.sizeClasses[c] += delta(totals.sizeClasses[c], &last->sizeClasses[c]);
+    }
+
+    sample->readBytes = sum.bytes[IO_READ];
+    sample->writeBytes = sum.bytes[IO_WRITE];
+    const uint64_t calls = sum.calls[IO_READ] + sum.calls[IO_WRITE] + sum.calls[IO_SYNC];
+    sample->latencyMean = calls == 0 ? 0.0 : (double) sum.ns / (double) calls / 1e9;
+
+    /* The bucket that the 99th percentile call is in, counting every call up to it */
+    sample->latencyP99 = 0.0;
+    const uint64_t rank = calls - calls / 100;
+    uint64_t seen = 0;
+    for (int b = 0; b < NUM_LATENCY_BUCKETS && calls > 0; ++b) {
+        seen += sum.latency[b];
+        if (seen >= rank) {
+            sample->latencyP99 = latency_of_bucket(b) / 1e9;
+            break;
+        }
+    }
+
+    const uint64_t transfers = sum.calls[IO_READ] + sum.calls[IO_WRITE];
+    uint64_t small = 0;
+    for (int c = 0; c <= size_class(smallBytes); ++c)
+        small += sum.sizeClasses[c];
+    sample->smallFraction = transfers == 0 ? 0.0 : 100.0 * (double) small / (double) transfers;
+}
+
+/*! Orders entries of \a files by the time spent in their I/O, most first. */
+static int compare_time(const void *a, const void *b)
+{
+    const uint64_t nsA = files[*(const uint16_t *) a].ns;
+    const uint64_t nsB = files[*(const uint16_t *) b].ns;
+    return nsA < nsB ? 1 : nsA > nsB ? -1 : 0;
+}
+
+void gpfs_io_print_files(FILE *out, int top)
+{
+    static uint16_t order[MAX_FILES];
+    int numFiles = 0;
+    for (int f = 0; f < MAX_FILES; ++f) {
+        const struct traced_file *traced = &files[f];
+        if (traced->calls[IO_READ] + traced->calls[IO_WRITE] + traced->calls[IO_SYNC] > 0)
+            order[numFiles++] = (uint16_t) f;
+    }
+    if (numFiles == 0)
+        return;
+    qsort(order, numFiles, sizeof(order[0]), compare_time);
+
+    fprintf(out, "GPFS files by time in I/O: %d files\n", numFiles);
+    fprintf(out, "  %10s %10s %12s %10s %13s %8s %12s  %s\n", "time (s)", "reads", "read (MiB)", "writes",
+            "written (MiB)", "syncs", "mean (ms)", "file");
+    for (int i = 0; i < numFiles && i < top; ++i) {
+        const struct traced_file *traced = &files[order[i]];
+        const uint64_t calls = traced->calls[IO_READ] + traced->calls[IO_WRITE] + traced->calls[IO_SYNC];
+        fprintf(out, "  %10.3f %10llu %12.2f %10llu %13.2f %8llu %12.3f  %s\n", (double) traced->ns / 1e9,
+                (unsigned long long) traced->calls[IO_READ], (double) traced->bytes[IO_READ] / 1048576.0,
+                (unsigned long long) traced->calls[IO_WRITE], (double) traced->bytes[IO_WRITE] / 1048576.0,
+                (unsigned long long) traced->calls[IO_SYNC], (double) traced->ns / (double) calls / 1e6,
+                order[i] == OTHER_FILES ? "(other files)" : traced->path);
+    }
+}
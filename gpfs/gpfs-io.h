@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The file I/O of the process on GPFS, traced by the open, read, write and
+ * sync functions that gpfs-io.c defines when lib-gpfs.so is preloaded.
+ */
+
+#ifndef GPFS_IO_H
+#define GPFS_IO_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*! The f_type fstatfs returns for GPFS. ARM_MAP_GPFS_IO_MAGIC traces another filesystem instead. */
+#define GPFS_SUPER_MAGIC 0x47504653
+
+/*! Reads and writes of at most this many bytes are small, unless ARM_MAP_GPFS_SMALL_IO says otherwise. */
+#define GPFS_SMALL_IO_BYTES 65536
+
+/*! The files printed at cleanup, unless ARM_MAP_GPFS_IO_TOP says otherwise. */
+#define GPFS_IO_TOP_FILES 10
+
+/*! The traced I/O of one sample. */
+struct gpfs_io_sample {
+    uint64_t readBytes;
+    uint64_t writeBytes;
+    /*! The mean and 99th percentile time of the reads, writes and syncs, in s. */
+    double latencyMean;
+    double latencyP99;
+    /*! The percentage of the reads and writes that were small. */
+    double smallFraction;
+};
+
+/*! Returns 1 if the functions of gpfs-io.c are the ones the program calls, else 0. */
+int gpfs_io_tracing(void);
+
+/*! Starts a new sample, so that only the I/O from now on is reported. */
+void gpfs_io_start(void);
+
+/*! Fills in \a sample with the I/O since the last call, or since \a gpfs_io_start. */
+void gpfs_io_sample(struct gpfs_io_sample *sample);
+
+/*! Prints the \a top files that the most time was spent in the I/O of, with their counts. */
+void gpfs_io_print_files(FILE *out, int top);
+
+#endif
@@ -1,18 +1,25 @@
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "allinea_metric_plugin_api.h"
+#include "gpfs-io.h"
 
 #define DEV_SS0 "/dev/ss0"
 
-static const char *ss0_dat_filename;
+/* Also read by the sub-sampling thread of the plugin */
+static const char *volatile ss0_dat_filename;
 static int dev_ss0_fd;
 
 extern int __real_ioctl(int fd, unsigned long request, ...);
@@ -56,9 +63,16 @@ int __wrap_ioctl(int fd, unsigned long request, ...)
     return 0;
 }
 
-extern int __real_open(const char *pathname, int flags);
-int __wrap_open(const char *pathname, int flags)
+extern int __real_open(const char *pathname, int flags, ...);
+int __wrap_open(const char *pathname, int flags, ...)
 {
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = (mode_t) va_arg(ap, int);
+        va_end(ap);
+    }
     if (strcmp(pathname, DEV_SS0) == 0) {
         if (flags != O_RDONLY) {
             fprintf(stderr, "FAIL: open: expected flags O_RDONLY != actual_flags: %d\n", flags);
@@ -69,7 +83,7 @@ int __wrap_open(const char *pathname, int flags)
         dev_ss0_fd = __real_open("/dev/null", flags);
         return dev_ss0_fd;
     }
-    return __real_open(pathname, flags);
+    return __real_open(pathname, flags, mode);
 }
 
 extern int __real_close(int fd);
@@ -96,6 +110,245 @@ extern int allinea_gpfsOpens(metric_id_t metricId, struct timespec *inOutCurrent
 extern int allinea_gpfsOpensTotal(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
 extern int allinea_gpfsINodeLookups(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
 extern int allinea_gpfsINodeLookupsTotal(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_gpfsIOPs(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_gpfsIOPsMin(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_gpfsIOPsMax(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_gpfsIOPsMean(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_gpfsIOPsLast(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_gpfsFileReadBytes(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_gpfsFileWriteBytes(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_gpfsFileLatencyMean(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_gpfsFileLatencyP99(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_gpfsFileSmallIO(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+
+/* The checking versions that programs built with _FORTIFY_SOURCE call, which the headers only declare when it is set */
+extern int __open_2(const char *path, int flags);
+extern int __openat_2(int dirfd, const char *path, int flags);
+extern ssize_t __read_chk(int fd, void *buffer, size_t count, size_t size);
+extern ssize_t __pread_chk(int fd, void *buffer, size_t count, off_t offset, size_t size);
+
+/* The IOPs and their rates over a sample */
+struct burst {
+    uint64_t iops;
+    double min, max, mean, last;
+};
+
+static struct burst sample_burst(int seconds)
+{
+    struct timespec sampleTime = { seconds, 0 };
+    struct burst b;
+    if (allinea_gpfsIOPs(1, &sampleTime, &b.iops) != 0 ||
+        allinea_gpfsIOPsMin(1, &sampleTime, &b.min) != 0 ||
+        allinea_gpfsIOPsMax(1, &sampleTime, &b.max) != 0 ||
+        allinea_gpfsIOPsMean(1, &sampleTime, &b.mean) != 0 ||
+        allinea_gpfsIOPsLast(1, &sampleTime, &b.last) != 0) {
+        fprintf(stderr, "FAIL: sampling the IOPs at %d s failed\n", seconds);
+        abort();
+    }
+    return b;
+}
+
+/* The traced file I/O of a sample */
+struct file_io {
+    uint64_t readBytes, writeBytes;
+    double latencyMean, latencyP99, smallFraction;
+};
+
+static struct file_io sample_file_io(int seconds)
+{
+    struct timespec sampleTime = { seconds, 0 };
+    struct file_io io;
+    if (allinea_gpfsFileReadBytes(1, &sampleTime, &io.readBytes) != 0 ||
+        allinea_gpfsFileWriteBytes(1, &sampleTime, &io.writeBytes) != 0 ||
+        allinea_gpfsFileLatencyMean(1, &sampleTime, &io.latencyMean) != 0 ||
+        allinea_gpfsFileLatencyP99(1, &sampleTime, &io.latencyP99) != 0 ||
+        allinea_gpfsFileSmallIO(1, &sampleTime, &io.smallFraction) != 0) {
+        fprintf(stderr, "FAIL: sampling the file I/O at %d s failed\n", seconds);
+        abort();
+    }
+    return io;
+}
+
+#define NUM_WRITERS 4
+#define WRITER_WRITES 8
+#define WRITER_SIZE 512
+#define SMALL_WRITES 16
+#define SMALL_SIZE 4096
+#define LARGE_SIZE (1 << 20)
+
+static char *directory;
+
+/* Writes a file of its own with small pwrites, from a thread of its own */
+static void *writer(void *arg)
+{
+    char path[256], buffer[WRITER_SIZE];
+    snprintf(path, sizeof(path), "%s/writer-%d", directory, (int) (intptr_t) arg);
+    memset(buffer, 'w', sizeof(buffer));
+    int fd = creat(path, 0600);
+    for (int i = 0; i < WRITER_WRITES; ++i)
+        if (fd == -1 || pwrite(fd, buffer, sizeof(buffer), i * WRITER_SIZE) != WRITER_SIZE)
+            return (void *) 1;
+    close(fd);
+    return NULL;
+}
+
+/* Traces I/O to files in /dev/shm, flagged as GPFS by ARM_MAP_GPFS_IO_MAGIC, and to files that are not */
+static void check_file_io(void)
+{
+    char template[] = "/dev/shm/gpfs-test-XXXXXX";
+    directory = mkdtemp(template);
+    if (directory == NULL) {
+        fprintf(stderr, "FAIL: mkdtemp: %s\n", strerror(errno));
+        abort();
+    }
+    if (!gpfs_io_tracing()) {
+        fprintf(stderr, "FAIL: expected the open, read and write of gpfs-io.c to be called\n");
+        abort();
+    }
+    ss0_dat_filename = "ss0.dat.1";
+    if (allinea_plugin_initialize(1, NULL) != 0) {
+        fprintf(stderr, "FAIL: allinea_plugin_initialize: errno %d (%s)\n", errno, strerror(errno));
+        abort();
+    }
+    sample_file_io(1);
+
+    static char buffer[LARGE_SIZE];
+    memset(buffer, 'x', sizeof(buffer));
+    char path[256];
+    snprintf(path, sizeof(path), "%s/data", directory);
+    int fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    for (int i = 0; i < SMALL_WRITES; ++i)
+        if (fd == -1 || write(fd, buffer, SMALL_SIZE) != SMALL_SIZE) {
+            fprintf(stderr, "FAIL: writing %s: %s\n", path, strerror(errno));
+            abort();
+        }
+    /* A duplicate descriptor is traced as the file it is of */
+    int copy = dup(fd);
+    if (write(copy, buffer, LARGE_SIZE) != LARGE_SIZE || fsync(fd) != 0 ||
+        pread(fd, buffer, SMALL_SIZE, 0) != SMALL_SIZE || lseek(copy, 0, SEEK_SET) != 0 ||
+        read(copy, buffer, LARGE_SIZE) != LARGE_SIZE) {
+        fprintf(stderr, "FAIL: reading back %s: %s\n", path, strerror(errno));
+        abort();
+    }
+    close(copy);
+    close(fd);
+
+    pthread_t threads[NUM_WRITERS];
+    for (int t = 0; t < NUM_WRITERS; ++t)
+        pthread_create(&threads[t], NULL, writer, (void *) (intptr_t) t);
+    for (int t = 0; t < NUM_WRITERS; ++t) {
+        void *failed;
+        pthread_join(threads[t], &failed);
+        if (failed != NULL) {
+            fprintf(stderr, "FAIL: a writer thread failed\n");
+            abort();
+        }
+    }
+
+    /* Files on other filesystems, and pipes, are not traced */
+    int proc = open("/proc/self/stat", O_RDONLY);
+    if (proc == -1 || read(proc, buffer, 100) <= 0) {
+        fprintf(stderr, "FAIL: reading /proc/self/stat\n");
+        abort();
+    }
+    close(proc);
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0 || write(pipeFds[1], buffer, 100) != 100 || read(pipeFds[0], buffer, 100) != 100) {
+        fprintf(stderr, "FAIL: pipe\n");
+        abort();
+    }
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+
+    struct file_io io = sample_file_io(2);
+    const uint64_t written = SMALL_WRITES * SMALL_SIZE + LARGE_SIZE + NUM_WRITERS * WRITER_WRITES * WRITER_SIZE;
+    if (io.readBytes != SMALL_SIZE + LARGE_SIZE || io.writeBytes != written) {
+        fprintf(stderr, "FAIL: expected %d bytes read and %llu written != actual %llu and %llu\n", SMALL_SIZE + LARGE_SIZE,
+                (unsigned long long) written, (unsigned long long) io.readBytes, (unsigned long long) io.writeBytes);
+        abort();
+    }
+    /* All but the 1 MiB write and read are small */
+    const double transfers = SMALL_WRITES + 3 + NUM_WRITERS * WRITER_WRITES;
+    const double small = 100.0 * (transfers - 2) / transfers;
+    if (io.smallFraction < small - 1e-9 || io.smallFraction > small + 1e-9) {
+        fprintf(stderr, "FAIL: expected %g%% small reads and writes != actual %g%%\n", small, io.smallFraction);
+        abort();
+    }
+    if (io.latencyMean <= 0.0 || io.latencyP99 < io.latencyMean || io.latencyP99 > 1.0) {
+        fprintf(stderr, "FAIL: expected 0 < mean latency %g s <= 99th percentile %g s < 1 s\n", io.latencyMean, io.latencyP99);
+        abort();
+    }
+
+    /* A sample without I/O */
+    io = sample_file_io(3);
+    if (io.readBytes != 0 || io.writeBytes != 0 || io.latencyMean != 0.0 || io.latencyP99 != 0.0 || io.smallFraction != 0.0) {
+        fprintf(stderr, "FAIL: expected no file I/O in a sample without any\n");
+        abort();
+    }
+
+    /* The checking versions of open, read and pread, and a descriptor duplicated by fcntl, are traced too */
+    fd = __open_2(path, O_RDONLY);
+    copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (fd == -1 || copy == -1 || __read_chk(fd, buffer, SMALL_SIZE, sizeof(buffer)) != SMALL_SIZE ||
+        __pread_chk(copy, buffer, SMALL_SIZE, 0, sizeof(buffer)) != SMALL_SIZE) {
+        fprintf(stderr, "FAIL: reading %s with the checking functions: %s\n", path, strerror(errno));
+        abort();
+    }
+    close(copy);
+    close(fd);
+    int dirFd = open(directory, O_RDONLY | O_DIRECTORY);
+    fd = __openat_2(dirFd, "data", O_RDONLY);
+    if (fd == -1 || read(fd, buffer, SMALL_SIZE) != SMALL_SIZE) {
+        fprintf(stderr, "FAIL: reading %s opened with __openat_2: %s\n", path, strerror(errno));
+        abort();
+    }
+    close(fd);
+    close(dirFd);
+    io = sample_file_io(4);
+    if (io.readBytes != 3 * SMALL_SIZE || io.writeBytes != 0) {
+        fprintf(stderr, "FAIL: expected %d bytes read and none written through the checking functions != actual %llu "
+                "and %llu\n", 3 * SMALL_SIZE, (unsigned long long) io.readBytes, (unsigned long long) io.writeBytes);
+        abort();
+    }
+
+    /* The table of files has the data file and those of the writers, and not /proc */
+    char *table;
+    size_t size;
+    FILE *out = open_memstream(&table, &size);
+    gpfs_io_print_files(out, GPFS_IO_TOP_FILES);
+    fclose(out);
+    if (strstr(table, "GPFS files by time in I/O: 5 files") == NULL || strstr(table, path) == NULL ||
+        strstr(table, "writer-3") == NULL || strstr(table, "/proc") != NULL) {
+        fprintf(stderr, "FAIL: expected the data and writer files in the table, got:\n%s", table);
+        abort();
+    }
+    out = open_memstream(&table, &size);
+    gpfs_io_print_files(out, 1);
+    fclose(out);
+    if (strstr(table, "writer-") != NULL && strstr(table, path) != NULL) {
+        fprintf(stderr, "FAIL: expected only the top file, got:\n%s", table);
+        abort();
+    }
+    free(table);
+
+    if (allinea_plugin_cleanup(1, NULL) != 0) {
+        fprintf(stderr, "FAIL: allinea_plugin_cleanup: errno %d (%s)\n", errno, strerror(errno));
+        abort();
+    }
+    for (int t = 0; t < NUM_WRITERS; ++t) {
+        snprintf(path, sizeof(path), "%s/writer-%d", directory, t);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/data", directory);
+    unlink(path);
+    rmdir(directory);
+}
+
+static void sleep_ms(int ms)
+{
+    struct timespec duration = { 0, ms * 1000000L };
+    nanosleep(&duration, NULL);
+}
 
 int main(void)
 {
@@ -103,6 +356,9 @@ int main(void)
     struct timespec sampleTime;
     uint64_t value;
 
+    /* Before anything is opened, so that files in /dev/shm are traced as if they were on GPFS */
+    setenv("ARM_MAP_GPFS_IO_MAGIC", "0x01021994", 1);
+
     ret = allinea_plugin_initialize(1, NULL);
     if (ret != 0) {
         fprintf(stderr, "FAIL: allinea_plugin_initialize: failed with return value %d errno %d (%s)\n", ret, errno, strerror(errno));
@@ -326,12 +582,63 @@ int main(void)
         return 1;
     }
     
+    /* Without sub-sampling the rates of a sample are all the rate over the whole sample */
+    struct burst b = sample_burst(4);
+    if (b.min != b.max || b.mean != b.max || b.last != b.max) {
+        fprintf(stderr, "FAIL: without sub-sampling: expected min %g == max %g == mean %g == last %g\n", b.min, b.max, b.mean, b.last);
+        abort();
+        return 1;
+    }
+
     ret = allinea_plugin_cleanup(1, NULL);
     if (ret != 0) {
         fprintf(stderr, "FAIL: allinea_plugin_initialize: failed with return value %d errno %d (%s)\n", ret, errno, strerror(errno));
         abort();
         return 1;
     }
+
+    /* With sub-sampling, a burst of IOPs between two reads shows in the maximum but not the last rate */
+    ss0_dat_filename = "ss0.dat.1";
+    setenv("ARM_MAP_SUBSAMPLE_HZ", "1000", 1);
+    ret = allinea_plugin_initialize(1, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "FAIL: allinea_plugin_initialize: failed with return value %d errno %d (%s)\n", ret, errno, strerror(errno));
+        abort();
+        return 1;
+    }
+    sample_burst(1);
+    sleep_ms(20);
+    ss0_dat_filename = "ss0.dat.2";
+    sleep_ms(20);
+    b = sample_burst(2);
+    /* The reads are 1 ms apart, but on a loaded machine may be further */
+    if (b.iops == 0 || b.max < (double) b.iops / 0.02) {
+        fprintf(stderr, "FAIL: sub-sampling: expected a maximum of at least %g IOPs/s != actual %g\n", (double) b.iops / 0.02, b.max);
+        abort();
+        return 1;
+    }
+    if (b.min != 0.0 || b.last != 0.0 || b.mean <= 0.0 || b.mean >= b.max) {
+        fprintf(stderr, "FAIL: sub-sampling: expected 0 == min %g < mean %g < max %g and last %g == 0\n", b.min, b.mean, b.max, b.last);
+        abort();
+        return 1;
+    }
+    /* A window with no IOPs */
+    sleep_ms(20);
+    b = sample_burst(3);
+    if (b.iops != 0 || b.max != 0.0 || b.mean != 0.0) {
+        fprintf(stderr, "FAIL: sub-sampling: expected no IOPs != actual %llu, max %g, mean %g\n", (unsigned long long) b.iops, b.max, b.mean);
+        abort();
+        return 1;
+    }
+
+    ret = allinea_plugin_cleanup(1, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "FAIL: allinea_plugin_cleanup: failed with return value %d errno %d (%s)\n", ret, errno, strerror(errno));
+        abort();
+        return 1;
+    }
+
+    check_file_io();
     
     fprintf(stderr, "PASS\n");
     
@@ -1,8 +1,14 @@
 #include "allinea_metric_plugin_api.h"
+#include "gpfs-io.h"
+#include "mpi_rank.h"
+#include "region_totals.h"
+#include "subsample.h"
+#include "telemetry.h"
 
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -75,6 +81,49 @@ static uint64_t iopsLastSample;
 /*! The number of cycles per IOP this sample.  */
 static double cyclesPerIOPLastSample;
 
+/*! The rates read many times per sample by the sub-sampling thread. */
+enum { BURST_IOPS, BURST_METADATA, NUM_BURST_CHANNELS };
+
+/*! Reads /dev/ss0 many times per sample if ARM_MAP_SUBSAMPLE_HZ is set. See ../common/subsample.h. */
+static struct subsampler subsampler;
+
+/*! \a 1 if the sub-sampling thread is running, else \a 0. */
+static int subsampling = 0;
+
+/*! The IOPs and metadata operations at the last read of the sub-sampling thread, and when it was in ns. */
+static uint64_t burstIops, burstMetadata, burstNs;
+
+/*! The minimum, maximum, mean and last IOPs and metadata operations per second this sample. */
+/*!
+ *  Over the reads of the sub-sampling thread, or if it is not running all
+ *  four are the rate over the whole sample.
+ */
+static struct subsample_window burstWindow;
+
+/*! The time of the previous sample in ns, for the rates when not sub-sampling. */
+static uint64_t previousSampleNs;
+
+/*! The file I/O of this process on GPFS this sample, if lib-gpfs.so is preloaded. See gpfs-io.h. */
+static struct gpfs_io_sample fileIo;
+
+/*! The counters added up by region, in the order of \a regionCounterNames. */
+enum { REGION_IO_CYCLES, REGION_IOPS, REGION_READS, REGION_WRITES, REGION_OPENS, REGION_INODE_LOOKUPS, NUM_REGION_COUNTERS };
+
+static const char *const regionCounterNames[NUM_REGION_COUNTERS] = {
+    "IO cycles", "IO operations", "reads", "writes", "opens", "inode lookups"
+};
+
+static const struct region_ratio regionRatios[] = {
+    { "cycles per IO operation", REGION_IO_CYCLES, REGION_IOPS, 1.0 },
+    { "opens per IO operation", REGION_OPENS, REGION_IOPS, 1.0 },
+};
+
+/*! The counts of each sample added up by the region the program was in, if it marks regions. See ../common/region_totals.h. */
+static struct region_totals regionTotals;
+
+/*! The live telemetry page, or NULL if not publishing. See ../common/telemetry.h. */
+static struct telemetry_page *telemetryPage = NULL;
+
 /*! \a 1 if the initial values of the metrics have not been read yet, else \a 0. */
 /*!
  *  The first time \a update is called and this variable is set it will
@@ -90,6 +139,43 @@ static int firstTime = 1;
  */
 static struct timespec lastSampleTime;
 
+/*! Reads the counters of every CPU from /dev/ss0. */
+static int read_counters(PerCpuCounters_t *buffer)
+{
+    uintptr_t args[6];
+
+    args[0] = cxiCounterTypeVfsStatsGetAll;
+    args[1] = sizeof(PerCpuCounters_t);
+    args[2] = (uintptr_t) buffer;
+    return ioctl(ss0_fd, GetCounters, args);
+}
+
+/*! Reads the IOPs and metadata operations per second since its last read. Called from the sub-sampling thread. */
+static int read_burst(void *arg, uint64_t nowNs, double *values)
+{
+    (void)arg; /* unused variable */
+    PerCpuCounters_t buffer;
+    int i;
+
+    if (read_counters(&buffer) != 0)
+        return -1;
+    uint64_t iops = 0LL;
+    for (i=0;i<nVFSStatItems;++i)
+        iops += buffer.vfsstat_count[i].count;
+    uint64_t metadata = buffer.vfsstat_count[lookupCall].count + buffer.vfsstat_count[openCall].count;
+    int ret = -1;
+    if (burstNs != 0 && nowNs > burstNs) {
+        const double seconds = (double) (nowNs - burstNs) / 1e9;
+        values[BURST_IOPS]     = (double) (iops - burstIops) / seconds;
+        values[BURST_METADATA] = (double) (metadata - burstMetadata) / seconds;
+        ret = 0;
+    }
+    burstIops     = iops;
+    burstMetadata = metadata;
+    burstNs       = nowNs;
+    return ret;
+}
+
 /*! This function is called when the metric plugin is loaded. */
 /*!
  *  We do not have to restrict ourselves to async-signal-safe functions because
@@ -114,6 +200,14 @@ int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused)
         return -1;
     }
     firstTime = 1;
+    burstNs = 0;
+    previousSampleNs = 0;
+    memset(&burstWindow, 0, sizeof(burstWindow));
+    memset(&fileIo, 0, sizeof(fileIo));
+    gpfs_io_start();
+    subsampling = subsample_start(&subsampler, subsample_hz_from_env(), NUM_BURST_CHANNELS, read_burst, NULL) == 0;
+    region_totals_open(&regionTotals, NUM_REGION_COUNTERS, regionCounterNames);
+    telemetryPage = telemetry_open();
 
     return 0;
 }
@@ -132,27 +226,61 @@ int allinea_plugin_cleanup(plugin_id_t id, void *unused)
     (void) id;  // Unused parameter
     (void)unused; /* unused variable */
 
+    /* Before closing /dev/ss0, which the thread reads */
+    subsample_stop(&subsampler);
+    subsampling = 0;
     if (ss0_fd != -1) {
         close(ss0_fd);
         ss0_fd = -1;
     }
+    if (mpi_rank_is_root()) {
+        region_totals_print(&regionTotals, stdout, "GPFS counters", regionRatios, sizeof(regionRatios) / sizeof(regionRatios[0]));
+        const char *top = getenv("ARM_MAP_GPFS_IO_TOP");
+        gpfs_io_print_files(stdout, top != NULL && *top != '\0' ? atoi(top) : GPFS_IO_TOP_FILES);
+    }
+    telemetry_close(telemetryPage);
+    telemetryPage = NULL;
     return 0;
 }
 
+/*! Publishes the metrics of the sample at \a sampleTime to the telemetry page. */
+static void publish(const struct timespec *sampleTime)
+{
+    telemetry_publish_begin(telemetryPage);
+    telemetry_set_uint64(telemetryPage, TELEMETRY_GPFS_IO_CYCLES, cyclesSpentInIOLastSample, sampleTime);
+    telemetry_set_uint64(telemetryPage, TELEMETRY_GPFS_INODE_LOOKUPS, inodeLookupsLastSample, sampleTime);
+    telemetry_set_uint64(telemetryPage, TELEMETRY_GPFS_OPENS, opensLastSample, sampleTime);
+    telemetry_set_uint64(telemetryPage, TELEMETRY_GPFS_READS, readsLastSample, sampleTime);
+    telemetry_set_uint64(telemetryPage, TELEMETRY_GPFS_WRITES, writesLastSample, sampleTime);
+    telemetry_set_uint64(telemetryPage, TELEMETRY_GPFS_IOPS, iopsLastSample, sampleTime);
+    telemetry_set_uint64(telemetryPage, TELEMETRY_GPFS_IOPS_TOTAL, iopsTotal, sampleTime);
+    telemetry_set_double(telemetryPage, TELEMETRY_GPFS_CYCLES_PER_IOP, cyclesPerIOPLastSample, sampleTime);
+    telemetry_set_double(telemetryPage, TELEMETRY_GPFS_IOPS_MIN, burstWindow.min[BURST_IOPS], sampleTime);
+    telemetry_set_double(telemetryPage, TELEMETRY_GPFS_IOPS_MAX, burstWindow.max[BURST_IOPS], sampleTime);
+    telemetry_set_double(telemetryPage, TELEMETRY_GPFS_IOPS_MEAN, burstWindow.mean[BURST_IOPS], sampleTime);
+    telemetry_set_double(telemetryPage, TELEMETRY_GPFS_IOPS_LAST, burstWindow.last[BURST_IOPS], sampleTime);
+    telemetry_set_double(telemetryPage, TELEMETRY_GPFS_METADATA_MIN, burstWindow.min[BURST_METADATA], sampleTime);
+    telemetry_set_double(telemetryPage, TELEMETRY_GPFS_METADATA_MAX, burstWindow.max[BURST_METADATA], sampleTime);
+    telemetry_set_double(telemetryPage, TELEMETRY_GPFS_METADATA_MEAN, burstWindow.mean[BURST_METADATA], sampleTime);
+    telemetry_set_double(telemetryPage, TELEMETRY_GPFS_METADATA_LAST, burstWindow.last[BURST_METADATA], sampleTime);
+    telemetry_set_uint64(telemetryPage, TELEMETRY_GPFS_FILE_READ_BYTES, fileIo.readBytes, sampleTime);
+    telemetry_set_uint64(telemetryPage, TELEMETRY_GPFS_FILE_WRITE_BYTES, fileIo.writeBytes, sampleTime);
+    telemetry_set_double(telemetryPage, TELEMETRY_GPFS_FILE_LATENCY_MEAN, fileIo.latencyMean, sampleTime);
+    telemetry_set_double(telemetryPage, TELEMETRY_GPFS_FILE_LATENCY_P99, fileIo.latencyP99, sampleTime);
+    telemetry_set_double(telemetryPage, TELEMETRY_GPFS_FILE_SMALL_IO, fileIo.smallFraction, sampleTime);
+    telemetry_publish_end(telemetryPage);
+}
+
 /*! Called once per sample to read the metrics from /dev/ss0. */
-static int update()
+static int update(const struct timespec *sampleTime)
 {
     int ret, i;
-    uintptr_t args[6];
     PerCpuCounters_t buffer;
     
     if (ss0_fd == -1)
         return 0;
 
-    args[0] = cxiCounterTypeVfsStatsGetAll;
-    args[1] = sizeof(PerCpuCounters_t);
-    args[2] = (uintptr_t) &buffer;
-    ret = ioctl(ss0_fd, GetCounters, args);
+    ret = read_counters(&buffer);
     if (ret != 0)
         return -1;
     uint64_t cyclesSpentInIO = 0LL;
@@ -201,6 +329,17 @@ static int update()
         writesLastSample          = writes - writesStart - writesTotal;
         iopsLastSample            = iops - iopsStart - iopsTotal;
         cyclesPerIOPLastSample    = (iopsLastSample == 0.0) ? 0.0 : (double) cyclesSpentInIOLastSample / (double) iopsLastSample;
+
+        if (region_totals_enabled(&regionTotals)) {
+            uint64_t deltas[NUM_REGION_COUNTERS];
+            deltas[REGION_IO_CYCLES]     = cyclesSpentInIOLastSample;
+            deltas[REGION_IOPS]          = iopsLastSample;
+            deltas[REGION_READS]         = readsLastSample;
+            deltas[REGION_WRITES]        = writesLastSample;
+            deltas[REGION_OPENS]         = opensLastSample;
+            deltas[REGION_INODE_LOOKUPS] = inodeLookupsLastSample;
+            region_totals_add(&regionTotals, region_totals_current(&regionTotals), deltas);
+        }
     }
     cyclesSpentInIOTotal = cyclesSpentInIO - cyclesSpentInIOStart;
     inodeLookupsTotal    = inodeLookups    - inodeLookupsStart;
@@ -209,6 +348,23 @@ static int update()
     writesTotal          = writes - writesStart;
     iopsTotal            = iops   - iopsStart;
 
+    const uint64_t sampleNs = (uint64_t) sampleTime->tv_sec * 1000000000ULL + (uint64_t) sampleTime->tv_nsec;
+    if (subsampling) {
+        subsample_window(&subsampler, &burstWindow);
+    } else if (previousSampleNs != 0 && sampleNs > previousSampleNs) {
+        const double seconds = (double) (sampleNs - previousSampleNs) / 1e9;
+        for (i=0;i<NUM_BURST_CHANNELS;++i) {
+            const uint64_t count = i == BURST_IOPS ? iopsLastSample : inodeLookupsLastSample + opensLastSample;
+            burstWindow.min[i] = burstWindow.max[i] = burstWindow.mean[i] = burstWindow.last[i] = (double) count / seconds;
+        }
+    }
+    previousSampleNs = sampleNs;
+
+    gpfs_io_sample(&fileIo);
+
+    if (telemetryPage != NULL)
+        publish(sampleTime);
+
     return 0;
 }
 
@@ -239,7 +395,7 @@ static int getMetricValue(metric_id_t metricId, const struct timespec *inCurrent
         lastSampleTime.tv_nsec != inCurrentSampleTime->tv_nsec) {
         lastSampleTime.tv_sec  = inCurrentSampleTime->tv_sec;
         lastSampleTime.tv_nsec = inCurrentSampleTime->tv_nsec;
-        int ret = update();
+        int ret = update(inCurrentSampleTime);
         if (ret != 0)
             return ret;
     }
@@ -276,7 +432,7 @@ static int getMetricValueDouble(metric_id_t metricId, const struct timespec *inC
         lastSampleTime.tv_nsec != inCurrentSampleTime->tv_nsec) {
         lastSampleTime.tv_sec  = inCurrentSampleTime->tv_sec;
         lastSampleTime.tv_nsec = inCurrentSampleTime->tv_nsec;
-        int ret = update();
+        int ret = update(inCurrentSampleTime);
         if (ret != 0)
             return ret;
     }
@@ -350,3 +506,68 @@ int allinea_gpfsCyclesPerIOP(metric_id_t metricId, struct timespec *inOutCurrent
 {
     return getMetricValueDouble(metricId, inOutCurrentSampleTime, &cyclesPerIOPLastSample, outValue);
 }
+
+int allinea_gpfsIOPsMin(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &burstWindow.min[BURST_IOPS], outValue);
+}
+
+int allinea_gpfsIOPsMax(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &burstWindow.max[BURST_IOPS], outValue);
+}
+
+int allinea_gpfsIOPsMean(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &burstWindow.mean[BURST_IOPS], outValue);
+}
+
+int allinea_gpfsIOPsLast(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &burstWindow.last[BURST_IOPS], outValue);
+}
+
+int allinea_gpfsMetadataMin(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &burstWindow.min[BURST_METADATA], outValue);
+}
+
+int allinea_gpfsMetadataMax(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &burstWindow.max[BURST_METADATA], outValue);
+}
+
+int allinea_gpfsMetadataMean(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &burstWindow.mean[BURST_METADATA], outValue);
+}
+
+int allinea_gpfsMetadataLast(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &burstWindow.last[BURST_METADATA], outValue);
+}
+
+int allinea_gpfsFileReadBytes(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &fileIo.readBytes, outValue);
+}
+
+int allinea_gpfsFileWriteBytes(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &fileIo.writeBytes, outValue);
+}
+
+int allinea_gpfsFileLatencyMean(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &fileIo.latencyMean, outValue);
+}
+
+int allinea_gpfsFileLatencyP99(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &fileIo.latencyP99, outValue);
+}
+
+int allinea_gpfsFileSmallIO(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &fileIo.smallFraction, outValue);
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the start up latency of the plugin when a node is shared by many
+// ranks. Each round forks the given number of "ranks" at once, and each rank
+// times its call to allinea_plugin_initialize. The first round starts with an
+// empty event cache directory, the following rounds reuse the cache written by
+// the first.
+//
+// Usage: bench-startup [ranks-per-node] [rounds]
+
+#include "allinea_metric_plugin_api.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+extern "C" {
+int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused);
+int allinea_plugin_cleanup(plugin_id_t plugin_id, void *unused);
+
+// Provided by Arm MAP when the plugin is loaded by the sampler
+void allinea_set_plugin_error_messagef(plugin_id_t id, int error_code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+void allinea_set_metric_error_messagef(metric_id_t id, int error_code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+} // extern "C"
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Runs one rank: initialise the plugin and write the time taken to the pipe
+static void run_rank(int rank, int outFd)
+{
+    std::string rankStr= std::to_string(rank);
+    setenv("PMI_RANK", rankStr.c_str(), 1);
+    // Keep the output of the ranks out of the timings
+    if (rank != 0 && freopen("/dev/null", "w", stdout) == nullptr)
+        _exit(2);
+
+    const double start= now_us();
+    const int ret= allinea_plugin_initialize(rank, nullptr);
+    const double elapsed= now_us() - start;
+    fflush(stdout);
+    if (ret == 0)
+        allinea_plugin_cleanup(rank, nullptr);
+
+    if (write(outFd, &elapsed, sizeof(elapsed)) != sizeof(elapsed))
+        _exit(3);
+    _exit(ret == 0 ? 0 : 1);
+}
+
+static bool run_round(int ranks, std::vector<double>& times)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return false;
+    }
+    // Do not let the children inherit (and write out again) our buffered output
+    fflush(stdout);
+    for (int rank= 0; rank < ranks; ++rank) {
+        pid_t pid= fork();
+        if (pid == -1) {
+            perror("fork");
+            return false;
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            run_rank(rank, fds[1]);
+        }
+    }
+    close(fds[1]);
+
+    bool ok= true;
+    times.clear();
+    double elapsed;
+    while (read(fds[0], &elapsed, sizeof(elapsed)) == sizeof(elapsed))
+        times.push_back(elapsed);
+    close(fds[0]);
+    for (int rank= 0; rank < ranks; ++rank) {
+        int status;
+        if (wait(&status) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ok= false;
+    }
+    return ok && static_cast<int>(times.size()) == ranks;
+}
+
+int main(int argc, char* argv[])
+{
+    const int ranks= argc > 1 ? atoi(argv[1]) : 16;
+    const int rounds= argc > 2 ? atoi(argv[2]) : 3;
+    if (ranks <= 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [ranks-per-node] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    char cacheDir[]= "/tmp/bench-startup.XXXXXX";
+    if (mkdtemp(cacheDir) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+    setenv("ARM_MAP_PAPI_CACHE_DIR", cacheDir, 1);
+
+    printf("%-8s %-6s %12s %12s %12s\n", "round", "cache", "min (us)", "mean (us)", "max (us)");
+    int ret= 0;
+    std::vector<double> times;
+    for (int round= 0; round < rounds; ++round) {
+        if (!run_round(ranks, times)) {
+            fprintf(stderr, "FAIL: round %d: a rank failed to initialise\n", round);
+            ret= 1;
+            break;
+        }
+        double sum= 0.0;
+        for (double t : times)
+            sum+= t;
+        printf("%-8d %-6s %12.1f %12.1f %12.1f\n", round, round == 0 ? "cold" : "warm",
+               *std::min_element(times.begin(), times.end()), sum / times.size(),
+               *std::max_element(times.begin(), times.end()));
+    }
+
+    std::string cleanup= std::string("rm -rf ") + cacheDir;
+    if (system(cleanup.c_str()) != 0)
+        fprintf(stderr, "Could not remove %s\n", cacheDir);
+    return ret;
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Tests the nominal frequency and the thermal throttle counters against a
+// fake sysfs tree, with the even CPUs on package 0 and the odd CPUs on
+// package 1. The test moves itself between the packages to check that the
+// counts of one package are not taken from the counters of another.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ftw.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "haswell_frequency.h"
+#include "test_helpers.h"
+
+static char gRoot[]= "/tmp/frequency-test-XXXXXX";
+
+// Sets the throttle counters of a package, as seen through all of its CPUs
+static void set_throttle(int numCpus, int package, unsigned long long events, unsigned long long milliseconds)
+{
+    for (int cpu= package; cpu < numCpus; cpu+= 2) {
+        char path[1024], value[32];
+        snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/thermal_throttle/package_throttle_count", gRoot, cpu);
+        snprintf(value, sizeof(value), "%llu\n", events);
+        write_file(path, value);
+        snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/thermal_throttle/package_throttle_total_time_ms", gRoot, cpu);
+        snprintf(value, sizeof(value), "%llu\n", milliseconds);
+        write_file(path, value);
+    }
+}
+
+static void make_tree(int numCpus)
+{
+    for (int cpu= 0; cpu < numCpus; ++cpu) {
+        char path[1024], value[32];
+        snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/topology", gRoot, cpu);
+        make_dirs(path);
+        snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/thermal_throttle", gRoot, cpu);
+        make_dirs(path);
+        snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/topology/physical_package_id", gRoot, cpu);
+        snprintf(value, sizeof(value), "%d\n", cpu % 2);
+        write_file(path, value);
+    }
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu0/cpufreq", gRoot);
+    make_dirs(path);
+    snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu0/cpufreq/base_frequency", gRoot);
+    write_file(path, "2300000\n");
+    set_throttle(numCpus, 0, 5, 100);
+    set_throttle(numCpus, 1, 40, 2000);
+}
+
+static bool run_on(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0 && sched_getcpu() == cpu;
+}
+
+static void check_throttle(int expectedPackage, unsigned long long events, unsigned long long milliseconds)
+{
+    Frequency::Throttle throttle;
+    const int package= Frequency::read_throttle(&throttle);
+    if (package != expectedPackage)
+        FAIL("expected the counters of package %d, got %d", expectedPackage, package);
+    if (throttle.events != events || throttle.milliseconds != milliseconds)
+        FAIL("expected %llu throttle events for %llu ms on package %d, got %llu for %llu ms",
+             events, milliseconds, package,
+             static_cast<unsigned long long>(throttle.events),
+             static_cast<unsigned long long>(throttle.milliseconds));
+}
+
+int main()
+{
+    if (mkdtemp(gRoot) == NULL)
+        FAIL("mkdtemp: %s", strerror(errno));
+    const int numCpus= static_cast<int>(sysconf(_SC_NPROCESSORS_CONF));
+    make_tree(numCpus);
+    setenv("ARM_MAP_THERMAL_SYSFS_ROOT", gRoot, 1);
+
+    if (!run_on(0))
+        FAIL("could not run on CPU 0");
+    if (!Frequency::open())
+        FAIL("expected to find the throttle counters");
+    if (Frequency::nominal_hz() != 2.3e9)
+        FAIL("expected a nominal frequency of 2.3 GHz, got %g", Frequency::nominal_hz());
+
+    // The first read is the baseline
+    check_throttle(0, 0, 0);
+    set_throttle(numCpus, 0, 8, 160);
+    check_throttle(0, 3, 60);
+    check_throttle(0, 0, 0);
+
+    // Moving to the other package starts again from its counters
+    unsigned long long totalEvents= 3, totalMilliseconds= 60;
+    if (numCpus > 1 && run_on(1)) {
+        check_throttle(1, 0, 0);
+        set_throttle(numCpus, 1, 41, 2010);
+        check_throttle(1, 1, 10);
+        totalEvents+= 1;
+        totalMilliseconds+= 10;
+    } else {
+        printf("Only one CPU: not testing a move between packages.\n");
+    }
+    const Frequency::Throttle total= Frequency::total_throttle();
+    if (total.events != totalEvents || total.milliseconds != totalMilliseconds)
+        FAIL("expected %llu throttle events for %llu ms in total, got %llu for %llu ms",
+             totalEvents, totalMilliseconds,
+             static_cast<unsigned long long>(total.events),
+             static_cast<unsigned long long>(total.milliseconds));
+    // Every package is read for the node, whichever the process ran on
+    int throttledPackages;
+    const Frequency::Throttle node= Frequency::node_throttle(&throttledPackages);
+    if (node.events != totalEvents || node.milliseconds != totalMilliseconds ||
+        throttledPackages != (totalEvents > 3 ? 2 : 1))
+        FAIL("expected %llu throttle events for %llu ms on the node, got %llu for %llu ms on %d packages",
+             totalEvents, totalMilliseconds,
+             static_cast<unsigned long long>(node.events),
+             static_cast<unsigned long long>(node.milliseconds), throttledPackages);
+    Frequency::close();
+
+    // Without the counters or cpufreq, throttling reads as 0 and the nominal
+    // frequency is found some other way
+    remove_fake_sysfs(gRoot);
+    mkdir(gRoot, 0755);
+    if (Frequency::open())
+        FAIL("expected no throttle counters in an empty tree");
+    check_throttle(-1, 0, 0);
+#if defined(__x86_64__)
+    if (Frequency::nominal_hz() < 1e8 || Frequency::nominal_hz() > 1e10)
+        FAIL("expected a plausible nominal frequency, got %g Hz", Frequency::nominal_hz());
+#endif
+    printf("Nominal frequency %.2f GHz\n", Frequency::nominal_hz() / 1e9);
+    Frequency::close();
+    rmdir(gRoot);
+
+    printf("PASS\n");
+    return 0;
+}
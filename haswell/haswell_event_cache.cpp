@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "haswell_event_cache.h"
+#include "papi.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace EventCache {
+
+  // Bump if the layout of the file changes
+  static const std::uint32_t CACHE_VERSION= 1;
+  static const char CACHE_MAGIC[8]= "HSWEVTC";
+
+  static const int MAX_KEY_LEN= 128;
+  static const int MAX_NAME_LEN= 120;
+
+  // The file is a header followed by numEntries entries
+  struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t numEntries;
+    std::int32_t numCounters;
+    std::int32_t reserved;
+    char key[MAX_KEY_LEN];
+  };
+
+  struct Entry {
+    char name[MAX_NAME_LEN];
+    std::int32_t code;
+    std::int32_t reserved;
+  };
+
+  static char gKey[MAX_KEY_LEN];
+  static char gPath[4096];
+  static char gLockPath[4096];
+
+  static const Header* gMapped= nullptr;
+  static size_t gMappedSize= 0;
+  static int gLockFd= -1;
+
+  // FNV-1a, only used to make the file name unique per key. The full key is
+  // stored in the header and checked when the file is mapped
+  static std::uint64_t hash_key(const char* key)
+  {
+    std::uint64_t h= 14695981039346656037ULL;
+    for (const char* c= key; *c; ++c) {
+      h^= static_cast<unsigned char>(*c);
+      h*= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  static bool build_paths()
+  {
+    const PAPI_hw_info_t* hw= PAPI_get_hardware_info();
+    if (hw == nullptr)
+      return false;
+    // A truncated key could match the cache of another CPU, so no cache
+    int n= snprintf(gKey, sizeof(gKey), "%s/%d/%d/%d/papi-%d.%d.%d",
+                    hw->vendor_string, hw->cpuid_family, hw->cpuid_model,
+                    hw->cpuid_stepping, PAPI_VERSION_MAJOR(PAPI_VERSION),
+                    PAPI_VERSION_MINOR(PAPI_VERSION),
+                    PAPI_VERSION_REVISION(PAPI_VERSION));
+    if (n < 0 || n >= static_cast<int>(sizeof(gKey)))
+      return false;
+
+    const char* dir= haswell_membound_cache_dir();
+    n= snprintf(gPath, sizeof(gPath), "%s/haswell-papi-events-%u-%016llx.cache",
+                    dir, static_cast<unsigned>(getuid()),
+                    static_cast<unsigned long long>(hash_key(gKey)));
+    if (n < 0 || n >= static_cast<int>(sizeof(gPath)))
+      return false;
+    n= snprintf(gLockPath, sizeof(gLockPath), "%s.lock", gPath);
+    return n > 0 && n < static_cast<int>(sizeof(gLockPath));
+  }
+
+  static const Entry* entries()
+  {
+    return reinterpret_cast<const Entry*>(gMapped + 1);
+  }
+
+  static void unmap()
+  {
+    if (gMapped != nullptr) {
+      munmap(const_cast<Header*>(gMapped), gMappedSize);
+      gMapped= nullptr;
+      gMappedSize= 0;
+    }
+  }
+
+  // Maps the current cache file, replacing any previous mapping. A file that
+  // does not match our key and version is ignored, as is one that another
+  // user owns or could have written, since the codes in it are used as they
+  // are. The events are then resolved instead
+  static bool map()
+  {
+    unmap();
+    int fd= ::open(gPath, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1)
+      return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid() ||
+        (st.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+        st.st_size < static_cast<off_t>(sizeof(Header))) {
+      ::close(fd);
+      return false;
+    }
+    void* addr= mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED)
+      return false;
+
+    gMapped= static_cast<const Header*>(addr);
+    gMappedSize= st.st_size;
+
+    const size_t expected= sizeof(Header) + gMapped->numEntries * sizeof(Entry);
+    if (memcmp(gMapped->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        gMapped->version != CACHE_VERSION ||
+        strncmp(gMapped->key, gKey, MAX_KEY_LEN) != 0 ||
+        expected > gMappedSize) {
+      unmap();
+      return false;
+    }
+    return true;
+  }
+
+  bool open()
+  {
+    if (!build_paths())
+      return false;
+    return map();
+  }
+
+  bool lookup(const char* name, int* code)
+  {
+    if (gMapped == nullptr)
+      return false;
+    const Entry* e= entries();
+    for (std::uint32_t i= 0; i < gMapped->numEntries; ++i) {
+      if (strncmp(e[i].name, name, MAX_NAME_LEN) == 0) {
+        *code= e[i].code;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  int num_counters()
+  {
+    return gMapped == nullptr ? 0 : gMapped->numCounters;
+  }
+
+  bool lock()
+  {
+    if (gPath[0] == '\0' && !build_paths())
+      return false;
+    gLockFd= ::open(gLockPath, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if (gLockFd == -1)
+      return false;
+    if (flock(gLockFd, LOCK_EX) != 0) {
+      ::close(gLockFd);
+      gLockFd= -1;
+      return false;
+    }
+    map();
+    return true;
+  }
+
+  void store(const char* const* names, const int* codes, int count,
+             int numCounters)
+  {
+    if (gLockFd == -1)
+      return;
+
+    // Start from what is already cached, then add or replace our entries
+    std::vector<Entry> all;
+    if (gMapped != nullptr)
+      all.assign(entries(), entries() + gMapped->numEntries);
+    for (int i= 0; i < count; ++i) {
+      if (strlen(names[i]) >= static_cast<size_t>(MAX_NAME_LEN))
+        continue;
+      Entry entry;
+      memset(&entry, 0, sizeof(entry));
+      strncpy(entry.name, names[i], MAX_NAME_LEN - 1);
+      entry.code= codes[i];
+      bool replaced= false;
+      for (auto& existing : all) {
+        if (strncmp(existing.name, entry.name, MAX_NAME_LEN) == 0) {
+          existing= entry;
+          replaced= true;
+          break;
+        }
+      }
+      if (!replaced)
+        all.push_back(entry);
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version= CACHE_VERSION;
+    header.numEntries= all.size();
+    header.numCounters= numCounters;
+    memcpy(header.key, gKey, MAX_KEY_LEN);
+
+    // Write to a temporary file and rename it into place, so that a rank
+    // mapping the cache never sees a partially written file
+    std::vector<char> tmpPath(gPath, gPath + strlen(gPath));
+    const char suffix[]= ".XXXXXX";
+    tmpPath.insert(tmpPath.end(), suffix, suffix + sizeof(suffix));
+    int fd= mkstemp(tmpPath.data());
+    if (fd == -1)
+      return;
+    bool ok= write(fd, &header, sizeof(header)) == static_cast<ssize_t>(sizeof(header));
+    if (ok && !all.empty()) {
+      const ssize_t bytes= all.size() * sizeof(Entry);
+      ok= write(fd, all.data(), bytes) == bytes;
+    }
+    ok= (fchmod(fd, 0644) == 0) && ok;
+    ::close(fd);
+    if (!ok || rename(tmpPath.data(), gPath) != 0) {
+      unlink(tmpPath.data());
+      return;
+    }
+    map();
+  }
+
+  void unlock()
+  {
+    if (gLockFd != -1) {
+      flock(gLockFd, LOCK_UN);
+      ::close(gLockFd);
+      gLockFd= -1;
+    }
+  }
+
+  void close()
+  {
+    unlock();
+    unmap();
+  }
+
+} // namespace EventCache
+
+const char* haswell_membound_cache_dir()
+{
+  const char* dir= getenv("ARM_MAP_PAPI_CACHE_DIR");
+  if (dir == nullptr || *dir == '\0')
+    dir= getenv("TMPDIR");
+  if (dir == nullptr || *dir == '\0')
+    dir= "/tmp";
+  return dir;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HASWELL_EVENT_CACHE_H
+#define HASWELL_EVENT_CACHE_H
+
+///////////////////////////////////////////////////////////////////////////////
+// A node-local cache of the PAPI event codes resolved for event names.
+//
+// Resolving event names with PAPI_event_name_to_code is slow, and at scale
+// every rank on every node resolves exactly the same names. The cache is a
+// file, keyed on the CPU vendor/family/model/stepping and the PAPI version,
+// that is mapped read-only by every rank on the node. Only ranks that find a
+// name missing take the cache lock, and the first of these resolves and
+// publishes the names for the others.
+//
+// The cache directory is $ARM_MAP_PAPI_CACHE_DIR, then $TMPDIR, then /tmp.
+// If the cache can not be used then the callers fall back to resolving every
+// name themselves.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace EventCache {
+
+  // Maps the cache for the CPU of this node. Must be called after
+  // PAPI_library_init, as the key is built from PAPI's hardware information.
+  // Returns true if a cache file was found and mapped
+  bool open();
+
+  // Looks up the code for an event name. Returns true if the name is in the
+  // cache. A cached code of 0 means that PAPI could not resolve the name
+  bool lookup(const char* name, int* code);
+
+  // The number of hardware counters stored with the cache, or 0 if unknown
+  int num_counters();
+
+  // Takes the node-wide cache lock and re-maps the cache, so that names
+  // resolved by another rank while we were waiting become visible. Returns
+  // false if the lock could not be taken (the cache is then unusable)
+  bool lock();
+
+  // Adds the given names and codes to the cache and atomically replaces the
+  // cache file. Must be called with the lock held
+  void store(const char* const* names, const int* codes, int count,
+             int numCounters);
+
+  // Releases the cache lock
+  void unlock();
+
+  // Unmaps the cache and releases the lock if it is still held
+  void close();
+
+} // namespace EventCache
+
+// The directory for the files shared by the ranks on a node:
+// $ARM_MAP_PAPI_CACHE_DIR, then $TMPDIR, then /tmp
+const char* haswell_membound_cache_dir();
+
+#endif // HASWELL_EVENT_CACHE_H
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "haswell_frequency.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+namespace Frequency {
+
+  static const int MAX_CPUS= 4096;
+  static const int MAX_PACKAGES= 16;
+
+  // How long to watch the time stamp counter for, if the nominal frequency
+  // has to be measured
+  static const long MEASURE_NS= 10000000;
+
+  // The throttle counters of one package, read through one of its CPUs
+  struct Package {
+    int eventsFd;
+    int millisecondsFd;
+    std::uint64_t lastEvents;
+    std::uint64_t lastMilliseconds;
+    // The counters when they were opened
+    std::uint64_t openEvents;
+    std::uint64_t openMilliseconds;
+  };
+
+  // Where to find the CPUs, "/sys" unless overridden
+  static char gRoot[1024];
+
+  static double gNominalHz= 0.0;
+
+  // The package of each CPU, or -1
+  static short gPackageOfCpu[MAX_CPUS];
+  static Package gPackages[MAX_PACKAGES];
+  static bool gOpen= false;
+
+  // The package of the last read, whose counters the next read is relative
+  // to, or -1 before the first read
+  static int gLastPackage= -1;
+  static Throttle gTotal;
+
+  // Reads an unsigned decimal from the start of an open sysfs file. Returns
+  // false if there is none. Async-signal-safe
+  static bool read_uint64(int fd, std::uint64_t* value)
+  {
+    char buffer[32];
+    const ssize_t n= pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (n <= 0 || buffer[0] < '0' || buffer[0] > '9')
+      return false;
+    std::uint64_t v= 0;
+    for (ssize_t i= 0; i < n && buffer[i] >= '0' && buffer[i] <= '9'; ++i)
+      v= v * 10 + static_cast<std::uint64_t>(buffer[i] - '0');
+    *value= v;
+    return true;
+  }
+
+  // Reads an unsigned decimal from a file under the root. Returns false if
+  // it cannot be read
+  static bool read_file(const char* path, std::uint64_t* value)
+  {
+    char fullPath[1280];
+    snprintf(fullPath, sizeof(fullPath), "%s/%s", gRoot, path);
+    const int fd= ::open(fullPath, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      return false;
+    const bool ok= read_uint64(fd, value);
+    ::close(fd);
+    return ok;
+  }
+
+  static int open_counter(int cpu, const char* name)
+  {
+    char path[1280];
+    snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/thermal_throttle/%s", gRoot, cpu, name);
+    return ::open(path, O_RDONLY | O_CLOEXEC);
+  }
+
+  // The nominal frequency from "model name : ... @ 2.30GHz" in /proc/cpuinfo,
+  // which Intel processors put there, or 0
+  static double cpuinfo_hz()
+  {
+    FILE* file= fopen("/proc/cpuinfo", "r");
+    if (file == NULL)
+      return 0.0;
+    double hz= 0.0;
+    char line[512];
+    while (hz == 0.0 && fgets(line, sizeof(line), file) != NULL) {
+      if (strncmp(line, "model name", 10) != 0)
+        continue;
+      const char* at= strrchr(line, '@');
+      double ghz;
+      if (at != NULL && sscanf(at + 1, "%lfGHz", &ghz) == 1 && ghz > 0.0)
+        hz= ghz * 1e9;
+    }
+    fclose(file);
+    return hz;
+  }
+
+  // Counts the time stamp counter over a short interval, or returns 0 if
+  // there is none
+  static double measure_hz()
+  {
+#if defined(__x86_64__)
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const unsigned long long startTsc= __rdtsc();
+    long elapsedNs;
+    do {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      elapsedNs= (now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec);
+    } while (elapsedNs < MEASURE_NS);
+    return static_cast<double>(__rdtsc() - startTsc) * 1e9 / static_cast<double>(elapsedNs);
+#else
+    return 0.0;
+#endif
+  }
+
+  static double find_nominal_hz()
+  {
+    // In kHz, from the intel_pstate driver
+    std::uint64_t khz;
+    if (read_file("devices/system/cpu/cpu0/cpufreq/base_frequency", &khz) && khz > 0)
+      return khz * 1e3;
+    const double hz= cpuinfo_hz();
+    return hz > 0.0 ? hz : measure_hz();
+  }
+
+  bool open()
+  {
+    const char* root= getenv("ARM_MAP_THERMAL_SYSFS_ROOT");
+    snprintf(gRoot, sizeof(gRoot), "%s", root != NULL && *root != '\0' ? root : "/sys");
+    gNominalHz= find_nominal_hz();
+
+    for (int p= 0; p < MAX_PACKAGES; ++p) {
+      gPackages[p].eventsFd= -1;
+      gPackages[p].millisecondsFd= -1;
+    }
+    gLastPackage= -1;
+    gTotal= Throttle();
+    bool found= false;
+    for (int cpu= 0; cpu < MAX_CPUS; ++cpu)
+      gPackageOfCpu[cpu]= -1;
+    // The counters of a package read the same through each of its CPUs, so
+    // they are opened through the first CPU found on each package
+    for (int cpu= 0; cpu < MAX_CPUS; ++cpu) {
+      char dir[1280];
+      snprintf(dir, sizeof(dir), "%s/devices/system/cpu/cpu%d", gRoot, cpu);
+      if (access(dir, F_OK) != 0)
+        break;
+      // Offline CPUs have no topology
+      char path[128];
+      snprintf(path, sizeof(path), "devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+      std::uint64_t package;
+      if (!read_file(path, &package) || package >= static_cast<std::uint64_t>(MAX_PACKAGES))
+        continue;
+      gPackageOfCpu[cpu]= static_cast<short>(package);
+      Package& counters= gPackages[package];
+      if (counters.eventsFd != -1)
+        continue;
+      counters.eventsFd= open_counter(cpu, "package_throttle_count");
+      if (counters.eventsFd == -1)
+        continue;
+      counters.millisecondsFd= open_counter(cpu, "package_throttle_total_time_ms");
+      counters.openEvents= counters.openMilliseconds= 0;
+      read_uint64(counters.eventsFd, &counters.openEvents);
+      if (counters.millisecondsFd != -1)
+        read_uint64(counters.millisecondsFd, &counters.openMilliseconds);
+      found= true;
+    }
+    gOpen= found;
+    return found;
+  }
+
+  double nominal_hz()
+  {
+    return gNominalHz;
+  }
+
+  int read_throttle(Throttle* throttle)
+  {
+    *throttle= Throttle();
+    if (!gOpen)
+      return -1;
+    const int cpu= sched_getcpu();
+    const int package= cpu >= 0 && cpu < MAX_CPUS ? gPackageOfCpu[cpu] : -1;
+    if (package < 0 || gPackages[package].eventsFd == -1)
+      return -1;
+
+    Package& counters= gPackages[package];
+    std::uint64_t events= 0, milliseconds= 0;
+    if (!read_uint64(counters.eventsFd, &events))
+      return -1;
+    if (counters.millisecondsFd != -1)
+      read_uint64(counters.millisecondsFd, &milliseconds);
+    // Only counted from the second read on the same package, as the counters
+    // of another package say nothing about the time since the last read
+    if (package == gLastPackage) {
+      throttle->events= events >= counters.lastEvents ? events - counters.lastEvents : 0;
+      throttle->milliseconds= milliseconds >= counters.lastMilliseconds ?
+        milliseconds - counters.lastMilliseconds : 0;
+      gTotal.events+= throttle->events;
+      gTotal.milliseconds+= throttle->milliseconds;
+    }
+    counters.lastEvents= events;
+    counters.lastMilliseconds= milliseconds;
+    gLastPackage= package;
+    return package;
+  }
+
+  Throttle total_throttle()
+  {
+    return gTotal;
+  }
+
+  Throttle node_throttle(int* throttledPackages)
+  {
+    Throttle node= Throttle();
+    *throttledPackages= 0;
+    for (int p= 0; gOpen && p < MAX_PACKAGES; ++p) {
+      const Package& counters= gPackages[p];
+      std::uint64_t events, milliseconds= 0;
+      if (counters.eventsFd == -1 || !read_uint64(counters.eventsFd, &events) ||
+          events <= counters.openEvents)
+        continue;
+      if (counters.millisecondsFd != -1 && read_uint64(counters.millisecondsFd, &milliseconds) &&
+          milliseconds > counters.openMilliseconds)
+        node.milliseconds+= milliseconds - counters.openMilliseconds;
+      node.events+= events - counters.openEvents;
+      ++*throttledPackages;
+    }
+    return node;
+  }
+
+  void close()
+  {
+    for (int p= 0; p < MAX_PACKAGES; ++p) {
+      if (gPackages[p].eventsFd != -1)
+        ::close(gPackages[p].eventsFd);
+      if (gPackages[p].millisecondsFd != -1)
+        ::close(gPackages[p].millisecondsFd);
+      gPackages[p].eventsFd= -1;
+      gPackages[p].millisecondsFd= -1;
+    }
+    gOpen= false;
+  }
+
+} // namespace Frequency
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HASWELL_FREQUENCY_H
+#define HASWELL_FREQUENCY_H
+
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////////
+// What is needed besides the counters to tell a slow core from a slow program:
+// the rate of the time stamp counter, and the thermal throttling of the
+// package the process runs on.
+//
+// The reference cycles (UNHALTED_REFERENCE_CYCLES) count at the rate of the
+// time stamp counter, the nominal frequency of the core, whatever its actual
+// frequency, so the core cycles over the reference cycles is the ratio of the
+// actual to the nominal frequency, like APERF over MPERF. The nominal
+// frequency is read from cpufreq (base_frequency) when it is there, and
+// measured from the time stamp counter otherwise.
+//
+// The kernel counts the times a package has been throttled because it was too
+// hot, and on recent kernels for how long, in
+// /sys/devices/system/cpu/cpu<N>/thermal_throttle. They are opened once for
+// each package, through its first CPU, and read for the package of the CPU
+// the calling thread is on, so the counts follow the process if it moves to
+// another package. ARM_MAP_THERMAL_SYSFS_ROOT replaces /sys, for testing with
+// synthetic files.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace Frequency {
+
+  // The increase in the throttle counters of a package since the last read
+  struct Throttle {
+    std::uint64_t events;
+    // 0 if the kernel does not count the time
+    std::uint64_t milliseconds;
+  };
+
+  // Finds the nominal frequency and opens the throttle counters of every
+  // package, through the first CPU of each. Returns false if there are no
+  // throttle counters, in which case throttling reads as 0
+  bool open();
+
+  // The rate of the time stamp counter, and of the reference cycles, in Hz,
+  // or 0 if it is not known
+  double nominal_hz();
+
+  // Sets throttle to the increase since the last call, or to 0 on the first
+  // call and when the calling thread has moved to another package. The
+  // package the counters are for is returned. Async-signal-safe
+  int read_throttle(Throttle* throttle);
+
+  // The throttling of the package since open(), added up over the calls to
+  // read_throttle
+  Throttle total_throttle();
+
+  // The throttling of every package of the node since open(), read now, and
+  // the number of packages that were throttled
+  Throttle node_throttle(int* throttledPackages);
+
+  // Closes the throttle counters
+  void close();
+
+} // namespace Frequency
+
+#endif // HASWELL_FREQUENCY_H
@@ -0,0 +1,869 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "haswell_load_latency.h"
+#include "alloc_blocks.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace LoadLatency {
+
+  // MEM_TRANS_RETIRED.LOAD_LATENCY, with the latency threshold in config1
+  static const std::uint64_t LOAD_LATENCY_CONFIG= 0x01cd;
+  static const std::uint64_t DEFAULT_THRESHOLD= 3;
+  static const std::uint64_t DEFAULT_PEBS_PERIOD= 1000;
+  static const std::uint64_t DEFAULT_SOFTWARE_PERIOD= 1;
+  // Data pages of the ring buffer of each CPU, a power of 2
+  static const std::size_t RING_PAGES= 64;
+  // CPUs beyond this many that the process may run on are not sampled
+  static const int MAX_CPUS= 256;
+
+  // Objects seen during the run. The entries of those that are no longer
+  // mapped are kept for the report until they are needed for new objects
+  static const int MAX_OBJECTS= 4096;
+  // Objects mapped at once, of which up to half are heap blocks
+  static const int MAX_LIVE= 2048;
+  static const int MAX_NAME= 96;
+  // Samples whose address is not in a known object wait here until the
+  // helper thread reads the objects again
+  static const int MAX_PENDING= 4096;
+  // How often the helper thread reads the objects
+  static const int REFRESH_INTERVAL_MS= 200;
+
+  enum Kind {
+    REGION=0,  // A mapping of /proc/self/maps
+    BLOCK      // A heap block, from ../alloc/lib-alloc.so
+  };
+
+  struct Object {
+    std::uint64_t start;
+    std::uint64_t end;
+    Kind kind;
+    bool live;
+    // The path of a region, empty for anonymous memory, or where a block was
+    // allocated
+    char name[MAX_NAME];
+    std::uint64_t samples;
+    std::uint64_t weight;
+    std::uint64_t periodSamples;
+    std::uint64_t periodWeight;
+  };
+
+  // An object as the helper thread found it
+  struct Mapped {
+    std::uint64_t start;
+    std::uint64_t end;
+    Kind kind;
+    char name[MAX_NAME];
+  };
+
+  struct Ring {
+    int fd;
+    // The data pages, which follow the metadata page
+    char* data;
+  };
+
+  static Mode gMode= OFF;
+  static long gPageSize= 0;
+  static std::uint32_t gPid= 0;
+  static Ring gRings[MAX_CPUS];
+  static int gNumRings= 0;
+  static std::size_t gRingSize= 0;
+
+  // Every object seen during the run, including those no longer mapped
+  static Object gObjects[MAX_OBJECTS];
+  static int gNumObjects= 0;
+  // The objects that are currently mapped, each sorted by start address.
+  // Blocks are within regions, and are looked up first
+  static int gLiveBlocks[MAX_LIVE];
+  static int gNumLiveBlocks= 0;
+  static int gLiveRegions[MAX_LIVE];
+  static int gNumLiveRegions= 0;
+
+  static std::uint64_t gPendingAddrs[MAX_PENDING];
+  static std::uint64_t gPendingWeights[MAX_PENDING];
+  static int gNumPending= 0;
+
+  // The objects as last read by the helper thread: the blocks, then the
+  // regions. The helper only writes them while gPublished == gConsumed, and
+  // the sampler only reads them while they differ
+  static Mapped gMapped[MAX_LIVE];
+  static int gNumMapped= 0;
+  static unsigned gPublished= 0;
+  static unsigned gConsumed= 0;
+  // The sampler asks the helper thread to read the objects now by
+  // incrementing gRequest. gMappedRequest is the request that gMapped was
+  // read after, so it includes the objects of the samples pending then
+  static unsigned gRequest= 0;
+  static unsigned gMappedRequest= 0;
+  static bool gRefreshRequested= false;
+  static int gPendingAtRequest= 0;
+
+  static pthread_t gHelper;
+  static bool gHelperStarted= false;
+  static int gStopPipe[2]= { -1, -1 };
+  static int gWakePipe[2]= { -1, -1 };
+
+  // The heap blocks of lib-alloc.so, or null if it is not preloaded
+  static const alloc_blocks* gAllocBlocks= nullptr;
+  static alloc_block gBlocks[ALLOC_BLOCKS_CAPACITY];
+  static char gMapsBuffer[16384];
+
+  // Totals over the run, including the samples that could not be attributed
+  static std::uint64_t gSamples= 0;
+  static std::uint64_t gWeight= 0;
+  static std::uint64_t gPeriodSamples= 0;
+  static std::uint64_t gPeriodWeight= 0;
+  static std::uint64_t gUnattributed= 0;
+  static std::uint64_t gLost= 0;
+  // The objects whose entries were reused for new objects, and their samples
+  static std::uint64_t gRecycled= 0;
+  static std::uint64_t gRecycledSamples= 0;
+  static std::uint64_t gRecycledWeight= 0;
+
+  static std::uint64_t env_u64(const char* name, std::uint64_t defaultValue)
+  {
+    const char* value= getenv(name);
+    if (value == nullptr || *value == '\0')
+      return defaultValue;
+    return strtoull(value, nullptr, 0);
+  }
+
+  //! Opens an event for the calling thread, and the threads it creates, while
+  //! they run on cpu. An event for every CPU is needed, as the kernel does not
+  //! map the ring buffer of an inherited event for any CPU
+  static int open_event(perf_event_attr* attr, int cpu)
+  {
+    attr->inherit= 1;
+    return syscall(__NR_perf_event_open, attr, 0, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+  }
+
+  static int open_pebs(int cpu)
+  {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size= sizeof(attr);
+    attr.type= PERF_TYPE_RAW;
+    attr.config= LOAD_LATENCY_CONFIG;
+    attr.config1= env_u64("ARM_MAP_LOAD_LATENCY_THRESHOLD", DEFAULT_THRESHOLD);
+    attr.sample_period= env_u64("ARM_MAP_LOAD_LATENCY_PERIOD", DEFAULT_PEBS_PERIOD);
+    attr.sample_type= PERF_SAMPLE_TID | PERF_SAMPLE_ADDR | PERF_SAMPLE_WEIGHT;
+    attr.precise_ip= 2;
+    attr.exclude_kernel= 1;
+    attr.exclude_hv= 1;
+    attr.disabled= 1;
+    return open_event(&attr, cpu);
+  }
+
+  static int open_software(int cpu)
+  {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size= sizeof(attr);
+    attr.type= PERF_TYPE_SOFTWARE;
+    attr.config= PERF_COUNT_SW_PAGE_FAULTS;
+    attr.sample_period= env_u64("ARM_MAP_LOAD_LATENCY_PERIOD", DEFAULT_SOFTWARE_PERIOD);
+    attr.sample_type= PERF_SAMPLE_TID | PERF_SAMPLE_ADDR | PERF_SAMPLE_WEIGHT;
+    attr.exclude_kernel= 1;
+    attr.exclude_hv= 1;
+    attr.disabled= 1;
+    return open_event(&attr, cpu);
+  }
+
+  //! Returns the index into live of the object containing addr, or -1
+  static int find_live(const int* live, int numLive, std::uint64_t addr)
+  {
+    int low= 0, high= numLive - 1;
+    while (low <= high) {
+      const int mid= (low + high) / 2;
+      const Object& object= gObjects[live[mid]];
+      if (addr < object.start)
+        high= mid - 1;
+      else if (addr >= object.end)
+        low= mid + 1;
+      else
+        return mid;
+    }
+    return -1;
+  }
+
+  //! Returns the live object containing addr, a block rather than the region
+  //! it is in, or -1
+  static int find_object(std::uint64_t addr)
+  {
+    int live= find_live(gLiveBlocks, gNumLiveBlocks, addr);
+    if (live != -1)
+      return gLiveBlocks[live];
+    live= find_live(gLiveRegions, gNumLiveRegions, addr);
+    return live == -1 ? -1 : gLiveRegions[live];
+  }
+
+  // The live objects that merge_mapped has found still mapped
+  static bool gKept[MAX_OBJECTS];
+
+  static void add_to_object(Object& object, std::uint64_t weight)
+  {
+    object.samples++;
+    object.weight+= weight;
+    object.periodSamples++;
+    object.periodWeight+= weight;
+  }
+
+  //! Returns the live object that mapped is, or -1 if it is new. Blocks are
+  //! reallocated in place, so only their start and where they were allocated
+  //! have to match. Regions grow, shrink and are merged with the mappings
+  //! next to them by the kernel, so a region is the first one with the same
+  //! name that it overlaps
+  static int find_mapped(const Mapped& mapped)
+  {
+    const bool block= mapped.kind == BLOCK;
+    const int* live= block ? gLiveBlocks : gLiveRegions;
+    const int numLive= block ? gNumLiveBlocks : gNumLiveRegions;
+    // The first object that ends after the start of mapped
+    int low= 0, high= numLive;
+    while (low < high) {
+      const int mid= (low + high) / 2;
+      if (gObjects[live[mid]].end <= mapped.start)
+        low= mid + 1;
+      else
+        high= mid;
+    }
+    for (int i= low; i < numLive && gObjects[live[i]].start < mapped.end; ++i) {
+      const Object& object= gObjects[live[i]];
+      if ((!block || object.start == mapped.start) && !gKept[live[i]] &&
+          strcmp(object.name, mapped.name) == 0)
+        return live[i];
+    }
+    return -1;
+  }
+
+  //! Replaces the live objects by those in gMapped, keeping the counts of the
+  //! ones still mapped, and attributes the pending samples.
+  //! Async-signal-safe
+  static void merge_mapped()
+  {
+    static int newLive[MAX_LIVE];
+    static int dead[MAX_OBJECTS];
+
+    int numNew= 0;
+    for (int i= 0; i < gNumMapped; ++i) {
+      newLive[i]= find_mapped(gMapped[i]);
+      if (newLive[i] == -1)
+        numNew++;
+      else
+        gKept[newLive[i]]= true;
+    }
+    for (int i= 0; i < gNumLiveBlocks + gNumLiveRegions; ++i) {
+      const int index= i < gNumLiveBlocks ? gLiveBlocks[i] : gLiveRegions[i - gNumLiveBlocks];
+      gObjects[index].live= gKept[index];
+      gKept[index]= false;
+    }
+    // Only now, as find_mapped needs the old ranges
+    for (int i= 0; i < gNumMapped; ++i) {
+      if (newLive[i] != -1) {
+        gObjects[newLive[i]].start= gMapped[i].start;
+        gObjects[newLive[i]].end= gMapped[i].end;
+      }
+    }
+
+    // New objects take unused entries, then those of the dead objects with
+    // the least latency
+    int numDead= 0;
+    if (numNew > MAX_OBJECTS - gNumObjects) {
+      for (int i= 0; i < gNumObjects; ++i) {
+        if (!gObjects[i].live)
+          dead[numDead++]= i;
+      }
+      std::sort(dead, dead + numDead, [](int a, int b) {
+        return gObjects[a].weight < gObjects[b].weight;
+      });
+    }
+    int nextDead= 0;
+    for (int i= 0; i < gNumMapped; ++i) {
+      if (newLive[i] != -1)
+        continue;
+      int index;
+      if (gNumObjects < MAX_OBJECTS) {
+        index= gNumObjects++;
+      } else if (nextDead < numDead) {
+        index= dead[nextDead++];
+        gRecycled++;
+        gRecycledSamples+= gObjects[index].samples;
+        gRecycledWeight+= gObjects[index].weight;
+      } else {
+        continue;
+      }
+      Object& object= gObjects[index];
+      memset(&object, 0, sizeof(object));
+      object.start= gMapped[i].start;
+      object.end= gMapped[i].end;
+      object.kind= gMapped[i].kind;
+      object.live= true;
+      memcpy(object.name, gMapped[i].name, MAX_NAME);
+      newLive[i]= index;
+    }
+
+    gNumLiveBlocks= 0;
+    gNumLiveRegions= 0;
+    for (int i= 0; i < gNumMapped; ++i) {
+      if (newLive[i] == -1)
+        continue;
+      if (gMapped[i].kind == BLOCK)
+        gLiveBlocks[gNumLiveBlocks++]= newLive[i];
+      else
+        gLiveRegions[gNumLiveRegions++]= newLive[i];
+    }
+
+    // The objects were read after the samples pending at the request they
+    // answer were taken, so those still not found never will be. Later ones
+    // wait for the next
+    const bool answered= gMappedRequest == gRequest;
+    const int numPending= gNumPending;
+    int numStillPending= 0;
+    int stillPendingAtRequest= 0;
+    for (int i= 0; i < numPending; ++i) {
+      const int object= find_object(gPendingAddrs[i]);
+      if (object != -1) {
+        add_to_object(gObjects[object], gPendingWeights[i]);
+      } else if (answered && i < gPendingAtRequest) {
+        gUnattributed++;
+      } else {
+        stillPendingAtRequest+= i < gPendingAtRequest;
+        gPendingAddrs[numStillPending]= gPendingAddrs[i];
+        gPendingWeights[numStillPending]= gPendingWeights[i];
+        numStillPending++;
+      }
+    }
+    gNumPending= numStillPending;
+    gPendingAtRequest= stillPendingAtRequest;
+    if (answered)
+      gRefreshRequested= false;
+  }
+
+  //! Takes the objects the helper thread has read since the last call, if
+  //! any. Async-signal-safe
+  static bool merge_published()
+  {
+    const unsigned published= __atomic_load_n(&gPublished, __ATOMIC_ACQUIRE);
+    if (published == gConsumed)
+      return false;
+    merge_mapped();
+    __atomic_store_n(&gConsumed, published, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  //! Wakes the helper thread to read the objects for the pending samples,
+  //! unless it has been asked already. Async-signal-safe
+  static void request_refresh()
+  {
+    if (gRefreshRequested || !gHelperStarted)
+      return;
+    gPendingAtRequest= gNumPending;
+    __atomic_store_n(&gRequest, gRequest + 1, __ATOMIC_RELEASE);
+    gRefreshRequested= true;
+    // The pipe is non-blocking, and if it is full the thread is awake anyway
+    const int savedErrno= errno;
+    if (write(gWakePipe[1], "x", 1) != 1 && errno != EAGAIN)
+      gRefreshRequested= false;
+    errno= savedErrno;
+  }
+
+  //! Adds a sample, or keeps it pending until its object is known. Returns
+  //! false if the sample has to be left in the ring buffer until the helper
+  //! thread has read the objects again
+  static bool add_sample(std::uint64_t addr, std::uint64_t weight)
+  {
+    int object= find_object(addr);
+    if (object == -1 && gNumPending == MAX_PENDING) {
+      // Many new objects are being used, so take the latest objects, or ask
+      // for them
+      merge_published();
+      if (gNumPending == MAX_PENDING) {
+        request_refresh();
+        return false;
+      }
+      object= find_object(addr);
+    }
+
+    // Only PEBS gives a latency
+    if (weight == 0)
+      weight= 1;
+    gSamples++;
+    gWeight+= weight;
+    gPeriodSamples++;
+    gPeriodWeight+= weight;
+    if (object != -1) {
+      add_to_object(gObjects[object], weight);
+    } else {
+      gPendingAddrs[gNumPending]= addr;
+      gPendingWeights[gNumPending]= weight;
+      gNumPending++;
+    }
+    return true;
+  }
+
+  //! Parses a line of /proc/self/maps into start, end and name. The name is
+  //! the path, a pseudo-path such as [heap], or empty for anonymous memory
+  static bool parse_maps_line(const char* line, const char* lineEnd,
+                              std::uint64_t* start, std::uint64_t* end,
+                              const char** name, std::size_t* nameLen)
+  {
+    char* p;
+    *start= strtoull(line, &p, 16);
+    if (p >= lineEnd || *p != '-')
+      return false;
+    *end= strtoull(p + 1, &p, 16);
+    // Skip the permissions, offset, device and inode
+    for (int field= 0; field < 4; ++field) {
+      while (p < lineEnd && *p == ' ')
+        p++;
+      while (p < lineEnd && *p != ' ')
+        p++;
+    }
+    while (p < lineEnd && *p == ' ')
+      p++;
+    *name= p;
+    *nameLen= lineEnd - p;
+    return *end > *start;
+  }
+
+  //! Describes where a heap block was allocated: the function and offset if
+  //! its symbol is exported, or else the file and offset
+  static void describe_site(std::uintptr_t site, char* out, std::size_t size)
+  {
+    Dl_info info;
+    if (dladdr(reinterpret_cast<void*>(site), &info) == 0 || info.dli_fname == nullptr) {
+      snprintf(out, size, "0x%llx", static_cast<unsigned long long>(site));
+    } else if (info.dli_sname != nullptr && info.dli_saddr != nullptr) {
+      snprintf(out, size, "%s+0x%llx", info.dli_sname,
+               static_cast<unsigned long long>(site - reinterpret_cast<std::uintptr_t>(info.dli_saddr)));
+    } else {
+      const char* file= strrchr(info.dli_fname, '/');
+      snprintf(out, size, "%s+0x%llx", file != nullptr ? file + 1 : info.dli_fname,
+               static_cast<unsigned long long>(site - reinterpret_cast<std::uintptr_t>(info.dli_fbase)));
+    }
+  }
+
+  //! Reads the heap blocks and the regions of /proc/self/maps into gMapped
+  static void read_mapped()
+  {
+    gMappedRequest= __atomic_load_n(&gRequest, __ATOMIC_ACQUIRE);
+    int numMapped= 0;
+
+    if (gAllocBlocks != nullptr) {
+      int numBlocks= 0;
+      for (std::size_t i= 0; i < ALLOC_BLOCKS_CAPACITY; ++i) {
+        if (alloc_blocks_read(gAllocBlocks, i, &gBlocks[numBlocks]))
+          numBlocks++;
+      }
+      std::sort(gBlocks, gBlocks + numBlocks, [](const alloc_block& a, const alloc_block& b) {
+        return a.start < b.start;
+      });
+      std::uint64_t lastEnd= 0;
+      for (int i= 0; i < numBlocks && numMapped < MAX_LIVE / 2; ++i) {
+        // A block freed and allocated again while the table was read may
+        // overlap the block that replaced it
+        if (gBlocks[i].start < lastEnd)
+          continue;
+        Mapped& mapped= gMapped[numMapped++];
+        mapped.start= gBlocks[i].start;
+        mapped.end= gBlocks[i].start + gBlocks[i].size;
+        mapped.kind= BLOCK;
+        describe_site(gBlocks[i].site, mapped.name, sizeof(mapped.name));
+        lastEnd= mapped.end;
+      }
+    }
+
+    int fd= open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+      std::size_t used= 0;
+      for (;;) {
+        ssize_t len= read(fd, gMapsBuffer + used, sizeof(gMapsBuffer) - used);
+        if (len <= 0)
+          break;
+        used+= len;
+        // Parse the complete lines, and keep any partial line for the next read
+        char* line= gMapsBuffer;
+        char* bufferEnd= gMapsBuffer + used;
+        char* newline;
+        while ((newline= static_cast<char*>(memchr(line, '\n', bufferEnd - line))) != nullptr) {
+          std::uint64_t start, end;
+          const char* name;
+          std::size_t nameLen;
+          // The kernel lists the mappings in address order
+          if (numMapped < MAX_LIVE &&
+              parse_maps_line(line, newline, &start, &end, &name, &nameLen)) {
+            Mapped& mapped= gMapped[numMapped++];
+            nameLen= std::min(nameLen, static_cast<std::size_t>(MAX_NAME - 1));
+            mapped.start= start;
+            mapped.end= end;
+            mapped.kind= REGION;
+            memcpy(mapped.name, name, nameLen);
+            mapped.name[nameLen]= '\0';
+          }
+          line= newline + 1;
+        }
+        used= bufferEnd - line;
+        memmove(gMapsBuffer, line, used);
+        // A line longer than the buffer is dropped
+        if (used == sizeof(gMapsBuffer))
+          used= 0;
+      }
+      close(fd);
+    }
+    gNumMapped= numMapped;
+  }
+
+  //! Reads and merges the objects on the calling thread, while the helper
+  //! thread is not running
+  static void refresh_now()
+  {
+    gPendingAtRequest= gNumPending;
+    read_mapped();
+    merge_mapped();
+    gConsumed= gPublished;
+  }
+
+  //! Reads the objects whenever the sampler has taken the last ones, every
+  //! REFRESH_INTERVAL_MS or sooner if the sampler asks
+  static void* helper_thread(void*)
+  {
+    for (;;) {
+      if (__atomic_load_n(&gConsumed, __ATOMIC_ACQUIRE) == gPublished) {
+        read_mapped();
+        __atomic_store_n(&gPublished, gPublished + 1, __ATOMIC_RELEASE);
+      }
+      pollfd fds[2]= { { gStopPipe[0], POLLIN, 0 }, { gWakePipe[0], POLLIN, 0 } };
+      if (poll(fds, 2, REFRESH_INTERVAL_MS) > 0) {
+        if (fds[0].revents != 0)
+          break;
+        char buffer[64];
+        while (read(gWakePipe[0], buffer, sizeof(buffer)) > 0) {
+        }
+      }
+    }
+    return nullptr;
+  }
+
+  static void close_pipes()
+  {
+    for (int* fd : { &gStopPipe[0], &gStopPipe[1], &gWakePipe[0], &gWakePipe[1] }) {
+      if (*fd != -1)
+        close(*fd);
+      *fd= -1;
+    }
+  }
+
+  //! Starts the helper thread with all signals blocked, so that the sampler
+  //! never runs on it part way through reading the objects
+  static bool start_helper()
+  {
+    // Non-blocking, so that the sampler never waits to wake the thread
+    if (pipe2(gStopPipe, O_CLOEXEC) != 0 || pipe2(gWakePipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+      close_pipes();
+      return false;
+    }
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int ret= pthread_create(&gHelper, nullptr, helper_thread, nullptr);
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    if (ret != 0) {
+      close_pipes();
+      errno= ret;
+      return false;
+    }
+    gHelperStarted= true;
+    return true;
+  }
+
+  static void stop_helper()
+  {
+    if (!gHelperStarted)
+      return;
+    if (write(gStopPipe[1], "x", 1) == 1)
+      pthread_join(gHelper, nullptr);
+    close_pipes();
+    gHelperStarted= false;
+  }
+
+  static void close_rings()
+  {
+    for (int i= 0; i < gNumRings; ++i) {
+      munmap(gRings[i].data - gPageSize, gRingSize + gPageSize);
+      close(gRings[i].fd);
+    }
+    gNumRings= 0;
+  }
+
+  //! Opens and maps an event of the given mode for each CPU in cpus. Sets
+  //! mapFailed if an event opened but its ring buffer could not be mapped
+  static bool open_rings(Mode mode, const cpu_set_t& cpus, bool* mapFailed)
+  {
+    for (int cpu= 0; cpu < CPU_SETSIZE && gNumRings < MAX_CPUS; ++cpu) {
+      if (!CPU_ISSET(cpu, &cpus))
+        continue;
+      const int fd= mode == PEBS ? open_pebs(cpu) : open_software(cpu);
+      if (fd == -1) {
+        const int error= errno;
+        close_rings();
+        errno= error;
+        return false;
+      }
+      void* ring= mmap(nullptr, gRingSize + gPageSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (ring == MAP_FAILED) {
+        const int error= errno;
+        close(fd);
+        close_rings();
+        errno= error;
+        *mapFailed= true;
+        return false;
+      }
+      gRings[gNumRings].fd= fd;
+      gRings[gNumRings].data= static_cast<char*>(ring) + gPageSize;
+      gNumRings++;
+    }
+    return true;
+  }
+
+  //! Copies len bytes from the ring at offset, which may wrap
+  static void ring_copy(const Ring& ring, void* out, std::uint64_t offset, std::size_t len)
+  {
+    const std::size_t start= offset & (gRingSize - 1);
+    const std::size_t first= std::min(len, gRingSize - start);
+    memcpy(out, ring.data + start, first);
+    memcpy(static_cast<char*>(out) + first, ring.data, len - first);
+  }
+
+  Mode start(bool forceSoftware, char* error, std::size_t errorSize)
+  {
+    gPageSize= sysconf(_SC_PAGESIZE);
+    gRingSize= RING_PAGES * gPageSize;
+    gPid= getpid();
+    gMode= OFF;
+
+    gAllocBlocks= alloc_blocks_open();
+    refresh_now();
+    // Before the events are opened, so that the thread is not sampled
+    if (!start_helper()) {
+      snprintf(error, errorSize, "Could not start the thread that reads the data objects: %s", strerror(errno));
+      return OFF;
+    }
+
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0) {
+      CPU_ZERO(&cpus);
+      for (long cpu= 0; cpu < sysconf(_SC_NPROCESSORS_CONF) && cpu < CPU_SETSIZE; ++cpu)
+        CPU_SET(cpu, &cpus);
+    }
+    bool mapFailed= false;
+    int pebsErrno= 0;
+    if (!forceSoftware) {
+      if (open_rings(PEBS, cpus, &mapFailed))
+        gMode= PEBS;
+      pebsErrno= errno;
+    }
+    if (gMode == OFF && !mapFailed && open_rings(SOFTWARE, cpus, &mapFailed))
+      gMode= SOFTWARE;
+    if (gMode == OFF) {
+      if (mapFailed)
+        snprintf(error, errorSize, "Could not map the perf ring buffer: %s", strerror(errno));
+      else
+        snprintf(error, errorSize, "Could not sample loads (%s) or page faults (%s)",
+                 forceSoftware ? "not tried" : strerror(pebsErrno), strerror(errno));
+      stop_helper();
+      return OFF;
+    }
+
+    for (int i= 0; i < gNumRings; ++i)
+      ioctl(gRings[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+    return gMode;
+  }
+
+  //! Reads the new samples of each ring buffer. Returns false if it stopped
+  //! to leave samples in a ring buffer until the objects are read again
+  static bool drain_rings()
+  {
+    for (int i= 0; i < gNumRings; ++i) {
+      const Ring& ring= gRings[i];
+      perf_event_mmap_page* meta= reinterpret_cast<perf_event_mmap_page*>(ring.data - gPageSize);
+      const std::uint64_t head= __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+      std::uint64_t tail= meta->data_tail;
+      bool complete= true;
+      while (tail < head) {
+        perf_event_header header;
+        ring_copy(ring, &header, tail, sizeof(header));
+        if (header.size < sizeof(header))
+          break;
+        std::uint64_t body[3];
+        if (header.type == PERF_RECORD_SAMPLE && header.size >= sizeof(header) + sizeof(body)) {
+          // PERF_SAMPLE_TID, PERF_SAMPLE_ADDR then PERF_SAMPLE_WEIGHT.
+          // Processes forked by the program inherit the events too, but their
+          // addresses are not in its objects
+          ring_copy(ring, body, tail + sizeof(header), sizeof(body));
+          if (static_cast<std::uint32_t>(body[0]) == gPid && !add_sample(body[1], body[2])) {
+            complete= false;
+            break;
+          }
+        } else if (header.type == PERF_RECORD_LOST && header.size >= sizeof(header) + 2 * sizeof(body[0])) {
+          // The id, then the number of records lost
+          ring_copy(ring, body, tail + sizeof(header), 2 * sizeof(body[0]));
+          gLost+= body[1];
+        }
+        tail+= header.size;
+      }
+      __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+      if (!complete)
+        return false;
+    }
+    return true;
+  }
+
+  void drain()
+  {
+    if (gMode == OFF)
+      return;
+    drain_rings();
+  }
+
+  void end_period(PeriodSummary* summary)
+  {
+    drain();
+    merge_published();
+    if (gNumPending > 0)
+      request_refresh();
+
+    summary->samples= gPeriodSamples;
+    summary->meanLatency= gPeriodSamples == 0 ? 0.0 :
+      static_cast<double>(gPeriodWeight) / static_cast<double>(gPeriodSamples);
+
+    // The objects with the most latency in this period, whether or not they
+    // are still mapped
+    int top[TOP_N];
+    for (int k= 0; k < TOP_N; ++k)
+      top[k]= -1;
+    for (int i= 0; i < gNumObjects; ++i) {
+      if (gObjects[i].periodWeight == 0)
+        continue;
+      int k= TOP_N;
+      while (k > 0 && (top[k-1] == -1 || gObjects[top[k-1]].periodWeight < gObjects[i].periodWeight))
+        k--;
+      if (k < TOP_N) {
+        for (int j= TOP_N - 1; j > k; --j)
+          top[j]= top[j-1];
+        top[k]= i;
+      }
+    }
+    for (int k= 0; k < TOP_N; ++k) {
+      summary->topShare[k]= (top[k] == -1 || gPeriodWeight == 0) ? 0.0 :
+        100.0 * static_cast<double>(gObjects[top[k]].periodWeight) /
+        static_cast<double>(gPeriodWeight);
+    }
+
+    for (int i= 0; i < gNumObjects; ++i) {
+      gObjects[i].periodSamples= 0;
+      gObjects[i].periodWeight= 0;
+    }
+    gPeriodSamples= 0;
+    gPeriodWeight= 0;
+  }
+
+  static void object_name(const Object& object, char* out, std::size_t size)
+  {
+    const unsigned long long start= object.start;
+    const unsigned long long kb= (object.end - object.start) / 1024;
+    const char* unmapped= object.live ? "" : " (unmapped)";
+    if (object.kind == BLOCK)
+      snprintf(out, size, "heap block 0x%llx (%llu KB) allocated at %s%s", start, kb, object.name, unmapped);
+    else if (object.name[0] != '\0')
+      snprintf(out, size, "%s%s", object.name, unmapped);
+    else
+      snprintf(out, size, "anonymous 0x%llx (%llu KB)%s", start, kb, unmapped);
+  }
+
+  void print_report(FILE* out, int numObjects)
+  {
+    if (gMode == OFF)
+      return;
+    // Everything left in the ring buffers is attributed here, so the objects
+    // are read on this thread from now on
+    stop_helper();
+    for (;;) {
+      const bool complete= drain_rings();
+      refresh_now();
+      if (complete)
+        break;
+    }
+
+    static int order[MAX_OBJECTS];
+    for (int i= 0; i < gNumObjects; ++i)
+      order[i]= i;
+    std::sort(order, order + gNumObjects, [](int a, int b) {
+      return gObjects[a].weight > gObjects[b].weight;
+    });
+
+    fprintf(out, "%s samples by data object: %llu samples, %llu unattributed, %llu lost\n",
+            gMode == PEBS ? "Load latency" : "Page fault",
+            static_cast<unsigned long long>(gSamples),
+            static_cast<unsigned long long>(gUnattributed),
+            static_cast<unsigned long long>(gLost));
+    if (gRecycled > 0)
+      fprintf(out, "%llu samples (%.2f%%) in %llu objects no longer mapped are not listed\n",
+              static_cast<unsigned long long>(gRecycledSamples),
+              gWeight == 0 ? 0.0 : 100.0 * gRecycledWeight / gWeight,
+              static_cast<unsigned long long>(gRecycled));
+    fprintf(out, "%10s %8s %12s  %s\n", "Samples", "Share",
+            gMode == PEBS ? "Mean cycles" : "Mean weight", "Object");
+    for (int i= 0; i < std::min(numObjects, gNumObjects); ++i) {
+      const Object& object= gObjects[order[i]];
+      if (object.samples == 0)
+        break;
+      char name[MAX_NAME + 96];
+      object_name(object, name, sizeof(name));
+      fprintf(out, "%10llu %7.2f%% %12.1f  %s\n",
+              static_cast<unsigned long long>(object.samples),
+              gWeight == 0 ? 0.0 : 100.0 * object.weight / gWeight,
+              static_cast<double>(object.weight) / object.samples, name);
+    }
+  }
+
+  void stop()
+  {
+    if (gMode == OFF)
+      return;
+    stop_helper();
+    for (int i= 0; i < gNumRings; ++i)
+      ioctl(gRings[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+    close_rings();
+    gMode= OFF;
+  }
+
+} // namespace LoadLatency
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HASWELL_LOAD_LATENCY_H
+#define HASWELL_LOAD_LATENCY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+///////////////////////////////////////////////////////////////////////////////
+// Precise sampling of the data addresses of loads, to attribute memory stalls
+// to the data objects that cause them.
+//
+// The loads are sampled by PEBS load latency (MEM_TRANS_RETIRED.LOAD_LATENCY)
+// through perf_event_open, which records the data address and latency of
+// every Nth load slower than a threshold. On hosts without PEBS the page
+// faults are sampled instead, which gives the data addresses but no latency.
+// The events are inherited, so the threads created after start() are sampled
+// too, on the CPUs the process may run on when it starts.
+//
+// The samples are drained from the perf ring buffers without system calls,
+// and accumulated per object: the heap blocks of 64KB and over that
+// ../alloc/lib-alloc.so tracks when it is preloaded (see
+// ../common/alloc_blocks.h), and otherwise the regions of /proc/self/maps. A
+// helper thread reads the objects; the sampler takes the latest it has read,
+// and keeps the samples it cannot attribute yet until the next.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace LoadLatency {
+
+  enum Mode {
+    OFF=0,
+    PEBS,      // Load latency, weighted by the latency in cycles
+    SOFTWARE   // Page faults, each with a weight of 1
+  };
+
+  // The number of objects reported by the top-N metrics
+  static const int TOP_N= 3;
+
+  // What was sampled in one sample period
+  struct PeriodSummary {
+    std::uint64_t samples;
+    // The mean latency of the sampled loads in cycles (1 in software mode)
+    double meanLatency;
+    // The percentage of the period's sampled latency in each of the objects
+    // with the most latency in the period
+    double topShare[TOP_N];
+  };
+
+  // Starts sampling the calling thread and the threads it creates, and the
+  // helper thread. Uses PEBS unless forceSoftware is true or PEBS is not
+  // available. Returns OFF on failure, with the reason in error
+  Mode start(bool forceSoftware, char* error, std::size_t errorSize);
+
+  // Reads the new samples from the ring buffer. Async-signal-safe
+  void drain();
+
+  // Drains, summarises the samples since the last call and starts a new
+  // period. Async-signal-safe
+  void end_period(PeriodSummary* summary);
+
+  // Writes a table of the numObjects objects with the most sampled latency
+  // over the run. Stops the helper thread, so is called once, at the end
+  void print_report(FILE* out, int numObjects);
+
+  // Stops sampling, and the helper thread
+  void stop();
+
+} // namespace LoadLatency
+
+#endif // HASWELL_LOAD_LATENCY_H
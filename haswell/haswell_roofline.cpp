@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "haswell_roofline.h"
+#include "haswell_event_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace Roofline {
+
+  // Sized to take a few tens of milliseconds each on a current core
+  static const long FLOP_ITERATIONS= 20000000;
+  static const size_t TRIAD_ELEMENTS= 4 * 1024 * 1024;  // 32MB per array
+  static const int TRIAD_REPEATS= 3;
+
+  static double now_seconds()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+
+  // The loops keep enough independent accumulators in flight to hide the
+  // latency of the FMA units. The result is returned so that the loops are
+  // not optimised away
+#if defined(__x86_64__)
+  __attribute__((target("avx2,fma")))
+  static double fma_kernel_avx2(long iterations, double* flops)
+  {
+    const __m256d b= _mm256_set1_pd(0.999999);
+    const __m256d c= _mm256_set1_pd(1e-6);
+    __m256d a0= _mm256_set1_pd(1.0), a1= a0, a2= a0, a3= a0, a4= a0,
+            a5= a0, a6= a0, a7= a0, a8= a0, a9= a0;
+    for (long i= 0; i < iterations; ++i) {
+      a0= _mm256_fmadd_pd(a0, b, c); a1= _mm256_fmadd_pd(a1, b, c);
+      a2= _mm256_fmadd_pd(a2, b, c); a3= _mm256_fmadd_pd(a3, b, c);
+      a4= _mm256_fmadd_pd(a4, b, c); a5= _mm256_fmadd_pd(a5, b, c);
+      a6= _mm256_fmadd_pd(a6, b, c); a7= _mm256_fmadd_pd(a7, b, c);
+      a8= _mm256_fmadd_pd(a8, b, c); a9= _mm256_fmadd_pd(a9, b, c);
+    }
+    // 10 accumulators, 4 doubles each, 2 operations per FMA
+    *flops= iterations * 10.0 * 4.0 * 2.0;
+    __m256d sum= _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(a0, a1), _mm256_add_pd(a2, a3)),
+                               _mm256_add_pd(_mm256_add_pd(a4, a5), _mm256_add_pd(a6, a7)));
+    sum= _mm256_add_pd(sum, _mm256_add_pd(a8, a9));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+#endif
+
+  static double fma_kernel_scalar(long iterations, double* flops)
+  {
+    const double b= 0.999999;
+    const double c= 1e-6;
+    double a[8]= { 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0 };
+    for (long i= 0; i < iterations; ++i)
+      for (int j= 0; j < 8; ++j)
+        a[j]= a[j] * b + c;
+    *flops= iterations * 8.0 * 2.0;
+    double sum= 0.0;
+    for (int j= 0; j < 8; ++j)
+      sum+= a[j];
+    return sum;
+  }
+
+  static double measure_peak_flops()
+  {
+    double flops= 0.0;
+    const double start= now_seconds();
+    volatile double sink;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      sink= fma_kernel_avx2(FLOP_ITERATIONS, &flops);
+    else
+#endif
+      sink= fma_kernel_scalar(FLOP_ITERATIONS, &flops);
+    (void)sink;
+    const double elapsed= now_seconds() - start;
+    return elapsed > 0.0 ? flops / elapsed : 0.0;
+  }
+
+  // STREAM triad. The bytes moved are counted as in STREAM: two arrays read
+  // and one written per iteration
+  static double measure_peak_bandwidth()
+  {
+    std::vector<double> a(TRIAD_ELEMENTS, 0.0), b(TRIAD_ELEMENTS, 1.0), c(TRIAD_ELEMENTS, 2.0);
+    const double scalar= 3.0;
+    double best= 0.0;
+    for (int repeat= 0; repeat < TRIAD_REPEATS; ++repeat) {
+      const double start= now_seconds();
+      for (size_t i= 0; i < TRIAD_ELEMENTS; ++i)
+        a[i]= b[i] + scalar * c[i];
+      const double elapsed= now_seconds() - start;
+      if (elapsed > 0.0)
+        best= std::max(best, 3.0 * sizeof(double) * TRIAD_ELEMENTS / elapsed);
+    }
+    volatile double sink= a[TRIAD_ELEMENTS / 2];
+    (void)sink;
+    return best;
+  }
+
+  static bool read_peaks(const char* path, Peaks* peaks)
+  {
+    FILE* file= fopen(path, "r");
+    if (file == nullptr)
+      return false;
+    const bool ok= fscanf(file, "peak_flops_per_second %lf\npeak_bytes_per_second %lf\n",
+                          &peaks->flopsPerSecond, &peaks->bytesPerSecond) == 2;
+    fclose(file);
+    return ok && peaks->flopsPerSecond > 0.0 && peaks->bytesPerSecond > 0.0;
+  }
+
+  static void write_peaks(const char* path, const Peaks& peaks)
+  {
+    std::vector<char> tmpPath(path, path + strlen(path));
+    const char suffix[]= ".XXXXXX";
+    tmpPath.insert(tmpPath.end(), suffix, suffix + sizeof(suffix));
+    int fd= mkstemp(tmpPath.data());
+    if (fd == -1)
+      return;
+    char buffer[128];
+    const int len= snprintf(buffer, sizeof(buffer),
+                            "peak_flops_per_second %.6e\npeak_bytes_per_second %.6e\n",
+                            peaks.flopsPerSecond, peaks.bytesPerSecond);
+    const bool ok= len > 0 && write(fd, buffer, len) == len && fchmod(fd, 0644) == 0;
+    close(fd);
+    if (!ok || rename(tmpPath.data(), path) != 0)
+      unlink(tmpPath.data());
+  }
+
+  static double env_peak(const char* var, double scale)
+  {
+    const char* value= getenv(var);
+    if (value == nullptr || *value == '\0')
+      return 0.0;
+    return atof(value) * scale;
+  }
+
+  bool calibrate(Peaks* peaks)
+  {
+    peaks->flopsPerSecond= env_peak("ARM_MAP_ROOFLINE_PEAK_GFLOPS", 1e9);
+    peaks->bytesPerSecond= env_peak("ARM_MAP_ROOFLINE_PEAK_GBS", 1e9);
+    if (peaks->flopsPerSecond > 0.0 && peaks->bytesPerSecond > 0.0)
+      return true;
+
+    // The peaks are a property of the node, so the file is named by host
+    char host[256];
+    if (gethostname(host, sizeof(host)) != 0)
+      return false;
+    host[sizeof(host) - 1]= '\0';
+    char path[4096];
+    int n= snprintf(path, sizeof(path), "%s/haswell-roofline-%u-%s.peaks",
+                    haswell_membound_cache_dir(), static_cast<unsigned>(getuid()), host);
+    if (n < 0 || n >= static_cast<int>(sizeof(path)))
+      return false;
+    char lockPath[4096 + 8];
+    snprintf(lockPath, sizeof(lockPath), "%s.lock", path);
+
+    Peaks measured;
+    if (!read_peaks(path, &measured)) {
+      // Measure under the lock so that only one rank per node calibrates (and
+      // reports the peaks), and the other ranks do not disturb the measurement
+      // with their own
+      int lockFd= open(lockPath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+      if (lockFd != -1)
+        flock(lockFd, LOCK_EX);
+      if (!read_peaks(path, &measured)) {
+        measured.flopsPerSecond= measure_peak_flops();
+        measured.bytesPerSecond= measure_peak_bandwidth();
+        printf("Roofline peaks of one core on %s: %.2f GFLOP/s, %.2f GB/s\n",
+               host, measured.flopsPerSecond * 1e-9, measured.bytesPerSecond * 1e-9);
+        if (lockFd != -1)
+          write_peaks(path, measured);
+      }
+      if (lockFd != -1) {
+        flock(lockFd, LOCK_UN);
+        close(lockFd);
+      }
+    }
+
+    if (peaks->flopsPerSecond <= 0.0)
+      peaks->flopsPerSecond= measured.flopsPerSecond;
+    if (peaks->bytesPerSecond <= 0.0)
+      peaks->bytesPerSecond= measured.bytesPerSecond;
+    return peaks->flopsPerSecond > 0.0 && peaks->bytesPerSecond > 0.0;
+  }
+
+  double attainable_flops(const Peaks& peaks, double intensity)
+  {
+    return std::min(peaks.flopsPerSecond, intensity * peaks.bytesPerSecond);
+  }
+
+} // namespace Roofline
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HASWELL_ROOFLINE_H
+#define HASWELL_ROOFLINE_H
+
+///////////////////////////////////////////////////////////////////////////////
+// The peak performance of one core, used as the roof of the roofline model.
+//
+// The counters are per thread, so the peaks are measured on a single core: a
+// vectorised FMA loop for the floating point peak and a triad over arrays much
+// larger than the last level cache for the memory bandwidth peak. The
+// calibration is done by the first rank on a node and stored in a file in the
+// node cache directory (see haswell_membound_cache_dir) for the others. Either
+// peak can be given instead with ARM_MAP_ROOFLINE_PEAK_GFLOPS and
+// ARM_MAP_ROOFLINE_PEAK_GBS.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace Roofline {
+
+  struct Peaks {
+    double flopsPerSecond;
+    double bytesPerSecond;
+  };
+
+  // Gets the peaks for this node, measuring them if no other rank has.
+  // Returns false if they could not be found
+  bool calibrate(Peaks* peaks);
+
+  // The attainable floating point rate for the given arithmetic intensity
+  // (FLOPs per byte of memory traffic)
+  double attainable_flops(const Peaks& peaks, double intensity);
+
+} // namespace Roofline
+
+#endif // HASWELL_ROOFLINE_H
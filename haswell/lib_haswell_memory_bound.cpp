@@ -18,7 +18,17 @@
 // The next include is required to create a custom metric for Arm MAP
 #include "allinea_metric_plugin_api.h"
 #include "papi.h"
-
+#include "haswell_event_cache.h"
+#include "haswell_frequency.h"
+#include "haswell_roofline.h"
+#include "haswell_load_latency.h"
+#include "mpi_rank.h"
+#include "node_stats.h"
+#include "region_totals.h"
+#include "telemetry.h"
+
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <sys/syscall.h>
 #include <unistd.h>
@@ -30,7 +40,21 @@
 
 static const int ERROR = -1; // Returned by a function when there is an error
 
-static int ARM_MAP_MEMORY_BOUND= 1; // =0 for ARM_MAP_BANDWIDTH_BOUND
+// Not all of the counters fit in the hardware at once, so only one group of
+// them is collected in a run. The group is chosen by environment variable.
+// Every group also counts the core and reference cycles, for the effective
+// frequency. Intel cores count them in fixed counters, so they do not take
+// any of the programmable counters that the other events need
+enum EventGroup {
+  MEMORY_BOUND_GROUP=0,   // The default
+  BANDWIDTH_BOUND_GROUP,  // ARM_MAP_BANDWIDTH_BOUND=1
+  SMT_CONTENTION_GROUP,   // ARM_MAP_SMT_CONTENTION=1
+  ROOFLINE_GROUP,         // ARM_MAP_ROOFLINE=1
+  CACHE_MISSES_GROUP,     // ARM_MAP_CACHE_MISSES=1
+  PORT_UTILIZATION_GROUP, // ARM_MAP_PORT_UTILIZATION=1
+  NUMA_LOCALITY_GROUP     // ARM_MAP_NUMA_LOCALITY=1
+};
+static EventGroup gEventGroup= MEMORY_BOUND_GROUP;
 
 ///////////////////////////////////////////////////////////////////////////////
 // The next definitions are user defined. We know the names of the counters
@@ -49,6 +73,7 @@ namespace MB { // MEMORY_BOUND
     CYCLE_ACTIVITY_NO_EXECUTE_IND,
     RESOURCE_STALLS_SB_IND,
     CYCLE_ACTIVITY_STALLS_L1D_PENDING_IND,
+    CLK_UNHALTED_REF_TSC_IND,
     NUM_INDS
   };
   constexpr static std::array<const char*, EventInds::NUM_INDS>
@@ -56,7 +81,8 @@ namespace MB { // MEMORY_BOUND
     "CPU_CLK_UNHALTED",
       "CYCLE_ACTIVITY:CYCLES_NO_EXECUTE",
       "RESOURCE_STALLS:SB",
-      "CYCLE_ACTIVITY:STALLS_L1D_PENDING"
+      "CYCLE_ACTIVITY:STALLS_L1D_PENDING",
+      "UNHALTED_REFERENCE_CYCLES"
       };
   // We want to store the event codes, but don't necessarily know these (we can
   // get them from the documentation for a particular hardware set, or let
@@ -72,6 +98,8 @@ namespace BB { // BANDWIDTH_BOUND
     RESOURCE_STALLS_SB_IND,
     L1D_PEND_MISS_FB_FULL_IND,
     OFFCORE_REQUESTS_BUFFER_SQ_IND,
+    CLK_UNHALTED_IND,
+    CLK_UNHALTED_REF_TSC_IND,
     NUM_INDS
   };
   constexpr static std::array<const char*, EventInds::NUM_INDS>
@@ -79,18 +107,295 @@ namespace BB { // BANDWIDTH_BOUND
     "CYCLE_ACTIVITY:CYCLES_NO_EXECUTE",
       "RESOURCE_STALLS:SB",
       "L1D_PEND_MISS:FB_FULL",
-      "OFFCORE_REQUESTS_BUFFER:SQ_FULL"
+      "OFFCORE_REQUESTS_BUFFER:SQ_FULL",
+      "CPU_CLK_UNHALTED",
+      "UNHALTED_REFERENCE_CYCLES"
+      };
+  static std::array<int, EventInds::NUM_INDS> gEventCodes;
+  static std::array<long long, EventInds::NUM_INDS> gEventValues;
+}
+
+namespace SMT { // SMT_CONTENTION
+  // The memory bound cycle and stall events, together with the reference
+  // cycles when this thread is unhalted and the reference cycles when this
+  // thread is unhalted and its sibling hardware thread is halted. The last two
+  // are counted per thread, so no any-thread access is needed to tell how
+  // often the sibling was running alongside us
+  enum EventInds {
+    CLK_UNHALTED_IND=0,
+    CYCLE_ACTIVITY_NO_EXECUTE_IND,
+    CYCLE_ACTIVITY_STALLS_L1D_PENDING_IND,
+    CLK_UNHALTED_REF_XCLK_IND,
+    CLK_UNHALTED_ONE_THREAD_ACTIVE_IND,
+    CLK_UNHALTED_REF_TSC_IND,
+    NUM_INDS
+  };
+  constexpr static std::array<const char*, EventInds::NUM_INDS>
+  gEventNames {
+    "CPU_CLK_UNHALTED",
+      "CYCLE_ACTIVITY:CYCLES_NO_EXECUTE",
+      "CYCLE_ACTIVITY:STALLS_L1D_PENDING",
+      "CPU_CLK_THREAD_UNHALTED:REF_XCLK",
+      "CPU_CLK_THREAD_UNHALTED:ONE_THREAD_ACTIVE",
+      "UNHALTED_REFERENCE_CYCLES"
+      };
+  static std::array<int, EventInds::NUM_INDS> gEventCodes;
+  static std::array<long long, EventInds::NUM_INDS> gEventValues;
+}
+
+namespace RL { // ROOFLINE
+  // Memory traffic is estimated from the last level cache misses, each of
+  // which moves one cache line. The floating point operations are counted by
+  // the FP_ARITH events, which count an FMA as two operations. These events
+  // are not available on Haswell, only on Broadwell and later cores
+  enum EventInds {
+    CLK_UNHALTED_IND=0,
+    LLC_MISS_IND,
+    FP_SCALAR_DOUBLE_IND,
+    FP_128B_PACKED_DOUBLE_IND,
+    FP_256B_PACKED_DOUBLE_IND,
+    CLK_UNHALTED_REF_TSC_IND,
+    NUM_INDS
+  };
+  constexpr static std::array<const char*, EventInds::NUM_INDS>
+  gEventNames {
+    "CPU_CLK_UNHALTED",
+      "LONGEST_LAT_CACHE:MISS",
+      "FP_ARITH_INST_RETIRED:SCALAR_DOUBLE",
+      "FP_ARITH_INST_RETIRED:128B_PACKED_DOUBLE",
+      "FP_ARITH_INST_RETIRED:256B_PACKED_DOUBLE",
+      "UNHALTED_REFERENCE_CYCLES"
+      };
+  static std::array<int, EventInds::NUM_INDS> gEventCodes;
+  static std::array<long long, EventInds::NUM_INDS> gEventValues;
+
+  static const long long CACHE_LINE_BYTES= 64;
+
+  // The peak performance of one core on this node, measured at start up
+  static Roofline::Peaks gPeaks;
+}
+
+namespace CM { // CACHE_MISSES
+  // Misses at each level of the cache hierarchy, and the cycles spent walking
+  // the page tables after DTLB misses. There are more events than there are
+  // programmable counters for a hyperthread, so if they do not all fit the
+  // group is multiplexed, and the counts are estimates
+  enum EventInds {
+    CLK_UNHALTED_IND=0,
+    INSTRUCTIONS_RETIRED_IND,
+    L1D_REPLACEMENT_IND,
+    L2_RQSTS_MISS_IND,
+    LLC_REFERENCE_IND,
+    LLC_MISS_IND,
+    DTLB_LOAD_WALK_DURATION_IND,
+    DTLB_STORE_WALK_DURATION_IND,
+    CLK_UNHALTED_REF_TSC_IND,
+    NUM_INDS
+  };
+  constexpr static std::array<const char*, EventInds::NUM_INDS>
+  gEventNames {
+    "CPU_CLK_UNHALTED",
+      "INSTRUCTION_RETIRED",
+      "L1D:REPLACEMENT",
+      "L2_RQSTS:MISS",
+      "LONGEST_LAT_CACHE:REFERENCE",
+      "LONGEST_LAT_CACHE:MISS",
+      "DTLB_LOAD_MISSES:WALK_DURATION",
+      "DTLB_STORE_MISSES:WALK_DURATION",
+      "UNHALTED_REFERENCE_CYCLES"
       };
   static std::array<int, EventInds::NUM_INDS> gEventCodes;
   static std::array<long long, EventInds::NUM_INDS> gEventValues;
 }
 
+namespace PU { // PORT_UTILIZATION
+  // The uops dispatched to each of the eight execution ports, the cycles in
+  // which at least one, two and three uops were executed by this hyperthread,
+  // and the floating point instructions retired by vector width (single and
+  // double precision together). There are more events than programmable
+  // counters, so the group is multiplexed, and the counts are estimates. The
+  // FP_ARITH events are only available on Broadwell and later cores
+  enum EventInds {
+    CLK_UNHALTED_IND=0,
+    UOPS_PORT_0_IND,
+    UOPS_PORT_1_IND,
+    UOPS_PORT_2_IND,
+    UOPS_PORT_3_IND,
+    UOPS_PORT_4_IND,
+    UOPS_PORT_5_IND,
+    UOPS_PORT_6_IND,
+    UOPS_PORT_7_IND,
+    CYCLES_GE_1_UOP_IND,
+    CYCLES_GE_2_UOPS_IND,
+    CYCLES_GE_3_UOPS_IND,
+    FP_SCALAR_IND,
+    FP_128B_PACKED_IND,
+    FP_256B_PACKED_IND,
+    CLK_UNHALTED_REF_TSC_IND,
+    NUM_INDS
+  };
+  constexpr static std::array<const char*, EventInds::NUM_INDS>
+  gEventNames {
+    "CPU_CLK_UNHALTED",
+      "UOPS_EXECUTED_PORT:PORT_0",
+      "UOPS_EXECUTED_PORT:PORT_1",
+      "UOPS_EXECUTED_PORT:PORT_2",
+      "UOPS_EXECUTED_PORT:PORT_3",
+      "UOPS_EXECUTED_PORT:PORT_4",
+      "UOPS_EXECUTED_PORT:PORT_5",
+      "UOPS_EXECUTED_PORT:PORT_6",
+      "UOPS_EXECUTED_PORT:PORT_7",
+      "UOPS_EXECUTED:CYCLES_GE_1_UOP_EXEC",
+      "UOPS_EXECUTED:CYCLES_GE_2_UOPS_EXEC",
+      "UOPS_EXECUTED:CYCLES_GE_3_UOPS_EXEC",
+      "FP_ARITH_INST_RETIRED:SCALAR_DOUBLE:SCALAR_SINGLE",
+      "FP_ARITH_INST_RETIRED:128B_PACKED_DOUBLE:128B_PACKED_SINGLE",
+      "FP_ARITH_INST_RETIRED:256B_PACKED_DOUBLE:256B_PACKED_SINGLE",
+      "UNHALTED_REFERENCE_CYCLES"
+      };
+  static std::array<int, EventInds::NUM_INDS> gEventCodes;
+  static std::array<long long, EventInds::NUM_INDS> gEventValues;
+
+  static const int NUM_PORTS= 8;
+}
+
+namespace NL { // NUMA_LOCALITY
+  // The loads that missed the L3 and were served from the DRAM of this socket
+  // or of another one, counted in the same event set as the cycle and stall
+  // events, so that a rise in the stalls can be matched to remote accesses
+  // sample by sample. They take all four programmable counters of a
+  // hyperthread, so the store buffer stalls are not counted
+  enum EventInds {
+    CLK_UNHALTED_IND=0,
+    CYCLE_ACTIVITY_NO_EXECUTE_IND,
+    CYCLE_ACTIVITY_STALLS_L1D_PENDING_IND,
+    LOCAL_DRAM_IND,
+    REMOTE_DRAM_IND,
+    CLK_UNHALTED_REF_TSC_IND,
+    NUM_INDS
+  };
+  constexpr static std::array<const char*, EventInds::NUM_INDS>
+  gEventNames {
+    "CPU_CLK_UNHALTED",
+      "CYCLE_ACTIVITY:CYCLES_NO_EXECUTE",
+      "CYCLE_ACTIVITY:STALLS_L1D_PENDING",
+      "MEM_LOAD_UOPS_L3_MISS_RETIRED:LOCAL_DRAM",
+      "MEM_LOAD_UOPS_L3_MISS_RETIRED:REMOTE_DRAM",
+      "UNHALTED_REFERENCE_CYCLES"
+      };
+  static std::array<int, EventInds::NUM_INDS> gEventCodes;
+  static std::array<long long, EventInds::NUM_INDS> gEventValues;
+}
+
+// The load latency sampling, which is independent of the event groups and is
+// turned on with ARM_MAP_LOAD_LATENCY=1
+static LoadLatency::Mode gLoadLatencyMode= LoadLatency::OFF;
+static LoadLatency::PeriodSummary gLoadLatency;
+
+// The length of the last sample period in seconds, or 0 for the first sample
+static double gSampleSeconds= 0.0;
+
+// The cycle and stall events are collected by the memory bound, the SMT
+// contention and the NUMA locality groups. These return their values from
+// whichever of them is being collected
+static bool has_stall_events()
+{
+  return gEventGroup == MEMORY_BOUND_GROUP || gEventGroup == SMT_CONTENTION_GROUP ||
+    gEventGroup == NUMA_LOCALITY_GROUP;
+}
+
+static long long clk_unhalted()
+{
+  if (gEventGroup == SMT_CONTENTION_GROUP)
+    return SMT::gEventValues.at(SMT::EventInds::CLK_UNHALTED_IND);
+  if (gEventGroup == NUMA_LOCALITY_GROUP)
+    return NL::gEventValues.at(NL::EventInds::CLK_UNHALTED_IND);
+  return MB::gEventValues.at(MB::EventInds::CLK_UNHALTED_IND);
+}
+
+static long long cycles_no_execute()
+{
+  if (gEventGroup == SMT_CONTENTION_GROUP)
+    return SMT::gEventValues.at(SMT::EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND);
+  if (gEventGroup == NUMA_LOCALITY_GROUP)
+    return NL::gEventValues.at(NL::EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND);
+  return MB::gEventValues.at(MB::EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND);
+}
+
+static long long stalls_l1d_pending()
+{
+  if (gEventGroup == SMT_CONTENTION_GROUP)
+    return SMT::gEventValues.at(SMT::EventInds::CYCLE_ACTIVITY_STALLS_L1D_PENDING_IND);
+  if (gEventGroup == NUMA_LOCALITY_GROUP)
+    return NL::gEventValues.at(NL::EventInds::CYCLE_ACTIVITY_STALLS_L1D_PENDING_IND);
+  return MB::gEventValues.at(MB::EventInds::CYCLE_ACTIVITY_STALLS_L1D_PENDING_IND);
+}
+
+// The core cycles and the reference cycles, which count at the nominal
+// frequency, from whichever group is being collected. Every group has them
+static void frequency_cycles(long long* core, long long* reference)
+{
+  switch (gEventGroup) {
+  case MEMORY_BOUND_GROUP:
+    *core= MB::gEventValues.at(MB::EventInds::CLK_UNHALTED_IND);
+    *reference= MB::gEventValues.at(MB::EventInds::CLK_UNHALTED_REF_TSC_IND);
+    break;
+  case BANDWIDTH_BOUND_GROUP:
+    *core= BB::gEventValues.at(BB::EventInds::CLK_UNHALTED_IND);
+    *reference= BB::gEventValues.at(BB::EventInds::CLK_UNHALTED_REF_TSC_IND);
+    break;
+  case SMT_CONTENTION_GROUP:
+    *core= SMT::gEventValues.at(SMT::EventInds::CLK_UNHALTED_IND);
+    *reference= SMT::gEventValues.at(SMT::EventInds::CLK_UNHALTED_REF_TSC_IND);
+    break;
+  case ROOFLINE_GROUP:
+    *core= RL::gEventValues.at(RL::EventInds::CLK_UNHALTED_IND);
+    *reference= RL::gEventValues.at(RL::EventInds::CLK_UNHALTED_REF_TSC_IND);
+    break;
+  case CACHE_MISSES_GROUP:
+    *core= CM::gEventValues.at(CM::EventInds::CLK_UNHALTED_IND);
+    *reference= CM::gEventValues.at(CM::EventInds::CLK_UNHALTED_REF_TSC_IND);
+    break;
+  case PORT_UTILIZATION_GROUP:
+    *core= PU::gEventValues.at(PU::EventInds::CLK_UNHALTED_IND);
+    *reference= PU::gEventValues.at(PU::EventInds::CLK_UNHALTED_REF_TSC_IND);
+    break;
+  case NUMA_LOCALITY_GROUP:
+    *core= NL::gEventValues.at(NL::EventInds::CLK_UNHALTED_IND);
+    *reference= NL::gEventValues.at(NL::EventInds::CLK_UNHALTED_REF_TSC_IND);
+    break;
+  }
+}
+
+// The thermal throttling of the package in the last sample period
+static Frequency::Throttle gThrottle;
+
+// The lock held by the one process of the job on each node that reports the
+// throttling of the node at the end, or -1. See ../common/node_shm.h
+static int gThrottleReportFd= -1;
+
 // A global PAPI event set is stored to collect the counter values
 static int gEventSet= PAPI_NULL;
 
+// The live telemetry page, or NULL if not publishing. See ../common/telemetry.h
+static telemetry_page* gTelemetryPage= NULL;
+
+// The counts of each sample added up by the region the program was in, if
+// it marks regions. See ../common/region_totals.h
+static region_totals gRegionTotals;
+
+// The fractions compared between the processes on the node, and their
+// minimum, mean, maximum and variation over the node at the last sample. See
+// ../common/node_stats.h
+enum NodeValue { NODE_MEMORY_BOUND=0, NODE_BANDWIDTH_BOUND, NUM_NODE_VALUES };
+static node_stats gNodeStats;
+static node_stats_summary gNodeSummaries[NUM_NODE_VALUES];
+
 // Forward declaration. Used so that in this section we can have all of the
 // functions that are required to report the data for MAP
 static int update_values(metric_id_t metric_id, const struct timespec* current_sample_time);
+static unsigned region_counters(const char** names, uint64_t* deltas);
+static void print_region_totals(FILE* out);
 
 extern "C"{
 /**
@@ -120,179 +425,871 @@ int haswell_membound_active_cycles(metric_id_t metric_id,
     // Update the counter values at the current sample period
     update_values(metric_id, current_sample_time);
 
-    using namespace MB;
-    if (ARM_MAP_MEMORY_BOUND) {
-      *out_value= gEventValues.at(EventInds::CLK_UNHALTED_IND);
+    if (has_stall_events()) {
+      *out_value= clk_unhalted();
+    }
+
+    return 0;
+}
+
+int haswell_membound_productive_cycles(metric_id_t metric_id,
+        struct timespec *current_sample_time, double* out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (has_stall_events()) {
+      // The value out here is given as a fraction of active cycles
+      *out_value=
+        static_cast<double>(clk_unhalted() - cycles_no_execute()) /
+        static_cast<double>(clk_unhalted());
+    }
+    return 0;
+}
+
+int haswell_membound_stall_cycles(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    // The value out here is given as a fraction of active cycles
+    if (has_stall_events()) {
+      *out_value=
+        static_cast<double>(cycles_no_execute()) /
+        static_cast<double>(clk_unhalted());
+    }
+    return 0;
+}
+
+int haswell_membound_store_buffer_stall_cycles(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == MEMORY_BOUND_GROUP) {
+      // The value out here is given as a fraction of active cycles
+      *out_value=
+        static_cast<double>(MB::gEventValues.at(MB::EventInds::RESOURCE_STALLS_SB_IND)) /
+        static_cast<double>(MB::gEventValues.at(MB::EventInds::CLK_UNHALTED_IND));
+    } else if (gEventGroup == BANDWIDTH_BOUND_GROUP) {
+      // The value out here is given as a fraction of stalled cycles
+      *out_value=
+        static_cast<double>(BB::gEventValues.at(BB::EventInds::RESOURCE_STALLS_SB_IND)) /
+        static_cast<double>(BB::gEventValues.at(BB::EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND));
+    }
+    return 0;
+}
+
+int haswell_membound_l1d_pending_stall_cycles(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    // The value out here is given as a fraction of active cycles
+    if (has_stall_events()) {
+      *out_value=
+        static_cast<double>(stalls_l1d_pending()) /
+        static_cast<double>(clk_unhalted());
+    }
+    return 0;
+}
+
+static uint64_t memory_bound_measure()
+{
+  using namespace MB;
+
+  if (gEventGroup == MEMORY_BOUND_GROUP) {
+    return std::max(gEventValues.at(EventInds::RESOURCE_STALLS_SB_IND),
+      gEventValues.at(EventInds::CYCLE_ACTIVITY_STALLS_L1D_PENDING_IND));
+  } else {
+    return 0;
+  }
+}
+
+int haswell_membound_memory_bound(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    using namespace MB;
+
+    if (gEventGroup == MEMORY_BOUND_GROUP) {
+      // The value out here is given as a fraction of STALLED cycles
+      *out_value= static_cast<double>(memory_bound_measure()) /
+        static_cast<double>(gEventValues.at(EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND));
+    }
+    return 0;
+}
+
+int haswell_membound_l1d_pend_miss_fb_full_cycles(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    using namespace BB;
+
+    if (gEventGroup == BANDWIDTH_BOUND_GROUP) {
+      // The value out here is given as a fraction of STALLED cycles
+      *out_value=
+        static_cast<double>(gEventValues.at(EventInds::L1D_PEND_MISS_FB_FULL_IND))/
+        static_cast<double>(gEventValues.at(EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND));
+    }
+
+    return 0;
+}
+
+int haswell_membound_offcore_requests_buffer_sq_cycles(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    using namespace BB;
+
+    if (gEventGroup == BANDWIDTH_BOUND_GROUP) {
+      // The value out here is given as a fraction of STALLED cycles
+      *out_value=
+        static_cast<double>(gEventValues.at(EventInds::OFFCORE_REQUESTS_BUFFER_SQ_IND))/
+        static_cast<double>(gEventValues.at(EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND));
+    }
+
+    return 0;
+}
+
+static uint64_t bandwidth_bound_measure()
+{
+  using namespace BB;
+  if (gEventGroup == BANDWIDTH_BOUND_GROUP) {
+    return std::max(gEventValues.at(EventInds::RESOURCE_STALLS_SB_IND),
+            gEventValues.at(EventInds::L1D_PEND_MISS_FB_FULL_IND) +
+            gEventValues.at(EventInds::OFFCORE_REQUESTS_BUFFER_SQ_IND));
+  } else {
+    return 0;
+  }
+}
+
+int haswell_membound_bandwidth_bound(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    using namespace BB;
+
+    if (gEventGroup == BANDWIDTH_BOUND_GROUP) {
+      // The value out here is given as a fraction of STALLED cycles
+      *out_value= static_cast<double>(bandwidth_bound_measure()) /
+        static_cast<double>(gEventValues.at(EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND));
+    }
+
+    return 0;
+}
+
+// Returns the fraction of this thread's unhalted cycles during which the
+// sibling hardware thread on the same core was also unhalted
+static double sibling_active_fraction()
+{
+  using namespace SMT;
+
+  const long long refCycles= gEventValues.at(EventInds::CLK_UNHALTED_REF_XCLK_IND);
+  const long long aloneCycles= gEventValues.at(EventInds::CLK_UNHALTED_ONE_THREAD_ACTIVE_IND);
+  if (refCycles <= 0)
+    return 0.0;
+  // Both count at the same reference clock, but they are not read at exactly
+  // the same instant
+  return std::min(1.0, std::max(0.0, 1.0 - static_cast<double>(aloneCycles) /
+                                         static_cast<double>(refCycles)));
+}
+
+int haswell_membound_sibling_active(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == SMT_CONTENTION_GROUP) {
+      // The value out here is given as a fraction of active cycles
+      *out_value= sibling_active_fraction();
+    }
+    return 0;
+}
+
+int haswell_membound_contention_stall_cycles(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == SMT_CONTENTION_GROUP) {
+      // The stall cycles are not split by sibling state by the hardware, so
+      // they are attributed to contention in proportion to the cycles that
+      // the sibling was active. The value out here is given as a fraction of
+      // active cycles
+      *out_value=
+        static_cast<double>(cycles_no_execute()) * sibling_active_fraction() /
+        static_cast<double>(clk_unhalted());
+    }
+    return 0;
+}
+
+static long long roofline_bytes()
+{
+  using namespace RL;
+  return gEventValues.at(EventInds::LLC_MISS_IND) * CACHE_LINE_BYTES;
+}
+
+static long long roofline_flops()
+{
+  using namespace RL;
+  return gEventValues.at(EventInds::FP_SCALAR_DOUBLE_IND) +
+    2 * gEventValues.at(EventInds::FP_128B_PACKED_DOUBLE_IND) +
+    4 * gEventValues.at(EventInds::FP_256B_PACKED_DOUBLE_IND);
+}
+
+int haswell_membound_dram_bytes(metric_id_t metric_id,
+        struct timespec *current_sample_time, uint64_t *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == ROOFLINE_GROUP) {
+      // Divided by the sample time by MAP to give the bandwidth
+      *out_value= roofline_bytes();
+    }
+    return 0;
+}
+
+int haswell_membound_flops(metric_id_t metric_id,
+        struct timespec *current_sample_time, uint64_t *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == ROOFLINE_GROUP) {
+      // Divided by the sample time by MAP to give the rate
+      *out_value= roofline_flops();
+    }
+    return 0;
+}
+
+int haswell_membound_arithmetic_intensity(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == ROOFLINE_GROUP) {
+      // The value out here is given in FLOPs per byte of memory traffic
+      const long long bytes= roofline_bytes();
+      *out_value= bytes == 0 ? 0.0 :
+        static_cast<double>(roofline_flops()) / static_cast<double>(bytes);
+    }
+    return 0;
+}
+
+int haswell_membound_roofline_attainable(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == ROOFLINE_GROUP) {
+      // The value out here is the achieved FLOP rate as a percentage of the
+      // rate attainable at this arithmetic intensity on this core
+      *out_value= 0.0;
+      const long long bytes= roofline_bytes();
+      const long long flops= roofline_flops();
+      if (gSampleSeconds > 0.0 && flops > 0) {
+        // With no memory traffic only the compute roof applies
+        const double attainable= bytes == 0 ? RL::gPeaks.flopsPerSecond :
+          Roofline::attainable_flops(RL::gPeaks, static_cast<double>(flops) /
+                                                 static_cast<double>(bytes));
+        if (attainable > 0.0)
+          *out_value= 100.0 * (flops / gSampleSeconds) / attainable;
+      }
+    }
+    return 0;
+}
+
+// Returns the misses of the given event per thousand instructions retired
+static double misses_per_kilo_instruction(CM::EventInds missInd)
+{
+  using namespace CM;
+
+  const long long instructions= gEventValues.at(EventInds::INSTRUCTIONS_RETIRED_IND);
+  if (instructions <= 0)
+    return 0.0;
+  return 1000.0 * static_cast<double>(gEventValues.at(missInd)) /
+    static_cast<double>(instructions);
+}
+
+int haswell_membound_l1d_mpki(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == CACHE_MISSES_GROUP) {
+      // L1D lines replaced, which is one per L1D miss
+      *out_value= misses_per_kilo_instruction(CM::EventInds::L1D_REPLACEMENT_IND);
+    }
+    return 0;
+}
+
+int haswell_membound_l2_mpki(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == CACHE_MISSES_GROUP) {
+      *out_value= misses_per_kilo_instruction(CM::EventInds::L2_RQSTS_MISS_IND);
+    }
+    return 0;
+}
+
+int haswell_membound_l3_mpki(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == CACHE_MISSES_GROUP) {
+      *out_value= misses_per_kilo_instruction(CM::EventInds::LLC_MISS_IND);
+    }
+    return 0;
+}
+
+int haswell_membound_l3_hit_ratio(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    using namespace CM;
+
+    if (gEventGroup == CACHE_MISSES_GROUP) {
+      // The value out here is given as a fraction of L3 references. When the
+      // group is multiplexed the two counts are estimates, so the ratio is
+      // clamped
+      const long long references= gEventValues.at(EventInds::LLC_REFERENCE_IND);
+      const long long misses= gEventValues.at(EventInds::LLC_MISS_IND);
+      *out_value= references <= 0 ? 0.0 :
+        std::max(0.0, 1.0 - static_cast<double>(misses) / static_cast<double>(references));
+    }
+    return 0;
+}
+
+int haswell_membound_dtlb_load_walk_cycles(metric_id_t metric_id,
+        struct timespec *current_sample_time, uint64_t *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == CACHE_MISSES_GROUP) {
+      *out_value= CM::gEventValues.at(CM::EventInds::DTLB_LOAD_WALK_DURATION_IND);
+    }
+    return 0;
+}
+
+int haswell_membound_dtlb_store_walk_cycles(metric_id_t metric_id,
+        struct timespec *current_sample_time, uint64_t *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == CACHE_MISSES_GROUP) {
+      *out_value= CM::gEventValues.at(CM::EventInds::DTLB_STORE_WALK_DURATION_IND);
+    }
+    return 0;
+}
+
+int haswell_membound_page_walk_cycles(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    using namespace CM;
+
+    if (gEventGroup == CACHE_MISSES_GROUP) {
+      // The value out here is given as a fraction of active cycles. Load and
+      // store walks can overlap, so the sum is clamped
+      const long long cycles= gEventValues.at(EventInds::CLK_UNHALTED_IND);
+      const long long walks= gEventValues.at(EventInds::DTLB_LOAD_WALK_DURATION_IND) +
+        gEventValues.at(EventInds::DTLB_STORE_WALK_DURATION_IND);
+      *out_value= cycles <= 0 ? 0.0 :
+        std::min(1.0, static_cast<double>(walks) / static_cast<double>(cycles));
+    }
+    return 0;
+}
+
+// Returns the fraction of active cycles in which the given port was
+// dispatched a uop. Each port takes at most one uop a cycle
+static double port_utilization(int port)
+{
+  using namespace PU;
+
+  const long long cycles= gEventValues.at(EventInds::CLK_UNHALTED_IND);
+  if (cycles <= 0)
+    return 0.0;
+  return std::min(1.0, static_cast<double>(gEventValues.at(EventInds::UOPS_PORT_0_IND + port)) /
+                  static_cast<double>(cycles));
+}
+
+// Returns the fraction of active cycles in which exactly the given number of
+// uops were executed, or for 3 at least three. The counts are multiplexed
+// estimates, so the differences between them are clamped
+static double ports_used_fraction(int ports)
+{
+  using namespace PU;
+
+  const long long cycles= gEventValues.at(EventInds::CLK_UNHALTED_IND);
+  if (cycles <= 0)
+    return 0.0;
+  const long long atLeast[]= {
+    cycles,
+    gEventValues.at(EventInds::CYCLES_GE_1_UOP_IND),
+    gEventValues.at(EventInds::CYCLES_GE_2_UOPS_IND),
+    gEventValues.at(EventInds::CYCLES_GE_3_UOPS_IND),
+    0
+  };
+  const long long exactly= ports == 3 ? atLeast[3] : atLeast[ports] - atLeast[ports + 1];
+  return std::min(1.0, std::max(0.0, static_cast<double>(exactly) / static_cast<double>(cycles)));
+}
+
+// Returns the fraction of the floating point instructions retired that are
+// of the given width
+static double fp_width_fraction(PU::EventInds widthInd)
+{
+  using namespace PU;
+
+  const long long instructions= gEventValues.at(EventInds::FP_SCALAR_IND) +
+    gEventValues.at(EventInds::FP_128B_PACKED_IND) +
+    gEventValues.at(EventInds::FP_256B_PACKED_IND);
+  if (instructions <= 0)
+    return 0.0;
+  return static_cast<double>(gEventValues.at(widthInd)) / static_cast<double>(instructions);
+}
+
+int haswell_membound_port0_utilization(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= port_utilization(0);
+    }
+    return 0;
+}
+
+int haswell_membound_port1_utilization(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= port_utilization(1);
+    }
+    return 0;
+}
+
+int haswell_membound_port2_utilization(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= port_utilization(2);
+    }
+    return 0;
+}
+
+int haswell_membound_port3_utilization(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= port_utilization(3);
+    }
+    return 0;
+}
+
+int haswell_membound_port4_utilization(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= port_utilization(4);
+    }
+    return 0;
+}
+
+int haswell_membound_port5_utilization(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= port_utilization(5);
+    }
+    return 0;
+}
+
+int haswell_membound_port6_utilization(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= port_utilization(6);
     }
-
     return 0;
 }
 
-int haswell_membound_productive_cycles(metric_id_t metric_id,
-        struct timespec *current_sample_time, double* out_value)
+int haswell_membound_port7_utilization(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
 {
     // Update the counter values at the current sample period
     update_values(metric_id, current_sample_time);
 
-    using namespace MB;
-
-    if (ARM_MAP_MEMORY_BOUND) {
-      // The value out here is given as a fraction of active cycles
-      *out_value=
-        static_cast<double>(gEventValues.at(EventInds::CLK_UNHALTED_IND) -
-        gEventValues.at(EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND)) /
-        static_cast<double>(gEventValues.at(EventInds::CLK_UNHALTED_IND));
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= port_utilization(7);
     }
     return 0;
 }
 
-int haswell_membound_stall_cycles(metric_id_t metric_id,
+int haswell_membound_cycles_0_ports(metric_id_t metric_id,
         struct timespec *current_sample_time, double *out_value)
 {
     // Update the counter values at the current sample period
     update_values(metric_id, current_sample_time);
 
-    using namespace MB;
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= ports_used_fraction(0);
+    }
+    return 0;
+}
 
-    // The value out here is given as a fraction of active cycles
-    if (ARM_MAP_MEMORY_BOUND) {
-      *out_value=
-        static_cast<double>(gEventValues.at(EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND)) /
-        static_cast<double>(gEventValues.at(EventInds::CLK_UNHALTED_IND));
+int haswell_membound_cycles_1_port(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= ports_used_fraction(1);
     }
     return 0;
 }
 
-int haswell_membound_store_buffer_stall_cycles(metric_id_t metric_id,
+int haswell_membound_cycles_2_ports(metric_id_t metric_id,
         struct timespec *current_sample_time, double *out_value)
 {
     // Update the counter values at the current sample period
     update_values(metric_id, current_sample_time);
 
-    if (ARM_MAP_MEMORY_BOUND) {
-      // The value out here is given as a fraction of active cycles
-      *out_value=
-        static_cast<double>(MB::gEventValues.at(MB::EventInds::RESOURCE_STALLS_SB_IND)) /
-        static_cast<double>(MB::gEventValues.at(MB::EventInds::CLK_UNHALTED_IND));
-    } else {
-      // The value out here is given as a fraction of stalled cycles
-      *out_value=
-        static_cast<double>(BB::gEventValues.at(BB::EventInds::RESOURCE_STALLS_SB_IND)) /
-        static_cast<double>(BB::gEventValues.at(BB::EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND));
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= ports_used_fraction(2);
     }
     return 0;
 }
 
-int haswell_membound_l1d_pending_stall_cycles(metric_id_t metric_id,
+int haswell_membound_cycles_3_ports(metric_id_t metric_id,
         struct timespec *current_sample_time, double *out_value)
 {
     // Update the counter values at the current sample period
     update_values(metric_id, current_sample_time);
 
-    using namespace MB;
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= ports_used_fraction(3);
+    }
+    return 0;
+}
 
-    // The value out here is given as a fraction of active cycles
-    if (ARM_MAP_MEMORY_BOUND) {
-      *out_value=
-        static_cast<double>(gEventValues.at(EventInds::CYCLE_ACTIVITY_STALLS_L1D_PENDING_IND)) /
-        static_cast<double>(gEventValues.at(EventInds::CLK_UNHALTED_IND));
+int haswell_membound_fp_scalar(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= fp_width_fraction(PU::EventInds::FP_SCALAR_IND);
     }
     return 0;
 }
 
-static uint64_t memory_bound_measure()
+int haswell_membound_fp_128b_packed(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
 {
-  using namespace MB;
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
 
-  if (ARM_MAP_MEMORY_BOUND) {
-    return std::max(gEventValues.at(EventInds::RESOURCE_STALLS_SB_IND),
-      gEventValues.at(EventInds::CYCLE_ACTIVITY_STALLS_L1D_PENDING_IND));
-  } else {
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= fp_width_fraction(PU::EventInds::FP_128B_PACKED_IND);
+    }
     return 0;
-  }
 }
 
-int haswell_membound_memory_bound(metric_id_t metric_id,
+int haswell_membound_fp_256b_packed(metric_id_t metric_id,
         struct timespec *current_sample_time, double *out_value)
 {
     // Update the counter values at the current sample period
     update_values(metric_id, current_sample_time);
 
-    using namespace MB;
+    if (gEventGroup == PORT_UTILIZATION_GROUP) {
+      *out_value= fp_width_fraction(PU::EventInds::FP_256B_PACKED_IND);
+    }
+    return 0;
+}
 
-    if (ARM_MAP_MEMORY_BOUND) {
-      // The value out here is given as a fraction of STALLED cycles
-      *out_value= static_cast<double>(memory_bound_measure()) /
-        static_cast<double>(gEventValues.at(EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND));
+// Returns the fraction of the loads served from DRAM that were served from
+// the DRAM of another socket
+static double remote_dram_fraction()
+{
+  using namespace NL;
+
+  const long long local= gEventValues.at(EventInds::LOCAL_DRAM_IND);
+  const long long remote= gEventValues.at(EventInds::REMOTE_DRAM_IND);
+  if (local + remote <= 0)
+    return 0.0;
+  return static_cast<double>(remote) / static_cast<double>(local + remote);
+}
+
+int haswell_membound_local_dram_loads(metric_id_t metric_id,
+        struct timespec *current_sample_time, uint64_t *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == NUMA_LOCALITY_GROUP) {
+      // Divided by the sample time by MAP to give the rate
+      *out_value= NL::gEventValues.at(NL::EventInds::LOCAL_DRAM_IND);
     }
     return 0;
 }
 
-int haswell_membound_l1d_pend_miss_fb_full_cycles(metric_id_t metric_id,
-        struct timespec *current_sample_time, double *out_value)
+int haswell_membound_remote_dram_loads(metric_id_t metric_id,
+        struct timespec *current_sample_time, uint64_t *out_value)
 {
     // Update the counter values at the current sample period
     update_values(metric_id, current_sample_time);
 
-    using namespace BB;
+    if (gEventGroup == NUMA_LOCALITY_GROUP) {
+      // Divided by the sample time by MAP to give the rate
+      *out_value= NL::gEventValues.at(NL::EventInds::REMOTE_DRAM_IND);
+    }
+    return 0;
+}
 
-    if (!ARM_MAP_MEMORY_BOUND) {
-      // The value out here is given as a fraction of STALLED cycles
-      *out_value=
-        static_cast<double>(gEventValues.at(EventInds::L1D_PEND_MISS_FB_FULL_IND))/
-        static_cast<double>(gEventValues.at(EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND));
+int haswell_membound_remote_dram_ratio(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gEventGroup == NUMA_LOCALITY_GROUP) {
+      *out_value= remote_dram_fraction();
     }
+    return 0;
+}
 
+int haswell_membound_load_latency_samples(metric_id_t metric_id,
+        struct timespec *current_sample_time, uint64_t *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gLoadLatencyMode != LoadLatency::OFF) {
+      *out_value= gLoadLatency.samples;
+    }
     return 0;
 }
 
-int haswell_membound_offcore_requests_buffer_sq_cycles(metric_id_t metric_id,
+int haswell_membound_load_latency_mean(metric_id_t metric_id,
         struct timespec *current_sample_time, double *out_value)
 {
     // Update the counter values at the current sample period
     update_values(metric_id, current_sample_time);
 
-    using namespace BB;
+    if (gLoadLatencyMode != LoadLatency::OFF) {
+      // The value out here is given in cycles
+      *out_value= gLoadLatency.meanLatency;
+    }
+    return 0;
+}
 
-    if (!ARM_MAP_MEMORY_BOUND) {
-      // The value out here is given as a fraction of STALLED cycles
-      *out_value=
-        static_cast<double>(gEventValues.at(EventInds::OFFCORE_REQUESTS_BUFFER_SQ_IND))/
-        static_cast<double>(gEventValues.at(EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND));
+// The percentage of the sampled latency in the rank-th data object, ranked
+// by the sampled latency in the sample period
+static int load_latency_top(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value, int rank)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    if (gLoadLatencyMode != LoadLatency::OFF) {
+      *out_value= gLoadLatency.topShare[rank];
     }
+    return 0;
+}
+
+int haswell_membound_load_latency_top1(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    return load_latency_top(metric_id, current_sample_time, out_value, 0);
+}
+
+int haswell_membound_load_latency_top2(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    return load_latency_top(metric_id, current_sample_time, out_value, 1);
+}
+
+int haswell_membound_load_latency_top3(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    return load_latency_top(metric_id, current_sample_time, out_value, 2);
+}
+
+// Returns the ratio of the actual frequency to the nominal frequency while
+// the thread was unhalted, like APERF / MPERF
+static double turbo_ratio()
+{
+  long long core= 0, reference= 0;
+  frequency_cycles(&core, &reference);
+  return reference <= 0 ? 0.0 :
+    static_cast<double>(core) / static_cast<double>(reference);
+}
+
+int haswell_membound_effective_frequency(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
 
+    // The value out here is given in GHz, or 0 if the nominal frequency is
+    // not known
+    *out_value= turbo_ratio() * Frequency::nominal_hz() / 1e9;
     return 0;
 }
 
-static uint64_t bandwidth_bound_measure()
+int haswell_membound_turbo_ratio(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
 {
-  using namespace BB;
-  if (!ARM_MAP_MEMORY_BOUND) {
-    return std::max(gEventValues.at(EventInds::RESOURCE_STALLS_SB_IND),
-            gEventValues.at(EventInds::L1D_PEND_MISS_FB_FULL_IND) +
-            gEventValues.at(EventInds::OFFCORE_REQUESTS_BUFFER_SQ_IND));
-  } else {
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    *out_value= turbo_ratio();
     return 0;
-  }
 }
 
-int haswell_membound_bandwidth_bound(metric_id_t metric_id,
+int haswell_membound_throttled_time(metric_id_t metric_id,
         struct timespec *current_sample_time, double *out_value)
 {
     // Update the counter values at the current sample period
     update_values(metric_id, current_sample_time);
 
-    using namespace BB;
+    // The value out here is given as a percentage of the sample period. The
+    // kernel counts whole milliseconds, so it is capped for short periods
+    *out_value= gSampleSeconds <= 0.0 ? 0.0 :
+      std::min(100.0, 100.0 * gThrottle.milliseconds / (gSampleSeconds * 1000.0));
+    return 0;
+}
 
-    if (!ARM_MAP_MEMORY_BOUND) {
-      // The value out here is given as a fraction of STALLED cycles
-      *out_value= static_cast<double>(bandwidth_bound_measure()) /
-        static_cast<double>(gEventValues.at(EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND));
-    }
+int haswell_membound_throttle_events(metric_id_t metric_id,
+        struct timespec *current_sample_time, uint64_t *out_value)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
 
+    *out_value= gThrottle.events;
     return 0;
 }
 
+// Sets out_value to a statistic over the processes on the node of one of
+// the fractions of stalled cycles. The fraction of the group that is not
+// being collected is 0
+static int node_statistic(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value,
+        NodeValue value, double node_stats_summary::*statistic)
+{
+    // Update the counter values at the current sample period
+    update_values(metric_id, current_sample_time);
+
+    *out_value= gNodeSummaries[value].*statistic;
+    return 0;
+}
+
+int haswell_membound_node_memory_bound_min(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    return node_statistic(metric_id, current_sample_time, out_value,
+                          NODE_MEMORY_BOUND, &node_stats_summary::min);
+}
+
+int haswell_membound_node_memory_bound_mean(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    return node_statistic(metric_id, current_sample_time, out_value,
+                          NODE_MEMORY_BOUND, &node_stats_summary::mean);
+}
+
+int haswell_membound_node_memory_bound_max(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    return node_statistic(metric_id, current_sample_time, out_value,
+                          NODE_MEMORY_BOUND, &node_stats_summary::max);
+}
+
+int haswell_membound_node_memory_bound_cv(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    return node_statistic(metric_id, current_sample_time, out_value,
+                          NODE_MEMORY_BOUND, &node_stats_summary::cv);
+}
+
+int haswell_membound_node_bandwidth_bound_min(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    return node_statistic(metric_id, current_sample_time, out_value,
+                          NODE_BANDWIDTH_BOUND, &node_stats_summary::min);
+}
+
+int haswell_membound_node_bandwidth_bound_mean(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    return node_statistic(metric_id, current_sample_time, out_value,
+                          NODE_BANDWIDTH_BOUND, &node_stats_summary::mean);
+}
+
+int haswell_membound_node_bandwidth_bound_max(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    return node_statistic(metric_id, current_sample_time, out_value,
+                          NODE_BANDWIDTH_BOUND, &node_stats_summary::max);
+}
+
+int haswell_membound_node_bandwidth_bound_cv(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    return node_statistic(metric_id, current_sample_time, out_value,
+                          NODE_BANDWIDTH_BOUND, &node_stats_summary::cv);
+}
+
 } // extern "C"
 
 //! Returns the thread id of the calling thread
@@ -302,33 +1299,57 @@ static unsigned long int haswell_membound_get_thread_id()
 }
 
 /**
- * Gets in event codes for event names
+ * Gets in event codes for event names. Names are looked up in the node-local
+ * event cache first, and only the names missing from it are resolved by PAPI.
+ * The resolved names are then published to the cache for the other ranks on
+ * the node, so only the first rank to get here on a node does any resolving
+ * or writes the messages for it.
  */
 template<int NI>
 int get_event_codes(std::array<int, NI> & eventCodes,
-                    const std::array<const char*, NI> eventNames)
+                    const std::array<const char*, NI> eventNames,
+                    int numCounters)
 {
   // Get the event codes for the string descriptors
   // Begin by initialising the event codes to some known invalid value
   eventCodes.fill(0);
-  auto codeIt= eventCodes.begin();
   // At this point the event codes array should be the same size as the event
   // names array
   assert(eventCodes.size() == eventNames.size());
+
+  bool allCached= true;
+  for (int i= 0; i < NI; ++i)
+    allCached= EventCache::lookup(eventNames[i], &eventCodes[i]) && allCached;
+  if (allCached)
+    return 0;
+
+  // Another rank may be resolving the same names, in which case they are in
+  // the cache once we hold the lock
+  const bool locked= EventCache::lock();
+  auto codeIt= eventCodes.begin();
   for (const auto& name : eventNames) {
+    if (locked && EventCache::lookup(name, &*codeIt)) {
+      codeIt++;
+      continue;
+    }
     int eventCode= PAPI_NULL;
     if (PAPI_event_name_to_code(const_cast<char*>(name), &eventCode)
         != PAPI_OK) {
-      //  TODO: Add some actual error handling in here. For the time
-      //  being we just ignore any issue with the counter name
-      printf("PAPI_NOT_OK!\n");
+      // Adding the event set fails, and reports the event before it. Every
+      // rank would find the same, so only the root rank says which
+      if (mpi_rank_is_root())
+        fprintf(stderr, "Unknown PAPI event %s.\n", name);
+      *codeIt= 0;
       codeIt++;
       continue;
     }
-    printf("Adding event code %x for name: %s\n",eventCode,name);
     *codeIt= eventCode;
     codeIt++;
   }
+  if (locked) {
+    EventCache::store(eventNames.data(), eventCodes.data(), NI, numCounters);
+    EventCache::unlock();
+  }
   return 0;
 }
 
@@ -340,13 +1361,47 @@ int get_event_codes(std::array<int, NI> & eventCodes,
  */
 int haswell_membound_initialise_papi(plugin_id_t plugin_id)
 {
+    // Only one rank reports the configuration, it is the same for all of them
+    const bool verbose= mpi_rank_is_root();
     const char* ambb = getenv("ARM_MAP_BANDWIDTH_BOUND");
-    if (ambb == NULL) {
-      printf("Using ARM_MAP_MEMORY_BOUND. Set ARM_MAP_BANDWIDTH_BOUND=1 to measure bandwidth bound cycles.\n");
-      ARM_MAP_MEMORY_BOUND= 1;
+    const char* amsc = getenv("ARM_MAP_SMT_CONTENTION");
+    const char* amrl = getenv("ARM_MAP_ROOFLINE");
+    const char* amcm = getenv("ARM_MAP_CACHE_MISSES");
+    const char* ampu = getenv("ARM_MAP_PORT_UTILIZATION");
+    const char* amnl = getenv("ARM_MAP_NUMA_LOCALITY");
+    if (ambb != NULL) {
+      if (verbose)
+        printf("Using ARM_MAP_BANDWIDTH_BOUND.\n");
+      gEventGroup= BANDWIDTH_BOUND_GROUP;
+    } else if (amsc != NULL) {
+      if (verbose)
+        printf("Using ARM_MAP_SMT_CONTENTION.\n");
+      gEventGroup= SMT_CONTENTION_GROUP;
+    } else if (amrl != NULL) {
+      if (verbose)
+        printf("Using ARM_MAP_ROOFLINE.\n");
+      gEventGroup= ROOFLINE_GROUP;
+    } else if (amcm != NULL) {
+      if (verbose)
+        printf("Using ARM_MAP_CACHE_MISSES.\n");
+      gEventGroup= CACHE_MISSES_GROUP;
+    } else if (ampu != NULL) {
+      if (verbose)
+        printf("Using ARM_MAP_PORT_UTILIZATION.\n");
+      gEventGroup= PORT_UTILIZATION_GROUP;
+    } else if (amnl != NULL) {
+      if (verbose)
+        printf("Using ARM_MAP_NUMA_LOCALITY.\n");
+      gEventGroup= NUMA_LOCALITY_GROUP;
     } else {
-      printf("Using ARM_MAP_BANDWIDTH_BOUND.\n");
-      ARM_MAP_MEMORY_BOUND= 0;
+      if (verbose)
+        printf("Using ARM_MAP_MEMORY_BOUND. Set ARM_MAP_BANDWIDTH_BOUND=1 to measure bandwidth bound cycles, "
+               "ARM_MAP_SMT_CONTENTION=1 to measure contention with the sibling hardware thread, "
+               "ARM_MAP_ROOFLINE=1 to measure memory bandwidth and FLOP rates, "
+               "ARM_MAP_CACHE_MISSES=1 to measure cache and DTLB misses, "
+               "ARM_MAP_PORT_UTILIZATION=1 to measure execution port use and vector widths, "
+               "or ARM_MAP_NUMA_LOCALITY=1 to measure local and remote DRAM accesses.\n");
+      gEventGroup= MEMORY_BOUND_GROUP;
     }
 
     // Initialise the library and check the initialisation was successful
@@ -382,34 +1437,92 @@ int haswell_membound_initialise_papi(plugin_id_t plugin_id)
         return ERROR;
     }
 
-    int maxHardwareCounters = PAPI_num_counters();
+    // The number of counters is stored with the event cache, so that only one
+    // rank per node has to ask PAPI
+    EventCache::open();
+    int maxHardwareCounters = EventCache::num_counters();
+    if (maxHardwareCounters <= 0)
+        maxHardwareCounters = PAPI_num_counters();
     if (maxHardwareCounters < 0)
     {
+        EventCache::close();
         allinea_set_plugin_error_messagef(plugin_id, maxHardwareCounters, "This installation does not support PAPI");
         return ERROR;
     }
     else if (maxHardwareCounters == 0)
     {
+        EventCache::close();
         allinea_set_plugin_error_messagef(plugin_id, 0, "This machine does not provide hardware counters");
         return ERROR;
     }
 
     // Get the event codes for the string descriptors
-    if (ARM_MAP_MEMORY_BOUND)
+    switch (gEventGroup) {
+    case MEMORY_BOUND_GROUP:
       get_event_codes<MB::EventInds::NUM_INDS>
-        (MB::gEventCodes, MB::gEventNames);
-    else
+        (MB::gEventCodes, MB::gEventNames, maxHardwareCounters);
+      break;
+    case BANDWIDTH_BOUND_GROUP:
       get_event_codes<BB::EventInds::NUM_INDS>
-        (BB::gEventCodes, BB::gEventNames);
+        (BB::gEventCodes, BB::gEventNames, maxHardwareCounters);
+      break;
+    case SMT_CONTENTION_GROUP:
+      get_event_codes<SMT::EventInds::NUM_INDS>
+        (SMT::gEventCodes, SMT::gEventNames, maxHardwareCounters);
+      break;
+    case ROOFLINE_GROUP:
+      get_event_codes<RL::EventInds::NUM_INDS>
+        (RL::gEventCodes, RL::gEventNames, maxHardwareCounters);
+      break;
+    case CACHE_MISSES_GROUP:
+      get_event_codes<CM::EventInds::NUM_INDS>
+        (CM::gEventCodes, CM::gEventNames, maxHardwareCounters);
+      break;
+    case PORT_UTILIZATION_GROUP:
+      get_event_codes<PU::EventInds::NUM_INDS>
+        (PU::gEventCodes, PU::gEventNames, maxHardwareCounters);
+      break;
+    case NUMA_LOCALITY_GROUP:
+      get_event_codes<NL::EventInds::NUM_INDS>
+        (NL::gEventCodes, NL::gEventNames, maxHardwareCounters);
+      break;
+    }
+    EventCache::close();
 
     return 0;
 }
 
+/**
+ * Switches an event set to be multiplexed, so that it can hold more events
+ * than there are hardware counters. Any events already added are removed, as
+ * PAPI only allows an empty event set to be multiplexed.
+ */
+static int enable_multiplexing(int eventSet)
+{
+  int retval= PAPI_cleanup_eventset(eventSet);
+  if (retval != PAPI_OK)
+    return retval;
+  retval= PAPI_multiplex_init();
+  if (retval != PAPI_OK)
+    return retval;
+  // The event set must be bound to the CPU component before multiplexing
+  retval= PAPI_assign_eventset_component(eventSet, 0);
+  if (retval != PAPI_OK)
+    return retval;
+  return PAPI_set_multiplex(eventSet);
+}
+
+/**
+ * Creates the event set for the given events and starts it. If allowMultiplex
+ * is true and the events do not all fit in the hardware counters together, the
+ * event set is multiplexed instead of failing.
+ */
 template<int NI>
 int initialize_events(int * eventSetPtr, plugin_id_t plugin_id,
                       std::array<int, NI> & eventCodes,
                       const std::array<const char*, NI> eventNames,
-                      std::array<long long, NI> & eventValues)
+                      std::array<long long, NI> & eventValues,
+                      bool allowMultiplex= false)
 {
   // Create the event sets
   int retval = PAPI_create_eventset(eventSetPtr);
@@ -421,6 +1534,19 @@ int initialize_events(int * eventSetPtr, plugin_id_t plugin_id,
   // We assume that all of the events have been found at this point
   retval= PAPI_add_events(*eventSetPtr, eventCodes.data(),
                           eventCodes.size());
+  if (retval != PAPI_OK && allowMultiplex) {
+    // Not all of the events could be counted at once, so share the counters
+    // between them
+    if (mpi_rank_is_root())
+      printf("The events do not fit in the hardware counters together, so they are multiplexed.\n");
+    retval= enable_multiplexing(*eventSetPtr);
+    if (retval != PAPI_OK) {
+      allinea_set_plugin_error_messagef(plugin_id, retval, "Could not multiplex the event set: %s", PAPI_strerror(retval));
+      return ERROR;
+    }
+    retval= PAPI_add_events(*eventSetPtr, eventCodes.data(),
+                            eventCodes.size());
+  }
   if (retval != PAPI_OK) {
     if (retval > 0) {
       printf("Error adding events to the event set. Last successful event added \"%s\".\n",
@@ -463,16 +1589,100 @@ extern "C" {
             return ERROR;
         }
 
-        if (ARM_MAP_MEMORY_BOUND)
-          initialize_events<MB::EventInds::NUM_INDS>(&gEventSet, plugin_id,
-                                                     MB::gEventCodes,
-                                                     MB::gEventNames,
-                                                     MB::gEventValues);
-        else
-          initialize_events<BB::EventInds::NUM_INDS>(&gEventSet, plugin_id,
-                                                     BB::gEventCodes,
-                                                     BB::gEventNames,
-                                                     BB::gEventValues);
+        // Before the counters start, as the nominal frequency may have to be
+        // measured. Without throttle counters, throttling reads as 0
+        if (Frequency::open()) {
+          char name[128];
+          if (node_shm_name(name, sizeof(name), "arm-map-haswell-throttle",
+                            static_cast<int>(node_stats_job())) == 0)
+            gThrottleReportFd= node_shm_elect(name);
+        }
+
+        int retval= 0;
+        switch (gEventGroup) {
+        case MEMORY_BOUND_GROUP:
+          retval= initialize_events<MB::EventInds::NUM_INDS>(&gEventSet, plugin_id,
+                                                             MB::gEventCodes,
+                                                             MB::gEventNames,
+                                                             MB::gEventValues);
+          break;
+        case BANDWIDTH_BOUND_GROUP:
+          retval= initialize_events<BB::EventInds::NUM_INDS>(&gEventSet, plugin_id,
+                                                             BB::gEventCodes,
+                                                             BB::gEventNames,
+                                                             BB::gEventValues);
+          break;
+        case SMT_CONTENTION_GROUP:
+          retval= initialize_events<SMT::EventInds::NUM_INDS>(&gEventSet, plugin_id,
+                                                              SMT::gEventCodes,
+                                                              SMT::gEventNames,
+                                                              SMT::gEventValues);
+          break;
+        case ROOFLINE_GROUP:
+          // Measure the peaks before the counters start, so the calibration
+          // loops are not counted
+          if (!Roofline::calibrate(&RL::gPeaks))
+          {
+              allinea_set_plugin_error_messagef(plugin_id, 0, "Could not measure the roofline peaks of this node");
+              return ERROR;
+          }
+          retval= initialize_events<RL::EventInds::NUM_INDS>(&gEventSet, plugin_id,
+                                                             RL::gEventCodes,
+                                                             RL::gEventNames,
+                                                             RL::gEventValues);
+          break;
+        case CACHE_MISSES_GROUP:
+          retval= initialize_events<CM::EventInds::NUM_INDS>(&gEventSet, plugin_id,
+                                                             CM::gEventCodes,
+                                                             CM::gEventNames,
+                                                             CM::gEventValues,
+                                                             true);
+          break;
+        case PORT_UTILIZATION_GROUP:
+          retval= initialize_events<PU::EventInds::NUM_INDS>(&gEventSet, plugin_id,
+                                                             PU::gEventCodes,
+                                                             PU::gEventNames,
+                                                             PU::gEventValues,
+                                                             true);
+          break;
+        case NUMA_LOCALITY_GROUP:
+          // Not multiplexed, so that the DRAM loads and the stalls are
+          // counted over the same cycles
+          retval= initialize_events<NL::EventInds::NUM_INDS>(&gEventSet, plugin_id,
+                                                             NL::gEventCodes,
+                                                             NL::gEventNames,
+                                                             NL::gEventValues);
+          break;
+        }
+        if (retval != 0)
+        {
+            // allinea_set_plugin_error_message() should have been called by initialize_events()
+            return ERROR;
+        }
+
+        gTelemetryPage= telemetry_open();
+        node_stats_open(&gNodeStats, "haswell", NUM_NODE_VALUES);
+        std::fill(gNodeSummaries, gNodeSummaries + NUM_NODE_VALUES, node_stats_summary());
+
+        const char* regionCounterNames[REGION_TOTALS_MAX_COUNTERS];
+        const unsigned numRegionCounters= region_counters(regionCounterNames, NULL);
+        region_totals_open(&gRegionTotals, numRegionCounters, regionCounterNames);
+
+        if (getenv("ARM_MAP_LOAD_LATENCY") != NULL)
+        {
+            char error[256];
+            gLoadLatencyMode= LoadLatency::start(getenv("ARM_MAP_LOAD_LATENCY_SOFTWARE") != NULL,
+                                                 error, sizeof(error));
+            if (gLoadLatencyMode == LoadLatency::OFF)
+            {
+                allinea_set_plugin_error_messagef(plugin_id, 0, "%s", error);
+                return ERROR;
+            }
+            if (mpi_rank_is_root())
+                printf("Using ARM_MAP_LOAD_LATENCY: sampling %s.\n",
+                       gLoadLatencyMode == LoadLatency::PEBS ? "load latency" :
+                       "page faults, as load latency sampling is not available");
+        }
         return 0;
     }
 
@@ -482,11 +1692,30 @@ extern "C" {
     int allinea_plugin_cleanup(plugin_id_t plugin_id, void *unused)
     {
         // Stop the event set counting
-      int retval;
-      if (ARM_MAP_MEMORY_BOUND)
+      int retval= PAPI_OK;
+      switch (gEventGroup) {
+      case MEMORY_BOUND_GROUP:
         retval= PAPI_stop(gEventSet, MB::gEventValues.data());
-      else
+        break;
+      case BANDWIDTH_BOUND_GROUP:
         retval= PAPI_stop(gEventSet, BB::gEventValues.data());
+        break;
+      case SMT_CONTENTION_GROUP:
+        retval= PAPI_stop(gEventSet, SMT::gEventValues.data());
+        break;
+      case ROOFLINE_GROUP:
+        retval= PAPI_stop(gEventSet, RL::gEventValues.data());
+        break;
+      case CACHE_MISSES_GROUP:
+        retval= PAPI_stop(gEventSet, CM::gEventValues.data());
+        break;
+      case PORT_UTILIZATION_GROUP:
+        retval= PAPI_stop(gEventSet, PU::gEventValues.data());
+        break;
+      case NUMA_LOCALITY_GROUP:
+        retval= PAPI_stop(gEventSet, NL::gEventValues.data());
+        break;
+      }
 
       if (retval != PAPI_OK) {
         allinea_set_plugin_error_messagef(plugin_id, retval, "Error in PAPI_stop: %s", PAPI_strerror(retval));
@@ -509,11 +1738,250 @@ extern "C" {
       // Reset the event set
       gEventSet= PAPI_NULL;
 
+      telemetry_close(gTelemetryPage);
+      gTelemetryPage= NULL;
+      node_stats_close(&gNodeStats);
+
+      // One process of the job on each node says if its packages were
+      // throttled, so that the nodes that ran hot can be picked out of the
+      // output
+      if (gThrottleReportFd != -1) {
+        int throttledPackages;
+        const Frequency::Throttle throttle= Frequency::node_throttle(&throttledPackages);
+        if (throttle.events > 0) {
+          char host[256]= "";
+          gethostname(host, sizeof(host) - 1);
+          printf("Thermal throttling on %s: %d package%s throttled %llu times",
+                 host, throttledPackages, throttledPackages == 1 ? " was" : "s were",
+                 static_cast<unsigned long long>(throttle.events));
+          if (throttle.milliseconds > 0)
+            printf(" for %llu ms", static_cast<unsigned long long>(throttle.milliseconds));
+          printf(" while profiling.\n");
+        }
+        node_shm_resign(gThrottleReportFd);
+        gThrottleReportFd= -1;
+      }
+      Frequency::close();
+
+      if (mpi_rank_is_root())
+        print_region_totals(stdout);
+
+      if (gLoadLatencyMode != LoadLatency::OFF) {
+        if (mpi_rank_is_root())
+          LoadLatency::print_report(stdout, 10);
+        LoadLatency::stop();
+        gLoadLatencyMode= LoadLatency::OFF;
+      }
+
       return 0;
     }
 
 } // extern "C"
 
+// Returns numerator / denominator, or 0 if there is nothing to divide by
+static double fraction(long long numerator, long long denominator)
+{
+  return denominator <= 0 ? 0.0 :
+    static_cast<double>(numerator) / static_cast<double>(denominator);
+}
+
+// Publishes the headline metrics of the group being collected to the
+// telemetry page, for watching while the program runs. The rest are only
+// reported to MAP
+static void publish_sample(const struct timespec* current_sample_time)
+{
+  telemetry_publish_begin(gTelemetryPage);
+  telemetry_set_double(gTelemetryPage, TELEMETRY_HASWELL_PAPI_EFFECTIVE_FREQUENCY,
+                       turbo_ratio() * Frequency::nominal_hz() / 1e9, current_sample_time);
+  telemetry_set_uint64(gTelemetryPage, TELEMETRY_HASWELL_PAPI_THROTTLE_EVENTS,
+                       gThrottle.events, current_sample_time);
+  if (has_stall_events()) {
+    telemetry_set_uint64(gTelemetryPage, TELEMETRY_HASWELL_PAPI_ACTIVE_CYCLES,
+                         clk_unhalted(), current_sample_time);
+    telemetry_set_double(gTelemetryPage, TELEMETRY_HASWELL_PAPI_STALL_CYCLES,
+                         fraction(cycles_no_execute(), clk_unhalted()), current_sample_time);
+  }
+  switch (gEventGroup) {
+  case MEMORY_BOUND_GROUP:
+    telemetry_set_double(gTelemetryPage, TELEMETRY_HASWELL_PAPI_MEMORY_BOUND,
+                         fraction(memory_bound_measure(), cycles_no_execute()), current_sample_time);
+    break;
+  case BANDWIDTH_BOUND_GROUP:
+    telemetry_set_double(gTelemetryPage, TELEMETRY_HASWELL_PAPI_BANDWIDTH_BOUND,
+                         fraction(bandwidth_bound_measure(),
+                                  BB::gEventValues.at(BB::EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND)),
+                         current_sample_time);
+    break;
+  case SMT_CONTENTION_GROUP:
+    telemetry_set_double(gTelemetryPage, TELEMETRY_HASWELL_PAPI_SIBLING_ACTIVE,
+                         sibling_active_fraction(), current_sample_time);
+    break;
+  case ROOFLINE_GROUP:
+    telemetry_set_uint64(gTelemetryPage, TELEMETRY_HASWELL_PAPI_DRAM_BANDWIDTH,
+                         roofline_bytes(), current_sample_time);
+    telemetry_set_uint64(gTelemetryPage, TELEMETRY_HASWELL_PAPI_FLOPS,
+                         roofline_flops(), current_sample_time);
+    telemetry_set_double(gTelemetryPage, TELEMETRY_HASWELL_PAPI_ARITHMETIC_INTENSITY,
+                         fraction(roofline_flops(), roofline_bytes()), current_sample_time);
+    break;
+  case CACHE_MISSES_GROUP:
+    telemetry_set_double(gTelemetryPage, TELEMETRY_HASWELL_PAPI_L1D_MPKI,
+                         misses_per_kilo_instruction(CM::EventInds::L1D_REPLACEMENT_IND), current_sample_time);
+    telemetry_set_double(gTelemetryPage, TELEMETRY_HASWELL_PAPI_L2_MPKI,
+                         misses_per_kilo_instruction(CM::EventInds::L2_RQSTS_MISS_IND), current_sample_time);
+    telemetry_set_double(gTelemetryPage, TELEMETRY_HASWELL_PAPI_L3_MPKI,
+                         misses_per_kilo_instruction(CM::EventInds::LLC_MISS_IND), current_sample_time);
+    break;
+  case PORT_UTILIZATION_GROUP:
+    telemetry_set_double(gTelemetryPage, TELEMETRY_HASWELL_PAPI_CYCLES_0_PORTS,
+                         ports_used_fraction(0), current_sample_time);
+    telemetry_set_double(gTelemetryPage, TELEMETRY_HASWELL_PAPI_CYCLES_3_PORTS,
+                         ports_used_fraction(3), current_sample_time);
+    telemetry_set_double(gTelemetryPage, TELEMETRY_HASWELL_PAPI_FP_256B_PACKED,
+                         fp_width_fraction(PU::EventInds::FP_256B_PACKED_IND), current_sample_time);
+    break;
+  case NUMA_LOCALITY_GROUP:
+    telemetry_set_uint64(gTelemetryPage, TELEMETRY_HASWELL_PAPI_REMOTE_DRAM_LOADS,
+                         NL::gEventValues.at(NL::EventInds::REMOTE_DRAM_IND), current_sample_time);
+    telemetry_set_double(gTelemetryPage, TELEMETRY_HASWELL_PAPI_REMOTE_DRAM_RATIO,
+                         remote_dram_fraction(), current_sample_time);
+    break;
+  }
+  telemetry_publish_end(gTelemetryPage);
+}
+
+// The events of the group being collected, followed by the measures derived
+// from them, in the order they are added to the region totals
+static unsigned region_counters(const char** names, uint64_t* deltas)
+{
+  unsigned n= 0;
+  auto add= [&](const char* name, long long value) {
+    if (names != NULL)
+      names[n]= name;
+    if (deltas != NULL)
+      deltas[n]= value < 0 ? 0 : static_cast<uint64_t>(value);
+    ++n;
+  };
+  switch (gEventGroup) {
+  case MEMORY_BOUND_GROUP:
+    for (int i= 0; i < MB::EventInds::NUM_INDS; ++i)
+      add(MB::gEventNames[i], MB::gEventValues[i]);
+    add("memory bound cycles", memory_bound_measure());
+    break;
+  case BANDWIDTH_BOUND_GROUP:
+    for (int i= 0; i < BB::EventInds::NUM_INDS; ++i)
+      add(BB::gEventNames[i], BB::gEventValues[i]);
+    add("bandwidth bound cycles", bandwidth_bound_measure());
+    break;
+  case SMT_CONTENTION_GROUP:
+    for (int i= 0; i < SMT::EventInds::NUM_INDS; ++i)
+      add(SMT::gEventNames[i], SMT::gEventValues[i]);
+    break;
+  case ROOFLINE_GROUP:
+    for (int i= 0; i < RL::EventInds::NUM_INDS; ++i)
+      add(RL::gEventNames[i], RL::gEventValues[i]);
+    add("FLOPs", roofline_flops());
+    add("DRAM bytes", roofline_bytes());
+    break;
+  case CACHE_MISSES_GROUP:
+    for (int i= 0; i < CM::EventInds::NUM_INDS; ++i)
+      add(CM::gEventNames[i], CM::gEventValues[i]);
+    break;
+  case PORT_UTILIZATION_GROUP:
+    for (int i= 0; i < PU::EventInds::NUM_INDS; ++i)
+      add(PU::gEventNames[i], PU::gEventValues[i]);
+    add("FP instructions", PU::gEventValues[PU::FP_SCALAR_IND] +
+        PU::gEventValues[PU::FP_128B_PACKED_IND] + PU::gEventValues[PU::FP_256B_PACKED_IND]);
+    break;
+  case NUMA_LOCALITY_GROUP:
+    for (int i= 0; i < NL::EventInds::NUM_INDS; ++i)
+      add(NL::gEventNames[i], NL::gEventValues[i]);
+    add("DRAM loads", NL::gEventValues[NL::LOCAL_DRAM_IND] + NL::gEventValues[NL::REMOTE_DRAM_IND]);
+    break;
+  }
+  return n;
+}
+
+// The ratios of the region counters above that summarise each group
+static const region_ratio MB_REGION_RATIOS[]= {
+  { "stall fraction", MB::CYCLE_ACTIVITY_NO_EXECUTE_IND, MB::CLK_UNHALTED_IND, 1.0 },
+  { "memory bound fraction of stalls", MB::NUM_INDS, MB::CYCLE_ACTIVITY_NO_EXECUTE_IND, 1.0 },
+  { "turbo ratio", MB::CLK_UNHALTED_IND, MB::CLK_UNHALTED_REF_TSC_IND, 1.0 },
+};
+static const region_ratio BB_REGION_RATIOS[]= {
+  { "bandwidth bound fraction of stalls", BB::NUM_INDS, BB::CYCLE_ACTIVITY_NO_EXECUTE_IND, 1.0 },
+  { "turbo ratio", BB::CLK_UNHALTED_IND, BB::CLK_UNHALTED_REF_TSC_IND, 1.0 },
+};
+static const region_ratio SMT_REGION_RATIOS[]= {
+  { "stall fraction", SMT::CYCLE_ACTIVITY_NO_EXECUTE_IND, SMT::CLK_UNHALTED_IND, 1.0 },
+  { "sibling halted fraction", SMT::CLK_UNHALTED_ONE_THREAD_ACTIVE_IND, SMT::CLK_UNHALTED_REF_XCLK_IND, 1.0 },
+  { "turbo ratio", SMT::CLK_UNHALTED_IND, SMT::CLK_UNHALTED_REF_TSC_IND, 1.0 },
+};
+static const region_ratio RL_REGION_RATIOS[]= {
+  { "arithmetic intensity (FLOPs/byte)", RL::NUM_INDS, RL::NUM_INDS + 1, 1.0 },
+  { "FLOPs per cycle", RL::NUM_INDS, RL::CLK_UNHALTED_IND, 1.0 },
+  { "turbo ratio", RL::CLK_UNHALTED_IND, RL::CLK_UNHALTED_REF_TSC_IND, 1.0 },
+};
+static const region_ratio CM_REGION_RATIOS[]= {
+  { "L1D misses per 1000 instructions", CM::L1D_REPLACEMENT_IND, CM::INSTRUCTIONS_RETIRED_IND, 1000.0 },
+  { "L2 misses per 1000 instructions", CM::L2_RQSTS_MISS_IND, CM::INSTRUCTIONS_RETIRED_IND, 1000.0 },
+  { "L3 misses per 1000 instructions", CM::LLC_MISS_IND, CM::INSTRUCTIONS_RETIRED_IND, 1000.0 },
+  { "L3 miss ratio", CM::LLC_MISS_IND, CM::LLC_REFERENCE_IND, 1.0 },
+  { "turbo ratio", CM::CLK_UNHALTED_IND, CM::CLK_UNHALTED_REF_TSC_IND, 1.0 },
+};
+static const region_ratio PU_REGION_RATIOS[]= {
+  { "port 0 utilization", PU::UOPS_PORT_0_IND, PU::CLK_UNHALTED_IND, 1.0 },
+  { "port 1 utilization", PU::UOPS_PORT_1_IND, PU::CLK_UNHALTED_IND, 1.0 },
+  { "port 5 utilization", PU::UOPS_PORT_5_IND, PU::CLK_UNHALTED_IND, 1.0 },
+  { "port 6 utilization", PU::UOPS_PORT_6_IND, PU::CLK_UNHALTED_IND, 1.0 },
+  { "cycles with 3+ uops executed", PU::CYCLES_GE_3_UOPS_IND, PU::CLK_UNHALTED_IND, 1.0 },
+  { "scalar fraction of FP instructions", PU::FP_SCALAR_IND, PU::NUM_INDS, 1.0 },
+  { "256-bit fraction of FP instructions", PU::FP_256B_PACKED_IND, PU::NUM_INDS, 1.0 },
+  { "turbo ratio", PU::CLK_UNHALTED_IND, PU::CLK_UNHALTED_REF_TSC_IND, 1.0 },
+};
+static const region_ratio NL_REGION_RATIOS[]= {
+  { "stall fraction", NL::CYCLE_ACTIVITY_NO_EXECUTE_IND, NL::CLK_UNHALTED_IND, 1.0 },
+  { "L1D pending fraction of stalls", NL::CYCLE_ACTIVITY_STALLS_L1D_PENDING_IND, NL::CYCLE_ACTIVITY_NO_EXECUTE_IND, 1.0 },
+  { "remote fraction of DRAM loads", NL::REMOTE_DRAM_IND, NL::NUM_INDS, 1.0 },
+  { "remote DRAM loads per 1000 cycles", NL::REMOTE_DRAM_IND, NL::CLK_UNHALTED_IND, 1000.0 },
+  { "turbo ratio", NL::CLK_UNHALTED_IND, NL::CLK_UNHALTED_REF_TSC_IND, 1.0 },
+};
+
+// Prints the region totals of this process, with the ratios of the group
+static void print_region_totals(FILE* out)
+{
+  switch (gEventGroup) {
+  case MEMORY_BOUND_GROUP:
+    region_totals_print(&gRegionTotals, out, "Memory bound counters", MB_REGION_RATIOS,
+                        sizeof(MB_REGION_RATIOS) / sizeof(MB_REGION_RATIOS[0]));
+    break;
+  case BANDWIDTH_BOUND_GROUP:
+    region_totals_print(&gRegionTotals, out, "Bandwidth bound counters", BB_REGION_RATIOS,
+                        sizeof(BB_REGION_RATIOS) / sizeof(BB_REGION_RATIOS[0]));
+    break;
+  case SMT_CONTENTION_GROUP:
+    region_totals_print(&gRegionTotals, out, "SMT contention counters", SMT_REGION_RATIOS,
+                        sizeof(SMT_REGION_RATIOS) / sizeof(SMT_REGION_RATIOS[0]));
+    break;
+  case ROOFLINE_GROUP:
+    region_totals_print(&gRegionTotals, out, "Roofline counters", RL_REGION_RATIOS,
+                        sizeof(RL_REGION_RATIOS) / sizeof(RL_REGION_RATIOS[0]));
+    break;
+  case CACHE_MISSES_GROUP:
+    region_totals_print(&gRegionTotals, out, "Cache miss counters", CM_REGION_RATIOS,
+                        sizeof(CM_REGION_RATIOS) / sizeof(CM_REGION_RATIOS[0]));
+    break;
+  case PORT_UTILIZATION_GROUP:
+    region_totals_print(&gRegionTotals, out, "Port utilization counters", PU_REGION_RATIOS,
+                        sizeof(PU_REGION_RATIOS) / sizeof(PU_REGION_RATIOS[0]));
+    break;
+  case NUMA_LOCALITY_GROUP:
+    region_totals_print(&gRegionTotals, out, "NUMA locality counters", NL_REGION_RATIOS,
+                        sizeof(NL_REGION_RATIOS) / sizeof(NL_REGION_RATIOS[0]));
+    break;
+  }
+}
+
 // The following function, during sample time, will update the counter values
 // stored. This uses PAPI_accum, which resets the counter values after reading
 // them
@@ -527,13 +1995,36 @@ static int update_values(metric_id_t metric_id, const struct timespec* current_s
 
     // Accumulate the values in the counters. The counter values are zeroed
     // before this method, and counters are reset after retrieving the value
-    int retval;
-    if (ARM_MAP_MEMORY_BOUND) {
+    int retval= PAPI_OK;
+    switch (gEventGroup) {
+    case MEMORY_BOUND_GROUP:
       MB::gEventValues.fill(0);
       retval= PAPI_accum(gEventSet, MB::gEventValues.data());
-    } else {
+      break;
+    case BANDWIDTH_BOUND_GROUP:
       BB::gEventValues.fill(0);
       retval= PAPI_accum(gEventSet, BB::gEventValues.data());
+      break;
+    case SMT_CONTENTION_GROUP:
+      SMT::gEventValues.fill(0);
+      retval= PAPI_accum(gEventSet, SMT::gEventValues.data());
+      break;
+    case ROOFLINE_GROUP:
+      RL::gEventValues.fill(0);
+      retval= PAPI_accum(gEventSet, RL::gEventValues.data());
+      break;
+    case CACHE_MISSES_GROUP:
+      CM::gEventValues.fill(0);
+      retval= PAPI_accum(gEventSet, CM::gEventValues.data());
+      break;
+    case PORT_UTILIZATION_GROUP:
+      PU::gEventValues.fill(0);
+      retval= PAPI_accum(gEventSet, PU::gEventValues.data());
+      break;
+    case NUMA_LOCALITY_GROUP:
+      NL::gEventValues.fill(0);
+      retval= PAPI_accum(gEventSet, NL::gEventValues.data());
+      break;
     }
 
     if (retval != PAPI_OK) {
@@ -541,6 +2032,33 @@ static int update_values(metric_id_t metric_id, const struct timespec* current_s
       return ERROR;
     }
 
+    if (gLoadLatencyMode != LoadLatency::OFF)
+      LoadLatency::end_period(&gLoadLatency);
+
+    gSampleSeconds= sLastSampleTime == 0 ? 0.0 :
+      static_cast<double>(now - sLastSampleTime) / ONE_SECOND_NS;
     sLastSampleTime= now;
+
+    Frequency::read_throttle(&gThrottle);
+
+    // The counts of the sample are all added to the region the sampled thread
+    // is in now, as the markers are too cheap to read the counters
+    if (region_totals_enabled(&gRegionTotals)) {
+      uint64_t deltas[REGION_TOTALS_MAX_COUNTERS];
+      region_counters(NULL, deltas);
+      region_totals_add(&gRegionTotals, region_totals_current(&gRegionTotals), deltas);
+    }
+
+    // Every process writes its fractions and reads those of the others on the
+    // node. Without ARM_MAP_NODE_STATS=1 the statistics are of this process
+    double nodeValues[NUM_NODE_VALUES];
+    nodeValues[NODE_MEMORY_BOUND]= fraction(memory_bound_measure(), cycles_no_execute());
+    nodeValues[NODE_BANDWIDTH_BOUND]= gEventGroup != BANDWIDTH_BOUND_GROUP ? 0.0 :
+      fraction(bandwidth_bound_measure(), BB::gEventValues.at(BB::EventInds::CYCLE_ACTIVITY_NO_EXECUTE_IND));
+    node_stats_write(&gNodeStats, nodeValues, current_sample_time);
+    node_stats_summarize(&gNodeStats, gNodeSummaries);
+
+    if (gTelemetryPage != NULL)
+      publish_sample(current_sample_time);
     return 0;
 }
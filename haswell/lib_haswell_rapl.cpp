@@ -0,0 +1,597 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The next include is required to create a custom metric for Arm MAP
+#include "allinea_metric_plugin_api.h"
+#include "node_shm.h"
+#include "node_stats.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define ONE_SECOND_NS      1000000000   // The number of nanoseconds in one second
+
+static const int ERROR = -1; // Returned by a function when there is an error
+
+///////////////////////////////////////////////////////////////////////////////
+// Package and DRAM energy and power of the socket the process runs on, from
+// the RAPL energy counters in the powercap sysfs interface
+// (/sys/class/powercap/intel-rapl:<package>/energy_uj, and the dram zone
+// below it).
+//
+// The energy counters are per package and reading sysfs is slow, so only one
+// process per package reads them. It is elected with a lock and publishes the
+// total energy, with the counter wraparound removed, in a shared memory page
+// for the package. If it exits or stops sampling, another process takes over
+// from the published totals once they become stale.
+//
+// Every process also adds the instructions it retires to a total in the page,
+// so the energy per instruction is the package energy divided by the
+// instructions of all of the processes on the package being profiled. So that
+// only the processes of one job are counted, the page is per job (see
+// node_stats_job in ../common/node_stats.h) and the last process of the job on
+// the package removes it. Each reader starts the instructions again when it
+// starts, so that none are left from processes that were killed.
+//
+// ARM_MAP_RAPL_SYSFS_ROOT replaces /sys, for testing with synthetic files.
+///////////////////////////////////////////////////////////////////////////////
+
+// If the totals have not been published for this long, the reader is assumed
+// to have gone and another process tries to take over
+static const std::uint64_t STALE_NS= ONE_SECOND_NS;
+
+// The page published for each package
+struct PackagePage {
+  std::uint32_t seq;
+  std::uint32_t hasDram;
+  std::uint64_t timestamp;
+  // The energy since the first reader started, in microjoules
+  std::uint64_t packageUj;
+  std::uint64_t dramUj;
+  // Not under the seqlock: every process adds to it atomically
+  std::uint64_t instructions;
+  // The processes with the page mapped. See node_shm_attach
+  std::uint32_t users;
+  // Counts the times the instructions were started again, under the seqlock
+  std::uint32_t epoch;
+};
+
+// The energy counter of one RAPL zone
+struct Zone {
+  int fd;
+  std::uint64_t maxRangeUj;
+  // The counter value at the last read, to find the increase from
+  std::uint64_t lastUj;
+  char path[1024];
+};
+
+namespace Rapl {
+  // Where to find the powercap zones and topology, "/sys" unless overridden
+  static char gRoot[1024];
+  static bool gMock= false;
+
+  static int gPackage= -1;
+  static Zone gPackageZone;
+  static Zone gDramZone;
+  static bool gHasDram= false;
+
+  // Only set in the reader
+  static int gLockFd= -1;
+
+  static char gShmName[128];
+  static PackagePage* gPage= nullptr;
+
+  // This process's retired instructions
+  static int gInstructionsFd= -1;
+  static std::uint64_t gLastInstructions= 0;
+
+  // The last publication used to compute the metrics, and the metrics
+  static std::uint64_t gPrevTimestamp= 0;
+  static std::uint64_t gPrevPackageUj= 0;
+  static std::uint64_t gPrevDramUj= 0;
+  static std::uint64_t gPrevInstructions= 0;
+  static std::uint32_t gPrevEpoch= 0;
+  static double gPackageWatts= 0.0;
+  static double gDramWatts= 0.0;
+  static double gPackageJoules= 0.0;
+  static double gDramJoules= 0.0;
+
+  // Between publications the energy of each sample is estimated from the last
+  // power. The estimates are taken off the energy measured at the next
+  // publication, so that the total is still what was measured
+  static std::uint64_t gLastUpdateNs= 0;
+  static double gEstimatedPackageJoules= 0.0;
+  static double gEstimatedDramJoules= 0.0;
+  static double gNanojoulesPerInstruction= 0.0;
+}
+
+// Forward declaration. Used so that in this section we can have all of the
+// functions that are required to report the data for MAP
+static int update_values(metric_id_t metric_id, const struct timespec* current_sample_time);
+
+extern "C" {
+
+/**
+ * Sets the power drawn by the package the process runs on, in watts, over the
+ * last interval published by the package's reader
+ */
+int haswell_rapl_package_power(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    if (update_values(metric_id, current_sample_time) != 0)
+      return ERROR;
+    *out_value= Rapl::gPackageWatts;
+    return 0;
+}
+
+int haswell_rapl_dram_power(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    if (update_values(metric_id, current_sample_time) != 0)
+      return ERROR;
+    *out_value= Rapl::gDramWatts;
+    return 0;
+}
+
+/**
+ * Sets the energy used by the package since the last sample, in joules
+ */
+int haswell_rapl_package_energy(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    if (update_values(metric_id, current_sample_time) != 0)
+      return ERROR;
+    *out_value= Rapl::gPackageJoules;
+    return 0;
+}
+
+int haswell_rapl_dram_energy(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    if (update_values(metric_id, current_sample_time) != 0)
+      return ERROR;
+    *out_value= Rapl::gDramJoules;
+    return 0;
+}
+
+/**
+ * Sets the package and DRAM energy per instruction retired by the processes
+ * on the package, in nanojoules
+ */
+int haswell_rapl_energy_per_instruction(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    if (update_values(metric_id, current_sample_time) != 0)
+      return ERROR;
+    *out_value= Rapl::gNanojoulesPerInstruction;
+    return 0;
+}
+
+} // extern "C"
+
+//! Reads a decimal integer from an open sysfs file. Async-signal-safe
+static bool pread_u64(int fd, std::uint64_t* value)
+{
+  char buffer[64];
+  ssize_t len= pread(fd, buffer, sizeof(buffer) - 1, 0);
+  if (len <= 0)
+    return false;
+  buffer[len]= '\0';
+  char* end;
+  *value= strtoull(buffer, &end, 10);
+  return end != buffer;
+}
+
+static bool read_file_u64(const char* path, std::uint64_t* value)
+{
+  int fd= open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  bool ok= pread_u64(fd, value);
+  close(fd);
+  return ok;
+}
+
+//! Reads the first line of a small file without the newline
+static bool read_file_line(const char* path, char* buffer, size_t size)
+{
+  FILE* file= fopen(path, "r");
+  if (file == nullptr)
+    return false;
+  bool ok= fgets(buffer, static_cast<int>(size), file) != nullptr;
+  fclose(file);
+  if (ok)
+    buffer[strcspn(buffer, "\n")]= '\0';
+  return ok;
+}
+
+static int package_of_cpu(int cpu)
+{
+  char path[1200];
+  snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/topology/physical_package_id",
+           Rapl::gRoot, cpu);
+  std::uint64_t package;
+  return read_file_u64(path, &package) ? static_cast<int>(package) : -1;
+}
+
+//! Finds the zones of our package: intel-rapl:<n> named package-<package>, and
+//! its subzone intel-rapl:<n>:<m> named dram
+static bool find_zones()
+{
+  using namespace Rapl;
+
+  char powercapPath[1100];
+  snprintf(powercapPath, sizeof(powercapPath), "%s/class/powercap", gRoot);
+  char packageName[32];
+  snprintf(packageName, sizeof(packageName), "package-%d", gPackage);
+
+  // The zone is found first so that its subzones can be recognised
+  char packageZone[256]= "";
+  for (int pass= 0; pass < 2; ++pass) {
+    DIR* dir= opendir(powercapPath);
+    if (dir == nullptr)
+      return false;
+    struct dirent* entry;
+    while ((entry= readdir(dir)) != nullptr) {
+      if (strncmp(entry->d_name, "intel-rapl:", strlen("intel-rapl:")) != 0)
+        continue;
+      const bool subzone= strchr(entry->d_name + strlen("intel-rapl:"), ':') != nullptr;
+      if (subzone != (pass == 1))
+        continue;
+      if (subzone && (strncmp(entry->d_name, packageZone, strlen(packageZone)) != 0 ||
+                      entry->d_name[strlen(packageZone)] != ':'))
+        continue;
+      char path[1400], name[64];
+      snprintf(path, sizeof(path), "%s/%s/name", powercapPath, entry->d_name);
+      if (!read_file_line(path, name, sizeof(name)))
+        continue;
+      Zone* zone= nullptr;
+      if (!subzone && strcmp(name, packageName) == 0) {
+        snprintf(packageZone, sizeof(packageZone), "%s", entry->d_name);
+        zone= &gPackageZone;
+      } else if (subzone && strcmp(name, "dram") == 0) {
+        zone= &gDramZone;
+        gHasDram= true;
+      }
+      if (zone == nullptr)
+        continue;
+      const int n= snprintf(zone->path, sizeof(zone->path), "%s/%s/energy_uj", powercapPath, entry->d_name);
+      if (n < 0 || n >= static_cast<int>(sizeof(zone->path))) {
+        closedir(dir);
+        return false;
+      }
+      snprintf(path, sizeof(path), "%s/%s/max_energy_range_uj", powercapPath, entry->d_name);
+      if (!read_file_u64(path, &zone->maxRangeUj))
+        zone->maxRangeUj= 0;
+    }
+    closedir(dir);
+    if (packageZone[0] == '\0')
+      return false;
+  }
+  return true;
+}
+
+static void close_zones()
+{
+  using namespace Rapl;
+  if (gPackageZone.fd != -1)
+    close(gPackageZone.fd);
+  if (gDramZone.fd != -1)
+    close(gDramZone.fd);
+  gPackageZone.fd= -1;
+  gDramZone.fd= -1;
+}
+
+//! The increase in a zone's counter since it was last read, allowing for it
+//! wrapping around at max_energy_range_uj. Async-signal-safe
+static bool read_zone(Zone* zone, std::uint64_t* increaseUj)
+{
+  std::uint64_t uj;
+  if (!pread_u64(zone->fd, &uj))
+    return false;
+  if (uj >= zone->lastUj)
+    *increaseUj= uj - zone->lastUj;
+  else if (zone->maxRangeUj >= zone->lastUj)
+    *increaseUj= zone->maxRangeUj - zone->lastUj + uj;
+  else
+    *increaseUj= uj; // Reset, with an unknown range
+  zone->lastUj= uj;
+  return true;
+}
+
+//! Tries to become the reader for our package. Async-signal-safe
+static bool become_reader()
+{
+  using namespace Rapl;
+
+  gLockFd= node_shm_elect(gShmName);
+  if (gLockFd == -1)
+    return false;
+  // energy_uj is only readable by root on many systems, so leave the package
+  // to a process that can read it
+  gPackageZone.fd= open(gPackageZone.path, O_RDONLY | O_CLOEXEC);
+  if (gHasDram)
+    gDramZone.fd= open(gDramZone.path, O_RDONLY | O_CLOEXEC);
+  if (gPackageZone.fd == -1 || !pread_u64(gPackageZone.fd, &gPackageZone.lastUj) ||
+      (gHasDram && (gDramZone.fd == -1 || !pread_u64(gDramZone.fd, &gDramZone.lastUj)))) {
+    close_zones();
+    node_shm_resign(gLockFd);
+    gLockFd= -1;
+    return false;
+  }
+  // The energy carries on from the last reader, but the instructions start
+  // again, as they may have been added to by processes that were killed
+  node_shm_write_begin(&gPage->seq);
+  __atomic_store_n(&gPage->instructions, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&gPage->epoch, gPage->epoch + 1, __ATOMIC_RELAXED);
+  node_shm_write_end(&gPage->seq);
+  return true;
+}
+
+//! Reads the energy counters of our package and publishes the totals, which
+//! carry on from those of any previous reader. Async-signal-safe
+static void publish()
+{
+  using namespace Rapl;
+
+  std::uint64_t packageIncrease, dramIncrease= 0;
+  if (!read_zone(&gPackageZone, &packageIncrease) ||
+      (gHasDram && !read_zone(&gDramZone, &dramIncrease)))
+    return;
+
+  const std::uint64_t packageUj= __atomic_load_n(&gPage->packageUj, __ATOMIC_RELAXED);
+  const std::uint64_t dramUj= __atomic_load_n(&gPage->dramUj, __ATOMIC_RELAXED);
+  node_shm_write_begin(&gPage->seq);
+  __atomic_store_n(&gPage->hasDram, gHasDram ? 1u : 0u, __ATOMIC_RELAXED);
+  __atomic_store_n(&gPage->timestamp, node_shm_now_ns(), __ATOMIC_RELAXED);
+  __atomic_store_n(&gPage->packageUj, packageUj + packageIncrease, __ATOMIC_RELAXED);
+  __atomic_store_n(&gPage->dramUj, dramUj + dramIncrease, __ATOMIC_RELAXED);
+  node_shm_write_end(&gPage->seq);
+}
+
+//! Takes a consistent copy of the published totals. Async-signal-safe
+//! \return false if the page was being written to on every try, e.g.
+//! because its reader died part way through publishing
+static bool read_page(std::uint64_t* timestamp, std::uint64_t* packageUj, std::uint64_t* dramUj,
+                      std::uint64_t* instructions, std::uint32_t* epoch)
+{
+  using namespace Rapl;
+
+  for (int tries= 0; tries < NODE_SHM_READ_TRIES; ++tries) {
+    std::uint32_t seq;
+    if (node_shm_read_begin(&gPage->seq, &seq) != 0)
+      return false;
+    *timestamp= __atomic_load_n(&gPage->timestamp, __ATOMIC_RELAXED);
+    *packageUj= __atomic_load_n(&gPage->packageUj, __ATOMIC_RELAXED);
+    *dramUj= __atomic_load_n(&gPage->dramUj, __ATOMIC_RELAXED);
+    *instructions= __atomic_load_n(&gPage->instructions, __ATOMIC_RELAXED);
+    *epoch= __atomic_load_n(&gPage->epoch, __ATOMIC_RELAXED);
+    if (!node_shm_read_retry(&gPage->seq, seq))
+      return true;
+  }
+  return false;
+}
+
+//! Counts the instructions retired by this process and the threads it creates
+static int open_instructions()
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size= sizeof(attr);
+  attr.type= PERF_TYPE_HARDWARE;
+  attr.config= PERF_COUNT_HW_INSTRUCTIONS;
+  attr.inherit= 1;
+  attr.exclude_kernel= 1;
+  attr.exclude_hv= 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+//! Adds the instructions retired since the last sample to the package total. Async-signal-safe
+static void add_instructions()
+{
+  using namespace Rapl;
+
+  std::uint64_t instructions;
+  if (gInstructionsFd == -1 ||
+      read(gInstructionsFd, &instructions, sizeof(instructions)) != sizeof(instructions))
+    return;
+  __atomic_fetch_add(&gPage->instructions, instructions - gLastInstructions, __ATOMIC_RELAXED);
+  gLastInstructions= instructions;
+}
+
+extern "C" {
+    // This function is called before the program starts executing. The function
+    // signature must remain unchanged to be picked up by the Arm MAP sampler.
+    int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused)
+    {
+        using namespace Rapl;
+
+        const char* root= getenv("ARM_MAP_RAPL_SYSFS_ROOT");
+        gMock= root != NULL && *root != '\0';
+        snprintf(gRoot, sizeof(gRoot), "%s", gMock ? root : "/sys");
+
+        const int cpu= sched_getcpu();
+        gPackage= cpu < 0 ? -1 : package_of_cpu(cpu);
+        if (gPackage < 0)
+        {
+            allinea_set_plugin_error_messagef(plugin_id, 0, "Could not find the package of CPU %d under %s", cpu, gRoot);
+            return ERROR;
+        }
+
+        gPackageZone.fd= -1;
+        gDramZone.fd= -1;
+        gHasDram= false;
+        if (!find_zones())
+        {
+            allinea_set_plugin_error_messagef(plugin_id, 0, "No RAPL powercap zone (intel-rapl:*) found for package %d under %s/class/powercap", gPackage, gRoot);
+            return ERROR;
+        }
+
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "%s-%u", gMock ? "haswell-rapl-mock" : "haswell-rapl", node_stats_job());
+        if (node_shm_name(gShmName, sizeof(gShmName), prefix, gPackage) != 0 ||
+            (gPage= static_cast<PackagePage*>(node_shm_map(gShmName, sizeof(PackagePage)))) == NULL)
+        {
+            allinea_set_plugin_error_messagef(plugin_id, errno, "Could not map the shared memory for package %d: %s", gPackage, strerror(errno));
+            return ERROR;
+        }
+        node_shm_attach(&gPage->users);
+
+        // Without instruction counts (e.g. in a VM) the energy per
+        // instruction is 0, but the energy and power are still reported
+        gInstructionsFd= open_instructions();
+        gLastInstructions= 0;
+
+        // It is not an error if another process is the reader, or if no
+        // process can read the counters yet
+        if (become_reader())
+            publish();
+        // The metrics of the first sample are from the totals at start up
+        if (!read_page(&gPrevTimestamp, &gPrevPackageUj, &gPrevDramUj, &gPrevInstructions, &gPrevEpoch))
+            gPrevTimestamp= 0;
+        return 0;
+    }
+
+    // This method is called after the main application has finished
+    int allinea_plugin_cleanup(plugin_id_t plugin_id, void *unused)
+    {
+        using namespace Rapl;
+
+        close_zones();
+        node_shm_resign(gLockFd);
+        gLockFd= -1;
+        if (gInstructionsFd != -1)
+            close(gInstructionsFd);
+        gInstructionsFd= -1;
+        if (gPage != nullptr)
+            node_shm_detach(gShmName, &gPage->users);
+        node_shm_unmap(gPage, sizeof(PackagePage));
+        gPage= nullptr;
+        return 0;
+    }
+} // extern "C"
+
+//! Estimates the energy of a sample without a new publication from the last
+//! power. Async-signal-safe
+static void hold_power(double sampleSeconds)
+{
+  using namespace Rapl;
+
+  gPackageJoules= gPackageWatts * sampleSeconds;
+  gDramJoules= gDramWatts * sampleSeconds;
+  gEstimatedPackageJoules+= gPackageJoules;
+  gEstimatedDramJoules+= gDramJoules;
+}
+
+// The following function, during sample time, publishes the energy if this
+// process is the reader for its package, and updates the metrics from the
+// latest published values. Everything called from here is async-signal-safe
+static int update_values(metric_id_t metric_id, const struct timespec* current_sample_time)
+{
+    using namespace Rapl;
+
+    static std::uint_fast64_t sLastSampleTime= 0;
+    const std::uint_fast64_t now= current_sample_time->tv_nsec + current_sample_time->tv_sec * ONE_SECOND_NS;
+    // If we have already updated for the current sample there is nothing to do
+    if (now == sLastSampleTime)
+        return 0;
+    sLastSampleTime= now;
+
+    if (gPage == nullptr)
+        return 0;
+
+    add_instructions();
+
+    if (gLockFd != -1) {
+        publish();
+    } else {
+        // Take over from a reader that has gone away
+        const std::uint64_t published= __atomic_load_n(&gPage->timestamp, __ATOMIC_RELAXED);
+        if (node_shm_now_ns() - published > STALE_NS && become_reader())
+            publish();
+    }
+
+    // The time since the last sample, over which the energy of this sample is
+    // estimated if nothing new has been published
+    const std::uint64_t updateNs= node_shm_now_ns();
+    const double sampleSeconds= gLastUpdateNs == 0 ? 0.0 :
+      static_cast<double>(updateNs - gLastUpdateNs) / ONE_SECOND_NS;
+    gLastUpdateNs= updateNs;
+
+    std::uint64_t timestamp, packageUj, dramUj, instructions;
+    std::uint32_t epoch;
+    if (!read_page(&timestamp, &packageUj, &dramUj, &instructions, &epoch)) {
+        // The reader died part way through publishing, so the page is stale.
+        // Take over if it has gone, otherwise hold the power
+        if (gLockFd != -1 || !become_reader()) {
+            hold_power(sampleSeconds);
+            return 0;
+        }
+        publish();
+        if (!read_page(&timestamp, &packageUj, &dramUj, &instructions, &epoch)) {
+            hold_power(sampleSeconds);
+            return 0;
+        }
+    }
+
+    // Nothing new has been published since the last sample, so the power is
+    // the same as before, unless there is no reader any more
+    if (timestamp == 0 || timestamp == gPrevTimestamp) {
+        if (updateNs - timestamp > STALE_NS) {
+            gPackageWatts= 0.0;
+            gDramWatts= 0.0;
+        }
+        hold_power(sampleSeconds);
+        return 0;
+    }
+
+    gPackageJoules= 0.0;
+    gDramJoules= 0.0;
+    if (gPrevTimestamp != 0) {
+        const double seconds= static_cast<double>(timestamp - gPrevTimestamp) / ONE_SECOND_NS;
+        const double packageJoules= (packageUj - gPrevPackageUj) * 1e-6;
+        const double dramJoules= (dramUj - gPrevDramUj) * 1e-6;
+        gPackageWatts= packageJoules / seconds;
+        gDramWatts= dramJoules / seconds;
+        gPackageJoules= std::max(packageJoules - gEstimatedPackageJoules, 0.0);
+        gDramJoules= std::max(dramJoules - gEstimatedDramJoules, 0.0);
+        // If a new reader started the instructions again since the last
+        // publication, the energy per instruction is held until the next
+        if (epoch == gPrevEpoch) {
+          const std::uint64_t retired= instructions - gPrevInstructions;
+          gNanojoulesPerInstruction= retired == 0 ? 0.0 :
+            (packageJoules + dramJoules) * 1e9 / retired;
+        }
+    }
+    gEstimatedPackageJoules= 0.0;
+    gEstimatedDramJoules= 0.0;
+    gPrevTimestamp= timestamp;
+    gPrevPackageUj= packageUj;
+    gPrevDramUj= dramUj;
+    gPrevInstructions= instructions;
+    gPrevEpoch= epoch;
+    return 0;
+}
@@ -0,0 +1,581 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The next include is required to create a custom metric for Arm MAP
+#include "allinea_metric_plugin_api.h"
+#include "mpi_rank.h"
+#include "node_shm.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <array>
+
+#define ONE_SECOND_NS      1000000000   // The number of nanoseconds in one second
+
+static const int ERROR = -1; // Returned by a function when there is an error
+
+///////////////////////////////////////////////////////////////////////////////
+// Memory controller (IMC) metrics of the socket the process runs on, from the
+// uncore CAS counts of each memory channel.
+//
+// The uncore counters are per socket, and opening them usually needs more
+// privileges than a rank has, so only one process per socket reads them. That
+// process is elected with a lock and publishes the totals in a shared memory
+// page for the socket, which every process (the reader included) turns into
+// bandwidth. If the reader exits or stops sampling, a thread of another
+// process takes over once the published totals become stale, so that opening
+// the counters is never done by the sampler. The last process to finish
+// removes the page.
+//
+// The peak bandwidth is the number of populated channels, by default one for
+// each PMU, times the speed of a channel, which must be given in
+// ARM_MAP_UNCORE_CHANNEL_GBS or ARM_MAP_UNCORE_CHANNEL_MTS, as it cannot be
+// read without privileges. ARM_MAP_UNCORE_CHANNELS overrides the channels.
+//
+// Setting ARM_MAP_UNCORE_SYSFS_ROOT to a directory laid out like /sys turns on
+// a mock mode for testing: the PMUs and the CPU topology are found under that
+// directory, and each PMU directory contains files mock_cas_count_read and
+// mock_cas_count_write holding the counter values.
+///////////////////////////////////////////////////////////////////////////////
+
+// CAS_COUNT.RD and CAS_COUNT.WR of the Haswell-EP memory channels. Each CAS
+// command transfers one cache line
+static const std::uint64_t CAS_COUNT_RD_CONFIG= 0x0304;
+static const std::uint64_t CAS_COUNT_WR_CONFIG= 0x0c04;
+static const std::uint64_t CAS_BYTES= 64;
+
+// The bytes a channel transfers each transfer, for ARM_MAP_UNCORE_CHANNEL_MTS
+static const double CHANNEL_BYTES_PER_TRANSFER= 8.0;
+
+// If the totals have not been published for this long, the reader is assumed
+// to have gone and another process tries to take over
+static const std::uint64_t STALE_NS= ONE_SECOND_NS;
+
+// How often the processes that are not the reader check for a stale page
+static const int TAKEOVER_CHECK_MS= 100;
+
+static const int MAX_CHANNELS= 32;
+
+// The page published for each socket
+struct SocketPage {
+  std::uint32_t seq;
+  std::uint32_t channels;
+  std::uint64_t timestamp;
+  std::uint64_t casReads;
+  std::uint64_t casWrites;
+  // The processes with the page mapped. See node_shm_attach
+  std::uint32_t users;
+  std::uint32_t reserved;
+};
+
+namespace Uncore {
+  // Where to find the PMUs and topology, "/sys" unless mocked
+  static char gRoot[1024];
+  static bool gMock= false;
+
+  // The socket of this process, and the PMU type and CPU to open for each of
+  // its memory channels
+  static int gSocket= -1;
+  static int gNumChannels= 0;
+  static std::array<int, MAX_CHANNELS> gChannelTypes;
+  static std::array<int, MAX_CHANNELS> gChannelCpus;
+  static std::array<char[256], MAX_CHANNELS> gChannelDirs;
+
+  // Only open in the reader. The counters are only read once gReading is
+  // set, after they are opened, as the takeover thread may open them
+  static int gLockFd= -1;
+  static int gReading= 0;
+  static std::array<int, MAX_CHANNELS> gReadFds;
+  static std::array<int, MAX_CHANNELS> gWriteFds;
+
+  // The totals published when the reader took over, which its counters,
+  // starting from zero, are added to
+  static std::uint64_t gBaseReads= 0;
+  static std::uint64_t gBaseWrites= 0;
+
+  static char gShmName[128];
+  static SocketPage* gPage= nullptr;
+
+  static double gPeakBytesPerSecond= 0.0;
+
+  // Takes over from a reader that has gone, in processes that are not the
+  // reader
+  static pthread_t gTakeoverThread;
+  static bool gTakeoverThreadStarted= false;
+  static int gTakeoverStopPipe[2]= { -1, -1 };
+
+  // The last publication used to compute the rates, and the rates
+  static std::uint64_t gPrevTimestamp= 0;
+  static std::uint64_t gPrevReads= 0;
+  static std::uint64_t gPrevWrites= 0;
+  static double gReadBytesPerSecond= 0.0;
+  static double gWriteBytesPerSecond= 0.0;
+}
+
+// Forward declaration. Used so that in this section we can have all of the
+// functions that are required to report the data for MAP
+static int update_values(metric_id_t metric_id, const struct timespec* current_sample_time);
+
+extern "C" {
+
+/**
+ * Sets the memory read bandwidth of the socket of this process, in bytes per
+ * second, over the last interval published by the socket's reader
+ */
+int haswell_uncore_read_bandwidth(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    if (update_values(metric_id, current_sample_time) != 0)
+      return ERROR;
+    *out_value= Uncore::gReadBytesPerSecond;
+    return 0;
+}
+
+int haswell_uncore_write_bandwidth(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    if (update_values(metric_id, current_sample_time) != 0)
+      return ERROR;
+    *out_value= Uncore::gWriteBytesPerSecond;
+    return 0;
+}
+
+/**
+ * Sets the memory bandwidth of the socket as a percentage of the peak of its
+ * memory channels
+ */
+int haswell_uncore_utilization(metric_id_t metric_id,
+        struct timespec *current_sample_time, double *out_value)
+{
+    if (update_values(metric_id, current_sample_time) != 0)
+      return ERROR;
+    *out_value= Uncore::gPeakBytesPerSecond <= 0.0 ? 0.0 :
+      100.0 * (Uncore::gReadBytesPerSecond + Uncore::gWriteBytesPerSecond) /
+      Uncore::gPeakBytesPerSecond;
+    return 0;
+}
+
+} // extern "C"
+
+//! Reads a decimal integer from a (sysfs) file. Async-signal-safe
+static bool read_file_u64(const char* path, std::uint64_t* value)
+{
+  int fd= open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  char buffer[64];
+  ssize_t len= read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
+  if (len <= 0)
+    return false;
+  buffer[len]= '\0';
+  char* end;
+  *value= strtoull(buffer, &end, 10);
+  return end != buffer;
+}
+
+//! Reads a counter value from an open perf event or mock file. Async-signal-safe
+static bool read_counter(int fd, std::uint64_t* value)
+{
+  if (!Uncore::gMock)
+    return read(fd, value, sizeof(*value)) == sizeof(*value);
+
+  char buffer[64];
+  ssize_t len= pread(fd, buffer, sizeof(buffer) - 1, 0);
+  if (len <= 0)
+    return false;
+  buffer[len]= '\0';
+  *value= strtoull(buffer, nullptr, 10);
+  return true;
+}
+
+static int socket_of_cpu(int cpu)
+{
+  char path[1200];
+  snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%d/topology/physical_package_id",
+           Uncore::gRoot, cpu);
+  std::uint64_t socket;
+  return read_file_u64(path, &socket) ? static_cast<int>(socket) : -1;
+}
+
+//! Finds the CPU in a PMU's cpumask (e.g. "0,18") that is on our socket
+static int cpu_on_socket(const char* cpumaskPath, int socket)
+{
+  FILE* file= fopen(cpumaskPath, "r");
+  if (file == nullptr)
+    return -1;
+  int cpu= -1;
+  int candidate;
+  while (fscanf(file, "%d", &candidate) == 1) {
+    if (socket_of_cpu(candidate) == socket) {
+      cpu= candidate;
+      break;
+    }
+    if (fgetc(file) == EOF)
+      break;
+  }
+  fclose(file);
+  return cpu;
+}
+
+//! Finds the memory channel PMUs of our socket
+static void find_channels()
+{
+  using namespace Uncore;
+
+  gNumChannels= 0;
+  char devicesPath[1100];
+  snprintf(devicesPath, sizeof(devicesPath), "%s/bus/event_source/devices", gRoot);
+  DIR* dir= opendir(devicesPath);
+  if (dir == nullptr)
+    return;
+  struct dirent* entry;
+  while ((entry= readdir(dir)) != nullptr && gNumChannels < MAX_CHANNELS) {
+    if (strncmp(entry->d_name, "uncore_imc_", strlen("uncore_imc_")) != 0)
+      continue;
+    char* pmuDir= gChannelDirs[gNumChannels];
+    if (snprintf(pmuDir, sizeof(gChannelDirs[0]), "%s/%s", devicesPath, entry->d_name)
+        >= static_cast<int>(sizeof(gChannelDirs[0])))
+      continue;
+    char path[512];
+    std::uint64_t type;
+    snprintf(path, sizeof(path), "%s/type", pmuDir);
+    if (!read_file_u64(path, &type))
+      continue;
+    snprintf(path, sizeof(path), "%s/cpumask", pmuDir);
+    int cpu= cpu_on_socket(path, gSocket);
+    if (cpu == -1)
+      continue;
+    gChannelTypes[gNumChannels]= static_cast<int>(type);
+    gChannelCpus[gNumChannels]= cpu;
+    gNumChannels++;
+  }
+  closedir(dir);
+}
+
+static int open_cas_counter(int channel, std::uint64_t config, const char* mockName)
+{
+  using namespace Uncore;
+
+  if (gMock) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", gChannelDirs[channel], mockName);
+    return open(path, O_RDONLY | O_CLOEXEC);
+  }
+
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size= sizeof(attr);
+  attr.type= gChannelTypes[channel];
+  attr.config= config;
+  return syscall(__NR_perf_event_open, &attr, -1, gChannelCpus[channel], -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static void close_counters()
+{
+  using namespace Uncore;
+  for (int i= 0; i < gNumChannels; ++i) {
+    if (gReadFds[i] != -1)
+      close(gReadFds[i]);
+    if (gWriteFds[i] != -1)
+      close(gWriteFds[i]);
+    gReadFds[i]= -1;
+    gWriteFds[i]= -1;
+  }
+}
+
+//! Tries to become the reader for our socket. Never called by the sampler,
+//! as it opens files and counters
+static bool become_reader()
+{
+  using namespace Uncore;
+
+  gLockFd= node_shm_elect(gShmName);
+  if (gLockFd == -1)
+    return false;
+  for (int i= 0; i < gNumChannels; ++i) {
+    gReadFds[i]= open_cas_counter(i, CAS_COUNT_RD_CONFIG, "mock_cas_count_read");
+    gWriteFds[i]= open_cas_counter(i, CAS_COUNT_WR_CONFIG, "mock_cas_count_write");
+    if (gReadFds[i] == -1 || gWriteFds[i] == -1) {
+      // Leave the socket to a process that can open the counters
+      close_counters();
+      node_shm_resign(gLockFd);
+      gLockFd= -1;
+      return false;
+    }
+  }
+  // Carry on from the totals of any previous reader, so that they never go
+  // backwards. It may have died part way through publishing them, which at
+  // worst gives one wrong sample
+  gBaseReads= __atomic_load_n(&gPage->casReads, __ATOMIC_RELAXED);
+  gBaseWrites= __atomic_load_n(&gPage->casWrites, __ATOMIC_RELAXED);
+  return true;
+}
+
+//! Reads the CAS counts of our socket and publishes them on top of the totals
+//! of any previous reader. Async-signal-safe
+static void publish()
+{
+  using namespace Uncore;
+
+  std::uint64_t reads= gBaseReads, writes= gBaseWrites;
+  for (int i= 0; i < gNumChannels; ++i) {
+    std::uint64_t value;
+    if (!read_counter(gReadFds[i], &value))
+      return;
+    reads+= value;
+    if (!read_counter(gWriteFds[i], &value))
+      return;
+    writes+= value;
+  }
+
+  node_shm_write_begin(&gPage->seq);
+  __atomic_store_n(&gPage->channels, static_cast<std::uint32_t>(gNumChannels), __ATOMIC_RELAXED);
+  __atomic_store_n(&gPage->timestamp, node_shm_now_ns(), __ATOMIC_RELAXED);
+  __atomic_store_n(&gPage->casReads, reads, __ATOMIC_RELAXED);
+  __atomic_store_n(&gPage->casWrites, writes, __ATOMIC_RELAXED);
+  node_shm_write_end(&gPage->seq);
+}
+
+//! Takes a consistent copy of the published totals. Async-signal-safe
+//! \return false if the page was being written to on every try, e.g.
+//! because its reader died part way through publishing
+static bool read_page(std::uint64_t* timestamp, std::uint64_t* reads, std::uint64_t* writes)
+{
+  using namespace Uncore;
+
+  for (int tries= 0; tries < NODE_SHM_READ_TRIES; ++tries) {
+    std::uint32_t seq;
+    if (node_shm_read_begin(&gPage->seq, &seq) != 0)
+      return false;
+    *timestamp= __atomic_load_n(&gPage->timestamp, __ATOMIC_RELAXED);
+    *reads= __atomic_load_n(&gPage->casReads, __ATOMIC_RELAXED);
+    *writes= __atomic_load_n(&gPage->casWrites, __ATOMIC_RELAXED);
+    if (!node_shm_read_retry(&gPage->seq, seq))
+      return true;
+  }
+  return false;
+}
+
+//! Whether the reader has stopped publishing, or died part way through
+static bool page_stale()
+{
+  using namespace Uncore;
+
+  std::uint64_t timestamp, reads, writes;
+  return !read_page(&timestamp, &reads, &writes) || node_shm_now_ns() - timestamp > STALE_NS;
+}
+
+//! Checks for a stale page until this process becomes the reader, and then
+//! publishes the first totals and leaves the publishing to the sampler
+static void* takeover_thread(void*)
+{
+  using namespace Uncore;
+
+  for (;;) {
+    if (page_stale() && become_reader()) {
+      publish();
+      __atomic_store_n(&gReading, 1, __ATOMIC_RELEASE);
+      break;
+    }
+    struct pollfd stop= { gTakeoverStopPipe[0], POLLIN, 0 };
+    if (poll(&stop, 1, TAKEOVER_CHECK_MS) != 0)
+      break;
+  }
+  return nullptr;
+}
+
+//! Starts the takeover thread with all signals blocked, so that the sampler
+//! never runs on it
+static bool start_takeover_thread()
+{
+  using namespace Uncore;
+
+  if (pipe2(gTakeoverStopPipe, O_CLOEXEC) != 0)
+    return false;
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  const int ret= pthread_create(&gTakeoverThread, nullptr, takeover_thread, nullptr);
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
+  if (ret != 0) {
+    close(gTakeoverStopPipe[0]);
+    close(gTakeoverStopPipe[1]);
+    gTakeoverStopPipe[0]= gTakeoverStopPipe[1]= -1;
+    return false;
+  }
+  gTakeoverThreadStarted= true;
+  return true;
+}
+
+static void stop_takeover_thread()
+{
+  using namespace Uncore;
+
+  if (!gTakeoverThreadStarted)
+    return;
+  if (write(gTakeoverStopPipe[1], "x", 1) == 1)
+    pthread_join(gTakeoverThread, nullptr);
+  close(gTakeoverStopPipe[0]);
+  close(gTakeoverStopPipe[1]);
+  gTakeoverStopPipe[0]= gTakeoverStopPipe[1]= -1;
+  gTakeoverThreadStarted= false;
+}
+
+//! The peak bandwidth of the socket from the channels and the speed of a
+//! channel given in the environment, or 0 if the speed is not given
+static double peak_bytes_per_second(int pmus)
+{
+  const char* channels= getenv("ARM_MAP_UNCORE_CHANNELS");
+  const int populated= channels != NULL && atoi(channels) > 0 ? atoi(channels) : pmus;
+  const char* gbs= getenv("ARM_MAP_UNCORE_CHANNEL_GBS");
+  if (gbs != NULL && atof(gbs) > 0.0)
+    return populated * atof(gbs) * 1e9;
+  const char* mts= getenv("ARM_MAP_UNCORE_CHANNEL_MTS");
+  if (mts != NULL && atof(mts) > 0.0)
+    return populated * atof(mts) * 1e6 * CHANNEL_BYTES_PER_TRANSFER;
+  return 0.0;
+}
+
+extern "C" {
+    // This function is called before the program starts executing. The function
+    // signature must remain unchanged to be picked up by the Arm MAP sampler.
+    int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused)
+    {
+        using namespace Uncore;
+
+        const char* root= getenv("ARM_MAP_UNCORE_SYSFS_ROOT");
+        gMock= root != NULL && *root != '\0';
+        snprintf(gRoot, sizeof(gRoot), "%s", gMock ? root : "/sys");
+
+        const int cpu= sched_getcpu();
+        gSocket= cpu < 0 ? -1 : socket_of_cpu(cpu);
+        if (gSocket < 0)
+        {
+            allinea_set_plugin_error_messagef(plugin_id, 0, "Could not find the socket of CPU %d under %s", cpu, gRoot);
+            return ERROR;
+        }
+
+        gReadFds.fill(-1);
+        gWriteFds.fill(-1);
+        find_channels();
+        if (gNumChannels == 0)
+        {
+            allinea_set_plugin_error_messagef(plugin_id, 0, "No uncore memory controller PMUs (uncore_imc_*) found for socket %d under %s", gSocket, gRoot);
+            return ERROR;
+        }
+
+        gPeakBytesPerSecond= peak_bytes_per_second(gNumChannels);
+        if (gPeakBytesPerSecond <= 0.0 && mpi_rank_is_root())
+            printf("Memory bandwidth utilization is not reported: set ARM_MAP_UNCORE_CHANNEL_GBS or ARM_MAP_UNCORE_CHANNEL_MTS to the speed of a memory channel.\n");
+
+        if (node_shm_name(gShmName, sizeof(gShmName),
+                          gMock ? "haswell-uncore-mock" : "haswell-uncore", gSocket) != 0 ||
+            (gPage= static_cast<SocketPage*>(node_shm_map(gShmName, sizeof(SocketPage)))) == NULL)
+        {
+            allinea_set_plugin_error_messagef(plugin_id, errno, "Could not map the shared memory for socket %d: %s", gSocket, strerror(errno));
+            return ERROR;
+        }
+        node_shm_attach(&gPage->users);
+
+        // It is not an error if another process is the reader, or if no
+        // process can open the counters yet
+        if (become_reader()) {
+            publish();
+            gReading= 1;
+        } else {
+            start_takeover_thread();
+        }
+        // The rates of the first sample are from the totals at start up
+        gReadBytesPerSecond= gWriteBytesPerSecond= 0.0;
+        if (!read_page(&gPrevTimestamp, &gPrevReads, &gPrevWrites))
+            gPrevTimestamp= 0;
+        return 0;
+    }
+
+    // This method is called after the main application has finished
+    int allinea_plugin_cleanup(plugin_id_t plugin_id, void *unused)
+    {
+        using namespace Uncore;
+
+        stop_takeover_thread();
+        gReading= 0;
+        close_counters();
+        node_shm_resign(gLockFd);
+        gLockFd= -1;
+        if (gPage != nullptr)
+            node_shm_detach(gShmName, &gPage->users);
+        node_shm_unmap(gPage, sizeof(SocketPage));
+        gPage= nullptr;
+        return 0;
+    }
+} // extern "C"
+
+// The following function, during sample time, publishes the counter values if
+// this process is the reader for its socket, and updates the rates from the
+// latest published values. Everything called from here is async-signal-safe
+static int update_values(metric_id_t metric_id, const struct timespec* current_sample_time)
+{
+    using namespace Uncore;
+
+    static std::uint_fast64_t sLastSampleTime= 0;
+    const std::uint_fast64_t now= current_sample_time->tv_nsec + current_sample_time->tv_sec * ONE_SECOND_NS;
+    // If we have already updated for the current sample there is nothing to do
+    if (now == sLastSampleTime)
+        return 0;
+    sLastSampleTime= now;
+
+    if (gPage == nullptr)
+        return 0;
+
+    // The takeover thread becomes the reader if the reader has gone
+    if (__atomic_load_n(&gReading, __ATOMIC_ACQUIRE))
+        publish();
+
+    // If the reader died part way through publishing, keep the rates until
+    // the page is taken over
+    std::uint64_t timestamp, reads, writes;
+    if (!read_page(&timestamp, &reads, &writes))
+        return 0;
+
+    // Nothing new has been published since the last sample, so keep the rates
+    if (timestamp == 0 || timestamp == gPrevTimestamp)
+        return 0;
+
+    // A new reader carries on from the published totals, but those may be
+    // torn if the last reader died part way through publishing them
+    if (gPrevTimestamp != 0 && reads >= gPrevReads && writes >= gPrevWrites) {
+        const double seconds= static_cast<double>(timestamp - gPrevTimestamp) / ONE_SECOND_NS;
+        gReadBytesPerSecond= (reads - gPrevReads) * CAS_BYTES / seconds;
+        gWriteBytesPerSecond= (writes - gPrevWrites) * CAS_BYTES / seconds;
+    }
+    gPrevTimestamp= timestamp;
+    gPrevReads= reads;
+    gPrevWrites= writes;
+    return 0;
+}
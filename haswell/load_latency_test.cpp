@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Tests the attribution of samples to data objects in the software (page
+// fault) mode of the load latency sampling, which works on any host. Three
+// arrays are mapped after sampling starts, so they are only found when the
+// helper thread reads the objects again, and the largest takes enough samples
+// to fill the pending samples. One is touched by a thread created after
+// sampling starts, and one is described as a heap block, as
+// ../alloc/lib-alloc.so would.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "alloc_blocks.h"
+#include "haswell_load_latency.h"
+#include "test_fixture.h"
+
+
+static const size_t LARGE_PAGES= 24576;
+static const size_t THREAD_PAGES= 4096;
+static const size_t SMALL_PAGES= 2048;
+
+static alloc_blocks gBlocks;
+
+// Found by LoadLatency::start in place of the one of lib-alloc.so, as the
+// test is linked with -rdynamic
+extern "C" const alloc_blocks* map_alloc_blocks()
+{
+    gBlocks.minSize= ALLOC_BLOCKS_MIN_SIZE;
+    return &gBlocks;
+}
+
+// Maps the arrays with an inaccessible page between each, so that the kernel
+// does not merge them into one mapping
+static void map_arrays(char** large, char** threaded, char** small)
+{
+    const size_t pageSize= sysconf(_SC_PAGESIZE);
+    const size_t size= (LARGE_PAGES + 1 + THREAD_PAGES + 1 + SMALL_PAGES) * pageSize;
+    void* arrays= mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arrays == MAP_FAILED)
+        FAIL("mmap: %s", strerror(errno));
+    // One page fault per page
+    madvise(arrays, size, MADV_NOHUGEPAGE);
+    *large= static_cast<char*>(arrays);
+    *threaded= *large + (LARGE_PAGES + 1) * pageSize;
+    *small= *threaded + (THREAD_PAGES + 1) * pageSize;
+    if (mprotect(*threaded - pageSize, pageSize, PROT_NONE) != 0 ||
+        mprotect(*small - pageSize, pageSize, PROT_NONE) != 0)
+        FAIL("mprotect: %s", strerror(errno));
+}
+
+// Faults in every page, and if drain is set drains the samples as a sampler
+// would
+static void touch(char* array, size_t pages, bool drain)
+{
+    const size_t pageSize= sysconf(_SC_PAGESIZE);
+    for (size_t page= 0; page < pages; ++page) {
+        array[page * pageSize]= 1;
+        if (drain && page % 1024 == 1023)
+            LoadLatency::drain();
+    }
+}
+
+static char* gThreadArray;
+
+static void* touch_in_thread(void*)
+{
+    touch(gThreadArray, THREAD_PAGES, false);
+    return NULL;
+}
+
+int main(void)
+{
+    char error[256];
+    if (LoadLatency::start(true, error, sizeof(error)) != LoadLatency::SOFTWARE)
+        FAIL("LoadLatency::start: %s", error);
+
+    char* large;
+    char* small;
+    map_arrays(&large, &gThreadArray, &small);
+    const size_t pageSize= sysconf(_SC_PAGESIZE);
+    alloc_block& block= gBlocks.blocks[alloc_blocks_hash(reinterpret_cast<uintptr_t>(small))];
+    block.start= reinterpret_cast<uintptr_t>(small);
+    block.site= reinterpret_cast<uintptr_t>(&map_alloc_blocks);
+    block.size= SMALL_PAGES * pageSize;
+
+    touch(large, LARGE_PAGES, true);
+    touch(small, SMALL_PAGES, true);
+    // The events are inherited by threads created after sampling starts
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, touch_in_thread, NULL) != 0)
+        FAIL("pthread_create");
+    pthread_join(thread, NULL);
+
+    LoadLatency::PeriodSummary summary;
+    LoadLatency::end_period(&summary);
+    const size_t pages= LARGE_PAGES + THREAD_PAGES + SMALL_PAGES;
+    if (summary.samples < pages)
+        FAIL("expected at least %zu samples != actual %llu", pages,
+             static_cast<unsigned long long>(summary.samples));
+    if (summary.meanLatency != 1.0)
+        FAIL("expected a mean weight of 1 in software mode != actual %g", summary.meanLatency);
+    const double largeShare= 100.0 * LARGE_PAGES / summary.samples;
+    const double threadShare= 100.0 * THREAD_PAGES / summary.samples;
+    const double smallShare= 100.0 * SMALL_PAGES / summary.samples;
+    if (summary.topShare[0] < largeShare || summary.topShare[0] > largeShare * 1.05)
+        FAIL("expected the large array to have %g%% of the samples != actual %g%%", largeShare, summary.topShare[0]);
+    if (summary.topShare[1] < threadShare || summary.topShare[1] > threadShare * 1.2)
+        FAIL("expected the thread's array to have %g%% of the samples != actual %g%%", threadShare, summary.topShare[1]);
+    if (summary.topShare[2] < smallShare || summary.topShare[2] > smallShare * 1.5)
+        FAIL("expected the small array to have %g%% of the samples != actual %g%%", smallShare, summary.topShare[2]);
+
+    // Nothing more has been sampled, and the shares are of this period only
+    LoadLatency::end_period(&summary);
+    if (summary.samples > 16 || summary.topShare[0] > 100.0)
+        FAIL("expected an empty period != actual %llu samples", static_cast<unsigned long long>(summary.samples));
+
+    // The small array is reported as a heap block, with where it was allocated
+    char* report;
+    size_t reportSize;
+    FILE* out= open_memstream(&report, &reportSize);
+    LoadLatency::print_report(out, 5);
+    fclose(out);
+    fputs(report, stderr);
+    if (strstr(report, "allocated at map_alloc_blocks+0x0") == NULL)
+        FAIL("expected the small array to be reported as a heap block");
+    free(report);
+
+    LoadLatency::stop();
+
+    fprintf(stderr, "PASS\n");
+    return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Tests the node statistics of ../common/node_stats.h with a process per
+// rank: that each sees the values of the others while they are current, that
+// the slots of processes that stop sampling or are killed are left out and
+// can be reused, and that the array is removed when the last process closes
+// it.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "node_stats.h"
+#include "test_fixture.h"
+
+
+static const int NUM_CHILDREN= 3;
+static const unsigned NUM_VALUES= 2;
+
+static void sleep_ms(int ms)
+{
+    struct timespec duration= { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&duration, NULL);
+}
+
+static struct timespec sample_time(int sample)
+{
+    struct timespec time= { sample, 0 };
+    return time;
+}
+
+// Opens the array, writes a sample of rank + 1 and 10, tells the parent and
+// waits to be told to go, then closes the array or, if killed is set, exits
+// without closing it
+static void child(int rank, int ready, int go, bool killed)
+{
+    node_stats stats;
+    if (node_stats_open(&stats, "test", NUM_VALUES) != 0 || stats.slot == -1)
+        _exit(2);
+    const double values[NUM_VALUES]= { rank + 1.0, 10.0 };
+    const struct timespec time= sample_time(1);
+    node_stats_write(&stats, values, &time);
+    char byte= 0;
+    if (write(ready, &byte, 1) != 1 || read(go, &byte, 1) != 1)
+        _exit(3);
+    if (!killed)
+        node_stats_close(&stats);
+    _exit(0);
+}
+
+static void check_summary(const node_stats_summary& summary, unsigned count, double min, double mean, double max,
+                          const char* what)
+{
+    if (summary.count != count || summary.min != min || std::fabs(summary.mean - mean) > 1e-9 || summary.max != max)
+        FAIL("%s: expected %u processes with min %g, mean %g, max %g, got %u with %g, %g, %g", what,
+             count, min, mean, max, summary.count, summary.min, summary.mean, summary.max);
+}
+
+static void run_children(node_stats* stats, bool killed)
+{
+    int ready[2], go[2];
+    if (pipe(ready) != 0 || pipe(go) != 0)
+        FAIL("pipe");
+    pid_t pids[NUM_CHILDREN];
+    for (int c= 0; c < NUM_CHILDREN; ++c) {
+        pids[c]= fork();
+        if (pids[c] == 0)
+            child(c + 1, ready[1], go[0], killed);
+    }
+    char byte;
+    for (int c= 0; c < NUM_CHILDREN; ++c)
+        if (read(ready[0], &byte, 1) != 1)
+            FAIL("a child did not start");
+
+    // Ranks 0 to 3 have values 1 to 4, and all have 10
+    const double values[NUM_VALUES]= { 1.0, 10.0 };
+    struct timespec time= sample_time(1);
+    node_stats_write(stats, values, &time);
+    node_stats_summary summaries[NUM_VALUES];
+    node_stats_summarize(stats, summaries);
+    check_summary(summaries[0], 4, 1.0, 2.5, 4.0, "ranks");
+    const double cv= std::sqrt(1.25) / 2.5;
+    if (std::fabs(summaries[0].cv - cv) > 1e-9)
+        FAIL("expected a coefficient of variation of %g, got %g", cv, summaries[0].cv);
+    check_summary(summaries[1], 4, 10.0, 10.0, 10.0, "constant");
+    if (summaries[1].cv != 0.0)
+        FAIL("expected no variation of a constant value, got %g", summaries[1].cv);
+
+    for (int c= 0; c < NUM_CHILDREN; ++c)
+        if (write(go[1], &byte, 1) != 1)
+            FAIL("write");
+    for (int c= 0; c < NUM_CHILDREN; ++c) {
+        int status;
+        if (waitpid(pids[c], &status, 0) != pids[c] || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            FAIL("a child failed");
+    }
+    close(ready[0]);
+    close(ready[1]);
+    close(go[0]);
+    close(go[1]);
+}
+
+int main()
+{
+    char job[32];
+    snprintf(job, sizeof(job), "node-stats-test-%d", (int) getpid());
+    setenv("ARM_MAP_NODE_STATS_JOB", job, 1);
+
+    // Off, the statistics are of this process alone
+    unsetenv("ARM_MAP_NODE_STATS");
+    node_stats stats;
+    if (node_stats_open(&stats, "test", NUM_VALUES) == 0)
+        FAIL("expected node statistics to be off without ARM_MAP_NODE_STATS=1");
+    const double own[NUM_VALUES]= { 0.5, 7.0 };
+    struct timespec time= sample_time(1);
+    node_stats_write(&stats, own, &time);
+    node_stats_summary summaries[NUM_VALUES];
+    node_stats_summarize(&stats, summaries);
+    check_summary(summaries[0], 1, 0.5, 0.5, 0.5, "off");
+    if (summaries[0].cv != 0.0)
+        FAIL("expected no variation of one process");
+    node_stats_close(&stats);
+
+    setenv("ARM_MAP_NODE_STATS", "1", 1);
+    if (node_stats_open(&stats, "test", NUM_VALUES) != 0 || stats.slot != 0)
+        FAIL("expected the first slot of a new array");
+    char path[256];
+    snprintf(path, sizeof(path), "/dev/shm%s", stats.name);
+
+    // Processes that close their slots are left out at once
+    run_children(&stats, false);
+    time= sample_time(2);
+    node_stats_write(&stats, own, &time);
+    node_stats_summarize(&stats, summaries);
+    check_summary(summaries[0], 1, 0.5, 0.5, 0.5, "closed");
+
+    // Killed processes are left out once their values are no longer current,
+    // two of their sample intervals or 0.2 s after they last wrote
+    run_children(&stats, true);
+    node_stats_summarize(&stats, summaries);
+    if (summaries[0].count != 4)
+        FAIL("expected the values of killed processes to be current for a while, got %u processes",
+             summaries[0].count);
+    sleep_ms(300);
+    node_stats_summarize(&stats, summaries);
+    check_summary(summaries[0], 1, 1.0, 1.0, 1.0, "killed");
+
+    // The slot of a process killed part way through a write is reused once
+    // there are no free slots
+    const int32_t killed= stats.array->slots[1].pid;
+    for (int s= 0; s < NODE_STATS_MAX_SLOTS; ++s)
+        if (stats.array->slots[s].pid == 0)
+            stats.array->slots[s].pid= killed;
+    stats.array->slots[1].seq|= 1;
+    node_stats reused;
+    if (node_stats_open(&reused, "test", NUM_VALUES) != 0 || reused.slot != 1)
+        FAIL("expected to reuse the slot of a killed process");
+    if (stats.array->slots[1].seq & 1)
+        FAIL("expected a reused slot to be readable, seq %u", stats.array->slots[1].seq);
+    const double reusedValues[NUM_VALUES]= { 3.0, 10.0 };
+    node_stats_write(&reused, reusedValues, &time);
+    node_stats_summarize(&stats, summaries);
+    check_summary(summaries[0], 2, 1.0, 2.0, 3.0, "reused");
+    node_stats_close(&reused);
+
+    // Another job on the node has an array of its own
+    pid_t other= fork();
+    if (other == 0) {
+        setenv("ARM_MAP_NODE_STATS_JOB", "another job", 1);
+        node_stats mine;
+        if (node_stats_open(&mine, "test", NUM_VALUES) != 0 || mine.slot != 0)
+            _exit(1);
+        node_stats_close(&mine);
+        _exit(0);
+    }
+    int status;
+    if (waitpid(other, &status, 0) != other || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        FAIL("expected another job to have an array of its own");
+
+    // The slots of the killed processes keep the array from being removed
+    node_stats_close(&stats);
+    if (access(path, F_OK) != 0)
+        FAIL("expected %s to be left while killed processes have slots", path);
+    shm_unlink(stats.name);
+
+    // Otherwise the last process to close it removes it
+    setenv("ARM_MAP_NODE_STATS_JOB", "node-stats-test-removed", 1);
+    node_stats first, second;
+    if (node_stats_open(&first, "test", NUM_VALUES) != 0 || node_stats_open(&second, "test", NUM_VALUES) != 0 ||
+        first.slot != 0 || second.slot != 1)
+        FAIL("expected two slots of a new array");
+    snprintf(path, sizeof(path), "/dev/shm%s", first.name);
+    node_stats_close(&first);
+    if (access(path, F_OK) != 0)
+        FAIL("expected %s to be left while a process has a slot", path);
+    node_stats_close(&second);
+    if (access(path, F_OK) == 0)
+        FAIL("expected %s to be removed by the last process", path);
+
+    printf("PASS\n");
+    return 0;
+}
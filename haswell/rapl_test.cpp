@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Tests libhaswellrapl against a fake sysfs tree with the package and DRAM
+// zones of two packages, with every CPU on package 0. A second process checks
+// that only the first one is elected to read the energy counters, that it
+// gets the totals the first one publishes, and that it holds the power between
+// publications.
+
+#include <cmath>
+
+#include "node_stats.h"
+#include "test_helpers.h"
+
+extern "C" {
+int allinea_plugin_cleanup(plugin_id_t plugin_id, void *unused);
+int haswell_rapl_package_power(metric_id_t metric_id, struct timespec *current_sample_time, double *out_value);
+int haswell_rapl_dram_power(metric_id_t metric_id, struct timespec *current_sample_time, double *out_value);
+int haswell_rapl_package_energy(metric_id_t metric_id, struct timespec *current_sample_time, double *out_value);
+int haswell_rapl_dram_energy(metric_id_t metric_id, struct timespec *current_sample_time, double *out_value);
+int haswell_rapl_energy_per_instruction(metric_id_t metric_id, struct timespec *current_sample_time, double *out_value);
+}
+
+// The counters wrap around after 1 J
+static const unsigned long long MAX_ENERGY_RANGE_UJ= 1000000;
+static char gRoot[]= "/tmp/rapl-test-XXXXXX";
+
+struct Sample {
+  double packageWatts;
+  double dramWatts;
+  double packageJoules;
+  double dramJoules;
+  double nanojoulesPerInstruction;
+};
+
+static void make_zone(const char* zone, const char* name)
+{
+    char path[1024], file[1100], value[32];
+    snprintf(path, sizeof(path), "%s/class/powercap/%s", gRoot, zone);
+    make_dirs(path);
+    snprintf(file, sizeof(file), "%s/name", path);
+    write_file(file, name);
+    snprintf(file, sizeof(file), "%s/max_energy_range_uj", path);
+    snprintf(value, sizeof(value), "%llu\n", MAX_ENERGY_RANGE_UJ);
+    write_file(file, value);
+    snprintf(file, sizeof(file), "%s/energy_uj", path);
+    write_file(file, "0\n");
+}
+
+static void make_zones()
+{
+    // Package 1 is listed first, so that the zones have to be found by name
+    make_zone("intel-rapl:0", "package-1\n");
+    make_zone("intel-rapl:0:0", "dram\n");
+    make_zone("intel-rapl:1", "package-0\n");
+    make_zone("intel-rapl:1:0", "core\n");
+    make_zone("intel-rapl:1:1", "dram\n");
+}
+
+static void set_energy(const char* zone, unsigned long long uj)
+{
+    char path[1024], value[32];
+    snprintf(path, sizeof(path), "%s/class/powercap/%s/energy_uj", gRoot, zone);
+    snprintf(value, sizeof(value), "%llu\n", uj);
+    write_file(path, value);
+}
+
+static void set_package_0(unsigned long long packageUj, unsigned long long dramUj)
+{
+    set_energy("intel-rapl:1", packageUj);
+    set_energy("intel-rapl:1:1", dramUj);
+    // The other package and the core zone must not be read
+    set_energy("intel-rapl:0", 999999);
+    set_energy("intel-rapl:0:0", 999999);
+    set_energy("intel-rapl:1:0", 999999);
+}
+
+static Sample sample(int second)
+{
+    struct timespec sampleTime;
+    sampleTime.tv_sec= second;
+    sampleTime.tv_nsec= 0;
+    Sample s;
+    if (haswell_rapl_package_power(1, &sampleTime, &s.packageWatts) != 0 ||
+        haswell_rapl_dram_power(2, &sampleTime, &s.dramWatts) != 0 ||
+        haswell_rapl_package_energy(3, &sampleTime, &s.packageJoules) != 0 ||
+        haswell_rapl_dram_energy(4, &sampleTime, &s.dramJoules) != 0 ||
+        haswell_rapl_energy_per_instruction(5, &sampleTime, &s.nanojoulesPerInstruction) != 0)
+        FAIL("sampling at %d s failed", second);
+    return s;
+}
+
+static void check_energy(const char* what, const Sample& s, double packageJoules, double dramJoules, double minSeconds)
+{
+    if (s.packageJoules < packageJoules - 1e-9 || s.packageJoules > packageJoules + 1e-9)
+        FAIL("%s: expected package energy %g J != actual %g J", what, packageJoules, s.packageJoules);
+    if (s.dramJoules < dramJoules - 1e-9 || s.dramJoules > dramJoules + 1e-9)
+        FAIL("%s: expected DRAM energy %g J != actual %g J", what, dramJoules, s.dramJoules);
+    if (!(s.packageWatts > 0.0 && s.packageWatts <= packageJoules / minSeconds))
+        FAIL("%s: expected package power in (0, %g] W != actual %g W", what, packageJoules / minSeconds, s.packageWatts);
+    if (!(s.dramWatts > 0.0 && s.dramWatts <= dramJoules / minSeconds))
+        FAIL("%s: expected DRAM power in (0, %g] W != actual %g W", what, dramJoules / minSeconds, s.dramWatts);
+    if (s.nanojoulesPerInstruction < 0.0)
+        FAIL("%s: expected a positive energy per instruction != actual %g nJ", what, s.nanojoulesPerInstruction);
+}
+
+// The page of package 0 for the job of the test
+static void page_name(char* name, size_t size)
+{
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "haswell-rapl-mock-%u", node_stats_job());
+    node_shm_name(name, size, prefix, 0);
+}
+
+// Not elected, so only sees the energy when the first process publishes it
+static void run_second_process(int readerReady, int ready, int published)
+{
+    char name[128];
+
+    page_name(name, sizeof(name));
+    initialize_second_process(readerReady, name);
+    Sample s= sample(1);
+    if (s.packageJoules != 0.0 || s.dramJoules != 0.0)
+        FAIL("second process: expected no energy before the next publication, got %g %g", s.packageJoules, s.dramJoules);
+    signal_pipe(ready);
+    wait_pipe(published);
+    s= sample(2);
+    check_energy("second process", s, 0.25, 0.05, 0.1);
+
+    // Until the next publication the energy is estimated from the power, and
+    // then the estimates are taken off what was measured
+    usleep(50000);
+    const Sample held= sample(3);
+    if (held.packageWatts != s.packageWatts || held.dramWatts != s.dramWatts)
+        FAIL("second process: expected the power to be held, got %g %g W after %g %g W",
+             held.packageWatts, held.dramWatts, s.packageWatts, s.dramWatts);
+    if (!(held.packageJoules > 0.0 && held.packageJoules < 0.25) || !(held.dramJoules > 0.0 && held.dramJoules < 0.05))
+        FAIL("second process: expected some of the next energy from the held power, got %g %g J",
+             held.packageJoules, held.dramJoules);
+    signal_pipe(ready);
+    wait_pipe(published);
+    s= sample(4);
+    if (std::fabs(held.packageJoules + s.packageJoules - 0.25) > 1e-9 ||
+        std::fabs(held.dramJoules + s.dramJoules - 0.05) > 1e-9)
+        FAIL("second process: expected the estimated and measured energy to add up to 0.25 0.05 J, got %g + %g, %g + %g J",
+             held.packageJoules, s.packageJoules, held.dramJoules, s.dramJoules);
+    allinea_plugin_cleanup(1, NULL);
+}
+
+int main(void)
+{
+    // The second process has another parent, so it is put in the job by name
+    setenv("ARM_MAP_NODE_STATS_JOB", "rapl-test", 1);
+    char name[128];
+    page_name(name, sizeof(name));
+    remove_shm(name);
+
+    make_fake_sysfs(gRoot);
+    make_zones();
+    set_package_0(100000, 10000);
+    setenv("ARM_MAP_RAPL_SYSFS_ROOT", gRoot, 1);
+
+    SecondProcess second;
+    start_second_process(&second, run_second_process);
+
+    // The first process is elected reader and publishes the totals at start up
+    if (allinea_plugin_initialize(1, NULL) != 0)
+        FAIL("allinea_plugin_initialize failed");
+    set_package_0(600000, 110000);
+    usleep(100000);
+    Sample s= sample(1);
+    check_energy("reader", s, 0.5, 0.1, 0.1);
+
+    // The package counter wraps around: 600000 -> 1000000 -> 200000
+    set_package_0(200000, 210000);
+    usleep(100000);
+    s= sample(2);
+    check_energy("reader after wraparound", s, 0.6, 0.1, 0.1);
+
+    signal_pipe(second.readerReady[1]);
+    wait_pipe(second.ready[0]);
+    set_package_0(450000, 260000);
+    usleep(100000);
+    s= sample(3);
+    check_energy("reader with a second process", s, 0.25, 0.05, 0.1);
+    signal_pipe(second.published[1]);
+    wait_pipe(second.ready[0]);
+    set_package_0(700000, 310000);
+    usleep(100000);
+    s= sample(4);
+    check_energy("reader after the second process held the power", s, 0.25, 0.05, 0.1);
+    signal_pipe(second.published[1]);
+    wait_second_process(second);
+
+    if (allinea_plugin_cleanup(1, NULL) != 0)
+        FAIL("allinea_plugin_cleanup failed");
+    check_removed(name);
+    remove_fake_sysfs(gRoot);
+
+    fprintf(stderr, "PASS\n");
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HASWELL_TEST_HELPERS_H
+#define HASWELL_TEST_HELPERS_H
+
+///////////////////////////////////////////////////////////////////////////////
+// What the tests of the Haswell plugins have in common, beyond
+// ../common/test_fixture.h: a fake sysfs tree to point a plugin at, and a
+// second process that shares a node with the test, in step with it through
+// pipes.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "node_shm.h"
+
+#define TEST_FIXTURE_PLUGIN
+#include "test_fixture.h"
+
+static inline void write_file(const char* path, const char* contents)
+{
+    FILE* file= fopen(path, "w");
+    if (file == NULL || fputs(contents, file) == EOF)
+        FAIL("could not write %s: %s", path, strerror(errno));
+    fclose(file);
+}
+
+static inline void make_dirs(const char* path)
+{
+    char buffer[1024];
+    snprintf(buffer, sizeof(buffer), "%s", path);
+    for (char* p= buffer + 1; *p; ++p) {
+        if (*p == '/') {
+            *p= '\0';
+            mkdir(buffer, 0700);
+            *p= '/';
+        }
+    }
+    mkdir(buffer, 0700);
+}
+
+// Creates the temporary directory root, a template ending in XXXXXX, with
+// every CPU of the machine on package 0
+static inline void make_fake_sysfs(char* root)
+{
+    if (mkdtemp(root) == NULL)
+        FAIL("mkdtemp: %s", strerror(errno));
+    char path[1024];
+    const long numCpus= sysconf(_SC_NPROCESSORS_CONF);
+    for (long cpu= 0; cpu < numCpus; ++cpu) {
+        snprintf(path, sizeof(path), "%s/devices/system/cpu/cpu%ld/topology", root, cpu);
+        make_dirs(path);
+        strcat(path, "/physical_package_id");
+        write_file(path, "0\n");
+    }
+}
+
+static inline int remove_entry(const char* path, const struct stat*, int, struct FTW*)
+{
+    return remove(path);
+}
+
+static inline void remove_fake_sysfs(const char* root)
+{
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Removes a shared memory object and its election lock, e.g. those left by a
+// run that failed
+static inline void remove_shm(const char* name)
+{
+    shm_unlink(name);
+    char lockPath[256];
+    snprintf(lockPath, sizeof(lockPath), "/dev/shm%s.lock", name);
+    unlink(lockPath);
+}
+
+// Checks that the last process removed a shared memory object and its
+// election lock
+static inline void check_removed(const char* name)
+{
+    const int fd= shm_open(name, O_RDONLY, 0);
+    if (fd != -1 || errno != ENOENT)
+        FAIL("expected %s to be removed by the last process", name);
+    char lockPath[256];
+    snprintf(lockPath, sizeof(lockPath), "/dev/shm%s.lock", name);
+    if (access(lockPath, F_OK) == 0)
+        FAIL("expected %s to be removed by the last process", lockPath);
+}
+
+static inline void signal_pipe(int fd)
+{
+    if (write(fd, "x", 1) != 1)
+        FAIL("pipe write: %s", strerror(errno));
+}
+
+static inline void wait_pipe(int fd)
+{
+    char byte;
+    if (read(fd, &byte, 1) != 1)
+        FAIL("pipe read: %s", strerror(errno));
+}
+
+// A second process, forked before the test initializes the plugin so that it
+// starts clean. The test signals readerReady once it is the reader; the
+// second process signals ready when it wants the reader to publish, and the
+// test signals published when it has
+struct SecondProcess {
+    pid_t pid;
+    int readerReady[2];
+    int ready[2];
+    int published[2];
+};
+
+static inline void start_second_process(SecondProcess* second, void (*body)(int readerReady, int ready, int published))
+{
+    if (pipe(second->readerReady) != 0 || pipe(second->ready) != 0 || pipe(second->published) != 0)
+        FAIL("pipe: %s", strerror(errno));
+    second->pid= fork();
+    if (second->pid == -1)
+        FAIL("fork: %s", strerror(errno));
+    if (second->pid == 0) {
+        body(second->readerReady[0], second->ready[1], second->published[0]);
+        _exit(0);
+    }
+}
+
+static inline void wait_second_process(const SecondProcess& second)
+{
+    int status;
+    if (waitpid(second.pid, &status, 0) != second.pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        FAIL("second process failed");
+}
+
+// In the second process: waits for the test to be the reader of the shared
+// memory object name, checks that it cannot be elected too, and initializes
+// the plugin
+static inline void initialize_second_process(int readerReady, const char* name)
+{
+    wait_pipe(readerReady);
+    if (node_shm_elect(name) != -1)
+        FAIL("second process: expected the first process to be the reader");
+    if (allinea_plugin_initialize(1, NULL) != 0)
+        FAIL("second process: allinea_plugin_initialize failed");
+}
+
+#endif // HASWELL_TEST_HELPERS_H
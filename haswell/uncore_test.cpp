@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Tests libhaswelluncore against a fake sysfs tree with two memory channels
+// on one socket. A second process checks that only the first one is elected
+// to read the counters, and that it gets the totals the first one publishes,
+// and that the page is removed when both have finished. Then a reader that
+// dies part way through publishing is taken over by the thread of another
+// process.
+
+#include <cstdint>
+#include <fcntl.h>
+
+#include "test_helpers.h"
+
+extern "C" {
+int allinea_plugin_cleanup(plugin_id_t plugin_id, void *unused);
+int haswell_uncore_read_bandwidth(metric_id_t metric_id, struct timespec *current_sample_time, double *out_value);
+int haswell_uncore_write_bandwidth(metric_id_t metric_id, struct timespec *current_sample_time, double *out_value);
+int haswell_uncore_utilization(metric_id_t metric_id, struct timespec *current_sample_time, double *out_value);
+}
+
+// As published by lib_haswell_uncore.cpp
+struct SocketPage {
+    std::uint32_t seq;
+    std::uint32_t channels;
+    std::uint64_t timestamp;
+    std::uint64_t casReads;
+    std::uint64_t casWrites;
+    std::uint32_t users;
+    std::uint32_t reserved;
+};
+
+static const int NUM_CHANNELS= 2;
+static char gRoot[]= "/tmp/uncore-test-XXXXXX";
+
+// Every CPU is on socket 0, and each channel PMU is read from CPU 0
+static void make_channels()
+{
+    char path[1024];
+    for (int channel= 0; channel < NUM_CHANNELS; ++channel) {
+        snprintf(path, sizeof(path), "%s/bus/event_source/devices/uncore_imc_%d", gRoot, channel);
+        make_dirs(path);
+        char file[1100];
+        snprintf(file, sizeof(file), "%s/type", path);
+        write_file(file, "20\n");
+        snprintf(file, sizeof(file), "%s/cpumask", path);
+        write_file(file, "0\n");
+    }
+}
+
+static void set_cas_counts(unsigned long long reads, unsigned long long writes)
+{
+    for (int channel= 0; channel < NUM_CHANNELS; ++channel) {
+        char path[1024], value[32];
+        snprintf(path, sizeof(path), "%s/bus/event_source/devices/uncore_imc_%d/mock_cas_count_read", gRoot, channel);
+        snprintf(value, sizeof(value), "%llu\n", reads);
+        write_file(path, value);
+        snprintf(path, sizeof(path), "%s/bus/event_source/devices/uncore_imc_%d/mock_cas_count_write", gRoot, channel);
+        snprintf(value, sizeof(value), "%llu\n", writes);
+        write_file(path, value);
+    }
+}
+
+static void sample(int second, double* read, double* write, double* utilization)
+{
+    struct timespec sampleTime;
+    sampleTime.tv_sec= second;
+    sampleTime.tv_nsec= 0;
+    if (haswell_uncore_read_bandwidth(1, &sampleTime, read) != 0 ||
+        haswell_uncore_write_bandwidth(2, &sampleTime, write) != 0 ||
+        haswell_uncore_utilization(3, &sampleTime, utilization) != 0)
+        FAIL("sampling at %d s failed", second);
+}
+
+// The bandwidth for the given CAS count increase on every channel, which took
+// at least minSeconds to publish
+static void check_bandwidth(const char* what, double actual, unsigned long long casPerChannel, double minSeconds)
+{
+    const double maxExpected= NUM_CHANNELS * casPerChannel * 64 / minSeconds;
+    if (!(actual > 0.0 && actual <= maxExpected))
+        FAIL("%s: expected in (0, %g] != actual %g", what, maxExpected, actual);
+}
+
+// The page and the election lock are removed by the last process to finish
+// A reader that dies part way through publishing leaves the page odd. The
+// thread of another process takes over, carrying on from the published totals
+// even though its counters start from zero
+static void check_takeover(const char* name)
+{
+    double readBandwidth, writeBandwidth, utilization;
+
+    SocketPage* page= static_cast<SocketPage*>(node_shm_map(name, sizeof(SocketPage)));
+    if (page == NULL)
+        FAIL("could not map %s: %s", name, strerror(errno));
+    page->casReads= 7000;
+    page->casWrites= 3000;
+    const std::uint64_t reads= page->casReads, writes= page->casWrites;
+
+    int lockFd= node_shm_elect(name);
+    if (lockFd == -1)
+        FAIL("takeover: expected no reader");
+    setenv("ARM_MAP_UNCORE_CHANNELS", "1", 1);
+    if (allinea_plugin_initialize(1, NULL) != 0)
+        FAIL("takeover: allinea_plugin_initialize failed");
+    page->seq|= 1;
+    set_cas_counts(0, 0);
+    node_shm_resign(lockFd);
+
+    // Sampling does not take over; the thread does, within a few checks
+    sample(3, &readBandwidth, &writeBandwidth, &utilization);
+    if (readBandwidth != 0.0 || writeBandwidth != 0.0)
+        FAIL("takeover: expected no bandwidth before the takeover, got %g %g", readBandwidth, writeBandwidth);
+    for (int tries= 0; tries < 100 && ((page->seq & 1) || page->timestamp == 0); ++tries)
+        usleep(10000);
+    if (page->seq & 1)
+        FAIL("takeover: expected the new reader to finish publishing, seq %u", page->seq);
+    sample(4, &readBandwidth, &writeBandwidth, &utilization);
+    if (page->casReads != reads || page->casWrites != writes)
+        FAIL("takeover: expected the totals %llu %llu to carry on, got %llu %llu",
+             (unsigned long long) reads, (unsigned long long) writes,
+             (unsigned long long) page->casReads, (unsigned long long) page->casWrites);
+
+    set_cas_counts(1000, 500);
+    usleep(100000);
+    sample(5, &readBandwidth, &writeBandwidth, &utilization);
+    check_bandwidth("new reader read bandwidth", readBandwidth, 1000, 0.1);
+    check_bandwidth("new reader write bandwidth", writeBandwidth, 500, 0.1);
+    // From ARM_MAP_UNCORE_CHANNELS rather than the PMUs
+    const double expectedUtilization= 100.0 * (readBandwidth + writeBandwidth) / 1e6;
+    if (utilization < 0.99 * expectedUtilization || utilization > 1.01 * expectedUtilization)
+        FAIL("takeover: expected utilization %g != actual %g", expectedUtilization, utilization);
+    if (page->casReads != reads + NUM_CHANNELS * 1000 || page->casWrites != writes + NUM_CHANNELS * 500)
+        FAIL("takeover: expected the totals to increase by the new counts");
+
+    if (allinea_plugin_cleanup(1, NULL) != 0)
+        FAIL("takeover: allinea_plugin_cleanup failed");
+    node_shm_unmap(page, sizeof(SocketPage));
+}
+
+// Not elected, so only sees the totals when the first process publishes them
+static void run_second_process(int readerReady, int ready, int published)
+{
+    double readBandwidth, writeBandwidth, utilization;
+    char name[128];
+
+    node_shm_name(name, sizeof(name), "haswell-uncore-mock", 0);
+    initialize_second_process(readerReady, name);
+    sample(1, &readBandwidth, &writeBandwidth, &utilization);
+    if (readBandwidth != 0.0 || writeBandwidth != 0.0)
+        FAIL("second process: expected no bandwidth before the next publication, got %g %g", readBandwidth, writeBandwidth);
+    signal_pipe(ready);
+    wait_pipe(published);
+    sample(2, &readBandwidth, &writeBandwidth, &utilization);
+    check_bandwidth("second process read bandwidth", readBandwidth, 2000, 0.1);
+    check_bandwidth("second process write bandwidth", writeBandwidth, 2000, 0.1);
+    if (readBandwidth < 0.99 * writeBandwidth || readBandwidth > 1.01 * writeBandwidth)
+        FAIL("second process: expected read bandwidth %g == write bandwidth %g", readBandwidth, writeBandwidth);
+    allinea_plugin_cleanup(1, NULL);
+}
+
+int main(void)
+{
+    double readBandwidth, writeBandwidth, utilization;
+
+    // A run that failed may have left the page with users that are gone
+    char name[128];
+    node_shm_name(name, sizeof(name), "haswell-uncore-mock", 0);
+    remove_shm(name);
+
+    make_fake_sysfs(gRoot);
+    make_channels();
+    set_cas_counts(0, 0);
+    setenv("ARM_MAP_UNCORE_SYSFS_ROOT", gRoot, 1);
+    setenv("ARM_MAP_UNCORE_CHANNEL_GBS", "0.001", 1);
+
+    SecondProcess second;
+    start_second_process(&second, run_second_process);
+
+    // The first process is elected reader and publishes the totals at start up
+    if (allinea_plugin_initialize(1, NULL) != 0)
+        FAIL("allinea_plugin_initialize failed");
+    set_cas_counts(1000, 500);
+    usleep(100000);
+    sample(1, &readBandwidth, &writeBandwidth, &utilization);
+    check_bandwidth("reader read bandwidth", readBandwidth, 1000, 0.1);
+    check_bandwidth("reader write bandwidth", writeBandwidth, 500, 0.1);
+    if (readBandwidth < 1.99 * writeBandwidth || readBandwidth > 2.01 * writeBandwidth)
+        FAIL("reader: expected read bandwidth %g == 2 x write bandwidth %g", readBandwidth, writeBandwidth);
+    const double expectedUtilization= 100.0 * (readBandwidth + writeBandwidth) / (NUM_CHANNELS * 1e6);
+    if (utilization < 0.99 * expectedUtilization || utilization > 1.01 * expectedUtilization)
+        FAIL("reader: expected utilization %g != actual %g", expectedUtilization, utilization);
+
+    signal_pipe(second.readerReady[1]);
+    wait_pipe(second.ready[0]);
+    set_cas_counts(3000, 2500);
+    usleep(100000);
+    sample(2, &readBandwidth, &writeBandwidth, &utilization);
+    signal_pipe(second.published[1]);
+    wait_second_process(second);
+
+    if (allinea_plugin_cleanup(1, NULL) != 0)
+        FAIL("allinea_plugin_cleanup failed");
+
+    check_removed(name);
+    check_takeover(name);
+    check_removed(name);
+    remove_fake_sysfs(gRoot);
+
+    fprintf(stderr, "PASS\n");
+    return 0;
+}
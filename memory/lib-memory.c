@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Memory metrics of the process: resident and anonymous memory, the coverage
+ * of anonymous memory by transparent huge pages, swap, and memory on remote
+ * NUMA nodes.
+ *
+ * All of the files are opened once at initialisation and re-read with pread
+ * into static buffers by a parser that does not allocate. /proc/self/statm,
+ * the cheapest file with the resident memory, is read on each sample.
+ * /proc/self/status costs several times as much to generate, as the kernel
+ * fills in every field, and /proc/self/smaps_rollup and /proc/self/numa_maps
+ * walk every page of the process, which takes hundreds of microseconds for a
+ * few GB, so they are read by a background thread at a lower rate
+ * (ARM_MAP_MEMORY_REFRESH_INTERVAL_MS, 1000 ms by default) that publishes the
+ * totals to the sampler under a seqlock.
+ */
+
+#define _GNU_SOURCE
+
+#include "allinea_metric_plugin_api.h"
+#include "node_shm.h"
+#include "procfs_parse.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define ERROR_INITIALIZATION_FAILED 100
+
+/*! Where the files are read from. Can be changed with ARM_MAP_MEMORY_PROC_DIR for testing. */
+#define DEFAULT_PROC_DIR "/proc/self"
+
+#define DEFAULT_REFRESH_INTERVAL_MS 1000
+
+#define MAX_NUMA_NODES 64
+
+/*! File descriptor for the file read on each sample. */
+static int statmFd = -1;
+
+/*! The size of the pages that statm counts in. */
+static uint64_t pageSize;
+
+/*! File descriptors for the files read by the background thread. smaps_rollup needs Linux 4.14. */
+static int statusFd = -1;
+static int smapsRollupFd = -1;
+static int numaMapsFd = -1;
+
+/*! The buffer the files are read into on each sample. */
+static char sampleBuffer[256];
+
+/*! The resident memory of the process in bytes this sample. */
+static uint64_t rssLastSample;
+
+/*! The anonymous memory of the process in bytes this sample. */
+static uint64_t anonymousLastSample;
+
+/*! The anonymous memory in transparent huge pages in bytes, as of the last smaps_rollup refresh. */
+static uint64_t anonHugePagesLastSample;
+
+/*! The percentage of anonymous memory in transparent huge pages, as of the last smaps_rollup refresh. */
+static double thpCoverageLastSample;
+
+/*! The memory of the process that is swapped out in bytes this sample. */
+static uint64_t swapLastSample;
+
+/*! The memory of the process on NUMA nodes other than the current CPU's, as of the last numa_maps refresh. */
+static uint64_t numaRemoteLastSample;
+
+/*! The percentage of the memory in numa_maps that is on remote NUMA nodes. */
+static double numaRemoteFractionLastSample;
+
+/*! The totals published by the background thread. */
+struct background_totals {
+    uint32_t seq;
+    uint32_t numNodes;
+    uint64_t anonymous;
+    uint64_t anonHugePages;
+    uint64_t swap;
+    uint64_t bytes[MAX_NUMA_NODES];
+};
+static struct background_totals backgroundTotals;
+
+/*! The background thread, and the pipe used to wake it up to stop. */
+static pthread_t backgroundThread;
+static int backgroundThreadStarted = 0;
+static int backgroundStopPipe[2] = { -1, -1 };
+static int refreshIntervalMs = DEFAULT_REFRESH_INTERVAL_MS;
+
+/*! The buffer the background thread reads into, numa_maps a chunk at a time. */
+static char backgroundBuffer[65536];
+
+/*! Time of the last sample. */
+/*!
+ *  If the time of the current sample is different from the time of the last
+ *  then we assume it is a new sample and we need to re-read the files.
+ */
+static struct timespec lastSampleTime;
+
+static int open_proc_file(const char *dir, const char *name)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static void close_proc_files(void)
+{
+    if (statmFd != -1) {
+        close(statmFd);
+        statmFd = -1;
+    }
+    if (statusFd != -1) {
+        close(statusFd);
+        statusFd = -1;
+    }
+    if (smapsRollupFd != -1) {
+        close(smapsRollupFd);
+        smapsRollupFd = -1;
+    }
+    if (numaMapsFd != -1) {
+        close(numaMapsFd);
+        numaMapsFd = -1;
+    }
+}
+
+/*! Adds the pages on each node in one line of numa_maps to \a bytes. */
+/*!
+ *  A line lists the pages on each node as "N<node>=<pages>", and the page size
+ *  as "kernelpagesize_kB=<size>", e.g.
+ *  "7f0000000000 default anon=512 dirty=512 N0=384 N1=128 kernelpagesize_kB=4"
+ */
+static void parse_numa_maps_line(const char *line, const char *end, uint64_t *bytes, uint32_t *numNodes)
+{
+    uint64_t pages[MAX_NUMA_NODES];
+    uint64_t pageSizeKb = 4;
+    uint32_t lineNodes = 0;
+    const char *p = line;
+    while (p < end) {
+        while (p < end && *p == ' ')
+            p++;
+        const char *token = p;
+        while (p < end && *p != ' ')
+            p++;
+        uint64_t value;
+        if (token[0] == 'N' && token + 1 < p) {
+            uint64_t node;
+            const char *eq = procfs_parse_u64(token + 1, p, &node);
+            if (eq != NULL && eq < p && *eq == '=' && node < MAX_NUMA_NODES &&
+                procfs_parse_u64(eq + 1, p, &value) != NULL) {
+                while (lineNodes <= node)
+                    pages[lineNodes++] = 0;
+                pages[node] += value;
+            }
+        } else if ((size_t) (p - token) > 18 && memcmp(token, "kernelpagesize_kB=", 18) == 0 &&
+                   procfs_parse_u64(token + 18, p, &value) != NULL) {
+            pageSizeKb = value;
+        }
+    }
+    for (uint32_t node = 0; node < lineNodes; ++node)
+        bytes[node] += pages[node] * pageSizeKb * 1024;
+    if (lineNodes > *numNodes)
+        *numNodes = lineNodes;
+}
+
+/*! Adds up the bytes on each node in numa_maps. */
+static void read_numa_maps(uint64_t *bytes, uint32_t *numNodes)
+{
+    size_t used = 0;
+    off_t offset = 0;
+    for (;;) {
+        ssize_t len = pread(numaMapsFd, backgroundBuffer + used, sizeof(backgroundBuffer) - used, offset);
+        if (len <= 0)
+            break;
+        offset += len;
+        used += (size_t) len;
+        /* Parse the complete lines, and keep any partial line for the next read */
+        const char *line = backgroundBuffer;
+        const char *bufferEnd = backgroundBuffer + used;
+        const char *newline;
+        while ((newline = memchr(line, '\n', (size_t) (bufferEnd - line))) != NULL) {
+            parse_numa_maps_line(line, newline, bytes, numNodes);
+            line = newline + 1;
+        }
+        used = (size_t) (bufferEnd - line);
+        memmove(backgroundBuffer, line, used);
+        /* A line longer than the buffer is dropped */
+        if (used == sizeof(backgroundBuffer))
+            used = 0;
+    }
+}
+
+/*! Reads status, smaps_rollup and numa_maps and publishes the totals to the sampler. */
+static void refresh_background_totals(void)
+{
+    uint64_t anonymous = 0;
+    uint64_t anonHugePages = 0;
+    uint64_t swap = 0;
+    uint64_t bytes[MAX_NUMA_NODES];
+    uint32_t numNodes = 0;
+    memset(bytes, 0, sizeof(bytes));
+
+    if (statusFd != -1) {
+        ssize_t len = procfs_pread(statusFd, backgroundBuffer, sizeof(backgroundBuffer));
+        if (len > 0)
+            procfs_find_u64(backgroundBuffer, (size_t) len, "VmSwap:", &swap);
+    }
+    if (smapsRollupFd != -1) {
+        ssize_t len = procfs_pread(smapsRollupFd, backgroundBuffer, sizeof(backgroundBuffer));
+        if (len > 0) {
+            procfs_find_u64(backgroundBuffer, (size_t) len, "Anonymous:", &anonymous);
+            procfs_find_u64(backgroundBuffer, (size_t) len, "AnonHugePages:", &anonHugePages);
+        }
+    }
+    if (numaMapsFd != -1)
+        read_numa_maps(bytes, &numNodes);
+
+    node_shm_write_begin(&backgroundTotals.seq);
+    __atomic_store_n(&backgroundTotals.anonymous, anonymous, __ATOMIC_RELAXED);
+    __atomic_store_n(&backgroundTotals.anonHugePages, anonHugePages, __ATOMIC_RELAXED);
+    __atomic_store_n(&backgroundTotals.swap, swap, __ATOMIC_RELAXED);
+    __atomic_store_n(&backgroundTotals.numNodes, numNodes, __ATOMIC_RELAXED);
+    for (uint32_t node = 0; node < MAX_NUMA_NODES; ++node)
+        __atomic_store_n(&backgroundTotals.bytes[node], bytes[node], __ATOMIC_RELAXED);
+    node_shm_write_end(&backgroundTotals.seq);
+}
+
+static void *background_thread(void *unused)
+{
+    (void)unused; /* unused variable */
+
+    for (;;) {
+        refresh_background_totals();
+        struct pollfd stop = { backgroundStopPipe[0], POLLIN, 0 };
+        if (poll(&stop, 1, refreshIntervalMs) != 0)
+            break;
+    }
+    return NULL;
+}
+
+/*! Starts the background thread with all signals blocked, so that it is never interrupted by the sampler part way through publishing. */
+static int start_background_thread(void)
+{
+    if (pipe2(backgroundStopPipe, O_CLOEXEC) != 0)
+        return -1;
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int ret = pthread_create(&backgroundThread, NULL, background_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret != 0) {
+        close(backgroundStopPipe[0]);
+        close(backgroundStopPipe[1]);
+        backgroundStopPipe[0] = backgroundStopPipe[1] = -1;
+        errno = ret;
+        return -1;
+    }
+    backgroundThreadStarted = 1;
+    return 0;
+}
+
+static void stop_background_thread(void)
+{
+    if (!backgroundThreadStarted)
+        return;
+    if (write(backgroundStopPipe[1], "x", 1) == 1)
+        pthread_join(backgroundThread, NULL);
+    close(backgroundStopPipe[0]);
+    close(backgroundStopPipe[1]);
+    backgroundStopPipe[0] = backgroundStopPipe[1] = -1;
+    backgroundThreadStarted = 0;
+}
+
+/*! This function is called when the metric plugin is loaded. */
+/*!
+ *  We do not have to restrict ourselves to async-signal-safe functions because
+ *  the initialization function will be called without any locks held.
+ *
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused)
+{
+    (void)unused; /* unused variable */
+
+    const char *procDir = getenv("ARM_MAP_MEMORY_PROC_DIR");
+    if (procDir == NULL || *procDir == '\0')
+        procDir = DEFAULT_PROC_DIR;
+    const char *interval = getenv("ARM_MAP_MEMORY_REFRESH_INTERVAL_MS");
+    refreshIntervalMs = DEFAULT_REFRESH_INTERVAL_MS;
+    if (interval != NULL && atoi(interval) > 0)
+        refreshIntervalMs = atoi(interval);
+
+    statmFd = open_proc_file(procDir, "statm");
+    if (statmFd == -1) {
+        int saved_errno = errno;
+        allinea_set_plugin_error_messagef(plugin_id, ERROR_INITIALIZATION_FAILED, "%s/statm: %s", procDir, strerror(saved_errno));
+        errno = saved_errno;
+        return -1;
+    }
+    pageSize = (uint64_t) sysconf(_SC_PAGESIZE);
+    /* These are optional: the swap, huge page and NUMA metrics are 0 without them */
+    statusFd = open_proc_file(procDir, "status");
+    smapsRollupFd = open_proc_file(procDir, "smaps_rollup");
+    numaMapsFd = open_proc_file(procDir, "numa_maps");
+
+    memset(&backgroundTotals, 0, sizeof(backgroundTotals));
+    if ((statusFd != -1 || smapsRollupFd != -1 || numaMapsFd != -1) && start_background_thread() != 0) {
+        int saved_errno = errno;
+        allinea_set_plugin_error_messagef(plugin_id, ERROR_INITIALIZATION_FAILED, "Could not start the background thread: %s", strerror(saved_errno));
+        close_proc_files();
+        errno = saved_errno;
+        return -1;
+    }
+
+    lastSampleTime.tv_sec = 0;
+    lastSampleTime.tv_nsec = 0;
+    return 0;
+}
+
+/*! This function is called when the metric plugin is unloaded. */
+/*!
+ *  We do not have to restrict ourselves to async-signal-safe functions because
+ *  the cleanup function will be called without any locks held.
+ *
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_cleanup(plugin_id_t id, void *unused)
+{
+    (void) id;  // Unused parameter
+    (void)unused; /* unused variable */
+
+    stop_background_thread();
+    close_proc_files();
+    return 0;
+}
+
+/*! Updates the swap, huge page and NUMA metrics from the totals last published by the background thread. */
+static void update_background(void)
+{
+    struct background_totals totals;
+    uint32_t seq;
+    int tries = 0;
+    /* Give up, and keep the last values, rather than spin if the thread is part way through publishing */
+    do {
+        if (++tries > 100)
+            return;
+        seq = __atomic_load_n(&backgroundTotals.seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        totals.anonymous = __atomic_load_n(&backgroundTotals.anonymous, __ATOMIC_RELAXED);
+        totals.anonHugePages = __atomic_load_n(&backgroundTotals.anonHugePages, __ATOMIC_RELAXED);
+        totals.swap = __atomic_load_n(&backgroundTotals.swap, __ATOMIC_RELAXED);
+        totals.numNodes = __atomic_load_n(&backgroundTotals.numNodes, __ATOMIC_RELAXED);
+        for (uint32_t node = 0; node < MAX_NUMA_NODES; ++node)
+            totals.bytes[node] = __atomic_load_n(&backgroundTotals.bytes[node], __ATOMIC_RELAXED);
+    } while ((seq & 1) || node_shm_read_retry(&backgroundTotals.seq, seq));
+
+    swapLastSample = totals.swap;
+    /* Both from the same read of smaps_rollup, so the coverage is consistent */
+    anonHugePagesLastSample = totals.anonHugePages;
+    thpCoverageLastSample = totals.anonymous == 0 ? 0.0 :
+        100.0 * (double) totals.anonHugePages / (double) totals.anonymous;
+
+    /* Remote to the node of the CPU the process is running on now */
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+        node = 0;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < totals.numNodes; ++i)
+        total += totals.bytes[i];
+    numaRemoteLastSample = total - (node < totals.numNodes ? totals.bytes[node] : 0);
+    numaRemoteFractionLastSample = total == 0 ? 0.0 : 100.0 * (double) numaRemoteLastSample / (double) total;
+}
+
+/*! Called once per sample to read the metrics from procfs. */
+static int update(void)
+{
+    ssize_t len = procfs_pread(statmFd, sampleBuffer, sizeof(sampleBuffer));
+    if (len < 0)
+        return -1;
+    /* The total, resident and shared (file backed and shmem) pages, of which the rest of the resident ones are anonymous */
+    const char *end = sampleBuffer + len;
+    uint64_t size, resident, shared;
+    const char *p = procfs_parse_u64(sampleBuffer, end, &size);
+    if (p != NULL && (p = procfs_parse_u64(p, end, &resident)) != NULL &&
+        procfs_parse_u64(p, end, &shared) != NULL) {
+        rssLastSample = resident * pageSize;
+        anonymousLastSample = resident > shared ? (resident - shared) * pageSize : 0;
+    }
+
+    if (backgroundThreadStarted)
+        update_background();
+    return 0;
+}
+
+/*! Returns non-zero if this is a new sample, in which case \a update must be called. */
+static int is_new_sample(const struct timespec *inCurrentSampleTime)
+{
+    if (lastSampleTime.tv_sec  == inCurrentSampleTime->tv_sec &&
+        lastSampleTime.tv_nsec == inCurrentSampleTime->tv_nsec)
+        return 0;
+    lastSampleTime.tv_sec  = inCurrentSampleTime->tv_sec;
+    lastSampleTime.tv_nsec = inCurrentSampleTime->tv_nsec;
+    return 1;
+}
+
+/*! Get the current value of the given metric. */
+/*!
+ *  \param metricId the ID of the metric to get the value for
+ *  \param inCurrentSampleTime [in] the time the metric was sampled
+ *  \param inValue pointer to where the metric is stored
+ *  \param outValue [out] value will be written here.
+ *
+ *  If this is a new sample (\a lastSampleTime != \a inCurrentsampleTime)
+ *  then \a update is called to re-read the files.
+ */
+static int getMetricValue(metric_id_t metricId, const struct timespec *inCurrentSampleTime, uint64_t *inValue, uint64_t *outValue)
+{
+    if (statmFd == -1)
+        return 0;
+
+    if (is_new_sample(inCurrentSampleTime) && update() != 0) {
+        allinea_set_metric_error_messagef(metricId, errno, "Could not read the memory statistics: %s", strerror(errno));
+        return -1;
+    }
+
+    *outValue = *inValue;
+
+    return 0;
+}
+
+/*! Get the current value of the given metric. See \a getMetricValue. */
+static int getMetricValueDouble(metric_id_t metricId, const struct timespec *inCurrentSampleTime, double *inValue, double *outValue)
+{
+    if (statmFd == -1)
+        return 0;
+
+    if (is_new_sample(inCurrentSampleTime) && update() != 0) {
+        allinea_set_metric_error_messagef(metricId, errno, "Could not read the memory statistics: %s", strerror(errno));
+        return -1;
+    }
+
+    *outValue = *inValue;
+
+    return 0;
+}
+
+int allinea_memoryRss(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &rssLastSample, outValue);
+}
+
+int allinea_memoryAnonymous(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &anonymousLastSample, outValue);
+}
+
+int allinea_memoryAnonHugePages(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &anonHugePagesLastSample, outValue);
+}
+
+int allinea_memoryThpCoverage(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &thpCoverageLastSample, outValue);
+}
+
+int allinea_memorySwap(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &swapLastSample, outValue);
+}
+
+int allinea_memoryNumaRemote(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &numaRemoteLastSample, outValue);
+}
+
+int allinea_memoryNumaRemoteFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &numaRemoteFractionLastSample, outValue);
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_FIXTURE_PLUGIN
+#include "test_fixture.h"
+
+extern int allinea_memoryRss(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_memoryAnonymous(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_memoryAnonHugePages(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_memoryThpCoverage(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_memorySwap(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_memoryNumaRemote(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_memoryNumaRemoteFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+
+static const char *STATUS =
+    "Name:\tmemory-test\n"
+    "VmPeak:\t  300000 kB\n"
+    "VmRSS:\t  204800 kB\n"
+    "RssAnon:\t  102400 kB\n"
+    "RssFile:\t  102400 kB\n"
+    "VmSwap:\t    2048 kB\n"
+    "Threads:\t1\n";
+
+static const char *SMAPS_ROLLUP =
+    "00400000-7fffffffe000 ---p 00000000 00:00 0                              [rollup]\n"
+    "Rss:              204800 kB\n"
+    "Anonymous:        102400 kB\n"
+    "AnonHugePages:     51200 kB\n"
+    "Swap:               2048 kB\n";
+
+/* 1000 pages of 4 kB on node 0, 3000 on node 1, and 10 huge pages of 2 MB on node 1 */
+static const char *NUMA_MAPS =
+    "00400000 default file=/usr/bin/memory-test mapped=10 N0=10 kernelpagesize_kB=4\n"
+    "7f0000000000 default anon=3990 dirty=3990 N0=990 N1=3000 kernelpagesize_kB=4\n"
+    "7f1000000000 default huge anon=10 dirty=10 N1=10 kernelpagesize_kB=2048\n"
+    "7ffd00000000 default stack anon=0\n";
+
+/*! Checks the values parsed from the files above. */
+static void test_fixture(void)
+{
+    char dir[] = "/tmp/memory-test-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+        FAIL("mkdtemp: %s", strerror(errno));
+    /* statm counts pages: the total, resident and shared (RssFile) */
+    const uint64_t pageKb = (uint64_t) sysconf(_SC_PAGESIZE) / 1024;
+    char statm[256];
+    snprintf(statm, sizeof(statm), "%llu %llu %llu 10 0 20000 0\n", (unsigned long long) (300000 / pageKb),
+             (unsigned long long) (204800 / pageKb), (unsigned long long) (102400 / pageKb));
+    write_file(dir, "statm", statm);
+    write_file(dir, "status", STATUS);
+    write_file(dir, "smaps_rollup", SMAPS_ROLLUP);
+    write_file(dir, "numa_maps", NUMA_MAPS);
+    setenv("ARM_MAP_MEMORY_PROC_DIR", dir, 1);
+    setenv("ARM_MAP_MEMORY_REFRESH_INTERVAL_MS", "10", 1);
+
+    initialize();
+    /* Let the background thread read status, smaps_rollup and numa_maps */
+    usleep(100000);
+
+    struct timespec sampleTime = { 1, 0 };
+    uint64_t value;
+    double fraction;
+    int ret;
+
+    ret = allinea_memoryRss(1, &sampleTime, &value);
+    expect_u64("allinea_memoryRss", ret, value, 204800ULL * 1024);
+    ret = allinea_memoryAnonymous(1, &sampleTime, &value);
+    expect_u64("allinea_memoryAnonymous", ret, value, 102400ULL * 1024);
+    ret = allinea_memoryAnonHugePages(1, &sampleTime, &value);
+    expect_u64("allinea_memoryAnonHugePages", ret, value, 51200ULL * 1024);
+    ret = allinea_memoryThpCoverage(1, &sampleTime, &fraction);
+    expect_double("allinea_memoryThpCoverage", ret, fraction, 50.0);
+    ret = allinea_memorySwap(1, &sampleTime, &value);
+    expect_u64("allinea_memorySwap", ret, value, 2048ULL * 1024);
+
+    /* Remote is relative to the node this process is running on */
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+        node = 0;
+    const uint64_t node0 = 1000ULL * 4096;
+    const uint64_t node1 = 3000ULL * 4096 + 10ULL * 2048 * 1024;
+    const uint64_t remote = node == 0 ? node1 : node == 1 ? node0 : node0 + node1;
+    ret = allinea_memoryNumaRemote(1, &sampleTime, &value);
+    expect_u64("allinea_memoryNumaRemote", ret, value, remote);
+    ret = allinea_memoryNumaRemoteFraction(1, &sampleTime, &fraction);
+    expect_double("allinea_memoryNumaRemoteFraction", ret, fraction, 100.0 * (double) remote / (double) (node0 + node1));
+
+    allinea_plugin_cleanup(1, NULL);
+
+    char path[4096];
+    const char *names[] = { "statm", "status", "smaps_rollup", "numa_maps" };
+    for (int i = 0; i < 4; ++i) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+    unsetenv("ARM_MAP_MEMORY_PROC_DIR");
+    unsetenv("ARM_MAP_MEMORY_REFRESH_INTERVAL_MS");
+}
+
+static void sample_rss(struct timespec *sampleTime)
+{
+    uint64_t value;
+    allinea_memoryRss(1, sampleTime, &value);
+}
+
+/*! Checks that the resident memory of this process grows when memory is touched, and prints the time per sample. */
+static void test_proc_self(void)
+{
+    initialize();
+
+    struct timespec sampleTime = { 1, 0 };
+    uint64_t before, after;
+    int ret = allinea_memoryRss(1, &sampleTime, &before);
+    expect_success("allinea_memoryRss", ret);
+
+    const size_t size = 64 * 1024 * 1024;
+    char *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        FAIL("mmap: %s", strerror(errno));
+    memset(memory, 1, size);
+
+    sampleTime.tv_sec = 2;
+    ret = allinea_memoryRss(1, &sampleTime, &after);
+    expect_success("allinea_memoryRss", ret);
+    if (after < before + size / 2)
+        FAIL("allinea_memoryRss: expected to grow by at least %zu from %llu but is %llu",
+             size / 2, (unsigned long long) before, (unsigned long long) after);
+
+    print_sample_cost(sample_rss, 3);
+
+    munmap(memory, size);
+    allinea_plugin_cleanup(1, NULL);
+}
+
+int main(void)
+{
+    test_fixture();
+    test_proc_self();
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,814 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * MPI metrics: message rates, time waiting for late senders and receivers,
+ * time in each kind of collective, and the MPI implementation's own
+ * performance variables (MPI_T pvars) such as the unexpected message queue
+ * length.
+ *
+ * The library defines the point-to-point, wait and collective MPI functions
+ * and calls the PMPI versions, so it must be preloaded into the program (see
+ * README.txt). Each thread counts its calls, bytes and time in each class of
+ * call in its own slot, aligned to cache lines, with relaxed atomic stores
+ * that the sampler reads with relaxed atomic loads. The slot also records the
+ * call in progress, so that a long wait shows up in the samples it spans
+ * rather than all at once when it returns.
+ *
+ * Reading a pvar is not async-signal-safe, so the pvars are read at the end
+ * of an intercepted MPI call, at most every ARM_MAP_MPI_PVAR_INTERVAL_MS, and
+ * the sampler reports the last values read. The queues only change while
+ * the program is in MPI anyway.
+ */
+
+#define _GNU_SOURCE
+
+#include "allinea_metric_plugin_api.h"
+
+#include <mpi.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*! Threads beyond this many are not measured. */
+#define MAX_THREADS 256
+
+/*! How many non-blocking requests each thread remembers the kind of. */
+#define MAX_TRACKED_REQUESTS 64
+
+#define DEFAULT_PVAR_INTERVAL_MS 10
+
+/*! The classes of MPI call that are timed separately. */
+enum call_class {
+    CLASS_SEND,     /*!< MPI_Send, MPI_Ssend, MPI_Isend */
+    CLASS_RECV,     /*!< MPI_Recv, MPI_Irecv, MPI_Sendrecv */
+    CLASS_WAIT,     /*!< MPI_Wait, MPI_Waitall, MPI_Waitany */
+    CLASS_BARRIER,  /*!< MPI_Barrier */
+    CLASS_BCAST,    /*!< MPI_Bcast */
+    CLASS_REDUCE,   /*!< MPI_Reduce, MPI_Allreduce */
+    CLASS_ALLTOALL, /*!< MPI_Alltoall */
+    CLASS_GATHER,   /*!< MPI_Gather, MPI_Allgather, MPI_Scatter */
+    NUM_CLASSES
+};
+
+/*! Why a point-to-point call or wait is blocked, as far as we can tell. */
+enum late_kind {
+    LATE_NONE,
+    LATE_SENDER,   /*!< Waiting for a message that had not arrived when the call started */
+    LATE_RECEIVER, /*!< Waiting for the receiver to post the receive for a rendezvous send */
+    NUM_LATE_KINDS
+};
+
+/*! The calls of one thread, written only by that thread. */
+struct thread_calls {
+    uint64_t count[NUM_CLASSES];
+    uint64_t bytes[NUM_CLASSES];
+    uint64_t ns[NUM_CLASSES];
+    uint64_t lateNs[NUM_LATE_KINDS];
+    /*! When the call in progress started, and when it started waiting for a late sender or receiver. */
+    uint64_t since;
+    uint64_t lateSince;
+    /*! The class of the call in progress plus 1, or 0 if the thread is not in MPI. */
+    uint32_t current;
+    /*! The kind of late wait in progress. */
+    uint32_t late;
+    /*! How many intercepted calls the thread is in, so that only the outermost is counted. */
+    uint32_t depth;
+} __attribute__((aligned(64)));
+
+static struct thread_calls threadCalls[MAX_THREADS];
+
+/*! How many entries of \a threadCalls have been handed out, which may be more than \a MAX_THREADS. */
+static uint32_t numThreads = 0;
+
+/*! The slot of the calling thread, or NULL if it has not made a call yet or there were too many threads. */
+static __thread struct thread_calls *myCalls;
+
+/*! The non-blocking requests of the calling thread, and whether each is a send or a receive. */
+struct tracked_request {
+    MPI_Request request;
+    enum late_kind late;
+};
+static __thread struct tracked_request trackedRequests[MAX_TRACKED_REQUESTS];
+static __thread int nextTrackedRequest;
+
+/*! The pvars that are read, and the names they are looked up by. */
+enum pvar {
+    PVAR_UNEXPECTED,
+    PVAR_POSTED,
+    NUM_PVARS
+};
+
+/*! The environment variables with the name of each pvar, and what to look for in the names when they are not set. */
+static const char *const pvarEnvironment[NUM_PVARS] = { "ARM_MAP_MPI_UNEXPECTED_PVAR", "ARM_MAP_MPI_POSTED_PVAR" };
+static const char *const pvarDefaultSubstring[NUM_PVARS] = { "unexpected", "posted" };
+
+static int pvarsStarted = 0;
+static MPI_T_pvar_session pvarSession;
+static MPI_T_pvar_handle pvarHandles[NUM_PVARS];
+static MPI_Datatype pvarTypes[NUM_PVARS];
+static int pvarCounts[NUM_PVARS];
+static int pvarFound[NUM_PVARS];
+static uint64_t pvarIntervalNs = DEFAULT_PVAR_INTERVAL_MS * 1000000ull;
+
+/*! The last values read from the pvars, and when they were read. */
+static uint64_t pvarValues[NUM_PVARS];
+static uint64_t lastPvarReadNs;
+
+/*! Set while a thread is reading the pvars, so that only one does at a time. */
+static int readingPvars = 0;
+
+/*! The totals of each thread at the last sample, so that each sample reports the calls since the last. */
+static uint64_t lastCount[MAX_THREADS][NUM_CLASSES];
+static uint64_t lastBytes[MAX_THREADS][NUM_CLASSES];
+static uint64_t lastNs[MAX_THREADS][NUM_CLASSES];
+static uint64_t lastLateNs[MAX_THREADS][NUM_LATE_KINDS];
+
+/*! When the last sample was taken, in the clock of \a now_ns. */
+static uint64_t lastSampleNs;
+
+/*! The metrics for the last sample. */
+static uint64_t p2pMessagesLastSample;
+static uint64_t p2pBytesLastSample;
+static uint64_t collectiveCallsLastSample;
+static double classFractionLastSample[NUM_CLASSES];
+static double lateFractionLastSample[NUM_LATE_KINDS];
+static uint64_t pvarLastSample[NUM_PVARS];
+
+/*! Time of the last sample. */
+/*!
+ *  If the time of the current sample is different from the time of the last
+ *  then we assume it is a new sample and we need to recalculate the metrics.
+ */
+static struct timespec lastSampleTime;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+static uint64_t message_bytes(int count, MPI_Datatype datatype)
+{
+    int size;
+    if (count <= 0 || PMPI_Type_size(datatype, &size) != MPI_SUCCESS || size <= 0)
+        return 0;
+    return (uint64_t) count * (uint64_t) size;
+}
+
+/*! Starts timing a call of class \a callClass by the calling thread. */
+/*!
+ *  \return the slot of the thread, or NULL if the call is not to be counted
+ *  because the thread is already in one or has no slot; \a end_call must be
+ *  called with it if not NULL
+ */
+static struct thread_calls *begin_call(enum call_class callClass)
+{
+    struct thread_calls *calls = myCalls;
+    if (calls == NULL) {
+        uint32_t index = __atomic_fetch_add(&numThreads, 1, __ATOMIC_RELAXED);
+        if (index >= MAX_THREADS)
+            return NULL;
+        calls = myCalls = &threadCalls[index];
+    }
+    if (calls->depth++ > 0)
+        return NULL;
+    __atomic_store_n(&calls->since, now_ns(), __ATOMIC_RELAXED);
+    __atomic_store_n(&calls->current, callClass + 1, __ATOMIC_RELAXED);
+    return calls;
+}
+
+/*! Marks the call in progress as waiting for a late sender or receiver from now on. */
+static void mark_late(struct thread_calls *calls, enum late_kind late)
+{
+    if (late == LATE_NONE)
+        return;
+    __atomic_store_n(&calls->lateSince, now_ns(), __ATOMIC_RELAXED);
+    __atomic_store_n(&calls->late, late, __ATOMIC_RELAXED);
+}
+
+/*! Counts a message of \a bytes bytes, for a call that sends as well as receives. */
+static void add_message(struct thread_calls *calls, enum call_class callClass, uint64_t bytes)
+{
+    __atomic_store_n(&calls->count[callClass], calls->count[callClass] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&calls->bytes[callClass], calls->bytes[callClass] + bytes, __ATOMIC_RELAXED);
+}
+
+static void read_pvars(uint64_t now);
+
+/*! Adds the call started by \a begin_call to the totals of the thread. */
+static void end_call(struct thread_calls *calls, enum call_class callClass, uint64_t bytes)
+{
+    const uint64_t now = now_ns();
+    add_message(calls, callClass, bytes);
+    __atomic_store_n(&calls->ns[callClass], calls->ns[callClass] + (now - calls->since), __ATOMIC_RELAXED);
+    if (calls->late != LATE_NONE) {
+        __atomic_store_n(&calls->lateNs[calls->late], calls->lateNs[calls->late] + (now - calls->lateSince), __ATOMIC_RELAXED);
+        __atomic_store_n(&calls->late, LATE_NONE, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&calls->current, 0, __ATOMIC_RELAXED);
+    calls->depth--;
+
+    if (pvarsStarted && now - __atomic_load_n(&lastPvarReadNs, __ATOMIC_RELAXED) >= pvarIntervalNs)
+        read_pvars(now);
+}
+
+/*! Leaves a call that \a begin_call said was not to be counted. */
+static void leave_call(void)
+{
+    if (myCalls != NULL)
+        myCalls->depth--;
+}
+
+/*! Remembers whether \a request is a send or a receive, for when it is waited for. */
+static void track_request(MPI_Request request, enum late_kind late)
+{
+    for (int i = 0; i < MAX_TRACKED_REQUESTS; ++i) {
+        if (trackedRequests[i].request == request) {
+            trackedRequests[i].late = late;
+            return;
+        }
+    }
+    /* The oldest is forgotten, which only matters if it has not been waited for yet */
+    trackedRequests[nextTrackedRequest].request = request;
+    trackedRequests[nextTrackedRequest].late = late;
+    nextTrackedRequest = (nextTrackedRequest + 1) % MAX_TRACKED_REQUESTS;
+}
+
+/*! Returns what waiting for \a request would be waiting for, or LATE_NONE if it has already completed or is not known. */
+static enum late_kind pending_request(MPI_Request request)
+{
+    if (request == MPI_REQUEST_NULL)
+        return LATE_NONE;
+    for (int i = 0; i < MAX_TRACKED_REQUESTS; ++i) {
+        if (trackedRequests[i].request == request && trackedRequests[i].late != LATE_NONE) {
+            int flag = 1;
+            if (PMPI_Request_get_status(request, &flag, MPI_STATUS_IGNORE) != MPI_SUCCESS || flag)
+                return LATE_NONE;
+            return trackedRequests[i].late;
+        }
+    }
+    return LATE_NONE;
+}
+
+/*! Returns the value of pvar \a pvar read into \a buffer. */
+static uint64_t pvar_value(enum pvar pvar, const void *buffer)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < pvarCounts[pvar]; ++i) {
+        if (pvarTypes[pvar] == MPI_UNSIGNED || pvarTypes[pvar] == MPI_INT)
+            total += ((const unsigned *) buffer)[i];
+        else if (pvarTypes[pvar] == MPI_DOUBLE)
+            total += (uint64_t) ((const double *) buffer)[i];
+        else
+            total += ((const uint64_t *) buffer)[i];
+    }
+    return total;
+}
+
+/*! Reads the pvars, unless another thread is already. */
+static void read_pvars(uint64_t now)
+{
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(&readingPvars, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    __atomic_store_n(&lastPvarReadNs, now, __ATOMIC_RELAXED);
+    for (int pvar = 0; pvar < NUM_PVARS; ++pvar) {
+        uint64_t buffer[16];
+        if (pvarFound[pvar] && MPI_T_pvar_read(pvarSession, pvarHandles[pvar], buffer) == MPI_SUCCESS)
+            __atomic_store_n(&pvarValues[pvar], pvar_value(pvar, buffer), __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&readingPvars, 0, __ATOMIC_RELEASE);
+}
+
+/*! Returns non-zero if pvar \a name is the one to read for \a pvar. */
+static int pvar_matches(enum pvar pvar, const char *name)
+{
+    const char *wanted = getenv(pvarEnvironment[pvar]);
+    if (wanted != NULL && *wanted != '\0')
+        return strcmp(name, wanted) == 0;
+    return strstr(name, pvarDefaultSubstring[pvar]) != NULL;
+}
+
+/*! Looks up the pvars and starts reading them. Called once MPI is initialised. */
+static void start_pvars(void)
+{
+    const char *enabled = getenv("ARM_MAP_MPI_PVARS");
+    if (enabled != NULL && strcmp(enabled, "0") == 0)
+        return;
+    const char *interval = getenv("ARM_MAP_MPI_PVAR_INTERVAL_MS");
+    if (interval != NULL && *interval != '\0')
+        pvarIntervalNs = (uint64_t) atoi(interval) * 1000000ull;
+
+    int provided, numPvars;
+    if (MPI_T_init_thread(MPI_THREAD_MULTIPLE, &provided) != MPI_SUCCESS)
+        return;
+    if (MPI_T_pvar_get_num(&numPvars) != MPI_SUCCESS ||
+        MPI_T_pvar_session_create(&pvarSession) != MPI_SUCCESS) {
+        MPI_T_finalize();
+        return;
+    }
+
+    MPI_Comm world = MPI_COMM_WORLD;
+    for (int index = 0; index < numPvars; ++index) {
+        char name[256], description[1024];
+        int nameLength = sizeof(name), descriptionLength = sizeof(description);
+        int verbosity, varClass, bind, readOnly, continuous, atomic;
+        MPI_Datatype datatype;
+        MPI_T_enum enumType;
+        if (MPI_T_pvar_get_info(index, name, &nameLength, &verbosity, &varClass, &datatype, &enumType,
+                                description, &descriptionLength, &bind, &readOnly, &continuous, &atomic) != MPI_SUCCESS)
+            continue;
+        if (bind != MPI_T_BIND_NO_OBJECT && bind != MPI_T_BIND_MPI_COMM)
+            continue;
+        if (datatype != MPI_UNSIGNED && datatype != MPI_INT && datatype != MPI_DOUBLE &&
+            datatype != MPI_UNSIGNED_LONG && datatype != MPI_UNSIGNED_LONG_LONG && datatype != MPI_COUNT)
+            continue;
+        for (int pvar = 0; pvar < NUM_PVARS; ++pvar) {
+            if (pvarFound[pvar] || !pvar_matches(pvar, name))
+                continue;
+            int count;
+            if (MPI_T_pvar_handle_alloc(pvarSession, index, bind == MPI_T_BIND_MPI_COMM ? (void *) &world : NULL,
+                                        &pvarHandles[pvar], &count) != MPI_SUCCESS)
+                continue;
+            /* Each element is read into 8 bytes at most */
+            if (count < 1 || count > 16 || (!continuous && MPI_T_pvar_start(pvarSession, pvarHandles[pvar]) != MPI_SUCCESS)) {
+                MPI_T_pvar_handle_free(pvarSession, &pvarHandles[pvar]);
+                continue;
+            }
+            pvarTypes[pvar] = datatype;
+            pvarCounts[pvar] = count;
+            pvarFound[pvar] = 1;
+            break;
+        }
+    }
+    pvarsStarted = 1;
+}
+
+/*! Stops reading the pvars, before MPI is finalised. */
+static void stop_pvars(void)
+{
+    if (!pvarsStarted)
+        return;
+    pvarsStarted = 0;
+    /* Wait for a thread part way through reading them */
+    int expected = 0;
+    while (!__atomic_compare_exchange_n(&readingPvars, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        expected = 0;
+    for (int pvar = 0; pvar < NUM_PVARS; ++pvar) {
+        if (pvarFound[pvar])
+            MPI_T_pvar_handle_free(pvarSession, &pvarHandles[pvar]);
+        pvarFound[pvar] = 0;
+    }
+    MPI_T_pvar_session_free(&pvarSession);
+    MPI_T_finalize();
+    __atomic_store_n(&readingPvars, 0, __ATOMIC_RELEASE);
+}
+
+int MPI_Init(int *argc, char ***argv)
+{
+    int ret = PMPI_Init(argc, argv);
+    if (ret == MPI_SUCCESS)
+        start_pvars();
+    return ret;
+}
+
+int MPI_Init_thread(int *argc, char ***argv, int required, int *provided)
+{
+    int ret = PMPI_Init_thread(argc, argv, required, provided);
+    if (ret == MPI_SUCCESS)
+        start_pvars();
+    return ret;
+}
+
+int MPI_Finalize(void)
+{
+    stop_pvars();
+    return PMPI_Finalize();
+}
+
+/*! Sends with a non-blocking send, to tell whether the send completes at once or waits for the receiver. */
+static int timed_send(int synchronous, const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
+{
+    struct thread_calls *calls = begin_call(CLASS_SEND);
+    if (calls == NULL) {
+        leave_call();
+        return synchronous ? PMPI_Ssend(buf, count, datatype, dest, tag, comm) : PMPI_Send(buf, count, datatype, dest, tag, comm);
+    }
+    MPI_Request request;
+    int ret = synchronous ? PMPI_Issend(buf, count, datatype, dest, tag, comm, &request) :
+                            PMPI_Isend(buf, count, datatype, dest, tag, comm, &request);
+    if (ret == MPI_SUCCESS) {
+        int flag = 0;
+        ret = PMPI_Test(&request, &flag, MPI_STATUS_IGNORE);
+        if (ret == MPI_SUCCESS && !flag) {
+            mark_late(calls, LATE_RECEIVER);
+            ret = PMPI_Wait(&request, MPI_STATUS_IGNORE);
+        }
+    }
+    end_call(calls, CLASS_SEND, message_bytes(count, datatype));
+    return ret;
+}
+
+int MPI_Send(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
+{
+    return timed_send(0, buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Ssend(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
+{
+    return timed_send(1, buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Isend(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm, MPI_Request *request)
+{
+    struct thread_calls *calls = begin_call(CLASS_SEND);
+    int ret = PMPI_Isend(buf, count, datatype, dest, tag, comm, request);
+    if (calls == NULL) {
+        leave_call();
+        return ret;
+    }
+    if (ret == MPI_SUCCESS)
+        track_request(*request, LATE_RECEIVER);
+    end_call(calls, CLASS_SEND, message_bytes(count, datatype));
+    return ret;
+}
+
+int MPI_Recv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Status *status)
+{
+    struct thread_calls *calls = begin_call(CLASS_RECV);
+    if (calls == NULL) {
+        leave_call();
+        return PMPI_Recv(buf, count, datatype, source, tag, comm, status);
+    }
+    int arrived = 1;
+    if (source != MPI_PROC_NULL)
+        PMPI_Iprobe(source, tag, comm, &arrived, MPI_STATUS_IGNORE);
+    if (!arrived)
+        mark_late(calls, LATE_SENDER);
+    MPI_Status localStatus;
+    MPI_Status *recvStatus = status == MPI_STATUS_IGNORE ? &localStatus : status;
+    int ret = PMPI_Recv(buf, count, datatype, source, tag, comm, recvStatus);
+    int received = 0;
+    if (ret == MPI_SUCCESS && PMPI_Get_count(recvStatus, datatype, &received) != MPI_SUCCESS)
+        received = 0;
+    end_call(calls, CLASS_RECV, message_bytes(received, datatype));
+    return ret;
+}
+
+int MPI_Irecv(void *buf, int count, MPI_Datatype datatype, int source, int tag, MPI_Comm comm, MPI_Request *request)
+{
+    struct thread_calls *calls = begin_call(CLASS_RECV);
+    int ret = PMPI_Irecv(buf, count, datatype, source, tag, comm, request);
+    if (calls == NULL) {
+        leave_call();
+        return ret;
+    }
+    if (ret == MPI_SUCCESS)
+        track_request(*request, LATE_SENDER);
+    /* The size of the message is not known until it arrives, so the whole buffer is counted */
+    end_call(calls, CLASS_RECV, message_bytes(count, datatype));
+    return ret;
+}
+
+int MPI_Sendrecv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, int dest, int sendtag,
+                 void *recvbuf, int recvcount, MPI_Datatype recvtype, int source, int recvtag,
+                 MPI_Comm comm, MPI_Status *status)
+{
+    struct thread_calls *calls = begin_call(CLASS_RECV);
+    if (calls == NULL) {
+        leave_call();
+        return PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag, recvbuf, recvcount, recvtype,
+                             source, recvtag, comm, status);
+    }
+    int arrived = 1;
+    if (source != MPI_PROC_NULL)
+        PMPI_Iprobe(source, recvtag, comm, &arrived, MPI_STATUS_IGNORE);
+    if (!arrived)
+        mark_late(calls, LATE_SENDER);
+    MPI_Status localStatus;
+    MPI_Status *recvStatus = status == MPI_STATUS_IGNORE ? &localStatus : status;
+    int ret = PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag, recvbuf, recvcount, recvtype,
+                            source, recvtag, comm, recvStatus);
+    int received = 0;
+    if (ret == MPI_SUCCESS && PMPI_Get_count(recvStatus, recvtype, &received) != MPI_SUCCESS)
+        received = 0;
+    if (dest != MPI_PROC_NULL)
+        add_message(calls, CLASS_SEND, message_bytes(sendcount, sendtype));
+    end_call(calls, CLASS_RECV, message_bytes(received, recvtype));
+    return ret;
+}
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status)
+{
+    struct thread_calls *calls = begin_call(CLASS_WAIT);
+    if (calls == NULL) {
+        leave_call();
+        return PMPI_Wait(request, status);
+    }
+    mark_late(calls, pending_request(*request));
+    int ret = PMPI_Wait(request, status);
+    end_call(calls, CLASS_WAIT, 0);
+    return ret;
+}
+
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[])
+{
+    struct thread_calls *calls = begin_call(CLASS_WAIT);
+    if (calls == NULL) {
+        leave_call();
+        return PMPI_Waitall(count, requests, statuses);
+    }
+    /* Waiting for any receive that has not arrived is a late sender, otherwise for a send a late receiver */
+    enum late_kind late = LATE_NONE;
+    for (int i = 0; i < count && late != LATE_SENDER; ++i) {
+        enum late_kind pending = pending_request(requests[i]);
+        if (pending != LATE_NONE)
+            late = pending;
+    }
+    mark_late(calls, late);
+    int ret = PMPI_Waitall(count, requests, statuses);
+    end_call(calls, CLASS_WAIT, 0);
+    return ret;
+}
+
+int MPI_Waitany(int count, MPI_Request requests[], int *index, MPI_Status *status)
+{
+    struct thread_calls *calls = begin_call(CLASS_WAIT);
+    int ret = PMPI_Waitany(count, requests, index, status);
+    if (calls == NULL) {
+        leave_call();
+        return ret;
+    }
+    end_call(calls, CLASS_WAIT, 0);
+    return ret;
+}
+
+/*! Defines an MPI collective that calls the PMPI version and counts the call in \a callClass. */
+#define TIMED_COLLECTIVE(callClass, function, parameters, arguments) \
+int MPI_##function parameters \
+{ \
+    struct thread_calls *calls = begin_call(callClass); \
+    int ret = PMPI_##function arguments; \
+    if (calls == NULL) \
+        leave_call(); \
+    else \
+        end_call(calls, callClass, 0); \
+    return ret; \
+}
+
+TIMED_COLLECTIVE(CLASS_BARRIER, Barrier, (MPI_Comm comm), (comm))
+TIMED_COLLECTIVE(CLASS_BCAST, Bcast,
+                 (void *buffer, int count, MPI_Datatype datatype, int root, MPI_Comm comm),
+                 (buffer, count, datatype, root, comm))
+TIMED_COLLECTIVE(CLASS_REDUCE, Reduce,
+                 (const void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm),
+                 (sendbuf, recvbuf, count, datatype, op, root, comm))
+TIMED_COLLECTIVE(CLASS_REDUCE, Allreduce,
+                 (const void *sendbuf, void *recvbuf, int count, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm),
+                 (sendbuf, recvbuf, count, datatype, op, comm))
+TIMED_COLLECTIVE(CLASS_ALLTOALL, Alltoall,
+                 (const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm),
+                 (sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm))
+TIMED_COLLECTIVE(CLASS_GATHER, Gather,
+                 (const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm),
+                 (sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm))
+TIMED_COLLECTIVE(CLASS_GATHER, Allgather,
+                 (const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm),
+                 (sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm))
+TIMED_COLLECTIVE(CLASS_GATHER, Scatter,
+                 (const void *sendbuf, int sendcount, MPI_Datatype sendtype, void *recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm),
+                 (sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm))
+
+/*! Reads the totals of a thread, including the time so far in the call in progress. */
+static void read_thread_calls(const struct thread_calls *calls, uint64_t now, uint64_t *count, uint64_t *bytes,
+                              uint64_t *ns, uint64_t *lateNs)
+{
+    for (int callClass = 0; callClass < NUM_CLASSES; ++callClass) {
+        count[callClass] = __atomic_load_n(&calls->count[callClass], __ATOMIC_RELAXED);
+        bytes[callClass] = __atomic_load_n(&calls->bytes[callClass], __ATOMIC_RELAXED);
+        ns[callClass] = __atomic_load_n(&calls->ns[callClass], __ATOMIC_RELAXED);
+    }
+    for (int late = 0; late < NUM_LATE_KINDS; ++late)
+        lateNs[late] = __atomic_load_n(&calls->lateNs[late], __ATOMIC_RELAXED);
+    /* The thread may be part way through a call, which the next sample makes up for */
+    const uint32_t current = __atomic_load_n(&calls->current, __ATOMIC_RELAXED);
+    const uint64_t since = __atomic_load_n(&calls->since, __ATOMIC_RELAXED);
+    if (current > 0 && current <= NUM_CLASSES && now > since)
+        ns[current - 1] += now - since;
+    const uint32_t late = __atomic_load_n(&calls->late, __ATOMIC_RELAXED);
+    const uint64_t lateSince = __atomic_load_n(&calls->lateSince, __ATOMIC_RELAXED);
+    if (late > LATE_NONE && late < NUM_LATE_KINDS && now > lateSince)
+        lateNs[late] += now - lateSince;
+}
+
+/*! Returns how much \a total has increased since \a last, and updates \a last. */
+/*!
+ *  A total read part way through a call can be ahead of the next one, in
+ *  which case it has not increased.
+ */
+static uint64_t delta(uint64_t total, uint64_t *last)
+{
+    if (total <= *last)
+        return 0;
+    const uint64_t d = total - *last;
+    *last = total;
+    return d;
+}
+
+/*! Called once per sample to calculate the metrics from the slots of every thread. */
+static void update(void)
+{
+    const uint64_t now = now_ns();
+    const uint64_t elapsed = now - lastSampleNs;
+    lastSampleNs = now;
+
+    uint32_t numSlots = __atomic_load_n(&numThreads, __ATOMIC_RELAXED);
+    if (numSlots > MAX_THREADS)
+        numSlots = MAX_THREADS;
+
+    uint64_t sumCount[NUM_CLASSES] = { 0 }, sumBytes[NUM_CLASSES] = { 0 }, sumNs[NUM_CLASSES] = { 0 };
+    uint64_t sumLateNs[NUM_LATE_KINDS] = { 0 };
+    for (uint32_t i = 0; i < numSlots; ++i) {
+        uint64_t count[NUM_CLASSES], bytes[NUM_CLASSES], ns[NUM_CLASSES], lateNs[NUM_LATE_KINDS];
+        read_thread_calls(&threadCalls[i], now, count, bytes, ns, lateNs);
+        for (int callClass = 0; callClass < NUM_CLASSES; ++callClass) {
+            sumCount[callClass] += delta(count[callClass], &lastCount[i][callClass]);
+            sumBytes[callClass] += delta(bytes[callClass], &lastBytes[i][callClass]);
+            sumNs[callClass] += delta(ns[callClass], &lastNs[i][callClass]);
+        }
+        for (int late = 0; late < NUM_LATE_KINDS; ++late)
+            sumLateNs[late] += delta(lateNs[late], &lastLateNs[i][late]);
+    }
+
+    p2pMessagesLastSample = sumCount[CLASS_SEND] + sumCount[CLASS_RECV];
+    p2pBytesLastSample = sumBytes[CLASS_SEND] + sumBytes[CLASS_RECV];
+    collectiveCallsLastSample = 0;
+    for (int callClass = CLASS_BARRIER; callClass < NUM_CLASSES; ++callClass)
+        collectiveCallsLastSample += sumCount[callClass];
+    for (int callClass = 0; callClass < NUM_CLASSES; ++callClass)
+        classFractionLastSample[callClass] = elapsed == 0 ? 0.0 : 100.0 * (double) sumNs[callClass] / (double) elapsed;
+    for (int late = 0; late < NUM_LATE_KINDS; ++late)
+        lateFractionLastSample[late] = elapsed == 0 ? 0.0 : 100.0 * (double) sumLateNs[late] / (double) elapsed;
+    for (int pvar = 0; pvar < NUM_PVARS; ++pvar)
+        pvarLastSample[pvar] = __atomic_load_n(&pvarValues[pvar], __ATOMIC_RELAXED);
+}
+
+/*! This function is called when the metric plugin is loaded. */
+/*!
+ *  We do not have to restrict ourselves to async-signal-safe functions because
+ *  the initialization function will be called without any locks held.
+ *
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused)
+{
+    (void) plugin_id; /* unused variable */
+    (void) unused; /* unused variable */
+
+    /* Only the calls from now on are reported */
+    uint32_t numSlots = __atomic_load_n(&numThreads, __ATOMIC_RELAXED);
+    if (numSlots > MAX_THREADS)
+        numSlots = MAX_THREADS;
+    lastSampleNs = now_ns();
+    for (uint32_t i = 0; i < numSlots; ++i)
+        read_thread_calls(&threadCalls[i], lastSampleNs, lastCount[i], lastBytes[i], lastNs[i], lastLateNs[i]);
+
+    lastSampleTime.tv_sec = 0;
+    lastSampleTime.tv_nsec = 0;
+    return 0;
+}
+
+/*! This function is called when the metric plugin is unloaded. */
+/*!
+ *  We do not have to restrict ourselves to async-signal-safe functions because
+ *  the cleanup function will be called without any locks held.
+ *
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_cleanup(plugin_id_t plugin_id, void *unused)
+{
+    (void) plugin_id; /* unused variable */
+    (void) unused; /* unused variable */
+    return 0;
+}
+
+/*! Recalculates the metrics if this is a new sample (\a lastSampleTime != \a inCurrentSampleTime). */
+static void update_if_new_sample(const struct timespec *inCurrentSampleTime)
+{
+    if (lastSampleTime.tv_sec  == inCurrentSampleTime->tv_sec &&
+        lastSampleTime.tv_nsec == inCurrentSampleTime->tv_nsec)
+        return;
+    lastSampleTime.tv_sec  = inCurrentSampleTime->tv_sec;
+    lastSampleTime.tv_nsec = inCurrentSampleTime->tv_nsec;
+    update();
+}
+
+/*! Get the current value of the given metric. */
+/*!
+ *  \param metricId the ID of the metric to get the value for
+ *  \param inCurrentSampleTime [in] the time the metric was sampled
+ *  \param inValue pointer to where the metric is stored
+ *  \param outValue [out] value will be written here.
+ */
+static int getMetricValue(metric_id_t metricId, const struct timespec *inCurrentSampleTime, uint64_t *inValue, uint64_t *outValue)
+{
+    (void) metricId; /* unused variable */
+    update_if_new_sample(inCurrentSampleTime);
+    *outValue = *inValue;
+    return 0;
+}
+
+/*! Get the current value of the given metric. See \a getMetricValue. */
+static int getMetricValueDouble(metric_id_t metricId, const struct timespec *inCurrentSampleTime, double *inValue, double *outValue)
+{
+    (void) metricId; /* unused variable */
+    update_if_new_sample(inCurrentSampleTime);
+    *outValue = *inValue;
+    return 0;
+}
+
+int allinea_mpiP2pMessages(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &p2pMessagesLastSample, outValue);
+}
+
+int allinea_mpiP2pBytes(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &p2pBytesLastSample, outValue);
+}
+
+int allinea_mpiCollectiveCalls(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &collectiveCallsLastSample, outValue);
+}
+
+int allinea_mpiWaitFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &classFractionLastSample[CLASS_WAIT], outValue);
+}
+
+int allinea_mpiLateSenderFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &lateFractionLastSample[LATE_SENDER], outValue);
+}
+
+int allinea_mpiLateReceiverFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &lateFractionLastSample[LATE_RECEIVER], outValue);
+}
+
+int allinea_mpiBarrierFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &classFractionLastSample[CLASS_BARRIER], outValue);
+}
+
+int allinea_mpiBcastFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &classFractionLastSample[CLASS_BCAST], outValue);
+}
+
+int allinea_mpiReduceFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &classFractionLastSample[CLASS_REDUCE], outValue);
+}
+
+int allinea_mpiAlltoallFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &classFractionLastSample[CLASS_ALLTOALL], outValue);
+}
+
+int allinea_mpiGatherFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValueDouble(metricId, inOutCurrentSampleTime, &classFractionLastSample[CLASS_GATHER], outValue);
+}
+
+int allinea_mpiUnexpectedQueueLength(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &pvarLastSample[PVAR_UNEXPECTED], outValue);
+}
+
+int allinea_mpiPostedQueueLength(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &pvarLastSample[PVAR_POSTED], outValue);
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs on two ranks with the plugin linked in, so that its MPI functions are
+ * called rather than the MPI library's. One rank sleeps before its side of
+ * each exchange so that the other waits for it; sleeping rather than
+ * computing means the times do not depend on how many CPUs there are.
+ */
+
+#include <mpi.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "allinea_metric_plugin_api.h"
+
+void allinea_set_plugin_error_messagef(plugin_id_t id, int error_code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void allinea_set_metric_error_messagef(metric_id_t id, int error_code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+extern int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused);
+extern int allinea_plugin_cleanup(plugin_id_t id, void *unused);
+extern int allinea_mpiP2pMessages(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_mpiP2pBytes(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_mpiCollectiveCalls(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_mpiWaitFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_mpiLateSenderFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_mpiLateReceiverFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_mpiBarrierFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_mpiReduceFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_mpiUnexpectedQueueLength(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+
+/* Large enough to be sent with the rendezvous protocol by any MPI */
+#define LARGE_MESSAGE_DOUBLES (1024 * 1024)
+
+struct sample {
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t collectives;
+    double wait;
+    double lateSender;
+    double lateReceiver;
+    double barrier;
+    double reduce;
+    uint64_t unexpected;
+};
+
+static int rank;
+
+static struct sample take_sample(int seconds)
+{
+    struct timespec sampleTime = { seconds, 0 };
+    struct sample s;
+    if (allinea_mpiP2pMessages(1, &sampleTime, &s.messages) != 0 ||
+        allinea_mpiP2pBytes(2, &sampleTime, &s.bytes) != 0 ||
+        allinea_mpiCollectiveCalls(3, &sampleTime, &s.collectives) != 0 ||
+        allinea_mpiWaitFraction(4, &sampleTime, &s.wait) != 0 ||
+        allinea_mpiLateSenderFraction(5, &sampleTime, &s.lateSender) != 0 ||
+        allinea_mpiLateReceiverFraction(6, &sampleTime, &s.lateReceiver) != 0 ||
+        allinea_mpiBarrierFraction(7, &sampleTime, &s.barrier) != 0 ||
+        allinea_mpiReduceFraction(8, &sampleTime, &s.reduce) != 0 ||
+        allinea_mpiUnexpectedQueueLength(9, &sampleTime, &s.unexpected) != 0) {
+        fprintf(stderr, "FAIL: rank %d: sampling at %d s failed\n", rank, seconds);
+        abort();
+    }
+    fprintf(stderr, "rank %d, %d s: %llu messages, %llu bytes, %llu collectives, wait %.1f%%, late sender %.1f%%, "
+            "late receiver %.1f%%, barrier %.1f%%, reduce %.1f%%, unexpected %llu\n",
+            rank, seconds, (unsigned long long) s.messages, (unsigned long long) s.bytes,
+            (unsigned long long) s.collectives, s.wait, s.lateSender, s.lateReceiver, s.barrier, s.reduce,
+            (unsigned long long) s.unexpected);
+    return s;
+}
+
+static void check_range(const char *what, double actual, double min, double max)
+{
+    if (actual < min || actual > max) {
+        fprintf(stderr, "FAIL: rank %d: %s: expected %g to %g != actual %g\n", rank, what, min, max, actual);
+        abort();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    setenv("ARM_MAP_MPI_PVAR_INTERVAL_MS", "0", 1);
+    MPI_Init(&argc, &argv);
+    int size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (size != 2) {
+        fprintf(stderr, "FAIL: run with 2 ranks, not %d\n", size);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    const int other = 1 - rank;
+    double *large = calloc(LARGE_MESSAGE_DOUBLES, sizeof(double));
+    double small[8] = { 0 };
+
+    if (allinea_plugin_initialize(1, NULL) != 0) {
+        fprintf(stderr, "FAIL: allinea_plugin_initialize failed\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    take_sample(1);
+
+    /* Late sender: rank 1 sends 200 ms after rank 0 starts to receive */
+    if (rank == 0) {
+        MPI_Recv(small, 8, MPI_DOUBLE, other, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    } else {
+        usleep(200000);
+        MPI_Send(small, 8, MPI_DOUBLE, other, 1, MPI_COMM_WORLD);
+    }
+    struct sample s = take_sample(2);
+    check_range("messages", s.messages, 1, 1);
+    check_range("bytes", s.bytes, 64, 64);
+    check_range("late sender", s.lateSender, rank == 0 ? 80.0 : 0.0, rank == 0 ? 100.0 : 0.0);
+    check_range("late receiver after a small send", s.lateReceiver, 0.0, 0.0);
+
+    /* Late receiver: rank 1 receives a large message 200 ms after rank 0 starts to send it */
+    MPI_Barrier(MPI_COMM_WORLD);
+    take_sample(3);
+    if (rank == 0) {
+        MPI_Send(large, LARGE_MESSAGE_DOUBLES, MPI_DOUBLE, other, 2, MPI_COMM_WORLD);
+    } else {
+        usleep(200000);
+        MPI_Recv(large, LARGE_MESSAGE_DOUBLES, MPI_DOUBLE, other, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+    s = take_sample(4);
+    check_range("bytes of a large message", s.bytes, 8.0 * LARGE_MESSAGE_DOUBLES, 8.0 * LARGE_MESSAGE_DOUBLES);
+    check_range("late receiver", s.lateReceiver, rank == 0 ? 80.0 : 0.0, rank == 0 ? 100.0 : 0.0);
+    check_range("late sender after an arrived message", s.lateSender, 0.0, 0.0);
+
+    /* A late sender with MPI_Irecv and MPI_Wait */
+    MPI_Barrier(MPI_COMM_WORLD);
+    take_sample(5);
+    if (rank == 0) {
+        MPI_Request request;
+        MPI_Irecv(small, 8, MPI_DOUBLE, other, 3, MPI_COMM_WORLD, &request);
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+    } else {
+        usleep(200000);
+        MPI_Send(small, 8, MPI_DOUBLE, other, 3, MPI_COMM_WORLD);
+    }
+    s = take_sample(6);
+    if (rank == 0) {
+        check_range("wait", s.wait, 80.0, 100.0);
+        check_range("late sender in a wait", s.lateSender, 80.0, 100.0);
+    }
+
+    /* Barrier and allreduce time: rank 1 arrives 200 ms late at the barrier */
+    take_sample(7);
+    if (rank == 1)
+        usleep(200000);
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, small, 8, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    s = take_sample(8);
+    check_range("collectives", s.collectives, 2, 2);
+    check_range("barrier", s.barrier, rank == 0 ? 80.0 : 0.0, rank == 0 ? 100.0 : 20.0);
+    check_range("reduce", s.reduce, 0.0, 20.0);
+
+    /* Unexpected messages: rank 1 sends 5 messages that rank 0 has not posted receives for */
+    if (rank == 1) {
+        for (int i = 0; i < 5; ++i)
+            MPI_Send(small, 1, MPI_DOUBLE, other, 4, MPI_COMM_WORLD);
+    }
+    /* The messages arrive before the barrier completes, and the pvars are read as it returns */
+    MPI_Barrier(MPI_COMM_WORLD);
+    s = take_sample(9);
+    if (rank == 0) {
+        check_range("unexpected queue length", s.unexpected, 5, 5);
+        for (int i = 0; i < 5; ++i)
+            MPI_Recv(small, 1, MPI_DOUBLE, other, 4, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        s = take_sample(10);
+        check_range("unexpected queue length after receiving", s.unexpected, 0, 0);
+    }
+
+    allinea_plugin_cleanup(1, NULL);
+    free(large);
+    MPI_Finalize();
+    if (rank == 0)
+        printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Feeds made up sequences of sends and receives to the iteration detector of
+ * muscle2-iterations.h and checks the iterations it finds.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "muscle2-iterations.h"
+#include "test_fixture.h"
+
+#define S MUSCLE2_ITERATION_SEND
+#define R MUSCLE2_ITERATION_RECEIVE
+
+//> One call of a sequence: its kind, conduit, and start and end (ns)
+struct call {
+    int kind;
+    uint32_t conduit;
+    uint64_t start, end;
+};
+
+static struct muscle2_iterations detector;
+
+static struct muscle2_iteration_totals feed(const struct call *calls, size_t count)
+{
+    muscle2_iterations_reset(&detector);
+    for (size_t i = 0; i < count; ++i)
+        muscle2_iterations_call(&detector, calls[i].kind, calls[i].conduit, calls[i].start, calls[i].end);
+    struct muscle2_iteration_totals totals;
+    if (muscle2_iterations_read(&detector, &totals) != 0)
+        FAIL("could not read the totals");
+    return totals;
+}
+
+static void expect_totals(const char *name, struct muscle2_iteration_totals actual, uint64_t iterations,
+                          uint64_t duration_ns, uint64_t receive_ns, uint64_t send_ns)
+{
+    if (actual.iterations != iterations || actual.durationNs != duration_ns || actual.receiveNs != receive_ns ||
+        actual.sendNs != send_ns) {
+        FAIL("%s: expected %llu iterations of %llu ns with %llu ns receiving and %llu ns sending != actual %llu of "
+             "%llu ns with %llu and %llu", name, (unsigned long long) iterations, (unsigned long long) duration_ns,
+             (unsigned long long) receive_ns, (unsigned long long) send_ns, (unsigned long long) actual.iterations,
+             (unsigned long long) actual.durationNs, (unsigned long long) actual.receiveNs,
+             (unsigned long long) actual.sendNs);
+    }
+}
+
+#define FEED(calls) feed(calls, sizeof(calls) / sizeof(calls[0]))
+
+/* Receive, compute, send on one conduit each way: every receive after a send starts an iteration */
+static void test_one_conduit_each_way(void)
+{
+    const struct call calls[] = {
+        { R, 0, 0, 10 }, { S, 1, 50, 55 },
+        { R, 0, 100, 120 }, { S, 1, 150, 160 },
+        { R, 0, 200, 205 },
+    };
+    expect_totals("one conduit each way", FEED(calls), 2, 200, 30, 15);
+}
+
+/* Several receives on one conduit before the send are all one iteration */
+static void test_several_receives_per_iteration(void)
+{
+    const struct call calls[] = {
+        { R, 0, 0, 10 }, { R, 0, 10, 20 }, { R, 0, 20, 30 }, { S, 1, 80, 90 },
+        { R, 0, 100, 110 }, { R, 0, 110, 120 }, { R, 0, 120, 130 }, { S, 1, 180, 190 },
+        { R, 0, 200, 210 },
+    };
+    expect_totals("several receives per iteration", FEED(calls), 2, 200, 60, 20);
+}
+
+/* Sends between the receives of different conduits do not start an iteration, only a conduit receiving again does */
+static void test_sends_between_conduits(void)
+{
+    const struct call calls[] = {
+        { R, 0, 0, 10 }, { S, 2, 20, 25 }, { R, 1, 30, 40 }, { S, 3, 60, 65 },
+        { R, 0, 100, 110 }, { S, 2, 120, 125 }, { R, 1, 130, 140 }, { S, 3, 160, 165 },
+        { R, 0, 200, 210 },
+    };
+    expect_totals("sends between conduits", FEED(calls), 2, 200, 40, 20);
+}
+
+/* The receives of the conduits may come in any order in each iteration */
+static void test_conduits_in_any_order(void)
+{
+    const struct call calls[] = {
+        { R, 0, 0, 10 }, { R, 1, 10, 20 }, { S, 2, 50, 60 },
+        { R, 1, 100, 110 }, { R, 0, 110, 120 }, { S, 2, 150, 160 },
+        { R, 0, 200, 210 },
+    };
+    expect_totals("conduits in any order", FEED(calls), 2, 200, 40, 20);
+}
+
+/* Sends before the first receive, such as initial conditions, are in no iteration */
+static void test_sends_before_first_receive(void)
+{
+    const struct call calls[] = {
+        { S, 1, 0, 50 },
+        { R, 0, 100, 110 }, { S, 1, 150, 155 },
+        { R, 0, 200, 210 },
+    };
+    expect_totals("sends before the first receive", FEED(calls), 1, 100, 10, 5);
+}
+
+/* A submodel that only sends, or only receives, completes no iteration */
+static void test_one_direction(void)
+{
+    const struct call sends[] = { { S, 0, 0, 10 }, { S, 0, 100, 110 }, { S, 0, 200, 210 } };
+    expect_totals("only sends", FEED(sends), 0, 0, 0, 0);
+    const struct call receives[] = { { R, 0, 0, 10 }, { R, 0, 100, 110 }, { R, 0, 200, 210 } };
+    expect_totals("only receives", FEED(receives), 0, 0, 0, 0);
+}
+
+/* Conduits beyond the last share its state */
+static void test_many_conduits(void)
+{
+    const uint32_t last = MUSCLE2_ITERATION_CONDUITS - 1;
+    const struct call calls[] = {
+        { R, last, 0, 10 }, { S, 0, 50, 55 },
+        { R, last + 10, 100, 110 }, { S, 0, 150, 155 },
+    };
+    expect_totals("many conduits", FEED(calls), 1, 100, 10, 5);
+}
+
+/* The totals are not read while they are being written */
+static void test_read_while_written(void)
+{
+    muscle2_iterations_reset(&detector);
+    detector.seq = 1;
+    struct muscle2_iteration_totals totals;
+    if (muscle2_iterations_read(&detector, &totals) == 0)
+        FAIL("read the totals while they were being written");
+}
+
+int main(int argc, char *argv[])
+{
+    test_one_conduit_each_way();
+    test_several_receives_per_iteration();
+    test_sends_between_conduits();
+    test_conduits_in_any_order();
+    test_sends_before_first_receive();
+    test_one_direction();
+    test_many_conduits();
+    test_read_while_written();
+    printf("PASS\n");
+    return 0;
+}
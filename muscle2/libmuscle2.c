@@ -15,10 +15,19 @@
  * limitations under the License.
  */
 #include "allinea_metric_plugin_api.h"
+#include "mpi_rank.h"
 #include "muscle_perf.h"
+#include "muscle2-iterations.h"
+#include "muscle2-trace.h"
+#include "node_stats.h"
+#include "region_totals.h"
+#include "subsample.h"
+#include "telemetry.h"
 #include <stdbool.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
 
 //> Success exitcode as defined by the ALLINEA Custom Metric Plugin Template
 #define SUCCESS 0;
@@ -37,6 +46,393 @@ int calculate_s_per_call_cumulative(muscle_perf_counter_t call_count_id, muscle_
 
 uint64_t duration_ns(const struct timespec *start, const struct timespec *end);
 
+//> The live telemetry page, or NULL if not publishing. See ../common/telemetry.h
+static struct telemetry_page *telemetry_page = NULL;
+
+/**
+ * Publishes the value of one metric for the sample at current_sample_time to the telemetry page.
+ * Each metric is published on its own, as MAP asks for each separately.
+ */
+static void publish_uint64(enum telemetry_metric_id id, uint64_t value, const struct timespec *current_sample_time) {
+    if (telemetry_page == NULL)
+        return;
+    telemetry_publish_begin(telemetry_page);
+    telemetry_set_uint64(telemetry_page, id, value, current_sample_time);
+    telemetry_publish_end(telemetry_page);
+}
+
+static void publish_double(enum telemetry_metric_id id, double value, const struct timespec *current_sample_time) {
+    if (telemetry_page == NULL)
+        return;
+    telemetry_publish_begin(telemetry_page);
+    telemetry_set_double(telemetry_page, id, value, current_sample_time);
+    telemetry_publish_end(telemetry_page);
+}
+
+//> The byte rates read many times per sample by the sub-sampling thread
+enum { BURST_SEND, BURST_RECEIVE, NUM_BURST_CHANNELS };
+
+//> The counters of each channel
+static const muscle_perf_counter_t burst_counters[NUM_BURST_CHANNELS] = {
+    MUSCLE_PERF_COUNTER_SEND_SIZE, MUSCLE_PERF_COUNTER_RECEIVE_SIZE
+};
+
+//> Reads the MUSCLE2 counters many times per sample if ARM_MAP_SUBSAMPLE_HZ is set. See ../common/subsample.h
+static struct subsampler subsampler;
+static bool subsampling = false;
+
+//> The counters at the last read of the sub-sampling thread, and when it was (ns)
+static uint64_t burst_thread_bytes[NUM_BURST_CHANNELS];
+static uint64_t burst_thread_ns = 0;
+
+//> The minimum, maximum, mean and last byte rates of the current sample
+static struct subsample_window burst_window;
+//> The sample burst_window is for, and the counters then if not sub-sampling
+static struct timespec burst_sample_time;
+static uint64_t burst_sample_bytes[NUM_BURST_CHANNELS];
+
+/**
+ * Reads the bytes sent and received per second since its last read. Called from the sub-sampling thread.
+ * @return 0, or -1 if there is no previous read to take the rate from
+ */
+static int read_burst(void *arg, uint64_t now_ns, double *values) {
+    uint64_t bytes[NUM_BURST_CHANNELS];
+    for (int c = 0; c < NUM_BURST_CHANNELS; ++c) {
+        if (MUSCLE_Perf_Get_Counter(burst_counters[c], &bytes[c]) != 0)
+            return -1;
+    }
+    int ret = -1;
+    if (burst_thread_ns != 0 && now_ns > burst_thread_ns) {
+        double seconds = (now_ns - burst_thread_ns) / 1000000000.0;
+        for (int c = 0; c < NUM_BURST_CHANNELS; ++c)
+            values[c] = (bytes[c] - burst_thread_bytes[c]) / seconds;
+        ret = 0;
+    }
+    memcpy(burst_thread_bytes, bytes, sizeof(bytes));
+    burst_thread_ns = now_ns;
+    return ret;
+}
+
+/**
+ * Updates burst_window once per sample: from the reads of the sub-sampling thread if it is running, else all four
+ * statistics are the rate over the whole sample.
+ * @return SUCCESS or FAILURE as appropriate
+ */
+static int update_burst_window(struct timespec *current_sample_time) {
+    if (current_sample_time->tv_sec == burst_sample_time.tv_sec &&
+        current_sample_time->tv_nsec == burst_sample_time.tv_nsec) {
+        return SUCCESS;
+    }
+    if (subsampling) {
+        subsample_window(&subsampler, &burst_window);
+    } else {
+        uint64_t bytes[NUM_BURST_CHANNELS];
+        for (int c = 0; c < NUM_BURST_CHANNELS; ++c) {
+            if (MUSCLE_Perf_Get_Counter(burst_counters[c], &bytes[c]) != 0)
+                return FAILURE;
+        }
+        bool is_first_sample = burst_sample_time.tv_sec == 0 && burst_sample_time.tv_nsec == 0;
+        uint64_t sample_ns = duration_ns(&burst_sample_time, current_sample_time);
+        for (int c = 0; c < NUM_BURST_CHANNELS && !is_first_sample && sample_ns > 0; ++c) {
+            double rate = (bytes[c] - burst_sample_bytes[c]) / (sample_ns / 1000000000.0);
+            burst_window.min[c] = burst_window.max[c] = burst_window.mean[c] = burst_window.last[c] = rate;
+        }
+        memcpy(burst_sample_bytes, bytes, sizeof(bytes));
+    }
+    burst_sample_time = *current_sample_time;
+    return SUCCESS;
+}
+
+/**
+ * Sets out_value to one statistic of the byte rate of a channel over the current sample.
+ * @return SUCCESS or FAILURE as appropriate
+ */
+static int get_burst(const double *statistic, enum telemetry_metric_id telemetry_id,
+                     struct timespec *current_sample_time, double *out_value) {
+    int ret = update_burst_window(current_sample_time);
+    if (ret != 0)
+        return ret;
+    *out_value = *statistic;
+    publish_double(telemetry_id, *out_value, current_sample_time);
+    return SUCCESS;
+}
+
+//> The counters added up by the region the program was in at each sample, if it marks regions. See ../common/region_totals.h
+enum {
+    REGION_SEND_BYTES, REGION_SEND_CALLS, REGION_SEND_DURATION,
+    REGION_RECEIVE_BYTES, REGION_RECEIVE_CALLS, REGION_RECEIVE_DURATION,
+    REGION_BARRIER_CALLS, REGION_BARRIER_DURATION, NUM_REGION_COUNTERS
+};
+static const muscle_perf_counter_t region_counters[NUM_REGION_COUNTERS] = {
+    MUSCLE_PERF_COUNTER_SEND_SIZE, MUSCLE_PERF_COUNTER_SEND_CALLS, MUSCLE_PERF_COUNTER_SEND_DURATION,
+    MUSCLE_PERF_COUNTER_RECEIVE_SIZE, MUSCLE_PERF_COUNTER_RECEIVE_CALLS, MUSCLE_PERF_COUNTER_RECEIVE_DURATION,
+    MUSCLE_PERF_COUNTER_BARRIER_CALLS, MUSCLE_PERF_COUNTER_BARRIER_DURATION
+};
+static const char *const region_counter_names[NUM_REGION_COUNTERS] = {
+    "bytes sent", "send calls", "send duration (ns)",
+    "bytes received", "receive calls", "receive duration (ns)",
+    "barrier calls", "barrier duration (ns)"
+};
+static const struct region_ratio region_ratios[] = {
+    { "bytes per send", REGION_SEND_BYTES, REGION_SEND_CALLS, 1.0 },
+    { "seconds per send", REGION_SEND_DURATION, REGION_SEND_CALLS, 1e-9 },
+    { "bytes per receive", REGION_RECEIVE_BYTES, REGION_RECEIVE_CALLS, 1.0 },
+    { "seconds per receive", REGION_RECEIVE_DURATION, REGION_RECEIVE_CALLS, 1e-9 },
+    { "seconds per barrier", REGION_BARRIER_DURATION, REGION_BARRIER_CALLS, 1e-9 }
+};
+static struct region_totals region_totals;
+//> The sample the region totals were last added for, and the counters then
+static struct timespec region_sample_time;
+static uint64_t region_sample_counters[NUM_REGION_COUNTERS];
+
+/**
+ * Adds the counts since the last sample to the region the program is in, once per sample.
+ * MAP asks for each metric separately, so every metric function calls this.
+ */
+static void update_region_totals(const struct timespec *current_sample_time) {
+    if (!region_totals_enabled(&region_totals) ||
+        (current_sample_time->tv_sec == region_sample_time.tv_sec &&
+         current_sample_time->tv_nsec == region_sample_time.tv_nsec)) {
+        return;
+    }
+    region_sample_time = *current_sample_time;
+    uint64_t curr[NUM_REGION_COUNTERS];
+    uint64_t deltas[NUM_REGION_COUNTERS];
+    for (int c = 0; c < NUM_REGION_COUNTERS; ++c) {
+        if (MUSCLE_Perf_Get_Counter(region_counters[c], &curr[c]) != 0)
+            return;
+        deltas[c] = curr[c] - region_sample_counters[c];
+    }
+    memcpy(region_sample_counters, curr, sizeof(curr));
+    region_totals_add(&region_totals, region_totals_current(&region_totals), deltas);
+}
+
+//> The kinds of call whose time is compared over the node and split out of each coupling iteration
+enum { CALL_SEND, CALL_RECEIVE, CALL_BARRIER, NUM_CALL_KINDS };
+static const muscle_perf_counter_t call_duration_counters[NUM_CALL_KINDS] = {
+    MUSCLE_PERF_COUNTER_SEND_DURATION, MUSCLE_PERF_COUNTER_RECEIVE_DURATION, MUSCLE_PERF_COUNTER_BARRIER_DURATION
+};
+
+/**
+ * Sets ns to the total time (ns) spent in each kind of call, with a call that has not returned yet counted up to
+ * current_sample_time, so that a long call shows in every sample it spans rather than all at once when it returns.
+ * @return SUCCESS or FAILURE as appropriate
+ */
+static int read_call_ns(const struct timespec *current_sample_time, uint64_t ns[NUM_CALL_KINDS]) {
+    struct timespec start_time;
+    muscle_perf_counter_t curr_call_id;
+    bool is_inside_call = MUSCLE_Perf_In_Call(&start_time, &curr_call_id);
+    for (int c = 0; c < NUM_CALL_KINDS; ++c) {
+        if (MUSCLE_Perf_Get_Counter(call_duration_counters[c], &ns[c]) != 0)
+            return FAILURE;
+        if (is_inside_call && curr_call_id == call_duration_counters[c])
+            ns[c] += duration_ns(&start_time, current_sample_time);
+    }
+    return SUCCESS;
+}
+
+//> The time in each kind of call compared between the processes on the node. See ../common/node_stats.h
+#define NUM_NODE_VALUES NUM_CALL_KINDS
+static struct node_stats node_stats;
+//> The minimum, mean, maximum and variation over the node of the time in each kind of call in the current sample
+static struct node_stats_summary node_summaries[NUM_NODE_VALUES];
+//> The sample node_summaries is for, and the time in each kind of call until then (ns)
+static struct timespec node_sample_time;
+static uint64_t node_sample_ns[NUM_NODE_VALUES];
+
+/**
+ * Writes the seconds this process spent in sends, receives and barriers in the current sample to its node statistics
+ * slot, and summarises them over the node, once per sample. A call that has not returned yet counts up to the sample.
+ * @return SUCCESS or FAILURE as appropriate
+ */
+static int update_node_stats(struct timespec *current_sample_time) {
+    if (current_sample_time->tv_sec == node_sample_time.tv_sec &&
+        current_sample_time->tv_nsec == node_sample_time.tv_nsec) {
+        return SUCCESS;
+    }
+    uint64_t ns[NUM_NODE_VALUES];
+    if (read_call_ns(current_sample_time, ns) != 0)
+        return FAILURE;
+    bool is_first_sample = node_sample_time.tv_sec == 0 && node_sample_time.tv_nsec == 0;
+    double seconds[NUM_NODE_VALUES];
+    for (int v = 0; v < NUM_NODE_VALUES; ++v) {
+        seconds[v] = is_first_sample || ns[v] < node_sample_ns[v] ? 0.0 : (ns[v] - node_sample_ns[v]) / 1000000000.0;
+        node_sample_ns[v] = ns[v];
+    }
+    node_sample_time = *current_sample_time;
+    node_stats_write(&node_stats, seconds, current_sample_time);
+    node_stats_summarize(&node_stats, node_summaries);
+    return SUCCESS;
+}
+
+/**
+ * Sets out_value to one statistic over the node of the seconds spent in one kind of call in the current sample.
+ * @return SUCCESS or FAILURE as appropriate
+ */
+static int get_node_stat(const double *statistic, struct timespec *current_sample_time, double *out_value) {
+    int ret = update_node_stats(current_sample_time);
+    if (ret != 0)
+        return ret;
+    *out_value = *statistic;
+    return SUCCESS;
+}
+
+/**
+ * Coupling iterations. A submodel receives on its input conduits, computes, then sends on its output conduits, so
+ * each iteration starts with a receive on a conduit that has received since the last send on any. With libmuscle2.so
+ * preloaded, its MUSCLE_Send and MUSCLE_Receive (muscle2-trace.c) feed every call and its conduit to the detector of
+ * muscle2-iterations.h, which finds those starts, and the duration, receive wait and compute are those of the
+ * iterations completed in each sample. Without it MUSCLE2 only counts calls over all the conduits, so iterations are
+ * counted from the receives, and the receives per iteration are learnt from the samples: a run of samples with
+ * receives and no sends, between two samples with sends and no receives, holds every receive of one iteration.
+ * ARM_MAP_MUSCLE2_RECEIVES_PER_ITERATION sets it instead; until either is known it is 1. The receive wait and compute
+ * are then those of the whole sample.
+ */
+static struct muscle2_iterations iteration_detector;
+static bool detecting_iterations;
+//> The totals of the detector at the last sample
+static struct muscle2_iteration_totals iteration_totals;
+enum iteration_phase { PHASE_NONE, PHASE_RECEIVE, PHASE_SEND, PHASE_MIXED };
+static double receives_per_iteration = 1.0;
+static bool receives_per_iteration_fixed = false;
+//> What the last sample with calls in it had: receives, sends or both
+static enum iteration_phase iteration_phase;
+//> The receives since the first sample of receives after one of sends, while no sample has had both
+static uint64_t receive_run;
+static bool receive_run_clean;
+//> The sample the iteration metrics are for, and the calls and time in calls (ns) until then
+static struct timespec iteration_sample_time;
+static uint64_t iteration_receive_calls, iteration_send_calls;
+static uint64_t iteration_call_ns[NUM_CALL_KINDS];
+//> The last sample that completed an iteration, and the iterations since the plugin was loaded
+static struct timespec last_iteration_time;
+static double iterations_total;
+//> Iterations per second, seconds per iteration, and the percentages of the time blocked in receives and computing
+static double iteration_rate, iteration_duration, iteration_receive_wait, iteration_compute;
+
+/**
+ * Learns the receives per iteration from the receives and sends of one sample, if they complete a run of receives.
+ */
+static void learn_receives_per_iteration(uint64_t new_receives, uint64_t new_sends) {
+    if (new_receives > 0 && new_sends == 0) {
+        if (iteration_phase == PHASE_SEND) {
+            receive_run = new_receives;
+            receive_run_clean = true;
+        } else if (receive_run_clean) {
+            receive_run += new_receives;
+        }
+        iteration_phase = PHASE_RECEIVE;
+    } else if (new_sends > 0 && new_receives == 0) {
+        if (receive_run_clean && iteration_phase == PHASE_RECEIVE && !receives_per_iteration_fixed)
+            receives_per_iteration = receive_run;
+        receive_run_clean = false;
+        iteration_phase = PHASE_SEND;
+    } else if (new_sends > 0) {
+        receive_run_clean = false;
+        iteration_phase = PHASE_MIXED;
+    }
+}
+
+/**
+ * Takes the iterations the detector completed since the last sample, and sets the duration, receive wait and compute
+ * to theirs. If none completed the receive wait and compute stay those of the last that did.
+ * @return the iterations completed
+ */
+static uint64_t update_detected_iterations(void) {
+    struct muscle2_iteration_totals totals;
+    // A sample that interrupted the detector leaves the iterations to the next
+    if (muscle2_iterations_read(&iteration_detector, &totals) != 0)
+        return 0;
+    const uint64_t iterations = totals.iterations - iteration_totals.iterations;
+    const double duration_ns = totals.durationNs - iteration_totals.durationNs;
+    if (iterations > 0 && duration_ns > 0) {
+        const double receive_ns = totals.receiveNs - iteration_totals.receiveNs;
+        const double send_ns = totals.sendNs - iteration_totals.sendNs;
+        iteration_duration = duration_ns / iterations / 1000000000.0;
+        iteration_receive_wait = 100.0 * fmin(receive_ns / duration_ns, 1.0);
+        iteration_compute = 100.0 * fmax(1.0 - (receive_ns + send_ns) / duration_ns, 0.0);
+    }
+    iteration_totals = totals;
+    return iterations;
+}
+
+/**
+ * Counts the iterations of the sample from its receives, and sets the receive wait and compute to those of the
+ * sample, when the detector is not fed.
+ * @return the iterations completed, which may be a fraction
+ */
+static double update_counted_iterations(uint64_t receives, uint64_t sends, const uint64_t ns[NUM_CALL_KINDS],
+                                        double seconds) {
+    uint64_t new_receives = receives - iteration_receive_calls;
+    learn_receives_per_iteration(new_receives, sends - iteration_send_calls);
+    double call_seconds[NUM_CALL_KINDS];
+    for (int c = 0; c < NUM_CALL_KINDS; ++c) {
+        call_seconds[c] = ns[c] < iteration_call_ns[c] ? 0.0 : (ns[c] - iteration_call_ns[c]) / 1000000000.0;
+    }
+    double in_calls = call_seconds[CALL_SEND] + call_seconds[CALL_RECEIVE] + call_seconds[CALL_BARRIER];
+    iteration_receive_wait = 100.0 * fmin(call_seconds[CALL_RECEIVE] / seconds, 1.0);
+    iteration_compute = 100.0 * fmax(1.0 - in_calls / seconds, 0.0);
+    return new_receives / receives_per_iteration;
+}
+
+/**
+ * Updates the iteration metrics once per sample. An iteration longer than a sample shows its duration so far in the
+ * samples before it completes.
+ * @return SUCCESS or FAILURE as appropriate
+ */
+static int update_iterations(struct timespec *current_sample_time) {
+    if (current_sample_time->tv_sec == iteration_sample_time.tv_sec &&
+        current_sample_time->tv_nsec == iteration_sample_time.tv_nsec) {
+        return SUCCESS;
+    }
+    uint64_t receives, sends, ns[NUM_CALL_KINDS];
+    if (MUSCLE_Perf_Get_Counter(MUSCLE_PERF_COUNTER_RECEIVE_CALLS, &receives) != 0 ||
+        MUSCLE_Perf_Get_Counter(MUSCLE_PERF_COUNTER_SEND_CALLS, &sends) != 0 ||
+        read_call_ns(current_sample_time, ns) != 0) {
+        return FAILURE;
+    }
+    bool is_first_sample = iteration_sample_time.tv_sec == 0 && iteration_sample_time.tv_nsec == 0;
+    uint64_t sample_ns = is_first_sample ? 0 : duration_ns(&iteration_sample_time, current_sample_time);
+    if (is_first_sample) {
+        last_iteration_time = *current_sample_time;
+        if (detecting_iterations)
+            muscle2_iterations_read(&iteration_detector, &iteration_totals);
+    } else if (sample_ns > 0) {
+        double seconds = sample_ns / 1000000000.0;
+        double iterations = detecting_iterations ? update_detected_iterations()
+                                                 : update_counted_iterations(receives, sends, ns, seconds);
+        iterations_total += iterations;
+        iteration_rate = iterations / seconds;
+        double since_last = duration_ns(&last_iteration_time, current_sample_time) / 1000000000.0;
+        if (iterations > 0) {
+            if (!detecting_iterations)
+                iteration_duration = since_last / iterations;
+            last_iteration_time = *current_sample_time;
+        } else {
+            iteration_duration = iterations_total > 0 ? since_last : 0.0;
+        }
+    }
+    iteration_receive_calls = receives;
+    iteration_send_calls = sends;
+    memcpy(iteration_call_ns, ns, sizeof(ns));
+    iteration_sample_time = *current_sample_time;
+    return SUCCESS;
+}
+
+/**
+ * Sets out_value to one of the iteration metrics of the current sample.
+ * @return SUCCESS or FAILURE as appropriate
+ */
+static int get_iteration_stat(const double *statistic, enum telemetry_metric_id telemetry_id,
+                              struct timespec *current_sample_time, double *out_value) {
+    int ret = update_iterations(current_sample_time);
+    if (ret != 0)
+        return ret;
+    *out_value = *statistic;
+    publish_double(telemetry_id, *out_value, current_sample_time);
+    return SUCCESS;
+}
+
 /**
  * Initialises metric plugin. 
  * It will be called when that plugin library is loaded, it is NOT called from a signal handler.
@@ -45,6 +441,36 @@ uint64_t duration_ns(const struct timespec *start, const struct timespec *end);
  */
 int allinea_plugin_initialize(plugin_id_t plugin_id, void *data) {
     MUSCLE_Perf_Reset_Counters();
+    memset(&burst_window, 0, sizeof(burst_window));
+    memset(&burst_sample_time, 0, sizeof(burst_sample_time));
+    burst_thread_ns = 0;
+    subsampling = subsample_start(&subsampler, subsample_hz_from_env(), NUM_BURST_CHANNELS, read_burst, NULL) == 0;
+    memset(&region_sample_time, 0, sizeof(region_sample_time));
+    memset(region_sample_counters, 0, sizeof(region_sample_counters));
+    region_totals_open(&region_totals, NUM_REGION_COUNTERS, region_counter_names);
+    telemetry_page = telemetry_open();
+    memset(&node_sample_time, 0, sizeof(node_sample_time));
+    memset(node_summaries, 0, sizeof(node_summaries));
+    node_stats_open(&node_stats, "muscle2", NUM_NODE_VALUES);
+    const char *receives = getenv("ARM_MAP_MUSCLE2_RECEIVES_PER_ITERATION");
+    receives_per_iteration_fixed = receives != NULL && atof(receives) > 0.0;
+    receives_per_iteration = receives_per_iteration_fixed ? atof(receives) : 1.0;
+    iteration_phase = PHASE_NONE;
+    receive_run_clean = false;
+    memset(&iteration_sample_time, 0, sizeof(iteration_sample_time));
+    iterations_total = 0.0;
+    iteration_rate = iteration_duration = iteration_receive_wait = iteration_compute = 0.0;
+    const char *trace_dir = getenv("ARM_MAP_MUSCLE2_TRACE");
+    if (trace_dir != NULL && *trace_dir != '\0') {
+        if (muscle2_trace_interposed())
+            muscle2_trace_start(trace_dir);
+        else
+            fprintf(stderr, "MUSCLE2 plugin: not tracing to %s, as libmuscle2.so is not preloaded\n", trace_dir);
+    }
+    // After the trace is started, as that numbers the conduits afresh
+    muscle2_iterations_reset(&iteration_detector);
+    memset(&iteration_totals, 0, sizeof(iteration_totals));
+    detecting_iterations = muscle2_trace_iterations(&iteration_detector) == 0;
     return SUCCESS;
 }
 
@@ -54,6 +480,18 @@ int allinea_plugin_initialize(plugin_id_t plugin_id, void *data) {
  * @return SUCCESS or FAILURE as appropriate
  */
 int allinea_plugin_cleanup(plugin_id_t plugin_id, void *data) {
+    subsample_stop(&subsampler);
+    subsampling = false;
+    if (mpi_rank_is_root()) {
+        region_totals_print(&region_totals, stdout, "MUSCLE2 counters", region_ratios,
+                            sizeof(region_ratios) / sizeof(region_ratios[0]));
+    }
+    telemetry_close(telemetry_page);
+    telemetry_page = NULL;
+    node_stats_close(&node_stats);
+    muscle2_trace_iterations(NULL);
+    detecting_iterations = false;
+    muscle2_trace_stop();
     return SUCCESS;
 }
 
@@ -62,6 +500,7 @@ int allinea_plugin_cleanup(plugin_id_t plugin_id, void *data) {
  * @return SUCCESS or FAILURE as appropriate
  */
 int allinea_muscle2_get_bytes_sent(metric_id_t id, struct timespec *current_sample_time, uint64_t *out_value) {
+    update_region_totals(current_sample_time);
     static uint64_t prev_send_size = 0; // initialized only on the first call to this function
     uint64_t curr;
     int is_successful = MUSCLE_Perf_Get_Counter(MUSCLE_PERF_COUNTER_SEND_SIZE, &curr); 
@@ -71,6 +510,7 @@ int allinea_muscle2_get_bytes_sent(metric_id_t id, struct timespec *current_samp
     uint64_t diff = curr - prev_send_size;
     prev_send_size = curr;
     *out_value = diff;
+    publish_uint64(TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_RATE, diff, current_sample_time);
     return SUCCESS;
 }
 
@@ -79,6 +519,7 @@ int allinea_muscle2_get_bytes_sent(metric_id_t id, struct timespec *current_samp
  * @return SUCCESS or FAILURE as appropriate
  */
 int allinea_muscle2_get_send_calls(metric_id_t id, struct timespec *current_sample_time, uint64_t *out_value) {
+    update_region_totals(current_sample_time);
     static uint64_t prev_send_calls = 0; // initialized only on the first call to this function
     uint64_t curr;
     int is_successful = MUSCLE_Perf_Get_Counter(MUSCLE_PERF_COUNTER_SEND_CALLS, &curr); 
@@ -88,6 +529,7 @@ int allinea_muscle2_get_send_calls(metric_id_t id, struct timespec *current_samp
     uint64_t diff = curr - prev_send_calls;
     prev_send_calls = curr;
     *out_value = diff;
+    publish_uint64(TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_CALLS, diff, current_sample_time);
     return SUCCESS;
 }
 
@@ -96,10 +538,14 @@ int allinea_muscle2_get_send_calls(metric_id_t id, struct timespec *current_samp
  * @return SUCCESS or FAILURE as appropriate 
  */
 int allinea_muscle2_get_send_duration(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
     static uint64_t prev_send_calls_total = 0;    // only initialized on the first call to this function
     static uint64_t prev_send_duration_total = 0; // only initialized on the first call to this function
-    return calculate_s_per_call(MUSCLE_PERF_COUNTER_SEND_CALLS, MUSCLE_PERF_COUNTER_SEND_DURATION,
+    int ret = calculate_s_per_call(MUSCLE_PERF_COUNTER_SEND_CALLS, MUSCLE_PERF_COUNTER_SEND_DURATION,
                                  &prev_send_calls_total, &prev_send_duration_total, current_sample_time, out_value);
+    if (ret == 0)
+        publish_double(TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_DURATION, *out_value, current_sample_time);
+    return ret;
 }
 
 
@@ -108,9 +554,13 @@ int allinea_muscle2_get_send_duration(metric_id_t id, struct timespec *current_s
  * @return SUCCESS or FAILURE as appropriate 
  */
 int allinea_muscle2_get_send_duration_cumulative(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
 
-    return calculate_s_per_call_cumulative(MUSCLE_PERF_COUNTER_SEND_CALLS, MUSCLE_PERF_COUNTER_SEND_DURATION,
+    int ret = calculate_s_per_call_cumulative(MUSCLE_PERF_COUNTER_SEND_CALLS, MUSCLE_PERF_COUNTER_SEND_DURATION,
                                  current_sample_time, out_value);
+    if (ret == 0)
+        publish_double(TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_DURATION_CUM, *out_value, current_sample_time);
+    return ret;
 }
 
 /**
@@ -118,6 +568,7 @@ int allinea_muscle2_get_send_duration_cumulative(metric_id_t id, struct timespec
  * @return SUCCESS or FAILURE as appropriate 
  */
 int allinea_muscle2_get_bytes_received(metric_id_t id, struct timespec *current_sample_time, uint64_t *out_value) {
+    update_region_totals(current_sample_time);
     static uint64_t prev_receive_size = 0; // initialized only on the first call to this function
     uint64_t curr;
     int is_successful = MUSCLE_Perf_Get_Counter(MUSCLE_PERF_COUNTER_RECEIVE_SIZE, &curr); 
@@ -127,6 +578,7 @@ int allinea_muscle2_get_bytes_received(metric_id_t id, struct timespec *current_
     uint64_t diff = curr - prev_receive_size;
     prev_receive_size = curr;
     *out_value = diff;
+    publish_uint64(TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_RATE, diff, current_sample_time);
     return SUCCESS;
 }
 
@@ -135,6 +587,7 @@ int allinea_muscle2_get_bytes_received(metric_id_t id, struct timespec *current_
  * @return SUCCESS or FAILURE as appropriate 
  */
 int allinea_muscle2_get_receive_calls(metric_id_t id, struct timespec *current_sample_time, uint64_t *out_value) {
+    update_region_totals(current_sample_time);
     static uint64_t prev_receive_calls = 0; // initialized only on the first call to this function
     uint64_t curr;
     int is_successful = MUSCLE_Perf_Get_Counter(MUSCLE_PERF_COUNTER_RECEIVE_CALLS, &curr); 
@@ -144,6 +597,7 @@ int allinea_muscle2_get_receive_calls(metric_id_t id, struct timespec *current_s
     uint64_t diff = curr - prev_receive_calls;
     prev_receive_calls = curr;
     *out_value = diff;
+    publish_uint64(TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_CALLS, diff, current_sample_time);
     return SUCCESS;
 }
 
@@ -152,10 +606,14 @@ int allinea_muscle2_get_receive_calls(metric_id_t id, struct timespec *current_s
  * @return SUCCESS or FAILURE as appropriate 
  */
 int allinea_muscle2_get_receive_duration(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
     static uint64_t prev_receive_calls_total = 0;    // only initialized on the first call to this function
     static uint64_t prev_receive_duration_total = 0; // only initialized on the first call to this function
-    return calculate_s_per_call(MUSCLE_PERF_COUNTER_RECEIVE_CALLS, MUSCLE_PERF_COUNTER_RECEIVE_DURATION,
+    int ret = calculate_s_per_call(MUSCLE_PERF_COUNTER_RECEIVE_CALLS, MUSCLE_PERF_COUNTER_RECEIVE_DURATION,
                                  &prev_receive_calls_total, &prev_receive_duration_total, current_sample_time, out_value);
+    if (ret == 0)
+        publish_double(TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_DURATION, *out_value, current_sample_time);
+    return ret;
 }
 
 /**
@@ -163,9 +621,13 @@ int allinea_muscle2_get_receive_duration(metric_id_t id, struct timespec *curren
  * @return SUCCESS or FAILURE as appropriate 
  */
 int allinea_muscle2_get_receive_duration_cumulative(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
 
-    return calculate_s_per_call_cumulative(MUSCLE_PERF_COUNTER_RECEIVE_CALLS, MUSCLE_PERF_COUNTER_RECEIVE_DURATION,
+    int ret = calculate_s_per_call_cumulative(MUSCLE_PERF_COUNTER_RECEIVE_CALLS, MUSCLE_PERF_COUNTER_RECEIVE_DURATION,
                                  current_sample_time, out_value);
+    if (ret == 0)
+        publish_double(TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_DURATION_CUM, *out_value, current_sample_time);
+    return ret;
 }
 
 /**
@@ -173,6 +635,7 @@ int allinea_muscle2_get_receive_duration_cumulative(metric_id_t id, struct times
  * @return SUCCESS or FAILURE as appropriate 
  */
 int allinea_muscle2_get_barrier_calls(metric_id_t id, struct timespec *current_sample_time, uint64_t *out_value) {
+    update_region_totals(current_sample_time);
     static uint64_t prev_barrier_calls = 0; // initialized only on the first call to this function
     uint64_t curr;
     int is_successful = MUSCLE_Perf_Get_Counter(MUSCLE_PERF_COUNTER_BARRIER_CALLS, &curr); 
@@ -182,6 +645,7 @@ int allinea_muscle2_get_barrier_calls(metric_id_t id, struct timespec *current_s
     uint64_t diff = curr - prev_barrier_calls;
     prev_barrier_calls = curr;
     *out_value = diff;
+    publish_uint64(TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_BARRIER_CALLS, diff, current_sample_time);
     return SUCCESS;
 }
 
@@ -190,10 +654,14 @@ int allinea_muscle2_get_barrier_calls(metric_id_t id, struct timespec *current_s
  * @return SUCCESS or FAILURE as appropriate 
  */
 int allinea_muscle2_get_barrier_duration(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
     static uint64_t prev_barrier_calls_total = 0;    // only initialized on the first call to this function
     static uint64_t prev_barrier_duration_total = 0; // only initialized on the first call to this function
-    return calculate_s_per_call(MUSCLE_PERF_COUNTER_BARRIER_CALLS, MUSCLE_PERF_COUNTER_BARRIER_DURATION,
+    int ret = calculate_s_per_call(MUSCLE_PERF_COUNTER_BARRIER_CALLS, MUSCLE_PERF_COUNTER_BARRIER_DURATION,
                                  &prev_barrier_calls_total, &prev_barrier_duration_total, current_sample_time, out_value);
+    if (ret == 0)
+        publish_double(TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_BARRIER_DURATION, *out_value, current_sample_time);
+    return ret;
 }
 
 
@@ -202,9 +670,244 @@ int allinea_muscle2_get_barrier_duration(metric_id_t id, struct timespec *curren
  * @return SUCCESS or FAILURE as appropriate 
  */
 int allinea_muscle2_get_barrier_duration_cumulative(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
 
-    return calculate_s_per_call_cumulative(MUSCLE_PERF_COUNTER_BARRIER_CALLS, MUSCLE_PERF_COUNTER_BARRIER_DURATION,
+    int ret = calculate_s_per_call_cumulative(MUSCLE_PERF_COUNTER_BARRIER_CALLS, MUSCLE_PERF_COUNTER_BARRIER_DURATION,
                                  current_sample_time, out_value);
+    if (ret == 0)
+        publish_double(TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_BARRIER_DURATION_CUM, *out_value, current_sample_time);
+    return ret;
+}
+
+/**
+ * Sets out_value to the lowest rate of data sent (B/s) read during the current sample
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_bytes_sent_min(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_burst(&burst_window.min[BURST_SEND], TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_RATE_MIN,
+                     current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the highest rate of data sent (B/s) read during the current sample
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_bytes_sent_max(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_burst(&burst_window.max[BURST_SEND], TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_RATE_MAX,
+                     current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the mean rate of data sent (B/s) over the reads during the current sample
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_bytes_sent_mean(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_burst(&burst_window.mean[BURST_SEND], TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_RATE_MEAN,
+                     current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the rate of data sent (B/s) at the last read of the current sample
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_bytes_sent_last(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_burst(&burst_window.last[BURST_SEND], TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_SEND_RATE_LAST,
+                     current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the lowest rate of data received (B/s) read during the current sample
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_bytes_received_min(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_burst(&burst_window.min[BURST_RECEIVE], TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_RATE_MIN,
+                     current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the highest rate of data received (B/s) read during the current sample
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_bytes_received_max(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_burst(&burst_window.max[BURST_RECEIVE], TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_RATE_MAX,
+                     current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the mean rate of data received (B/s) over the reads during the current sample
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_bytes_received_mean(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_burst(&burst_window.mean[BURST_RECEIVE], TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_RATE_MEAN,
+                     current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the rate of data received (B/s) at the last read of the current sample
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_bytes_received_last(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_burst(&burst_window.last[BURST_RECEIVE], TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_RECEIVE_RATE_LAST,
+                     current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the lowest time (s) in sends in the current sample over the processes on the node
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_node_send_time_min(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_node_stat(&node_summaries[CALL_SEND].min, current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the mean time (s) in sends in the current sample over the processes on the node
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_node_send_time_mean(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_node_stat(&node_summaries[CALL_SEND].mean, current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the highest time (s) in sends in the current sample over the processes on the node
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_node_send_time_max(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_node_stat(&node_summaries[CALL_SEND].max, current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the coefficient of variation of the time in sends in the current sample over the processes on the node
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_node_send_time_cv(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_node_stat(&node_summaries[CALL_SEND].cv, current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the lowest time (s) in receives in the current sample over the processes on the node
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_node_receive_time_min(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_node_stat(&node_summaries[CALL_RECEIVE].min, current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the mean time (s) in receives in the current sample over the processes on the node
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_node_receive_time_mean(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_node_stat(&node_summaries[CALL_RECEIVE].mean, current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the highest time (s) in receives in the current sample over the processes on the node
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_node_receive_time_max(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_node_stat(&node_summaries[CALL_RECEIVE].max, current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the coefficient of variation of the time in receives in the current sample over the processes on the node
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_node_receive_time_cv(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_node_stat(&node_summaries[CALL_RECEIVE].cv, current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the lowest time (s) in barriers in the current sample over the processes on the node
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_node_barrier_time_min(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_node_stat(&node_summaries[CALL_BARRIER].min, current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the mean time (s) in barriers in the current sample over the processes on the node
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_node_barrier_time_mean(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_node_stat(&node_summaries[CALL_BARRIER].mean, current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the highest time (s) in barriers in the current sample over the processes on the node
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_node_barrier_time_max(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_node_stat(&node_summaries[CALL_BARRIER].max, current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the coefficient of variation of the time in barriers in the current sample over the processes on the node
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_node_barrier_time_cv(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_node_stat(&node_summaries[CALL_BARRIER].cv, current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the coupling iterations per second in the current sample
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_iteration_rate(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_iteration_stat(&iteration_rate, TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_ITERATION_RATE,
+                              current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the mean duration (s) of the coupling iterations completed in the current sample, or of the
+ * iteration so far if none completed
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_iteration_duration(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_iteration_stat(&iteration_duration, TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_ITERATION_DURATION,
+                              current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the percentage of the iterations completed in the current sample spent blocked in receives,
+ * waiting for the neighbours
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_iteration_receive_wait(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_iteration_stat(&iteration_receive_wait, TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_ITERATION_RECEIVE_WAIT,
+                              current_sample_time, out_value);
+}
+
+/**
+ * Sets out_value to the percentage of the iterations completed in the current sample spent computing, outside sends
+ * and receives
+ * @return SUCCESS or FAILURE as appropriate
+ */
+int allinea_muscle2_get_iteration_compute(metric_id_t id, struct timespec *current_sample_time, double *out_value) {
+    update_region_totals(current_sample_time);
+    return get_iteration_stat(&iteration_compute, TELEMETRY_COM_ALLINEA_METRICS_MUSCLE2_ITERATION_COMPUTE,
+                              current_sample_time, out_value);
 }
 
 /** 
@@ -364,7 +1067,7 @@ int calculate_s_per_call_cumulative(muscle_perf_counter_t call_count_id, muscle_
 
     // duration within this sampling window
     uint64_t curr_duration_total;
-    is_successful = MUSCLE_Perf_Get_Counter(call_duration_id, &curr_duration_total);
+    int is_successful = MUSCLE_Perf_Get_Counter(call_duration_id, &curr_duration_total);
     if (is_successful != 0) {
         return FAILURE;
     }
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The iteration detector of muscle2-iterations.h. It has no MUSCLE2
+ * dependencies, so iterations-test.c can feed it made up calls.
+ */
+
+#include "muscle2-iterations.h"
+
+#include <string.h>
+
+//> Tries to read the totals while they are not being written
+#define READ_TRIES 16
+
+void muscle2_iterations_reset(struct muscle2_iterations *detector) {
+    memset(detector, 0, sizeof(*detector));
+}
+
+/**
+ * Adds the current iteration, which ended when the next one started at end_ns, to the totals
+ */
+static void complete_iteration(struct muscle2_iterations *detector, uint64_t end_ns) {
+    __atomic_store_n(&detector->seq, detector->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    detector->totals.iterations += 1;
+    detector->totals.durationNs += end_ns > detector->currentStartNs ? end_ns - detector->currentStartNs : 0;
+    detector->totals.receiveNs += detector->currentReceiveNs;
+    detector->totals.sendNs += detector->currentSendNs;
+    __atomic_store_n(&detector->seq, detector->seq + 1, __ATOMIC_RELEASE);
+}
+
+void muscle2_iterations_call(struct muscle2_iterations *detector, int kind, uint32_t conduit, uint64_t start_ns,
+                             uint64_t end_ns) {
+    if (conduit >= MUSCLE2_ITERATION_CONDUITS)
+        conduit = MUSCLE2_ITERATION_CONDUITS - 1;
+    const uint64_t call = ++detector->calls;
+    const uint64_t ns = end_ns > start_ns ? end_ns - start_ns : 0;
+    if (kind == MUSCLE2_ITERATION_SEND) {
+        detector->lastSend = call;
+        if (detector->current > 0)
+            detector->currentSendNs += ns;
+        return;
+    }
+    if (detector->current == 0 ||
+        (detector->receivedIn[conduit] == detector->current && detector->lastSend > detector->lastReceive[conduit])) {
+        if (detector->current > 0)
+            complete_iteration(detector, start_ns);
+        ++detector->current;
+        detector->currentStartNs = start_ns;
+        detector->currentReceiveNs = detector->currentSendNs = 0;
+    }
+    detector->receivedIn[conduit] = detector->current;
+    detector->lastReceive[conduit] = call;
+    detector->currentReceiveNs += ns;
+}
+
+int muscle2_iterations_read(const struct muscle2_iterations *detector, struct muscle2_iteration_totals *totals) {
+    for (int i = 0; i < READ_TRIES; ++i) {
+        const uint32_t seq = __atomic_load_n(&detector->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        memcpy(totals, &detector->totals, sizeof(*totals));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&detector->seq, __ATOMIC_RELAXED) == seq)
+            return 0;
+    }
+    return -1;
+}
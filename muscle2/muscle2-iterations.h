@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Finds the coupling iterations of a submodel in its MUSCLE2 sends and
+ * receives, as the MUSCLE_Send and MUSCLE_Receive of muscle2-trace.c see
+ * them, with the conduit of each call.
+ *
+ * A submodel receives on its input conduits, computes, then sends on its
+ * output conduits. A new iteration starts with a receive on a conduit that
+ * has already received in the current iteration, with a send since, so
+ * several receives on one conduit before a send, and sends between the
+ * receives of different conduits, stay in one iteration.
+ */
+
+#ifndef MUSCLE2_ITERATIONS_H
+#define MUSCLE2_ITERATIONS_H
+
+#include <stdint.h>
+
+/*! Conduits beyond this many share the last one's state */
+#define MUSCLE2_ITERATION_CONDUITS 256
+
+/*! The kinds of call fed to the detector */
+enum { MUSCLE2_ITERATION_SEND, MUSCLE2_ITERATION_RECEIVE };
+
+/*! The totals over the iterations completed so far */
+struct muscle2_iteration_totals {
+    uint64_t iterations;
+    //> From the start of the first receive of each iteration to the start of the first receive of the next
+    uint64_t durationNs;
+    //> In the receives and sends of those iterations
+    uint64_t receiveNs;
+    uint64_t sendNs;
+};
+
+struct muscle2_iterations {
+    //> Odd while the totals are being written, so a reader can tell it saw half an update
+    uint32_t seq;
+    struct muscle2_iteration_totals totals;
+    //> The calls fed so far, the number of the last send, and of the last receive on each conduit
+    uint64_t calls;
+    uint64_t lastSend;
+    uint64_t lastReceive[MUSCLE2_ITERATION_CONDUITS];
+    //> The iteration (from 1) each conduit last received in, or 0 if it has not received yet
+    uint64_t receivedIn[MUSCLE2_ITERATION_CONDUITS];
+    //> The current iteration: its number (0 before the first receive), start, and time in calls so far
+    uint64_t current;
+    uint64_t currentStartNs;
+    uint64_t currentReceiveNs;
+    uint64_t currentSendNs;
+};
+
+/** Forgets every call and iteration */
+void muscle2_iterations_reset(struct muscle2_iterations *detector);
+
+/**
+ * Feeds one call that has returned to the detector. Calls must be fed one at a time, in the order they started.
+ * @param kind MUSCLE2_ITERATION_SEND or MUSCLE2_ITERATION_RECEIVE
+ */
+void muscle2_iterations_call(struct muscle2_iterations *detector, int kind, uint32_t conduit, uint64_t start_ns,
+                             uint64_t end_ns);
+
+/**
+ * Copies the totals of the completed iterations without waiting, so it may be called from a signal handler, even one
+ * that interrupted muscle2_iterations_call.
+ * @return 0 on success, or -1 if the totals were being written on every try
+ */
+int muscle2_iterations_read(const struct muscle2_iterations *detector, struct muscle2_iteration_totals *totals);
+
+#endif
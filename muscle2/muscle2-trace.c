@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Traces every MUSCLE2 send and receive of the process: when it started, how
+ * long it took, the bytes and the conduit.
+ *
+ * The library defines MUSCLE_Send and MUSCLE_Receive, which time the call and
+ * call the next definition, MUSCLE2's own, so it must be preloaded into the
+ * program (see README.md). The bytes are the change in the MUSCLE2 size
+ * counters over the call, so calls made by several threads at once may swap
+ * their sizes. The calls are also fed to the iteration detector of
+ * muscle2-iterations.h while the plugin reports iterations.
+ *
+ * A call reserves a record in a ring by compare and swap on the head, fills
+ * it in and marks it done with its sequence number, so any number of threads
+ * can record without a lock. A thread of the plugin writes the done records
+ * out in order every MUSCLE2_TRACE_FLUSH_MS. If the ring is full the record is
+ * dropped and counted rather than making the program wait.
+ */
+
+#define _GNU_SOURCE
+
+#include "muscle2-trace.h"
+#include "muscle2-iterations.h"
+#include "muscle2_trace.h"
+#include "cmuscle.h"
+#include "mpi_rank.h"
+#include "muscle_perf.h"
+#include "telemetry.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//> Conduits beyond this many are recorded as the last, "(other conduits)"
+#define MAX_CONDUITS 256
+#define OTHER_CONDUITS (MAX_CONDUITS - 1)
+
+struct ring_slot {
+    //> The position of the record plus 1 once it is filled in, so a slot from the last lap does not look done
+    uint64_t seq;
+    struct muscle2_trace_record record;
+};
+
+static struct ring_slot ring[MUSCLE2_TRACE_RING_SIZE];
+//> Records are reserved at head by the calls and written out from tail by the thread
+static uint64_t ring_head __attribute__((aligned(64)));
+static uint64_t ring_tail __attribute__((aligned(64)));
+static uint64_t dropped;
+
+//> 1 while the calls should be recorded
+static int tracing;
+
+//> The detector the calls are fed to, or NULL. Calls from several threads are fed one at a time
+static struct muscle2_iterations *iterations;
+static pthread_mutex_t iterations_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char conduit_names[MAX_CONDUITS][MUSCLE2_TRACE_NAME_SIZE];
+//> The conduits named so far, published after the name is written so a lookup never sees half a name
+static uint32_t num_conduits;
+static pthread_mutex_t conduit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//> The MUSCLE2 kernel name, read at the first call, when MUSCLE2 is sure to be initialised
+static char kernel_name[MUSCLE2_TRACE_NAME_SIZE];
+static pthread_once_t kernel_name_once = PTHREAD_ONCE_INIT;
+
+static FILE *trace_file;
+static struct muscle2_trace_header header;
+static pthread_t writer;
+static int writer_stop;
+//> Whether the thread has written the conduit record of each conduit yet. Only used by the thread
+static unsigned char conduit_written[MAX_CONDUITS];
+
+//> The next definitions of the functions, MUSCLE2's own
+static muscle_error_t (*real_send)(const char *, void *, int, muscle_datatype_t);
+static void *(*real_receive)(const char *, void *, int *, muscle_datatype_t);
+
+__attribute__((constructor)) static void find_real_functions(void) {
+    real_send = (muscle_error_t (*)(const char *, void *, int, muscle_datatype_t)) dlsym(RTLD_NEXT, "MUSCLE_Send");
+    real_receive = (void *(*)(const char *, void *, int *, muscle_datatype_t)) dlsym(RTLD_NEXT, "MUSCLE_Receive");
+}
+
+static uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t size_counter(muscle_perf_counter_t counter) {
+    uint64_t value;
+    return MUSCLE_Perf_Get_Counter(counter, &value) == 0 ? value : 0;
+}
+
+static void read_kernel_name(void) {
+    const char *name = MUSCLE_Get_Kernel_Name();
+    if (name != NULL)
+        snprintf(kernel_name, sizeof(kernel_name), "%s", name);
+}
+
+/**
+ * Returns the number of the conduit with the given name, numbering it if it is new. Names are compared as truncated
+ */
+static uint32_t conduit_id(const char *name) {
+    uint32_t count = __atomic_load_n(&num_conduits, __ATOMIC_ACQUIRE);
+    for (uint32_t c = 0; c < count; ++c) {
+        if (strncmp(conduit_names[c], name, MUSCLE2_TRACE_NAME_SIZE - 1) == 0)
+            return c;
+    }
+    pthread_mutex_lock(&conduit_lock);
+    count = num_conduits;
+    uint32_t id = OTHER_CONDUITS;
+    for (uint32_t c = 0; c < count; ++c) {
+        if (strncmp(conduit_names[c], name, MUSCLE2_TRACE_NAME_SIZE - 1) == 0) {
+            id = c;
+            break;
+        }
+    }
+    if (id == OTHER_CONDUITS && count < OTHER_CONDUITS) {
+        snprintf(conduit_names[count], MUSCLE2_TRACE_NAME_SIZE, "%s", name);
+        __atomic_store_n(&num_conduits, count + 1, __ATOMIC_RELEASE);
+        id = count;
+    }
+    pthread_mutex_unlock(&conduit_lock);
+    return id;
+}
+
+static void record_call(uint32_t kind, const char *conduit, uint64_t start_ns, uint64_t end_ns, uint64_t bytes) {
+    pthread_once(&kernel_name_once, read_kernel_name);
+    uint64_t head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+    do {
+        if (head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) >= MUSCLE2_TRACE_RING_SIZE) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&ring_head, &head, head + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    struct ring_slot *slot = &ring[head & (MUSCLE2_TRACE_RING_SIZE - 1)];
+    slot->record.startNs = start_ns;
+    slot->record.durationNs = end_ns - start_ns;
+    slot->record.bytes = bytes;
+    slot->record.conduit = conduit_id(conduit != NULL ? conduit : "");
+    slot->record.kind = kind;
+    __atomic_store_n(&slot->seq, head + 1, __ATOMIC_RELEASE);
+}
+
+static void feed_iterations(int kind, const char *conduit, uint64_t start_ns, uint64_t end_ns) {
+    pthread_mutex_lock(&iterations_lock);
+    if (iterations != NULL)
+        muscle2_iterations_call(iterations, kind, conduit_id(conduit != NULL ? conduit : ""), start_ns, end_ns);
+    pthread_mutex_unlock(&iterations_lock);
+}
+
+muscle_error_t MUSCLE_Send(const char *exit_name, void *array, int size, muscle_datatype_t type) {
+    const int is_tracing = __atomic_load_n(&tracing, __ATOMIC_RELAXED);
+    const int is_counting = __atomic_load_n(&iterations, __ATOMIC_RELAXED) != NULL;
+    if (!is_tracing && !is_counting)
+        return real_send(exit_name, array, size, type);
+    const uint64_t bytes = is_tracing ? size_counter(MUSCLE_PERF_COUNTER_SEND_SIZE) : 0;
+    const uint64_t start_ns = realtime_ns();
+    const muscle_error_t ret = real_send(exit_name, array, size, type);
+    const uint64_t end_ns = realtime_ns();
+    if (is_tracing) {
+        record_call(MUSCLE2_TRACE_SEND, exit_name, start_ns, end_ns,
+                    size_counter(MUSCLE_PERF_COUNTER_SEND_SIZE) - bytes);
+    }
+    if (is_counting)
+        feed_iterations(MUSCLE2_ITERATION_SEND, exit_name, start_ns, end_ns);
+    return ret;
+}
+
+void *MUSCLE_Receive(const char *entrance_name, void *array, int *size, muscle_datatype_t type) {
+    const int is_tracing = __atomic_load_n(&tracing, __ATOMIC_RELAXED);
+    const int is_counting = __atomic_load_n(&iterations, __ATOMIC_RELAXED) != NULL;
+    if (!is_tracing && !is_counting)
+        return real_receive(entrance_name, array, size, type);
+    const uint64_t bytes = is_tracing ? size_counter(MUSCLE_PERF_COUNTER_RECEIVE_SIZE) : 0;
+    const uint64_t start_ns = realtime_ns();
+    void *ret = real_receive(entrance_name, array, size, type);
+    const uint64_t end_ns = realtime_ns();
+    if (is_tracing) {
+        record_call(MUSCLE2_TRACE_RECEIVE, entrance_name, start_ns, end_ns,
+                    size_counter(MUSCLE_PERF_COUNTER_RECEIVE_SIZE) - bytes);
+    }
+    if (is_counting)
+        feed_iterations(MUSCLE2_ITERATION_RECEIVE, entrance_name, start_ns, end_ns);
+    return ret;
+}
+
+/**
+ * Writes out the done records from the tail, each new conduit's name first. Only called by one thread at a time
+ * @return the records written
+ */
+static uint64_t write_records(void) {
+    uint64_t tail = ring_tail;
+    const uint64_t start = tail;
+    for (;;) {
+        struct ring_slot *slot = &ring[tail & (MUSCLE2_TRACE_RING_SIZE - 1)];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != tail + 1)
+            break;
+        const struct muscle2_trace_record record = slot->record;
+        if (!conduit_written[record.conduit]) {
+            struct muscle2_trace_record named = { 0, 0, 0, record.conduit, MUSCLE2_TRACE_CONDUIT };
+            fwrite(&named, sizeof(named), 1, trace_file);
+            fwrite(conduit_names[record.conduit], MUSCLE2_TRACE_NAME_SIZE, 1, trace_file);
+            conduit_written[record.conduit] = 1;
+        }
+        fwrite(&record, sizeof(record), 1, trace_file);
+        ++tail;
+        // Hand the slots back in batches, so the calls do not contend with the thread for the line
+        if ((tail & 255) == 0)
+            __atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+    return tail - start;
+}
+
+static void *writer_thread(void *arg) {
+    const struct timespec period = { 0, MUSCLE2_TRACE_FLUSH_MS * 1000000L };
+    while (!__atomic_load_n(&writer_stop, __ATOMIC_RELAXED)) {
+        if (write_records() > 0)
+            fflush(trace_file);
+        nanosleep(&period, NULL);
+    }
+    return NULL;
+}
+
+int muscle2_trace_interposed(void) {
+    Dl_info called, here;
+    void *called_send = dlsym(RTLD_DEFAULT, "MUSCLE_Send");
+    return called_send != NULL && dladdr(called_send, &called) != 0 && dladdr((void *) &record_call, &here) != 0 &&
+        called.dli_fbase == here.dli_fbase;
+}
+
+int muscle2_trace_iterations(struct muscle2_iterations *detector) {
+    if (detector != NULL && (real_send == NULL || real_receive == NULL || !muscle2_trace_interposed()))
+        return -1;
+    pthread_mutex_lock(&iterations_lock);
+    __atomic_store_n(&iterations, detector, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&iterations_lock);
+    return 0;
+}
+
+int muscle2_trace_start(const char *dir) {
+    if (real_send == NULL || real_receive == NULL)
+        return -1;
+    memset(&header, 0, sizeof(header));
+    header.version = MUSCLE2_TRACE_VERSION;
+    header.pid = (int32_t) getpid();
+    header.rank = mpi_rank();
+    gethostname(header.host, sizeof(header.host) - 1);
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/muscle2-%s-%d.trace", dir, header.host, (int) header.pid);
+    trace_file = fopen(path, "wb");
+    if (trace_file == NULL) {
+        fprintf(stderr, "MUSCLE2 plugin: cannot write the trace %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    // The header is written again with the magic when the trace is closed
+    fwrite(&header, sizeof(header), 1, trace_file);
+
+    memset(conduit_names, 0, sizeof(conduit_names));
+    snprintf(conduit_names[OTHER_CONDUITS], MUSCLE2_TRACE_NAME_SIZE, "(other conduits)");
+    memset(conduit_written, 0, sizeof(conduit_written));
+    num_conduits = 0;
+    dropped = 0;
+    writer_stop = 0;
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    const int ret = pthread_create(&writer, NULL, writer_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (ret != 0) {
+        fclose(trace_file);
+        trace_file = NULL;
+        return -1;
+    }
+    __atomic_store_n(&tracing, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void muscle2_trace_stop(void) {
+    if (trace_file == NULL)
+        return;
+    __atomic_store_n(&tracing, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&writer_stop, 1, __ATOMIC_RELAXED);
+    pthread_join(writer, NULL);
+    write_records();
+
+    header.magic = MUSCLE2_TRACE_MAGIC;
+    header.dropped = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    const char *name = kernel_name[0] != '\0' ? kernel_name : program_invocation_short_name;
+    snprintf(header.program, sizeof(header.program), "%s", name);
+    if (fseek(trace_file, 0, SEEK_SET) == 0)
+        fwrite(&header, sizeof(header), 1, trace_file);
+    fclose(trace_file);
+    trace_file = NULL;
+    if (header.dropped > 0)
+        fprintf(stderr, "MUSCLE2 plugin: %" PRIu64 " calls were not traced because the ring was full\n",
+                header.dropped);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The message trace of the process: every MUSCLE2 send and receive, written
+ * to a file in the format of ../common/muscle2_trace.h by the MUSCLE_Send and
+ * MUSCLE_Receive that muscle2-trace.c defines when libmuscle2.so is preloaded.
+ */
+
+#ifndef MUSCLE2_TRACE_PLUGIN_H
+#define MUSCLE2_TRACE_PLUGIN_H
+
+/*! Records in the ring between the calls and the thread that writes them, a power of 2. */
+#define MUSCLE2_TRACE_RING_SIZE 65536
+
+/*! How often the thread writes the records out. The ring holds 6.5 ms of calls at 10 million a second. */
+#define MUSCLE2_TRACE_FLUSH_MS 5
+
+/** Returns 1 if the MUSCLE_Send and MUSCLE_Receive of muscle2-trace.c are the ones the program calls, else 0 */
+int muscle2_trace_interposed(void);
+
+struct muscle2_iterations;
+
+/**
+ * Feeds every send and receive to the iteration detector of muscle2-iterations.h from now on, or to none if NULL.
+ * @return 0 on success, or -1 if the calls are not interposed
+ */
+int muscle2_trace_iterations(struct muscle2_iterations *detector);
+
+/**
+ * Starts tracing to dir/muscle2-<host>-<pid>.trace, with a thread that writes the records.
+ * @return 0 on success, or -1 if the file or thread could not be created
+ */
+int muscle2_trace_start(const char *dir);
+
+/** Stops the thread, writes the records that are left and closes the file */
+void muscle2_trace_stop(void);
+
+#endif
@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * OpenMP runtime metrics: load imbalance, time waiting in barriers and
+ * taskwaits, time in serial code and the number of threads doing OpenMP work.
+ *
+ * The library is also an OMPT tool. The OpenMP runtime calls ompt_start_tool
+ * when it starts, and then calls back into the library as each thread moves
+ * between parallel work, barrier waits, taskwaits and serial code. Each thread
+ * adds the time it spent in its last state to its own accumulators, which
+ * are aligned to cache lines so that threads never share one, using relaxed
+ * atomic stores that the sampler reads with relaxed atomic loads. The
+ * callbacks take no locks and do not allocate, and the sampler only reads.
+ */
+
+#define _GNU_SOURCE
+
+#include "allinea_metric_plugin_api.h"
+#include "ompt.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/*! Threads beyond this many are not measured. */
+#define MAX_THREADS 1024
+
+/*! Parallel regions nested deeper than this are counted as part of the region they are nested in. */
+#define MAX_DEPTH 4
+
+/*! How many recent parallel regions have their end times kept. */
+#define MAX_REGIONS 256
+
+/*! What a thread is doing, as far as the OpenMP runtime has told us. */
+enum thread_state {
+    STATE_IDLE,     /*!< A worker thread outside any parallel region */
+    STATE_WORK,     /*!< Running an implicit or explicit task in a parallel region */
+    STATE_BARRIER,  /*!< Waiting in a barrier, including the implicit ones at the end of constructs */
+    STATE_TASKWAIT, /*!< Waiting in a taskwait or at the end of a taskgroup */
+    STATE_SERIAL,   /*!< The initial thread outside any parallel region */
+    NUM_STATES
+};
+
+/*! The time a thread has spent in each state, written only by that thread. */
+struct thread_times {
+    uint64_t ns[NUM_STATES];
+    /*! When the thread entered its current state, in ns since an arbitrary point. */
+    uint64_t since;
+    /*! The parallel region whose implicit barrier at the end the thread is waiting in, or 0. */
+    uint64_t waitRegion;
+    uint32_t state;
+    /*! The state to go back to when the outermost barrier or taskwait ends. */
+    uint8_t waitResumeState;
+    /*! The state to go back to when an explicit task is switched out. */
+    uint8_t taskResumeState;
+    /*! How many implicit tasks, i.e. nested parallel regions, the thread is in. */
+    uint8_t depth;
+    /*! How many barriers or taskwaits the thread is waiting in. */
+    uint8_t waitDepth;
+    uint32_t initial;
+    /*! The parallel region of each implicit task the thread is in, and of the last one it left. */
+    uint64_t regions[MAX_DEPTH];
+    uint64_t lastRegion;
+} __attribute__((aligned(64)));
+
+/*! The accumulators of each thread, in the order the threads started. */
+static struct thread_times threadTimes[MAX_THREADS];
+
+/*! How many entries of \a threadTimes have been handed out, which may be more than \a MAX_THREADS. */
+static uint32_t numThreads = 0;
+
+/*! The accumulators of the calling thread, or NULL if it has not been seen yet or there were too many threads. */
+static __thread struct thread_times *myTimes;
+
+/*! The ids of recent parallel regions, and when they ended or 0 if they have not, indexed by id modulo \a MAX_REGIONS. */
+static uint64_t regionIds[MAX_REGIONS];
+static uint64_t regionEndNs[MAX_REGIONS];
+
+/*! The id of the last parallel region to start. Ids start from 1. */
+static uint64_t numRegions = 0;
+
+/*! Marks the task data of explicit tasks, so that the switches to and from them can be told apart. */
+#define EXPLICIT_TASK 1
+
+/*! The totals of each thread at the last sample, so that each sample reports the time since the last. */
+static uint64_t lastTotals[MAX_THREADS][NUM_STATES];
+
+/*! When the last sample was taken, in the clock of \a now_ns. */
+static uint64_t lastSampleNs;
+
+/*! The maximum work of a thread divided by the mean over the threads in parallel regions this sample. */
+static double imbalanceLastSample;
+
+/*! The percentage of the time of the threads in parallel regions spent waiting in barriers this sample. */
+static double barrierFractionLastSample;
+
+/*! The percentage of the time of the threads in parallel regions spent waiting in taskwaits this sample. */
+static double taskwaitFractionLastSample;
+
+/*! The percentage of this sample the initial thread spent outside parallel regions. */
+static double serialFractionLastSample;
+
+/*! The mean number of threads working, waiting or in serial code this sample. */
+static double activeThreadsLastSample;
+
+/*! Time of the last sample. */
+/*!
+ *  If the time of the current sample is different from the time of the last
+ *  then we assume it is a new sample and we need to recalculate the metrics.
+ */
+static struct timespec lastSampleTime;
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+/*! Returns the accumulators of the calling thread, handing out new ones to a thread not seen before. */
+static struct thread_times *get_thread_times(ompt_thread_t threadType)
+{
+    if (myTimes != NULL)
+        return myTimes;
+    uint32_t index = __atomic_fetch_add(&numThreads, 1, __ATOMIC_RELAXED);
+    if (index >= MAX_THREADS)
+        return NULL;
+    struct thread_times *times = &threadTimes[index];
+    times->initial = threadType == ompt_thread_initial;
+    __atomic_store_n(&times->since, now_ns(), __ATOMIC_RELAXED);
+    __atomic_store_n(&times->state, times->initial ? STATE_SERIAL : STATE_IDLE, __ATOMIC_RELAXED);
+    myTimes = times;
+    return times;
+}
+
+/*! Returns when the parallel region \a region ended, or 0 if it has not ended or is not known. */
+static uint64_t region_end_ns(uint64_t region)
+{
+    if (region == 0)
+        return 0;
+    const uint64_t id = __atomic_load_n(&regionIds[region % MAX_REGIONS], __ATOMIC_ACQUIRE);
+    /* Replaced by a later region, so it ended long ago */
+    if (id > region)
+        return 1;
+    return id == region ? __atomic_load_n(&regionEndNs[region % MAX_REGIONS], __ATOMIC_ACQUIRE) : 0;
+}
+
+/*! Returns when a thread in \a state since \a since stopped being in it, for the time up to \a now. */
+/*!
+ *  A worker thread waiting in the implicit barrier at the end of a parallel
+ *  region is not told that the wait is over until the next region starts, so
+ *  the wait is taken to be over when the region ended.
+ */
+static uint64_t state_end_ns(uint32_t state, uint64_t since, uint64_t waitRegion, uint64_t now)
+{
+    if (state != STATE_BARRIER)
+        return now;
+    const uint64_t end = region_end_ns(waitRegion);
+    if (end == 0 || end >= now)
+        return now;
+    return end > since ? end : since;
+}
+
+/*! Adds the time since the last change of state to the old state, and moves the thread to \a state. */
+static void enter_state(struct thread_times *times, uint32_t state)
+{
+    const uint64_t now = now_ns();
+    const uint32_t old = times->state;
+    const uint64_t end = state_end_ns(old, times->since, times->waitRegion, now);
+    __atomic_store_n(&times->ns[old], times->ns[old] + (end - times->since), __ATOMIC_RELAXED);
+    __atomic_store_n(&times->ns[STATE_IDLE], times->ns[STATE_IDLE] + (now - end), __ATOMIC_RELAXED);
+    __atomic_store_n(&times->since, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&times->state, state, __ATOMIC_RELAXED);
+}
+
+/*! The state of a thread outside the current implicit task. */
+static uint32_t outside_state(const struct thread_times *times)
+{
+    if (times->depth > 0)
+        return STATE_WORK;
+    return times->initial ? STATE_SERIAL : STATE_IDLE;
+}
+
+static void on_thread_begin(ompt_thread_t threadType, ompt_data_t *threadData)
+{
+    (void) threadData; /* unused variable */
+    get_thread_times(threadType);
+}
+
+static void on_thread_end(ompt_data_t *threadData)
+{
+    (void) threadData; /* unused variable */
+    struct thread_times *times = get_thread_times(ompt_thread_worker);
+    if (times != NULL)
+        enter_state(times, STATE_IDLE);
+}
+
+static void on_parallel_begin(ompt_data_t *encounteringTaskData, const ompt_frame_t *encounteringTaskFrame,
+                              ompt_data_t *parallelData, unsigned int requestedParallelism, int flags, const void *codeptr)
+{
+    (void) encounteringTaskData; /* unused variable */
+    (void) encounteringTaskFrame; /* unused variable */
+    (void) requestedParallelism; /* unused variable */
+    (void) flags; /* unused variable */
+    (void) codeptr; /* unused variable */
+
+    const uint64_t region = __atomic_add_fetch(&numRegions, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&regionEndNs[region % MAX_REGIONS], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&regionIds[region % MAX_REGIONS], region, __ATOMIC_RELEASE);
+    parallelData->value = region;
+}
+
+static void on_parallel_end(ompt_data_t *parallelData, ompt_data_t *encounteringTaskData, int flags, const void *codeptr)
+{
+    (void) encounteringTaskData; /* unused variable */
+    (void) flags; /* unused variable */
+    (void) codeptr; /* unused variable */
+
+    const uint64_t region = parallelData->value;
+    if (region != 0)
+        __atomic_store_n(&regionEndNs[region % MAX_REGIONS], now_ns(), __ATOMIC_RELEASE);
+}
+
+static void on_implicit_task(ompt_scope_endpoint_t endpoint, ompt_data_t *parallelData, ompt_data_t *taskData,
+                             unsigned int actualParallelism, unsigned int index, int flags)
+{
+    (void) taskData; /* unused variable */
+    (void) actualParallelism; /* unused variable */
+    (void) index; /* unused variable */
+
+    /* The initial task is the serial code of the program, not a parallel region */
+    if (flags & ompt_task_initial)
+        return;
+    struct thread_times *times = get_thread_times(ompt_thread_worker);
+    if (times == NULL)
+        return;
+    if (endpoint == ompt_scope_begin) {
+        if (times->depth < MAX_DEPTH)
+            times->regions[times->depth] = parallelData != NULL ? parallelData->value : 0;
+        times->depth++;
+        enter_state(times, STATE_WORK);
+    } else if (times->depth > 0) {
+        times->depth--;
+        times->lastRegion = times->depth < MAX_DEPTH ? times->regions[times->depth] : 0;
+        /* Some runtimes end the implicit task before the implicit barrier wait at the end of the region */
+        if (times->waitDepth > 0)
+            times->waitResumeState = outside_state(times);
+        else
+            enter_state(times, outside_state(times));
+    }
+}
+
+static void on_sync_region_wait(ompt_sync_region_t kind, ompt_scope_endpoint_t endpoint, ompt_data_t *parallelData,
+                                ompt_data_t *taskData, const void *codeptr)
+{
+    (void) parallelData; /* unused variable */
+    (void) taskData; /* unused variable */
+    (void) codeptr; /* unused variable */
+
+    struct thread_times *times = get_thread_times(ompt_thread_worker);
+    if (times == NULL)
+        return;
+    if (endpoint == ompt_scope_begin) {
+        if (times->waitDepth++ == 0)
+            times->waitResumeState = (uint8_t) times->state;
+        uint64_t region = 0;
+        if (kind == ompt_sync_region_barrier_implicit || kind == ompt_sync_region_barrier_implicit_parallel) {
+            if (times->depth == 0)
+                region = times->lastRegion;
+            else if (times->depth <= MAX_DEPTH)
+                region = times->regions[times->depth - 1];
+        }
+        __atomic_store_n(&times->waitRegion, region, __ATOMIC_RELAXED);
+        const int taskwait = kind == ompt_sync_region_taskwait || kind == ompt_sync_region_taskgroup;
+        enter_state(times, taskwait ? STATE_TASKWAIT : STATE_BARRIER);
+    } else if (times->waitDepth > 0 && --times->waitDepth == 0) {
+        enter_state(times, times->waitResumeState);
+    }
+}
+
+static void on_task_create(ompt_data_t *encounteringTaskData, const ompt_frame_t *encounteringTaskFrame,
+                           ompt_data_t *newTaskData, int flags, int hasDependences, const void *codeptr)
+{
+    (void) encounteringTaskData; /* unused variable */
+    (void) encounteringTaskFrame; /* unused variable */
+    (void) hasDependences; /* unused variable */
+    (void) codeptr; /* unused variable */
+
+    newTaskData->value = (flags & ompt_task_explicit) ? EXPLICIT_TASK : 0;
+}
+
+/*! Counts the time a thread spends running explicit tasks as work, even when it runs them while waiting in a barrier or taskwait. */
+static void on_task_schedule(ompt_data_t *priorTaskData, ompt_task_status_t priorTaskStatus, ompt_data_t *nextTaskData)
+{
+    (void) priorTaskStatus; /* unused variable */
+
+    struct thread_times *times = get_thread_times(ompt_thread_worker);
+    if (times == NULL)
+        return;
+    const int fromExplicit = priorTaskData != NULL && priorTaskData->value == EXPLICIT_TASK;
+    const int toExplicit = nextTaskData != NULL && nextTaskData->value == EXPLICIT_TASK;
+    if (toExplicit && !fromExplicit) {
+        times->taskResumeState = (uint8_t) times->state;
+        enter_state(times, STATE_WORK);
+    } else if (fromExplicit && !toExplicit) {
+        enter_state(times, times->taskResumeState);
+    }
+}
+
+static int ompt_initialize(ompt_function_lookup_t lookup, int initialDeviceNum, ompt_data_t *toolData)
+{
+    (void) initialDeviceNum; /* unused variable */
+    (void) toolData; /* unused variable */
+
+    ompt_set_callback_t setCallback = (ompt_set_callback_t) lookup("ompt_set_callback");
+    if (setCallback == NULL)
+        return 0;
+    setCallback(ompt_callback_thread_begin, (ompt_callback_t) on_thread_begin);
+    setCallback(ompt_callback_thread_end, (ompt_callback_t) on_thread_end);
+    setCallback(ompt_callback_parallel_begin, (ompt_callback_t) on_parallel_begin);
+    setCallback(ompt_callback_parallel_end, (ompt_callback_t) on_parallel_end);
+    setCallback(ompt_callback_implicit_task, (ompt_callback_t) on_implicit_task);
+    setCallback(ompt_callback_sync_region_wait, (ompt_callback_t) on_sync_region_wait);
+    setCallback(ompt_callback_task_create, (ompt_callback_t) on_task_create);
+    setCallback(ompt_callback_task_schedule, (ompt_callback_t) on_task_schedule);
+    /* Non-zero keeps the tool active */
+    return 1;
+}
+
+static void ompt_finalize(ompt_data_t *toolData)
+{
+    (void) toolData; /* unused variable */
+}
+
+ompt_start_tool_result_t *ompt_start_tool(unsigned int ompVersion, const char *runtimeVersion)
+{
+    (void) ompVersion; /* unused variable */
+    (void) runtimeVersion; /* unused variable */
+
+    static ompt_start_tool_result_t result = { ompt_initialize, ompt_finalize, { 0 } };
+    return &result;
+}
+
+/*! Reads the totals of a thread, including the time so far in its current state. */
+static void read_thread_times(const struct thread_times *times, uint64_t now, uint64_t *totals)
+{
+    for (int state = 0; state < NUM_STATES; ++state)
+        totals[state] = __atomic_load_n(&times->ns[state], __ATOMIC_RELAXED);
+    const uint32_t state = __atomic_load_n(&times->state, __ATOMIC_RELAXED);
+    const uint64_t since = __atomic_load_n(&times->since, __ATOMIC_RELAXED);
+    const uint64_t waitRegion = __atomic_load_n(&times->waitRegion, __ATOMIC_RELAXED);
+    /* The thread may be part way through changing state, which the next sample makes up for */
+    if (state < NUM_STATES && now > since)
+        totals[state] += state_end_ns(state, since, waitRegion, now) - since;
+}
+
+/*! Called once per sample to calculate the metrics from the accumulators of every thread. */
+static void update(void)
+{
+    const uint64_t now = now_ns();
+    const uint64_t elapsed = now - lastSampleNs;
+    lastSampleNs = now;
+
+    uint32_t count = __atomic_load_n(&numThreads, __ATOMIC_RELAXED);
+    if (count > MAX_THREADS)
+        count = MAX_THREADS;
+
+    uint64_t sum[NUM_STATES] = { 0 };
+    uint64_t maxWork = 0;
+    uint32_t parallelThreads = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t totals[NUM_STATES];
+        uint64_t delta[NUM_STATES];
+        read_thread_times(&threadTimes[i], now, totals);
+        for (int state = 0; state < NUM_STATES; ++state) {
+            /* A total read part way through a change of state can be ahead of the next one */
+            if (totals[state] > lastTotals[i][state]) {
+                delta[state] = totals[state] - lastTotals[i][state];
+                lastTotals[i][state] = totals[state];
+            } else {
+                delta[state] = 0;
+            }
+            sum[state] += delta[state];
+        }
+        if (delta[STATE_WORK] + delta[STATE_BARRIER] + delta[STATE_TASKWAIT] > 0)
+            parallelThreads++;
+        if (delta[STATE_WORK] > maxWork)
+            maxWork = delta[STATE_WORK];
+    }
+
+    const uint64_t parallel = sum[STATE_WORK] + sum[STATE_BARRIER] + sum[STATE_TASKWAIT];
+    imbalanceLastSample = sum[STATE_WORK] == 0 ? 0.0 :
+        (double) maxWork * parallelThreads / (double) sum[STATE_WORK];
+    barrierFractionLastSample = parallel == 0 ? 0.0 : 100.0 * (double) sum[STATE_BARRIER] / (double) parallel;
+    taskwaitFractionLastSample = parallel == 0 ? 0.0 : 100.0 * (double) sum[STATE_TASKWAIT] / (double) parallel;
+    serialFractionLastSample = elapsed == 0 ? 0.0 : 100.0 * (double) sum[STATE_SERIAL] / (double) elapsed;
+    if (serialFractionLastSample > 100.0)
+        serialFractionLastSample = 100.0;
+    activeThreadsLastSample = elapsed == 0 ? 0.0 : (double) (parallel + sum[STATE_SERIAL]) / (double) elapsed;
+}
+
+/*! This function is called when the metric plugin is loaded. */
+/*!
+ *  We do not have to restrict ourselves to async-signal-safe functions because
+ *  the initialization function will be called without any locks held.
+ *
+ *  The OpenMP runtime may not have started yet, so it is not an error for the
+ *  tool not to be active: the metrics are 0 until it is.
+ *
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused)
+{
+    (void) plugin_id; /* unused variable */
+    (void) unused; /* unused variable */
+
+    /* Only the time from now on is reported */
+    uint32_t count = __atomic_load_n(&numThreads, __ATOMIC_RELAXED);
+    if (count > MAX_THREADS)
+        count = MAX_THREADS;
+    lastSampleNs = now_ns();
+    memset(lastTotals, 0, sizeof(lastTotals));
+    for (uint32_t i = 0; i < count; ++i)
+        read_thread_times(&threadTimes[i], lastSampleNs, lastTotals[i]);
+
+    lastSampleTime.tv_sec = 0;
+    lastSampleTime.tv_nsec = 0;
+    return 0;
+}
+
+/*! This function is called when the metric plugin is unloaded. */
+/*!
+ *  We do not have to restrict ourselves to async-signal-safe functions because
+ *  the cleanup function will be called without any locks held.
+ *
+ *  The tool stays registered with the OpenMP runtime, as OMPT has no way to
+ *  remove it, but nothing reads the accumulators any more.
+ *
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_cleanup(plugin_id_t plugin_id, void *unused)
+{
+    (void) plugin_id; /* unused variable */
+    (void) unused; /* unused variable */
+    return 0;
+}
+
+/*! Get the current value of the given metric. */
+/*!
+ *  \param metricId the ID of the metric to get the value for
+ *  \param inCurrentSampleTime [in] the time the metric was sampled
+ *  \param inValue pointer to where the metric is stored
+ *  \param outValue [out] value will be written here.
+ *
+ *  If this is a new sample (\a lastSampleTime != \a inCurrentsampleTime)
+ *  then \a update is called to recalculate the metrics.
+ */
+static int getMetricValue(metric_id_t metricId, const struct timespec *inCurrentSampleTime, double *inValue, double *outValue)
+{
+    (void) metricId; /* unused variable */
+
+    if (lastSampleTime.tv_sec  != inCurrentSampleTime->tv_sec ||
+        lastSampleTime.tv_nsec != inCurrentSampleTime->tv_nsec) {
+        lastSampleTime.tv_sec  = inCurrentSampleTime->tv_sec;
+        lastSampleTime.tv_nsec = inCurrentSampleTime->tv_nsec;
+        update();
+    }
+
+    *outValue = *inValue;
+
+    return 0;
+}
+
+int allinea_openmpImbalance(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &imbalanceLastSample, outValue);
+}
+
+int allinea_openmpBarrierFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &barrierFractionLastSample, outValue);
+}
+
+int allinea_openmpTaskwaitFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &taskwaitFractionLastSample, outValue);
+}
+
+int allinea_openmpSerialFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &serialFractionLastSample, outValue);
+}
+
+int allinea_openmpActiveThreads(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue)
+{
+    return getMetricValue(metricId, inOutCurrentSampleTime, &activeThreadsLastSample, outValue);
+}
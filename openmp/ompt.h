@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The parts of the OpenMP 5.0 tools interface (OMPT) used by the plugin.
+ *
+ * The types and values are those of omp-tools.h in the OpenMP specification,
+ * which is part of the ABI between a runtime and a tool. They are declared
+ * here because GCC does not install omp-tools.h, so the plugin builds with
+ * any compiler and works with any runtime that supports OMPT.
+ */
+
+#ifndef OMPT_H
+#define OMPT_H
+
+#include <stdint.h>
+
+typedef union ompt_data_t {
+    uint64_t value;
+    void *ptr;
+} ompt_data_t;
+
+typedef struct ompt_frame_t ompt_frame_t;
+
+typedef enum ompt_callbacks_t {
+    ompt_callback_thread_begin     = 1,
+    ompt_callback_thread_end       = 2,
+    ompt_callback_parallel_begin   = 3,
+    ompt_callback_parallel_end     = 4,
+    ompt_callback_task_create      = 5,
+    ompt_callback_task_schedule    = 6,
+    ompt_callback_implicit_task    = 7,
+    ompt_callback_sync_region_wait = 16
+} ompt_callbacks_t;
+
+typedef enum ompt_set_result_t {
+    ompt_set_error            = 0,
+    ompt_set_never            = 1,
+    ompt_set_impossible       = 2,
+    ompt_set_sometimes        = 3,
+    ompt_set_sometimes_paired = 4,
+    ompt_set_always           = 5
+} ompt_set_result_t;
+
+typedef enum ompt_thread_t {
+    ompt_thread_initial = 1,
+    ompt_thread_worker  = 2,
+    ompt_thread_other   = 3,
+    ompt_thread_unknown = 4
+} ompt_thread_t;
+
+typedef enum ompt_scope_endpoint_t {
+    ompt_scope_begin    = 1,
+    ompt_scope_end      = 2,
+    ompt_scope_beginend = 3
+} ompt_scope_endpoint_t;
+
+typedef enum ompt_sync_region_t {
+    ompt_sync_region_barrier                    = 1,
+    ompt_sync_region_barrier_implicit           = 2,
+    ompt_sync_region_barrier_explicit           = 3,
+    ompt_sync_region_barrier_implementation     = 4,
+    ompt_sync_region_taskwait                   = 5,
+    ompt_sync_region_taskgroup                  = 6,
+    ompt_sync_region_reduction                  = 7,
+    ompt_sync_region_barrier_implicit_workshare = 8,
+    ompt_sync_region_barrier_implicit_parallel  = 9,
+    ompt_sync_region_barrier_teams              = 10
+} ompt_sync_region_t;
+
+typedef enum ompt_task_flag_t {
+    ompt_task_initial  = 0x00000001,
+    ompt_task_implicit = 0x00000002,
+    ompt_task_explicit = 0x00000004,
+    ompt_task_target   = 0x00000008
+} ompt_task_flag_t;
+
+typedef enum ompt_task_status_t {
+    ompt_task_complete      = 1,
+    ompt_task_yield         = 2,
+    ompt_task_cancel        = 3,
+    ompt_task_detach        = 4,
+    ompt_task_early_fulfill = 5,
+    ompt_task_late_fulfill  = 6,
+    ompt_task_switch        = 7
+} ompt_task_status_t;
+
+typedef void (*ompt_interface_fn_t)(void);
+typedef ompt_interface_fn_t (*ompt_function_lookup_t)(const char *interface_function_name);
+
+typedef void (*ompt_callback_t)(void);
+typedef ompt_set_result_t (*ompt_set_callback_t)(ompt_callbacks_t event, ompt_callback_t callback);
+
+typedef int (*ompt_initialize_t)(ompt_function_lookup_t lookup, int initial_device_num, ompt_data_t *tool_data);
+typedef void (*ompt_finalize_t)(ompt_data_t *tool_data);
+
+typedef struct ompt_start_tool_result_t {
+    ompt_initialize_t initialize;
+    ompt_finalize_t finalize;
+    ompt_data_t tool_data;
+} ompt_start_tool_result_t;
+
+typedef void (*ompt_callback_thread_begin_t)(ompt_thread_t thread_type, ompt_data_t *thread_data);
+typedef void (*ompt_callback_thread_end_t)(ompt_data_t *thread_data);
+typedef void (*ompt_callback_parallel_begin_t)(ompt_data_t *encountering_task_data,
+                                               const ompt_frame_t *encountering_task_frame,
+                                               ompt_data_t *parallel_data, unsigned int requested_parallelism,
+                                               int flags, const void *codeptr_ra);
+typedef void (*ompt_callback_parallel_end_t)(ompt_data_t *parallel_data, ompt_data_t *encountering_task_data,
+                                             int flags, const void *codeptr_ra);
+typedef void (*ompt_callback_task_create_t)(ompt_data_t *encountering_task_data,
+                                            const ompt_frame_t *encountering_task_frame,
+                                            ompt_data_t *new_task_data, int flags,
+                                            int has_dependences, const void *codeptr_ra);
+typedef void (*ompt_callback_task_schedule_t)(ompt_data_t *prior_task_data,
+                                              ompt_task_status_t prior_task_status,
+                                              ompt_data_t *next_task_data);
+typedef void (*ompt_callback_implicit_task_t)(ompt_scope_endpoint_t endpoint, ompt_data_t *parallel_data,
+                                              ompt_data_t *task_data, unsigned int actual_parallelism,
+                                              unsigned int index, int flags);
+typedef void (*ompt_callback_sync_region_t)(ompt_sync_region_t kind, ompt_scope_endpoint_t endpoint,
+                                            ompt_data_t *parallel_data, ompt_data_t *task_data,
+                                            const void *codeptr_ra);
+
+/*! Called by the OpenMP runtime when it starts, to find out whether there is a tool. */
+ompt_start_tool_result_t *ompt_start_tool(unsigned int omp_version, const char *runtime_version);
+
+#endif /* OMPT_H */
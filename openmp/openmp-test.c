@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs an imbalanced parallel region, serial code and a taskwait under the
+ * plugin, with the plugin linked into the test so that the OpenMP runtime
+ * finds ompt_start_tool. The threads sleep rather than compute, so that the
+ * times do not depend on how many CPUs there are.
+ *
+ * The test is skipped if the OpenMP runtime does not support OMPT, like
+ * libgomp from GCC: link with LLVM's libomp to run it (see the Makefile).
+ */
+
+#include <omp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "allinea_metric_plugin_api.h"
+
+void allinea_set_plugin_error_messagef(plugin_id_t id, int error_code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void allinea_set_metric_error_messagef(metric_id_t id, int error_code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+extern int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused);
+extern int allinea_plugin_cleanup(plugin_id_t id, void *unused);
+extern int allinea_openmpImbalance(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_openmpBarrierFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_openmpTaskwaitFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_openmpSerialFraction(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+extern int allinea_openmpActiveThreads(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, double *outValue);
+
+#define NUM_THREADS 4
+
+struct sample {
+    double imbalance;
+    double barrierFraction;
+    double taskwaitFraction;
+    double serialFraction;
+    double activeThreads;
+};
+
+static struct sample take_sample(int seconds)
+{
+    struct timespec sampleTime = { seconds, 0 };
+    struct sample s;
+    if (allinea_openmpImbalance(1, &sampleTime, &s.imbalance) != 0 ||
+        allinea_openmpBarrierFraction(2, &sampleTime, &s.barrierFraction) != 0 ||
+        allinea_openmpTaskwaitFraction(3, &sampleTime, &s.taskwaitFraction) != 0 ||
+        allinea_openmpSerialFraction(4, &sampleTime, &s.serialFraction) != 0 ||
+        allinea_openmpActiveThreads(5, &sampleTime, &s.activeThreads) != 0) {
+        fprintf(stderr, "FAIL: sampling at %d s failed\n", seconds);
+        abort();
+    }
+    fprintf(stderr, "%d s: imbalance %.2f, barrier %.1f%%, taskwait %.1f%%, serial %.1f%%, active threads %.2f\n",
+           seconds, s.imbalance, s.barrierFraction, s.taskwaitFraction, s.serialFraction, s.activeThreads);
+    return s;
+}
+
+static void check_range(const char *what, double actual, double min, double max)
+{
+    if (actual < min || actual > max) {
+        fprintf(stderr, "FAIL: %s: expected %g to %g != actual %g\n", what, min, max, actual);
+        abort();
+    }
+}
+
+int main(void)
+{
+    int ret = allinea_plugin_initialize(1, NULL);
+    if (ret != 0) {
+        fprintf(stderr, "FAIL: allinea_plugin_initialize: failed with return value %d\n", ret);
+        abort();
+    }
+
+    /* Start the threads before the first sample */
+    #pragma omp parallel num_threads(NUM_THREADS)
+    {
+        usleep(1000);
+    }
+    take_sample(1);
+
+    /* Thread 0 works for 200 ms and the others for 50 ms, then wait for it in the implicit barrier */
+    #pragma omp parallel num_threads(NUM_THREADS)
+    {
+        usleep(omp_get_thread_num() == 0 ? 200000 : 50000);
+    }
+    struct sample s = take_sample(2);
+    if (s.activeThreads == 0.0) {
+        printf("SKIP: the OpenMP runtime does not support OMPT\n");
+        return 0;
+    }
+    /* max / mean = 200 / ((200 + 3 * 50) / 4) = 2.29, and the barrier is 3 * 150 / (4 * 200) = 56% */
+    check_range("imbalance", s.imbalance, 2.0, 2.6);
+    check_range("barrier fraction", s.barrierFraction, 45.0, 65.0);
+    check_range("taskwait fraction in a parallel region without tasks", s.taskwaitFraction, 0.0, 0.0);
+    check_range("active threads in a parallel region", s.activeThreads, 3.0, 4.5);
+
+    /* Serial code for 100 ms */
+    usleep(100000);
+    s = take_sample(3);
+    check_range("imbalance without a parallel region", s.imbalance, 0.0, 0.0);
+    check_range("barrier fraction without a parallel region", s.barrierFraction, 0.0, 0.0);
+    check_range("serial fraction", s.serialFraction, 90.0, 100.0);
+    check_range("active threads in serial code", s.activeThreads, 0.9, 1.1);
+
+    /*
+     * Each task sleeps for 200 ms. The thread that creates them sleeps for
+     * 100 ms first so that the others, waiting in the barrier at the end of
+     * the single, have taken all of them before it reaches the taskwait.
+     */
+    #pragma omp parallel num_threads(NUM_THREADS)
+    {
+        #pragma omp single
+        {
+            for (int i = 0; i < NUM_THREADS - 1; ++i) {
+                #pragma omp task
+                usleep(200000);
+            }
+            usleep(100000);
+            #pragma omp taskwait
+        }
+    }
+    s = take_sample(4);
+    /* 100 ms of the 4 * 200 ms is the taskwait. The tasks are work, not barrier time */
+    check_range("taskwait fraction", s.taskwaitFraction, 5.0, 20.0);
+    check_range("barrier fraction with tasks", s.barrierFraction, 0.0, 10.0);
+
+    allinea_plugin_cleanup(1, NULL);
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// The next include is required to create a custom metric for Arm MAP
+#include "allinea_metric_plugin_api.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <array>
+
+#define ONE_SECOND_NS      1000000000   // The number of nanoseconds in one second
+
+static const int ERROR = -1; // Returned by a function when there is an error
+
+///////////////////////////////////////////////////////////////////////////////
+// Operating system events that perturb the application: context switches, CPU
+// migrations and page faults. These are perf software events, counted by the
+// kernel, so they are available on any Linux machine including VMs.
+//
+// The events are opened as one group on the thread that initialises the
+// plugin, with inherit set so that the threads it creates are counted too, and
+// all of them are read with one read of the group leader per sample. Kernels
+// that do not allow an inherited group to be read together get one inherited
+// event per counter instead.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace PS { // PERF_SOFTWARE
+  enum EventInds {
+    CONTEXT_SWITCHES_IND=0,
+    CPU_MIGRATIONS_IND,
+    MINOR_FAULTS_IND,
+    MAJOR_FAULTS_IND,
+    ALIGNMENT_FAULTS_IND,
+    NUM_INDS
+  };
+  constexpr static std::array<std::uint64_t, EventInds::NUM_INDS>
+  gEventConfigs {
+    PERF_COUNT_SW_CONTEXT_SWITCHES,
+      PERF_COUNT_SW_CPU_MIGRATIONS,
+      PERF_COUNT_SW_PAGE_FAULTS_MIN,
+      PERF_COUNT_SW_PAGE_FAULTS_MAJ,
+      PERF_COUNT_SW_ALIGNMENT_FAULTS
+      };
+  // The group leader is the first fd. The other fds are only read when the
+  // events are not grouped
+  static std::array<int, EventInds::NUM_INDS> gEventFds;
+  static bool gGrouped= false;
+  // The counts at the last sample, and the increase since the one before
+  static std::array<std::uint64_t, EventInds::NUM_INDS> gEventTotals;
+  static std::array<std::uint64_t, EventInds::NUM_INDS> gEventValues;
+}
+
+// Forward declaration. Used so that in this section we can have all of the
+// functions that are required to report the data for MAP
+static int update_values(metric_id_t metric_id, const struct timespec* current_sample_time);
+
+extern "C" {
+
+/**
+ * Sets the number of context switches of the process since the last sample
+ *
+ * \param [in] metric_id Identifies the metric when reporting an error back to
+ *                       Arm MAP.
+ * \param [in] current_sample_time The time at which the sample is taken. The
+ *                                 same time is passed to all of the metric
+ *                                 functions for a sample, so the events are
+ *                                 only read once per sample.
+ * \param [out] out_value The number of events, which MAP divides by the
+ *                        length of the sample to give a rate.
+ */
+int perf_sw_context_switches(metric_id_t metric_id,
+        struct timespec *current_sample_time, uint64_t *out_value)
+{
+    if (update_values(metric_id, current_sample_time) != 0)
+      return ERROR;
+    *out_value= PS::gEventValues.at(PS::EventInds::CONTEXT_SWITCHES_IND);
+    return 0;
+}
+
+int perf_sw_cpu_migrations(metric_id_t metric_id,
+        struct timespec *current_sample_time, uint64_t *out_value)
+{
+    if (update_values(metric_id, current_sample_time) != 0)
+      return ERROR;
+    *out_value= PS::gEventValues.at(PS::EventInds::CPU_MIGRATIONS_IND);
+    return 0;
+}
+
+int perf_sw_minor_faults(metric_id_t metric_id,
+        struct timespec *current_sample_time, uint64_t *out_value)
+{
+    if (update_values(metric_id, current_sample_time) != 0)
+      return ERROR;
+    *out_value= PS::gEventValues.at(PS::EventInds::MINOR_FAULTS_IND);
+    return 0;
+}
+
+int perf_sw_major_faults(metric_id_t metric_id,
+        struct timespec *current_sample_time, uint64_t *out_value)
+{
+    if (update_values(metric_id, current_sample_time) != 0)
+      return ERROR;
+    *out_value= PS::gEventValues.at(PS::EventInds::MAJOR_FAULTS_IND);
+    return 0;
+}
+
+int perf_sw_alignment_faults(metric_id_t metric_id,
+        struct timespec *current_sample_time, uint64_t *out_value)
+{
+    if (update_values(metric_id, current_sample_time) != 0)
+      return ERROR;
+    *out_value= PS::gEventValues.at(PS::EventInds::ALIGNMENT_FAULTS_IND);
+    return 0;
+}
+
+} // extern "C"
+
+static int open_event(std::uint64_t config, int groupFd, bool grouped, bool excludeKernel)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size= sizeof(attr);
+  attr.type= PERF_TYPE_SOFTWARE;
+  attr.config= config;
+  attr.inherit= 1;
+  attr.exclude_kernel= excludeKernel;
+  attr.exclude_hv= 1;
+  if (grouped)
+    attr.read_format= PERF_FORMAT_GROUP;
+  // The group is enabled together once all of it has been added
+  attr.disabled= groupFd == -1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, PERF_FLAG_FD_CLOEXEC);
+}
+
+static void close_events()
+{
+  for (auto& fd : PS::gEventFds) {
+    if (fd != -1)
+      close(fd);
+    fd= -1;
+  }
+}
+
+/**
+ * Opens all of the events, grouped if grouped is true. Returns 0, or the errno
+ * of the event that could not be opened
+ */
+static int open_events(bool grouped, bool excludeKernel)
+{
+  using namespace PS;
+
+  gEventFds.fill(-1);
+  for (int i= 0; i < EventInds::NUM_INDS; ++i) {
+    const int groupFd= grouped && i > 0 ? gEventFds[0] : -1;
+    gEventFds[i]= open_event(gEventConfigs[i], groupFd, grouped, excludeKernel);
+    if (gEventFds[i] == -1) {
+      const int error= errno;
+      close_events();
+      return error;
+    }
+  }
+  return 0;
+}
+
+//! Reads the current totals of all of the events. Async-signal-safe
+static bool read_events(std::array<std::uint64_t, PS::EventInds::NUM_INDS>& totals)
+{
+  using namespace PS;
+
+  if (gGrouped) {
+    // The number of events, then the value of each in the order they were added
+    std::uint64_t buffer[1 + EventInds::NUM_INDS];
+    if (read(gEventFds[0], buffer, sizeof(buffer)) != sizeof(buffer) ||
+        buffer[0] != EventInds::NUM_INDS)
+      return false;
+    for (int i= 0; i < EventInds::NUM_INDS; ++i)
+      totals[i]= buffer[1 + i];
+    return true;
+  }
+
+  for (int i= 0; i < EventInds::NUM_INDS; ++i) {
+    if (read(gEventFds[i], &totals[i], sizeof(totals[i])) != sizeof(totals[i]))
+      return false;
+  }
+  return true;
+}
+
+extern "C" {
+    // This function is called before the program starts executing. The function
+    // signature must remain unchanged to be picked up by the Arm MAP sampler.
+    int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused)
+    {
+        using namespace PS;
+
+        // Context switches and migrations happen in the kernel, so they are
+        // only counted when kernel events may be counted (perf_event_paranoid
+        // of 1 or less, or CAP_PERFMON). Otherwise only the faults are counted
+        bool excludeKernel= false;
+        gGrouped= true;
+        int error= open_events(gGrouped, excludeKernel);
+        if (error == EACCES || error == EPERM) {
+            excludeKernel= true;
+            error= open_events(gGrouped, excludeKernel);
+        }
+        if (error == EINVAL) {
+            // Reading an inherited group is not supported by this kernel
+            gGrouped= false;
+            error= open_events(gGrouped, excludeKernel);
+        }
+        if (error != 0)
+        {
+            allinea_set_plugin_error_messagef(plugin_id, error, "Could not open the perf software events: %s", strerror(error));
+            return ERROR;
+        }
+        if (excludeKernel)
+            printf("perf_event_paranoid does not allow kernel events to be counted, so the context switches and CPU migrations may be 0.\n");
+
+        if (gGrouped) {
+            ioctl(gEventFds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        } else {
+            for (int fd : gEventFds)
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+
+        gEventTotals.fill(0);
+        gEventValues.fill(0);
+        return 0;
+    }
+
+    // This method is called after the main application has finished
+    int allinea_plugin_cleanup(plugin_id_t plugin_id, void *unused)
+    {
+        close_events();
+        return 0;
+    }
+} // extern "C"
+
+// The following function, during sample time, reads the events and updates
+// the increase in each since the last sample
+static int update_values(metric_id_t metric_id, const struct timespec* current_sample_time)
+{
+    using namespace PS;
+
+    static std::uint_fast64_t sLastSampleTime= 0;
+    const std::uint_fast64_t now= current_sample_time->tv_nsec + current_sample_time->tv_sec * ONE_SECOND_NS;
+    // If we have already updated for the current sample there is nothing to do
+    if (now == sLastSampleTime)
+        return 0;
+    sLastSampleTime= now;
+
+    std::array<std::uint64_t, EventInds::NUM_INDS> totals;
+    if (!read_events(totals)) {
+      allinea_set_metric_error_messagef(metric_id, errno, "Error reading the perf software events: %s", strerror(errno));
+      return ERROR;
+    }
+    for (int i= 0; i < EventInds::NUM_INDS; ++i) {
+      gEventValues[i]= totals[i] - gEventTotals[i];
+      gEventTotals[i]= totals[i];
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Tests libperfsoftware by causing page faults and context switches, in the
+// main thread and in a thread created after the plugin is initialised.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define TEST_FIXTURE_PLUGIN
+#include "../common/test_fixture.h"
+
+extern "C" {
+int perf_sw_context_switches(metric_id_t metric_id, struct timespec *current_sample_time, uint64_t *out_value);
+int perf_sw_cpu_migrations(metric_id_t metric_id, struct timespec *current_sample_time, uint64_t *out_value);
+int perf_sw_minor_faults(metric_id_t metric_id, struct timespec *current_sample_time, uint64_t *out_value);
+int perf_sw_major_faults(metric_id_t metric_id, struct timespec *current_sample_time, uint64_t *out_value);
+int perf_sw_alignment_faults(metric_id_t metric_id, struct timespec *current_sample_time, uint64_t *out_value);
+}
+
+static const size_t PAGES= 512;
+static const int SLEEPS= 20;
+
+struct Sample {
+    uint64_t contextSwitches;
+    uint64_t cpuMigrations;
+    uint64_t minorFaults;
+    uint64_t majorFaults;
+    uint64_t alignmentFaults;
+};
+
+static Sample sample(int second)
+{
+    struct timespec sampleTime;
+    sampleTime.tv_sec= second;
+    sampleTime.tv_nsec= 0;
+    Sample values;
+    if (perf_sw_context_switches(1, &sampleTime, &values.contextSwitches) != 0 ||
+        perf_sw_cpu_migrations(2, &sampleTime, &values.cpuMigrations) != 0 ||
+        perf_sw_minor_faults(3, &sampleTime, &values.minorFaults) != 0 ||
+        perf_sw_major_faults(4, &sampleTime, &values.majorFaults) != 0 ||
+        perf_sw_alignment_faults(5, &sampleTime, &values.alignmentFaults) != 0)
+        FAIL("sampling at %d s failed", second);
+    return values;
+}
+
+// Faults in PAGES pages, and sleeps to give up the CPU
+static void* perturb(void*)
+{
+    const size_t pageSize= sysconf(_SC_PAGESIZE);
+    char* pages= static_cast<char*>(mmap(NULL, PAGES * pageSize, PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (pages == MAP_FAILED)
+        FAIL("mmap: %s", strerror(errno));
+    madvise(pages, PAGES * pageSize, MADV_NOHUGEPAGE);
+    for (size_t page= 0; page < PAGES; ++page)
+        pages[page * pageSize]= 1;
+    munmap(pages, PAGES * pageSize);
+    for (int i= 0; i < SLEEPS; ++i)
+        usleep(100);
+    return NULL;
+}
+
+// Context switches are only counted if kernel events can be counted
+static bool counts_kernel_events()
+{
+    if (geteuid() == 0)
+        return true;
+    FILE* file= fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+    int paranoid= 2;
+    if (file != NULL) {
+        if (fscanf(file, "%d", &paranoid) != 1)
+            paranoid= 2;
+        fclose(file);
+    }
+    return paranoid <= 1;
+}
+
+static void check(const char* what, const Sample& values)
+{
+    if (values.minorFaults < PAGES)
+        FAIL("%s: expected at least %zu minor faults != actual %llu", what, PAGES,
+             static_cast<unsigned long long>(values.minorFaults));
+    if (counts_kernel_events() && values.contextSwitches < SLEEPS)
+        FAIL("%s: expected at least %d context switches != actual %llu", what, SLEEPS,
+             static_cast<unsigned long long>(values.contextSwitches));
+}
+
+int main(void)
+{
+    if (allinea_plugin_initialize(1, NULL) != 0)
+        FAIL("allinea_plugin_initialize failed");
+
+    sample(1);
+    perturb(NULL);
+    check("main thread", sample(2));
+
+    // The thread inherits the events
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, perturb, NULL) != 0)
+        FAIL("pthread_create failed");
+    pthread_join(thread, NULL);
+    check("created thread", sample(3));
+
+    // The same sample time does not read the events again
+    const Sample repeated= sample(3);
+    if (repeated.minorFaults < PAGES)
+        FAIL("expected the values of the last sample when repeated, got %llu minor faults",
+             static_cast<unsigned long long>(repeated.minorFaults));
+
+    if (allinea_plugin_cleanup(1, NULL) != 0)
+        FAIL("allinea_plugin_cleanup failed");
+
+    fprintf(stderr, "PASS\n");
+    return 0;
+}
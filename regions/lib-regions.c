@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Region metrics: the innermost region that the program has marked with
+ * map_regions.h, and how deeply regions are nested, at each sample. The
+ * names of the region ids are printed when the program ends.
+ *
+ * The Haswell, GPFS and MUSCLE2 plugins break their own counters down by
+ * the same regions; see ../common/region_totals.h.
+ */
+
+#include "allinea_metric_plugin_api.h"
+#include "mpi_rank.h"
+#include "region_totals.h"
+#include "telemetry.h"
+
+#include <errno.h>
+
+#define ERROR_NO_REGIONS 100
+
+/*! The region functions of the program. No counters are totalled, only the current region is read. */
+static struct region_totals regions;
+
+/*! The depth function of the program, which region_totals does not look up. */
+static int (*regionDepth)(void) = NULL;
+
+/*! The live telemetry page, or NULL if not publishing. See ../common/telemetry.h. */
+static struct telemetry_page *telemetryPage = NULL;
+
+/*! This function is called when the metric plugin is loaded. */
+/*!
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused)
+{
+    (void) unused; /* unused variable */
+
+    if (region_totals_open(&regions, 0, NULL) != 0) {
+        allinea_set_plugin_error_messagef(plugin_id, ERROR_NO_REGIONS,
+                                          "The program does not mark regions: link it with -lmapregions");
+        errno = ENOENT;
+        return -1;
+    }
+    union { void *symbol; int (*depth)(void); } f;
+    f.symbol = dlsym(RTLD_DEFAULT, "map_region_depth");
+    regionDepth = f.depth;
+    telemetryPage = telemetry_open();
+    return 0;
+}
+
+/*! This function is called when the metric plugin is unloaded. */
+/*!
+ *  Prints the names of the region ids, so that the values of the region
+ *  metric can be read.
+ *
+ *  \param plugin_id an opaque handle for the plugin.
+ *  \param unused unused
+ *  \return 0 on success; -1 on failure and set errno
+ */
+int allinea_plugin_cleanup(plugin_id_t plugin_id, void *unused)
+{
+    (void) plugin_id; /* unused variable */
+    (void) unused; /* unused variable */
+
+    if (region_totals_enabled(&regions) && mpi_rank_is_root()) {
+        const int numRegions = regions.count();
+        printf("Regions:");
+        for (int r = 1; r < numRegions; ++r)
+            printf(" %d %s%s", r, regions.name(r), r + 1 < numRegions ? "," : "");
+        printf("\n");
+    }
+    telemetry_close(telemetryPage);
+    telemetryPage = NULL;
+    return 0;
+}
+
+int allinea_regionCurrent(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    (void) metricId; /* unused variable */
+
+    *outValue = (uint64_t) region_totals_current(&regions);
+    if (telemetryPage != NULL) {
+        telemetry_publish_begin(telemetryPage);
+        telemetry_set_uint64(telemetryPage, TELEMETRY_MAP_REGION, *outValue, inOutCurrentSampleTime);
+        telemetry_publish_end(telemetryPage);
+    }
+    return 0;
+}
+
+int allinea_regionDepth(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue)
+{
+    (void) metricId; /* unused variable */
+    (void) inOutCurrentSampleTime; /* unused variable */
+
+    *outValue = regionDepth != NULL ? (uint64_t) regionDepth() : 0;
+    return 0;
+}
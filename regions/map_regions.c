@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The region table and the stack of regions of each thread, linked into the
+ * program as libmapregions.so. The plugins find these functions at run time,
+ * so programs without markers need not link it.
+ */
+
+#include "map_regions.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+__thread struct map_region_stack map_region_stack;
+
+/*! The names of the regions, by id. Names are only ever added, so a name once read does not change. */
+static char names[MAP_REGIONS_MAX][MAP_REGIONS_MAX_NAME] = { "(no region)" };
+
+/*! The number of regions in \a names, stored after the name is written. */
+static int numRegions = 1;
+
+/*! Serialises adding regions. Looking them up by id takes no lock. */
+static pthread_mutex_t registerLock = PTHREAD_MUTEX_INITIALIZER;
+
+int map_region_register(const char *name)
+{
+    char truncated[MAP_REGIONS_MAX_NAME];
+    snprintf(truncated, sizeof(truncated), "%s", name != NULL ? name : "");
+    pthread_mutex_lock(&registerLock);
+    int id;
+    for (id = 1; id < numRegions; ++id) {
+        if (strcmp(names[id], truncated) == 0)
+            break;
+    }
+    if (id == numRegions) {
+        if (numRegions == MAP_REGIONS_MAX) {
+            id = 0;
+        } else {
+            memcpy(names[id], truncated, sizeof(truncated));
+            __atomic_store_n(&numRegions, id + 1, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&registerLock);
+    return id;
+}
+
+const char *map_region_name(int id)
+{
+    if (id < 0 || id >= __atomic_load_n(&numRegions, __ATOMIC_ACQUIRE))
+        return NULL;
+    return names[id];
+}
+
+int map_region_count(void)
+{
+    return __atomic_load_n(&numRegions, __ATOMIC_ACQUIRE);
+}
+
+int map_region_current(void)
+{
+    const int depth = map_region_stack.depth;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    if (depth <= 0)
+        return 0;
+    return map_region_stack.ids[(depth < MAP_REGIONS_MAX_DEPTH ? depth : MAP_REGIONS_MAX_DEPTH) - 1];
+}
+
+int map_region_depth(void)
+{
+    return map_region_stack.depth;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Region markers: a program marks the entry and exit of the phases it wants
+ * the metrics broken down by, e.g.
+ *
+ *     MAP_REGION_BEGIN("halo");
+ *     exchange_halos();
+ *     MAP_REGION_END();
+ *
+ * and links with -lmapregions. Each thread has a stack of the regions it is
+ * in, and the plugins that support regions add what they count in each
+ * sample to the innermost region of the sampled thread.
+ *
+ * A marker is a few stores to thread-local storage, so the markers can be
+ * left in production builds; the name is only looked up the first time each
+ * MAP_REGION_BEGIN is reached.
+ */
+
+#ifndef MAP_REGIONS_H
+#define MAP_REGIONS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! The most regions a program can have, including region 0, which is outside every region. */
+#define MAP_REGIONS_MAX 256
+
+/*! The deepest regions can be nested. Deeper regions are counted in the deepest one that fits. */
+#define MAP_REGIONS_MAX_DEPTH 64
+
+/*! The longest region name, including the terminating null; longer names are truncated. */
+#define MAP_REGIONS_MAX_NAME 64
+
+/*! The regions a thread is in, innermost last. */
+struct map_region_stack {
+    int depth;
+    int ids[MAP_REGIONS_MAX_DEPTH];
+};
+
+extern __thread struct map_region_stack map_region_stack;
+
+/*! Looks up the region called \a name, adding it if it is new. Thread safe. */
+/*!
+ *  \return the id of the region, from 1, or 0 if there are already
+ *  \a MAP_REGIONS_MAX regions
+ */
+int map_region_register(const char *name);
+
+/*! \return the name of region \a id, or NULL if there is no such region */
+const char *map_region_name(int id);
+
+/*! \return the number of regions, including region 0 */
+int map_region_count(void);
+
+/*! \return the innermost region the calling thread is in, or 0 if none. Async-signal-safe. */
+int map_region_current(void);
+
+/*! \return how deeply regions are nested in the calling thread. Async-signal-safe. */
+int map_region_depth(void);
+
+/*! Enters region \a id on the calling thread. */
+static inline void map_region_enter(int id)
+{
+    struct map_region_stack *stack = &map_region_stack;
+    const int depth = stack->depth;
+    if (depth < MAP_REGIONS_MAX_DEPTH)
+        stack->ids[depth] = id;
+    /* A sample taken in a signal handler between the two stores must see the id before the depth */
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    stack->depth = depth + 1;
+}
+
+/*! Leaves the innermost region of the calling thread. */
+static inline void map_region_exit(void)
+{
+    struct map_region_stack *stack = &map_region_stack;
+    if (stack->depth > 0)
+        --stack->depth;
+}
+
+/*! Enters the region called \a name, looking up its id only the first time this line is reached. */
+#define MAP_REGION_BEGIN(name)                                                   \
+    do {                                                                         \
+        static int map_region_id_;                                               \
+        int map_region_this_id_ = __atomic_load_n(&map_region_id_, __ATOMIC_RELAXED); \
+        if (map_region_this_id_ == 0) {                                          \
+            map_region_this_id_ = map_region_register(name);                     \
+            __atomic_store_n(&map_region_id_, map_region_this_id_, __ATOMIC_RELAXED); \
+        }                                                                        \
+        map_region_enter(map_region_this_id_);                                   \
+    } while (0)
+
+/*! Leaves the innermost region. */
+#define MAP_REGION_END() map_region_exit()
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MAP_REGIONS_H */
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs with libmapregions.so linked in, as a program that marks regions
+ * would be, and with the region plugin linked in. Checks the region stacks,
+ * the totals the plugins keep, samples taken from a profiling timer signal
+ * part way through a marker, and the cost of a marker.
+ */
+
+#define _GNU_SOURCE
+
+#include "map_regions.h"
+#include "region_totals.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "allinea_metric_plugin_api.h"
+
+void allinea_set_plugin_error_messagef(plugin_id_t id, int error_code, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+extern int allinea_plugin_initialize(plugin_id_t plugin_id, void *unused);
+extern int allinea_plugin_cleanup(plugin_id_t id, void *unused);
+extern int allinea_regionCurrent(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+extern int allinea_regionDepth(metric_id_t metricId, struct timespec *inOutCurrentSampleTime, uint64_t *outValue);
+
+#define BENCHMARK_CALLS 10000000
+#define BENCHMARK_ROUNDS 5
+
+/* The most each begin and end pair may cost, with some allowance for a loaded machine */
+#define MAX_MARKER_NS 10.0
+
+static void check(int ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        abort();
+    }
+}
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static uint64_t current_metric(void)
+{
+    static int seconds = 0;
+    struct timespec sampleTime = { ++seconds, 0 };
+    uint64_t value;
+    check(allinea_regionCurrent(1, &sampleTime, &value) == 0, "allinea_regionCurrent failed");
+    return value;
+}
+
+static void *thread_in_region(void *unused)
+{
+    (void) unused;
+    check(map_region_current() == 0, "expected a new thread to be in no region");
+    MAP_REGION_BEGIN("thread");
+    const int id = map_region_current();
+    MAP_REGION_END();
+    return (void *) (intptr_t) id;
+}
+
+/* Samples from the signal handler, as the sampler does, whatever the marker loop is doing */
+static volatile int signalSamples = 0;
+static volatile int badSamples = 0;
+static int outerId, innerId;
+
+static void sample_from_signal(int signal)
+{
+    (void) signal;
+    const int current = map_region_current();
+    if (current != outerId && current != innerId)
+        ++badSamples;
+    ++signalSamples;
+}
+
+int main(void)
+{
+    check(allinea_plugin_initialize(1, NULL) == 0, "allinea_plugin_initialize failed");
+
+    /* Names are looked up once, and the same name is the same region */
+    const int halo = map_region_register("halo");
+    const int solver = map_region_register("solver");
+    check(halo > 0 && solver > 0 && halo != solver, "expected two new regions");
+    check(map_region_register("halo") == halo, "expected the same id for the same name");
+    check(strcmp(map_region_name(halo), "halo") == 0, "expected the name of the region");
+    check(strcmp(map_region_name(0), "(no region)") == 0, "expected region 0 to be outside every region");
+    check(map_region_name(map_region_count()) == NULL, "expected no name for an id not handed out");
+
+    /* Nesting */
+    check(map_region_current() == 0 && current_metric() == 0, "expected no region before any marker");
+    MAP_REGION_BEGIN("solver");
+    check(map_region_current() == solver && current_metric() == (uint64_t) solver, "expected to be in the solver");
+    MAP_REGION_BEGIN("halo");
+    check(map_region_current() == halo && map_region_depth() == 2, "expected the halo inside the solver");
+    MAP_REGION_END();
+    check(map_region_current() == solver, "expected to be back in the solver");
+    MAP_REGION_END();
+    check(map_region_current() == 0, "expected no region after the last end");
+    MAP_REGION_END();
+    check(map_region_depth() == 0, "expected an unmatched end to be ignored");
+
+    /* Regions nested too deeply are counted in the deepest that fits */
+    for (int i = 0; i < MAP_REGIONS_MAX_DEPTH + 10; ++i)
+        map_region_enter(i < MAP_REGIONS_MAX_DEPTH ? solver : halo);
+    check(map_region_current() == solver, "expected the deepest region that fits");
+    for (int i = 0; i < MAP_REGIONS_MAX_DEPTH + 10; ++i)
+        map_region_exit();
+    check(map_region_depth() == 0, "expected every region to be left");
+
+    /* Each thread has its own stack */
+    MAP_REGION_BEGIN("solver");
+    pthread_t thread;
+    void *threadId;
+    pthread_create(&thread, NULL, thread_in_region, NULL);
+    pthread_join(thread, &threadId);
+    check((intptr_t) threadId > 0 && (intptr_t) threadId != solver, "expected the thread to be in its own region");
+    check(map_region_current() == solver, "expected this thread to still be in the solver");
+    MAP_REGION_END();
+
+    /* Totals go to the innermost region */
+    static struct region_totals totals;
+    static const char *const counterNames[] = { "cycles", "stalls" };
+    static const struct region_ratio ratios[] = { { "stall fraction", 1, 0, 1.0 } };
+    check(region_totals_open(&totals, 2, counterNames) == 0, "expected the region functions to be found");
+    const uint64_t outside[] = { 100, 10 }, inHalo[] = { 1000, 900 }, inSolver[] = { 2000, 200 };
+    region_totals_add(&totals, region_totals_current(&totals), outside);
+    MAP_REGION_BEGIN("solver");
+    region_totals_add(&totals, region_totals_current(&totals), inSolver);
+    MAP_REGION_BEGIN("halo");
+    region_totals_add(&totals, region_totals_current(&totals), inHalo);
+    region_totals_add(&totals, region_totals_current(&totals), inHalo);
+    MAP_REGION_END();
+    MAP_REGION_END();
+    check(totals.samples[0] == 1 && totals.samples[solver] == 1 && totals.samples[halo] == 2,
+          "expected the samples of each region");
+    check(totals.totals[halo][0] == 2000 && totals.totals[halo][1] == 1800, "expected the halo totals");
+    check(totals.totals[solver][0] == 2000 && totals.totals[solver][1] == 200, "expected the solver totals");
+    char *report;
+    size_t reportSize;
+    FILE *out = open_memstream(&report, &reportSize);
+    region_totals_print(&totals, out, "Test counters", ratios, 1);
+    fclose(out);
+    fputs(report, stderr);
+    check(strstr(report, "Test counters by region: 4 samples") != NULL, "expected the number of samples");
+    check(strstr(report, "halo: 2 samples (50.0%)") != NULL, "expected the share of the halo");
+    check(strstr(report, "0.9000") != NULL && strstr(report, "0.1000") != NULL, "expected the stall fractions");
+    free(report);
+
+    /* Samples taken in a signal handler part way through a marker see one region or the other */
+    outerId = map_region_register("outer");
+    innerId = map_region_register("inner");
+    map_region_enter(outerId);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sample_from_signal;
+    sigaction(SIGPROF, &action, NULL);
+    struct itimerval timer = { { 0, 200 }, { 0, 200 } };
+    setitimer(ITIMER_PROF, &timer, NULL);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (seconds_since(&start) < 0.5) {
+        for (int i = 0; i < 1000; ++i) {
+            map_region_enter(innerId);
+            map_region_exit();
+        }
+    }
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    map_region_exit();
+    check(signalSamples > 10, "expected samples from the signal handler");
+    check(badSamples == 0, "expected every sample to see the outer or inner region");
+
+    /* The cost of a begin and end pair, in the best of several rounds */
+    double best = 1e9;
+    for (int round = 0; round < BENCHMARK_ROUNDS; ++round) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < BENCHMARK_CALLS; ++i) {
+            MAP_REGION_BEGIN("benchmark");
+            __asm__ volatile("" ::: "memory");
+            MAP_REGION_END();
+        }
+        const double seconds = seconds_since(&start);
+        best = seconds < best ? seconds : best;
+    }
+    const double markerNs = best * 1e9 / BENCHMARK_CALLS;
+    fprintf(stderr, "%.1f ns per begin and end pair (%d signal samples)\n", markerNs, signalSamples);
+    check(markerNs < MAX_MARKER_NS, "expected less than 10 ns per begin and end pair");
+
+    allinea_plugin_cleanup(1, NULL);
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Tests the critical path of a synthetic coupled run of three submodels in a
+// pipeline, the slowest in the middle, written as traces in the format of the
+// MUSCLE2 plugin; that a trace cut short is read up to where it stops; and
+// times a run of millions of calls.
+
+#include "critpath.h"
+#include "../phases/thread_pool.h"
+#include "../../common/muscle2_trace.h"
+#include "../../common/test_fixture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// The fewest calls a second the tool must read and analyse
+static const double MIN_CALLS_PER_SECOND= 1e6;
+
+static const uint64_t MS= 1000000;
+
+struct Call {
+  uint32_t kind;
+  std::string conduit;
+  uint64_t startNs;
+  uint64_t durationNs;
+  uint64_t bytes;
+};
+
+// Writes the calls as the plugin would, each conduit named before its first
+// call, and the header with the magic only if closed is set
+static std::string write_trace(const std::string& dir, const char* program, int rank, const std::vector<Call>& calls,
+                               bool closed)
+{
+  const std::string path= dir + "/" + program + ".trace";
+  FILE* file= fopen(path.c_str(), "wb");
+  if (file == NULL)
+    FAIL("cannot write %s", path.c_str());
+  muscle2_trace_header header;
+  memset(&header, 0, sizeof(header));
+  header.magic= closed ? MUSCLE2_TRACE_MAGIC : 0;
+  header.version= MUSCLE2_TRACE_VERSION;
+  header.pid= 1000 + rank;
+  header.rank= rank;
+  snprintf(header.host, sizeof(header.host), "node");
+  snprintf(header.program, sizeof(header.program), "%s", closed ? program : "");
+  fwrite(&header, sizeof(header), 1, file);
+  std::vector<std::string> conduits;
+  for (const Call& call : calls) {
+    uint32_t conduit= std::find(conduits.begin(), conduits.end(), call.conduit) - conduits.begin();
+    if (conduit == conduits.size()) {
+      conduits.push_back(call.conduit);
+      muscle2_trace_record named= { 0, 0, 0, conduit, MUSCLE2_TRACE_CONDUIT };
+      char name[MUSCLE2_TRACE_NAME_SIZE]= { 0 };
+      snprintf(name, sizeof(name), "%s", call.conduit.c_str());
+      fwrite(&named, sizeof(named), 1, file);
+      fwrite(name, sizeof(name), 1, file);
+    }
+    muscle2_trace_record record= { call.startNs, call.durationNs, call.bytes, conduit, call.kind };
+    fwrite(&record, sizeof(record), 1, file);
+  }
+  fclose(file);
+  return path;
+}
+
+// A pipeline of iterations: "source" computes 1 ms and sends on source_out,
+// "middle" receives on middle_in, computes 5 ms and sends on middle_out, and
+// "sink" receives on sink_in and computes 1 ms. Sends take 0.1 ms and do not
+// wait; a receive ends 0.05 ms after its message was sent, or at once
+static void pipeline(int iterations, std::vector<Call>* source, std::vector<Call>* middle, std::vector<Call>* sink)
+{
+  const uint64_t send= MS / 10, latency= MS / 20;
+  uint64_t sourceTime= 0, middleTime= 0, sinkTime= 0;
+  for (int i= 0; i < iterations; ++i) {
+    sourceTime+= MS;
+    source->push_back({ CritPath::SEND, "source_out", sourceTime, send, 800 });
+    sourceTime+= send;
+
+    const uint64_t arrived= std::max(sourceTime + latency, middleTime);
+    middle->push_back({ CritPath::RECEIVE, "middle_in", middleTime, arrived - middleTime, 800 });
+    middleTime= arrived + 5 * MS;
+    middle->push_back({ CritPath::SEND, "middle_out", middleTime, send, 400 });
+    middleTime+= send;
+
+    const uint64_t reached= std::max(middleTime + latency, sinkTime);
+    sink->push_back({ CritPath::RECEIVE, "sink_in", sinkTime, reached - sinkTime, 400 });
+    sinkTime= reached + MS;
+  }
+}
+
+static void check_pipeline(const std::string& dir, ThreadPool& pool)
+{
+  const int iterations= 100;
+  std::vector<Call> source, middle, sink;
+  pipeline(iterations, &source, &middle, &sink);
+  std::vector<std::string> paths;
+  paths.push_back(write_trace(dir, "source", 0, source, true));
+  paths.push_back(write_trace(dir, "middle", 1, middle, true));
+  paths.push_back(write_trace(dir, "sink", 2, sink, true));
+
+  std::vector<CritPath::Process> processes;
+  std::string error;
+  if (!CritPath::read_traces(paths, pool, &processes, &error))
+    FAIL("%s", error.c_str());
+  if (processes[1].program != "middle" || processes[1].rank != 1 || !processes[1].complete ||
+      processes[1].events.size() != 2 * iterations || processes[1].conduits.size() != 2)
+    FAIL("expected the middle trace to have 2 conduits and %d calls, got %zu", 2 * iterations,
+         processes[1].events.size());
+
+  // Without the connections nothing is matched, and the path stays in the
+  // process that ended last
+  CritPath::Options options;
+  CritPath::Result result= CritPath::analyse(processes, options, pool);
+  if (result.matched != 0 || !result.edges.empty())
+    FAIL("expected no messages to match without connections, got %zu", result.matched);
+  if (result.submodels[0].computeOnPath + result.submodels[1].computeOnPath > 0.0)
+    FAIL("expected only the sink on the path without connections");
+
+  options.connections.push_back({ "source_out", "middle_in" });
+  options.connections.push_back({ "middle_out", "sink_in" });
+  if (!CritPath::read_traces(paths, pool, &processes, &error))
+    FAIL("%s", error.c_str());
+  result= CritPath::analyse(processes, options, pool);
+  if (result.matched != 2 * iterations || result.edges.size() != 2)
+    FAIL("expected %d messages on 2 edges, got %zu on %zu", 2 * iterations, result.matched, result.edges.size());
+
+  // The path covers the run, and nearly all of it is the middle computing
+  const double span= result.spanSeconds;
+  if (std::fabs(result.pathSeconds - span) > 1e-6)
+    FAIL("expected the path to cover the %g s run, got %g s", span, result.pathSeconds);
+  const double middleShare= (result.submodels[1].computeOnPath + result.submodels[1].callsOnPath) / span;
+  if (middleShare < 0.95 || std::fabs(result.submodels[1].computeOnPath - iterations * 0.005) > 1e-6)
+    FAIL("expected the middle to be on the path for its %g s of computation, got %g s, %.1f%%",
+         iterations * 0.005, result.submodels[1].computeOnPath, 100.0 * middleShare);
+  // The source only for its first iteration, and the sink not at all, as it
+  // makes no call after its last computation
+  if (std::fabs(result.submodels[0].computeOnPath - 0.001) > 1e-6 || result.submodels[2].computeOnPath != 0.0)
+    FAIL("expected the source to be on the path for 1 ms and the sink not at all, got %g s and %g s",
+         result.submodels[0].computeOnPath, result.submodels[2].computeOnPath);
+  if (std::fabs(result.transferOnPath - 0.0001) > 1e-9)
+    FAIL("expected two transfers of 0.05 ms on the path, got %g s", result.transferOnPath);
+
+  // The middle only waits for the first message, the sink for most of the
+  // run, and the source finishes long before the end
+  if (result.submodels[1].slack > 0.002)
+    FAIL("expected the middle to have no slack after the first message, got %g s", result.submodels[1].slack);
+  if (result.submodels[2].slack < 0.7 * span || result.submodels[0].slack < 0.7 * span)
+    FAIL("expected the source and sink to have most of the run as slack, got %g s and %g s of %g s",
+         result.submodels[0].slack, result.submodels[2].slack, span);
+  const CritPath::Edge& toSink= result.edges[0].exit == "middle_out" ? result.edges[0] : result.edges[1];
+  if (toSink.bytes != 400u * iterations || toSink.messages != static_cast<std::size_t>(iterations) ||
+      std::fabs(toSink.waitSeconds - (result.submodels[2].receiveSeconds - iterations * 0.00005)) > 1e-9)
+    FAIL("expected the sink to wait for the middle's %d messages, got %zu", iterations, toSink.messages);
+
+  // Conduits of the same name are connected without being told
+  std::vector<Call> sender= { { CritPath::SEND, "data", 2 * MS, MS, 8 } };
+  std::vector<Call> receiver= { { CritPath::RECEIVE, "data", 0, 3 * MS + MS / 2, 8 } };
+  std::vector<std::string> pair= { write_trace(dir, "sender", -1, sender, true),
+                                   write_trace(dir, "receiver", -1, receiver, true) };
+  if (!CritPath::read_traces(pair, pool, &processes, &error))
+    FAIL("%s", error.c_str());
+  result= CritPath::analyse(processes, CritPath::Options(), pool);
+  if (result.matched != 1 || std::fabs(result.submodels[0].computeOnPath - 0.002) > 1e-9 ||
+      std::fabs(result.transferOnPath - 0.0005) > 1e-9 || std::fabs(result.submodels[1].slack - 0.003) > 1e-9)
+    FAIL("expected the receive to wait 3 ms for the send of the same name, 0.5 ms of transfer, got %zu matched",
+         result.matched);
+  if (CritPath::label(processes[0]) != "sender (node:999)")
+    FAIL("expected a process without a rank to be labelled by host and pid, got %s",
+         CritPath::label(processes[0]).c_str());
+}
+
+static void check_cut_short(const std::string& dir)
+{
+  std::vector<Call> calls;
+  for (int i= 0; i < 10; ++i)
+    calls.push_back({ CritPath::SEND, "out", i * MS, MS / 2, 1 });
+  const std::string path= write_trace(dir, "crashed", 3, calls, false);
+  // Half a record left at the end
+  if (truncate(path.c_str(), sizeof(muscle2_trace_header) + sizeof(muscle2_trace_record) + MUSCLE2_TRACE_NAME_SIZE +
+               9 * sizeof(muscle2_trace_record) + 7) != 0)
+    FAIL("truncate");
+  CritPath::Process process;
+  std::string error;
+  if (!CritPath::read_trace(path.c_str(), &process, &error))
+    FAIL("%s", error.c_str());
+  if (process.complete || process.events.size() != 9 || process.conduits[0] != "out")
+    FAIL("expected 9 calls of a trace cut short, got %zu", process.events.size());
+
+  FILE* file= fopen(path.c_str(), "r+b");
+  const uint32_t wrong= 0x12345678;
+  fwrite(&wrong, sizeof(wrong), 1, file);
+  fclose(file);
+  if (CritPath::read_trace(path.c_str(), &process, &error))
+    FAIL("expected a file without the magic to be refused");
+}
+
+static void check_large(const std::string& dir, ThreadPool& pool)
+{
+  // 8 pipelines of 125000 iterations, 4 million calls
+  const int pipelines= 8, iterations= 125000;
+  std::vector<std::string> paths;
+  CritPath::Options options;
+  for (int p= 0; p < pipelines; ++p) {
+    std::vector<Call> source, middle, sink;
+    pipeline(iterations, &source, &middle, &sink);
+    const std::string suffix= std::to_string(p);
+    for (Call& call : source)
+      call.conduit+= suffix;
+    for (Call& call : middle)
+      call.conduit+= suffix;
+    for (Call& call : sink)
+      call.conduit+= suffix;
+    paths.push_back(write_trace(dir, ("source" + suffix).c_str(), 3 * p, source, true));
+    paths.push_back(write_trace(dir, ("middle" + suffix).c_str(), 3 * p + 1, middle, true));
+    paths.push_back(write_trace(dir, ("sink" + suffix).c_str(), 3 * p + 2, sink, true));
+    options.connections.push_back({ "source_out" + suffix, "middle_in" + suffix });
+    options.connections.push_back({ "middle_out" + suffix, "sink_in" + suffix });
+  }
+
+  const auto start= std::chrono::steady_clock::now();
+  std::vector<CritPath::Process> processes;
+  std::string error;
+  if (!CritPath::read_traces(paths, pool, &processes, &error))
+    FAIL("%s", error.c_str());
+  const CritPath::Result result= CritPath::analyse(processes, options, pool);
+  const double seconds= std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (result.events != static_cast<std::size_t>(4 * pipelines * iterations) ||
+      result.matched != static_cast<std::size_t>(2 * pipelines * iterations))
+    FAIL("expected %d calls, got %zu", 4 * pipelines * iterations, result.events);
+  printf("%zu calls read and analysed in %.2f s with %u threads, %.1f million a second\n", result.events, seconds,
+         pool.size(), result.events / seconds / 1e6);
+  if (result.events / seconds < MIN_CALLS_PER_SECOND)
+    FAIL("expected at least %g calls a second", MIN_CALLS_PER_SECOND);
+  for (const std::string& path : paths)
+    unlink(path.c_str());
+}
+
+int main()
+{
+  char dir[]= "/tmp/critpath-test-XXXXXX";
+  if (mkdtemp(dir) == NULL)
+    FAIL("mkdtemp");
+  ThreadPool pool(0);
+  check_pipeline(dir, pool);
+  check_cut_short(dir);
+  check_large(dir, pool);
+
+  const char* names[]= { "source", "middle", "sink", "sender", "receiver", "crashed" };
+  for (const char* name : names)
+    unlink((std::string(dir) + "/" + name + ".trace").c_str());
+  rmdir(dir);
+  printf("PASS\n");
+  return 0;
+}
@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "critpath.h"
+#include "../phases/thread_pool.h"
+#include "../../common/muscle2_trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace CritPath {
+
+  static const double NS= 1e-9;
+
+  static bool fail(std::string* error, const char* path, const char* what)
+  {
+    *error= std::string(path) + ": " + what;
+    return false;
+  }
+
+  static std::string name_of(const char* field)
+  {
+    return std::string(field, strnlen(field, MUSCLE2_TRACE_NAME_SIZE));
+  }
+
+  bool read_trace(const char* path, Process* process, std::string* error)
+  {
+    const int fd= open(path, O_RDONLY);
+    if (fd < 0)
+      return fail(error, path, strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return fail(error, path, strerror(errno));
+    }
+    const std::size_t size= static_cast<std::size_t>(st.st_size);
+    if (size < sizeof(muscle2_trace_header)) {
+      close(fd);
+      return fail(error, path, "not a MUSCLE2 trace");
+    }
+    void* mapping= mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+      return fail(error, path, strerror(errno));
+    const char* data= static_cast<const char*>(mapping);
+
+    muscle2_trace_header header;
+    memcpy(&header, data, sizeof(header));
+    if ((header.magic != MUSCLE2_TRACE_MAGIC && header.magic != 0) || header.version != MUSCLE2_TRACE_VERSION) {
+      munmap(mapping, size);
+      return fail(error, path, "not a MUSCLE2 trace of this version");
+    }
+    process->path= path;
+    process->host= name_of(header.host);
+    process->program= name_of(header.program);
+    process->pid= header.pid;
+    process->rank= header.rank;
+    process->dropped= header.dropped;
+    process->complete= header.magic == MUSCLE2_TRACE_MAGIC;
+    process->conduits.clear();
+    process->events.clear();
+    process->events.reserve((size - sizeof(header)) / sizeof(muscle2_trace_record));
+
+    // A record cut short at the end of a trace that was not closed is left out
+    std::size_t offset= sizeof(header);
+    while (offset + sizeof(muscle2_trace_record) <= size) {
+      muscle2_trace_record record;
+      memcpy(&record, data + offset, sizeof(record));
+      offset+= sizeof(record);
+      if (record.kind == MUSCLE2_TRACE_CONDUIT) {
+        if (offset + MUSCLE2_TRACE_NAME_SIZE > size)
+          break;
+        if (record.conduit >= process->conduits.size())
+          process->conduits.resize(record.conduit + 1);
+        process->conduits[record.conduit]= name_of(data + offset);
+        offset+= MUSCLE2_TRACE_NAME_SIZE;
+      } else if (record.kind == MUSCLE2_TRACE_SEND || record.kind == MUSCLE2_TRACE_RECEIVE) {
+        Event event= { record.startNs, record.startNs + record.durationNs, record.bytes, record.conduit, record.kind,
+                       -1, 0 };
+        process->events.push_back(event);
+      } else {
+        munmap(mapping, size);
+        return fail(error, path, "corrupt record");
+      }
+    }
+    munmap(mapping, size);
+
+    for (const Event& event : process->events) {
+      if (event.conduit >= process->conduits.size())
+        process->conduits.resize(event.conduit + 1);
+    }
+    for (std::size_t c= 0; c < process->conduits.size(); ++c) {
+      if (process->conduits[c].empty())
+        process->conduits[c]= "(conduit " + std::to_string(c) + ")";
+    }
+    // The records are in the order the calls ended, which is out of order of
+    // their start only where threads overlap
+    auto byStart= [](const Event& a, const Event& b) { return a.startNs < b.startNs; };
+    if (!std::is_sorted(process->events.begin(), process->events.end(), byStart))
+      std::stable_sort(process->events.begin(), process->events.end(), byStart);
+    return true;
+  }
+
+  bool read_traces(const std::vector<std::string>& paths, ThreadPool& pool, std::vector<Process>* processes,
+                   std::string* error)
+  {
+    processes->assign(paths.size(), Process());
+    std::vector<std::string> errors(paths.size());
+    pool.parallel_for(paths.size(), [&](std::size_t p, unsigned) {
+      read_trace(paths[p].c_str(), &(*processes)[p], &errors[p]);
+    });
+    for (const std::string& message : errors) {
+      if (!message.empty()) {
+        *error= message;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool read_connections(const char* path, std::vector<Connection>* connections, std::string* error)
+  {
+    std::ifstream in(path);
+    if (!in)
+      return fail(error, path, strerror(errno));
+    std::string line;
+    for (int number= 1; std::getline(in, line); ++number) {
+      std::istringstream fields(line);
+      Connection connection;
+      if (!(fields >> connection.exit) || connection.exit[0] == '#')
+        continue;
+      std::string extra;
+      if (!(fields >> connection.entrance) || fields >> extra)
+        return fail(error, path, ("line " + std::to_string(number) + " is not \"exit entrance\"").c_str());
+      connections->push_back(connection);
+    }
+    return true;
+  }
+
+  // A conduit of one process
+  struct End {
+    std::size_t process;
+    uint32_t conduit;
+  };
+
+  // The time a receive was blocked waiting for a message not yet sent, or the
+  // whole receive if it has no matching send
+  static uint64_t wait_ns(const std::vector<Process>& processes, const Event& receive)
+  {
+    if (receive.matchProcess < 0)
+      return receive.endNs - receive.startNs;
+    const Event& send= processes[receive.matchProcess].events[receive.matchEvent];
+    return send.endNs > receive.startNs ? std::min(send.endNs, receive.endNs) - receive.startNs : 0;
+  }
+
+  Result analyse(std::vector<Process>& processes, const Options& options, ThreadPool& pool)
+  {
+    Result result= Result();
+    const std::size_t numProcesses= processes.size();
+    result.submodels.assign(numProcesses, Submodel());
+
+    // The events of each conduit of each process, in order
+    std::vector<std::vector<std::vector<uint64_t>>> byConduit(numProcesses);
+    pool.parallel_for(numProcesses, [&](std::size_t p, unsigned) {
+      const std::vector<Event>& events= processes[p].events;
+      byConduit[p].resize(processes[p].conduits.size());
+      for (uint64_t e= 0; e < events.size(); ++e)
+        byConduit[p][events[e].conduit].push_back(e);
+    });
+
+    // Who sends on each exit and receives on each entrance. A conduit that
+    // both sends and receives in one process counts as both
+    std::unordered_map<std::string, std::vector<End>> senders, receivers;
+    for (std::size_t p= 0; p < numProcesses; ++p) {
+      result.events+= processes[p].events.size();
+      for (uint32_t c= 0; c < byConduit[p].size(); ++c) {
+        bool sends= false, receives= false;
+        for (uint64_t e : byConduit[p][c]) {
+          sends= sends || processes[p].events[e].kind == SEND;
+          receives= receives || processes[p].events[e].kind == RECEIVE;
+        }
+        const End end= { p, c };
+        if (sends)
+          senders[processes[p].conduits[c]].push_back(end);
+        if (receives)
+          receivers[processes[p].conduits[c]].push_back(end);
+      }
+    }
+    std::unordered_map<std::string, std::string> entranceOf;
+    for (const Connection& connection : options.connections)
+      entranceOf[connection.exit]= connection.entrance;
+
+    std::vector<std::pair<End, End>> ends;
+    for (const auto& sender : senders) {
+      const auto connected= entranceOf.find(sender.first);
+      const std::string& entrance= connected != entranceOf.end() ? connected->second : sender.first;
+      const auto receiver= receivers.find(entrance);
+      if (receiver == receivers.end())
+        continue;
+      if (sender.second.size() != 1 || receiver->second.size() != 1) {
+        result.ambiguous.push_back(sender.second.size() != 1 ? sender.first : entrance);
+        continue;
+      }
+      ends.push_back(std::make_pair(sender.second[0], receiver->second[0]));
+      Edge edge= Edge();
+      edge.sender= sender.second[0].process;
+      edge.receiver= receiver->second[0].process;
+      edge.exit= sender.first;
+      edge.entrance= entrance;
+      result.edges.push_back(edge);
+    }
+    std::sort(result.ambiguous.begin(), result.ambiguous.end());
+
+    // Each send on an exit goes to the receive in the same place on its
+    // entrance. The edges share no events, so they are matched in parallel
+    pool.parallel_for(ends.size(), [&](std::size_t i, unsigned) {
+      const End& from= ends[i].first;
+      const End& to= ends[i].second;
+      std::vector<Event>& sendEvents= processes[from.process].events;
+      std::vector<Event>& receiveEvents= processes[to.process].events;
+      std::vector<uint64_t> sends, receives;
+      for (uint64_t e : byConduit[from.process][from.conduit])
+        if (sendEvents[e].kind == SEND)
+          sends.push_back(e);
+      for (uint64_t e : byConduit[to.process][to.conduit])
+        if (receiveEvents[e].kind == RECEIVE)
+          receives.push_back(e);
+      const std::size_t matched= std::min(sends.size(), receives.size());
+      Edge& edge= result.edges[i];
+      for (std::size_t m= 0; m < matched; ++m) {
+        Event& send= sendEvents[sends[m]];
+        Event& receive= receiveEvents[receives[m]];
+        send.matchProcess= static_cast<int32_t>(to.process);
+        send.matchEvent= receives[m];
+        receive.matchProcess= static_cast<int32_t>(from.process);
+        receive.matchEvent= sends[m];
+      }
+      edge.messages= matched;
+      edge.unmatched= std::max(sends.size(), receives.size()) - matched;
+      for (uint64_t e : sends)
+        edge.bytes+= sendEvents[e].bytes;
+    });
+    for (std::size_t i= 0; i < ends.size(); ++i) {
+      result.matched+= result.edges[i].messages;
+      const Process& receiver= processes[ends[i].second.process];
+      uint64_t waited= 0;
+      for (uint64_t e : byConduit[ends[i].second.process][ends[i].second.conduit])
+        if (receiver.events[e].kind == RECEIVE && receiver.events[e].matchProcess >= 0)
+          waited+= wait_ns(processes, receiver.events[e]);
+      result.edges[i].waitSeconds= waited * NS;
+    }
+
+    // The run is from the first call of any process to the last end
+    uint64_t runStart= UINT64_MAX, runEnd= 0;
+    std::size_t last= 0;
+    for (std::size_t p= 0; p < numProcesses; ++p) {
+      for (const Event& event : processes[p].events) {
+        runStart= std::min(runStart, event.startNs);
+        if (event.endNs > runEnd) {
+          runEnd= event.endNs;
+          last= p;
+        }
+      }
+    }
+    if (runEnd == 0)
+      return result;
+    result.spanSeconds= (runEnd - runStart) * NS;
+
+    // A process that has not started or has finished is not holding up the run either
+    pool.parallel_for(numProcesses, [&](std::size_t p, unsigned) {
+      const std::vector<Event>& events= processes[p].events;
+      if (events.empty()) {
+        result.submodels[p].slack= result.spanSeconds;
+        return;
+      }
+      uint64_t slack= events.front().startNs - runStart, receiving= 0, lastEnd= 0;
+      for (const Event& event : events) {
+        lastEnd= std::max(lastEnd, event.endNs);
+        if (event.kind != RECEIVE)
+          continue;
+        slack+= wait_ns(processes, event);
+        receiving+= event.endNs - event.startNs;
+      }
+      // Receives of several threads may overlap
+      result.submodels[p].slack= std::min(slack + runEnd - lastEnd, runEnd - runStart) * NS;
+      result.submodels[p].receiveSeconds= receiving * NS;
+    });
+
+    // Walk back from the end. Each step moves to an earlier time, so the walk
+    // ends even where the clocks of the nodes disagree
+    std::vector<uint64_t> computeNs(numProcesses, 0), callsNs(numProcesses, 0);
+    uint64_t transferNs= 0;
+    std::size_t p= last;
+    uint64_t t= runEnd;
+    auto startsBefore= [](const Event& event, uint64_t time) { return event.startNs < time; };
+    for (;;) {
+      const std::vector<Event>& events= processes[p].events;
+      const auto next= std::lower_bound(events.begin(), events.end(), t, startsBefore);
+      if (next == events.begin()) {
+        computeNs[p]+= t - std::min(t, runStart);
+        break;
+      }
+      const Event& event= *(next - 1);
+      const uint64_t end= std::min(event.endNs, t);
+      computeNs[p]+= t - end;
+      ++result.stepsOnPath;
+      if (event.kind == RECEIVE && event.matchProcess >= 0) {
+        const Event& send= processes[event.matchProcess].events[event.matchEvent];
+        const uint64_t arrived= std::min(send.endNs, end);
+        if (send.endNs > event.startNs && arrived < t) {
+          transferNs+= end - arrived;
+          p= static_cast<std::size_t>(event.matchProcess);
+          t= arrived;
+          continue;
+        }
+      }
+      callsNs[p]+= end - event.startNs;
+      t= event.startNs;
+    }
+    for (std::size_t q= 0; q < numProcesses; ++q) {
+      result.submodels[q].computeOnPath= computeNs[q] * NS;
+      result.submodels[q].callsOnPath= callsNs[q] * NS;
+      result.pathSeconds+= (computeNs[q] + callsNs[q]) * NS;
+    }
+    result.transferOnPath= transferNs * NS;
+    result.pathSeconds+= result.transferOnPath;
+    return result;
+  }
+
+  std::string label(const Process& process)
+  {
+    std::string name= process.program;
+    if (name.empty()) {
+      const std::size_t slash= process.path.rfind('/');
+      name= slash == std::string::npos ? process.path : process.path.substr(slash + 1);
+    }
+    if (process.rank >= 0)
+      return name + " (rank " + std::to_string(process.rank) + ")";
+    return name + " (" + process.host + ":" + std::to_string(process.pid) + ")";
+  }
+
+  void print_result(FILE* out, const std::vector<Process>& processes, const Result& result)
+  {
+    fprintf(out, "Critical path: %.3f s of a %.3f s run, %zu steps, %.3f s of it in transfers between submodels\n",
+            result.pathSeconds, result.spanSeconds, result.stepsOnPath, result.transferOnPath);
+    fprintf(out, "%zu calls, %zu messages matched\n\n", result.events, result.matched);
+
+    // The submodels that lengthen the run most first
+    std::vector<std::size_t> order(processes.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto onPath= [&](std::size_t p) { return result.submodels[p].computeOnPath + result.submodels[p].callsOnPath; };
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return onPath(a) > onPath(b); });
+    int width= 8;
+    for (const Process& process : processes)
+      width= std::max(width, static_cast<int>(label(process).size()));
+    fprintf(out, "%-*s %10s %12s %7s %12s %12s %12s %7s\n", width, "submodel", "calls", "on path (s)", "path",
+            "compute (s)", "in calls (s)", "slack (s)", "slack");
+    for (std::size_t p : order) {
+      const Submodel& submodel= result.submodels[p];
+      const double share= result.pathSeconds > 0.0 ? 100.0 * onPath(p) / result.pathSeconds : 0.0;
+      const double slackShare= result.spanSeconds > 0.0 ? 100.0 * submodel.slack / result.spanSeconds : 0.0;
+      fprintf(out, "%-*s %10zu %12.3f %6.1f%% %12.3f %12.3f %12.3f %6.1f%%\n", width, label(processes[p]).c_str(),
+              processes[p].events.size(), onPath(p), share, submodel.computeOnPath, submodel.callsOnPath,
+              submodel.slack, slackShare);
+    }
+
+    if (!result.edges.empty()) {
+      std::vector<const Edge*> edges;
+      for (const Edge& edge : result.edges)
+        edges.push_back(&edge);
+      std::sort(edges.begin(), edges.end(), [](const Edge* a, const Edge* b) {
+        return a->waitSeconds != b->waitSeconds ? a->waitSeconds > b->waitSeconds : a->exit < b->exit;
+      });
+      fprintf(out, "\nCoupling, by the time the receiver waited:\n");
+      for (const Edge* edge : edges) {
+        fprintf(out, "  %s -> %s: %s -> %s, %zu messages, %llu bytes, %.3f s waited", edge->exit.c_str(),
+                edge->entrance.c_str(), label(processes[edge->sender]).c_str(),
+                label(processes[edge->receiver]).c_str(), edge->messages,
+                static_cast<unsigned long long>(edge->bytes), edge->waitSeconds);
+        if (edge->unmatched > 0)
+          fprintf(out, ", %zu unmatched", edge->unmatched);
+        fprintf(out, "\n");
+      }
+    }
+  }
+
+} // namespace CritPath
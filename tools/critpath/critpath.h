@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CRITPATH_H
+#define CRITPATH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+///////////////////////////////////////////////////////////////////////////////
+// Finds the critical path of a coupled MUSCLE2 run from the message traces
+// of its processes (see ../../common/muscle2_trace.h).
+//
+// The sends on each exit are matched in order to the receives on the
+// entrance it is connected to, which makes the run a graph: the calls of
+// each process follow each other, and a receive that was waiting follows the
+// send that it waited for. The critical path is walked back from the last
+// call of the run: through the computation and calls of a process, until a
+// receive that was blocked waiting for its message, where it jumps to the
+// sender of the message. The time of each submodel on the path is what
+// lengthens the run if that submodel is slower. Its slack, the time it spent
+// blocked in receives for messages that had not been sent yet, or before its
+// first call or after its last, is how much slower it could be before
+// anything else waits for it.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace CritPath {
+
+  enum Kind { SEND= 1, RECEIVE= 2 };
+
+  struct Event {
+    uint64_t startNs;
+    uint64_t endNs;
+    uint64_t bytes;
+    uint32_t conduit;
+    uint32_t kind;
+    // The process and event of the matching send or receive, or -1
+    int32_t matchProcess;
+    uint64_t matchEvent;
+  };
+
+  // The trace of one process, its events in order of start
+  struct Process {
+    std::string path;
+    std::string host;
+    std::string program;
+    int pid;
+    int rank;
+    uint64_t dropped;
+    // False if the process did not close the trace, e.g. because it crashed
+    bool complete;
+    // The name of each conduit, by its number in the events
+    std::vector<std::string> conduits;
+    std::vector<Event> events;
+  };
+
+  // An exit connected to an entrance, as in the CxA file
+  struct Connection {
+    std::string exit;
+    std::string entrance;
+  };
+
+  struct Options {
+    // The connections of the run, on top of each exit being connected to the
+    // entrance of the same name
+    std::vector<Connection> connections;
+  };
+
+  // The messages sent from one submodel to another
+  struct Edge {
+    std::size_t sender;
+    std::size_t receiver;
+    std::string exit;
+    std::string entrance;
+    std::size_t messages;
+    // Sends or receives without one to match, because the counts differ
+    std::size_t unmatched;
+    uint64_t bytes;
+    // The time the receiver was blocked waiting for these messages
+    double waitSeconds;
+  };
+
+  struct Submodel {
+    // On the critical path, computing and in calls
+    double computeOnPath;
+    double callsOnPath;
+    // Blocked in receives for messages not yet sent, or not started or finished
+    double slack;
+    double receiveSeconds;
+  };
+
+  struct Result {
+    double spanSeconds;
+    double pathSeconds;
+    // On the path between a send and the end of the receive that waited for it
+    double transferOnPath;
+    std::size_t events;
+    std::size_t matched;
+    std::size_t stepsOnPath;
+    // One per process, in the order of the trace
+    std::vector<Submodel> submodels;
+    std::vector<Edge> edges;
+    // Conduit names used by more than one sending or receiving process, which cannot be matched
+    std::vector<std::string> ambiguous;
+  };
+
+  // Reads the trace of one process. Returns false with a message in error if
+  // it cannot be read. A trace cut short is read up to where it stops
+  bool read_trace(const char* path, Process* process, std::string* error);
+
+  // Reads the traces of the processes in parallel, each sorted by start
+  bool read_traces(const std::vector<std::string>& paths, ThreadPool& pool, std::vector<Process>* processes,
+                   std::string* error);
+
+  // Reads the connections from a file of lines of "exit entrance", skipping
+  // empty lines and those starting with #
+  bool read_connections(const char* path, std::vector<Connection>* connections, std::string* error);
+
+  // Matches the sends to the receives and walks the critical path
+  Result analyse(std::vector<Process>& processes, const Options& options, ThreadPool& pool);
+
+  // The name to print for a process: its program, and its rank or host and pid
+  std::string label(const Process& process);
+
+  // Prints the critical path, the time of each submodel on it and the edges
+  void print_result(FILE* out, const std::vector<Process>& processes, const Result& result);
+
+} // namespace CritPath
+
+#endif // CRITPATH_H
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Reads the MUSCLE2 message traces of the processes of a coupled run and
+// prints its critical path: how long each submodel is on it, how much slack
+// each has, and the messages between them. See critpath.h for how.
+
+#include "critpath.h"
+#include "../phases/thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <getopt.h>
+#include <string>
+#include <sys/stat.h>
+
+static void usage(FILE* out)
+{
+  fprintf(out,
+          "Usage: map-critpath [options] TRACE|DIRECTORY...\n"
+          "Prints the critical path of a coupled MUSCLE2 run from the traces written with\n"
+          "ARM_MAP_MUSCLE2_TRACE, given as files or as the directories they are in.\n"
+          "\n"
+          "  -c, --connections FILE  lines of \"exit entrance\" connecting the conduits (default\n"
+          "                          each exit to the entrance of the same name)\n"
+          "  -t, --threads N         the number of threads (default one per hardware thread)\n"
+          "  -h, --help              print this help\n");
+}
+
+// Adds the *.trace files of a directory, in order, or the path itself if it is not one
+static void add_traces(const char* path, std::vector<std::string>* paths)
+{
+  struct stat st;
+  DIR* dir= stat(path, &st) == 0 && S_ISDIR(st.st_mode) ? opendir(path) : NULL;
+  if (dir == NULL) {
+    paths->push_back(path);
+    return;
+  }
+  std::vector<std::string> found;
+  while (const struct dirent* entry= readdir(dir)) {
+    const std::size_t length= strlen(entry->d_name);
+    if (length > 6 && strcmp(entry->d_name + length - 6, ".trace") == 0)
+      found.push_back(std::string(path) + "/" + entry->d_name);
+  }
+  closedir(dir);
+  std::sort(found.begin(), found.end());
+  paths->insert(paths->end(), found.begin(), found.end());
+}
+
+int main(int argc, char* argv[])
+{
+  static const struct option options[]= {
+    { "connections", required_argument, NULL, 'c' },
+    { "threads", required_argument, NULL, 't' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+  CritPath::Options pathOptions;
+  unsigned threads= 0;
+  std::string error;
+  int option;
+  while ((option= getopt_long(argc, argv, "c:t:h", options, NULL)) != -1) {
+    switch (option) {
+    case 'c':
+      if (!CritPath::read_connections(optarg, &pathOptions.connections, &error)) {
+        fprintf(stderr, "map-critpath: %s\n", error.c_str());
+        return 1;
+      }
+      break;
+    case 't':
+      threads= static_cast<unsigned>(std::max(0, atoi(optarg)));
+      break;
+    case 'h':
+      usage(stdout);
+      return 0;
+    default:
+      usage(stderr);
+      return 1;
+    }
+  }
+  if (optind == argc) {
+    usage(stderr);
+    return 1;
+  }
+  std::vector<std::string> paths;
+  for (int a= optind; a < argc; ++a)
+    add_traces(argv[a], &paths);
+  if (paths.empty()) {
+    fprintf(stderr, "map-critpath: no traces found\n");
+    return 1;
+  }
+
+  const auto start= std::chrono::steady_clock::now();
+  ThreadPool pool(threads);
+  std::vector<CritPath::Process> processes;
+  if (!CritPath::read_traces(paths, pool, &processes, &error)) {
+    fprintf(stderr, "map-critpath: %s\n", error.c_str());
+    return 1;
+  }
+  const auto read= std::chrono::steady_clock::now();
+  const CritPath::Result result= CritPath::analyse(processes, pathOptions, pool);
+  const auto analysed= std::chrono::steady_clock::now();
+
+  const double seconds= std::chrono::duration<double>(analysed - start).count();
+  fprintf(stderr, "map-critpath: %zu processes, %zu calls: read in %.2f s, analysed in %.2f s with %u threads"
+          " (%.1f million calls/s)\n", processes.size(), result.events,
+          std::chrono::duration<double>(read - start).count(),
+          std::chrono::duration<double>(analysed - read).count(), pool.size(),
+          seconds > 0.0 ? result.events / seconds / 1e6 : 0.0);
+  for (const CritPath::Process& process : processes) {
+    if (!process.complete)
+      fprintf(stderr, "map-critpath: warning: %s was not closed, so it may be cut short\n", process.path.c_str());
+    if (process.dropped > 0)
+      fprintf(stderr, "map-critpath: warning: %s lost %llu calls\n", process.path.c_str(),
+              static_cast<unsigned long long>(process.dropped));
+  }
+  for (const std::string& conduit : result.ambiguous)
+    fprintf(stderr, "map-critpath: warning: %s is used by more than one process, so its messages are not matched\n",
+            conduit.c_str());
+  CritPath::print_result(stdout, processes, result);
+  return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Reads the metric time series of every rank of a run and prints the phases
+// of the run: when each starts and ends, the mean of each metric in it, and
+// the metric that stands out most. See phases.h for how they are found.
+
+#include "phases.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <sstream>
+#include <string>
+
+static void usage(FILE* out)
+{
+  fprintf(out,
+          "Usage: map-phases [options] FILE\n"
+          "Prints the phases of a run from the metrics of every rank in FILE (- for the standard\n"
+          "input), a CSV file with a header of rank,time and the metric ids.\n"
+          "\n"
+          "  -p, --penalty N         how much a change must stand out of the noise (default 3)\n"
+          "  -m, --min-samples N     the fewest samples in a phase (default 5)\n"
+          "  -a, --agreement F       the fraction of the ranks that must change together (default 0.25)\n"
+          "  -b, --bottlenecks LIST  the comma separated metrics to pick the dominant one from (default all)\n"
+          "  -t, --threads N         the number of threads (default one per hardware thread)\n"
+          "  -c, --csv               print the phases as CSV\n"
+          "  -h, --help              print this help\n");
+}
+
+int main(int argc, char* argv[])
+{
+  static const struct option options[]= {
+    { "penalty", required_argument, NULL, 'p' },
+    { "min-samples", required_argument, NULL, 'm' },
+    { "agreement", required_argument, NULL, 'a' },
+    { "bottlenecks", required_argument, NULL, 'b' },
+    { "threads", required_argument, NULL, 't' },
+    { "csv", no_argument, NULL, 'c' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+  Phases::Options phaseOptions;
+  unsigned threads= 0;
+  bool csv= false;
+  int option;
+  while ((option= getopt_long(argc, argv, "p:m:a:b:t:ch", options, NULL)) != -1) {
+    switch (option) {
+    case 'p':
+      phaseOptions.penalty= atof(optarg);
+      break;
+    case 'm':
+      phaseOptions.minSamples= static_cast<std::size_t>(std::max(1, atoi(optarg)));
+      break;
+    case 'a':
+      phaseOptions.agreement= atof(optarg);
+      break;
+    case 'b': {
+      std::stringstream list(optarg);
+      std::string metric;
+      while (std::getline(list, metric, ','))
+        if (!metric.empty())
+          phaseOptions.bottlenecks.push_back(metric);
+      break;
+    }
+    case 't':
+      threads= static_cast<unsigned>(std::max(0, atoi(optarg)));
+      break;
+    case 'c':
+      csv= true;
+      break;
+    case 'h':
+      usage(stdout);
+      return 0;
+    default:
+      usage(stderr);
+      return 1;
+    }
+  }
+  if (optind + 1 != argc) {
+    usage(stderr);
+    return 1;
+  }
+
+  const auto start= std::chrono::steady_clock::now();
+  ThreadPool pool(threads);
+  Phases::Profile profile;
+  std::string error;
+  if (!Phases::read_csv(argv[optind], pool, &profile, &error)) {
+    fprintf(stderr, "map-phases: %s\n", error.c_str());
+    return 1;
+  }
+  const auto read= std::chrono::steady_clock::now();
+  const std::vector<Phases::Phase> phases= Phases::detect(profile, phaseOptions, pool);
+  const auto detected= std::chrono::steady_clock::now();
+
+  std::size_t samples= 0;
+  for (const Phases::Rank& rank : profile.ranks)
+    samples+= rank.times.size();
+  fprintf(stderr, "map-phases: %zu ranks, %zu samples, %zu metrics: read in %.2f s, %zu phases found in %.2f s with %u threads\n",
+          profile.ranks.size(), samples, profile.metrics.size(),
+          std::chrono::duration<double>(read - start).count(), phases.size(),
+          std::chrono::duration<double>(detected - read).count(), pool.size());
+  for (const std::string& metric : phaseOptions.bottlenecks) {
+    bool found= false;
+    for (const std::string& name : profile.metrics)
+      found= found || name == metric;
+    if (!found)
+      fprintf(stderr, "map-phases: warning: %s is not one of the metrics\n", metric.c_str());
+  }
+  Phases::print_phases(stdout, profile, phases, csv);
+  return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Tests the change point detection on series with known changes, then the
+// phases of a synthetic run of 64 ranks with three phases, each with a
+// different metric standing out, and times a run of 4096 ranks.
+
+#include "phases.h"
+#include "thread_pool.h"
+#include "../../common/test_fixture.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// The most a large profile may take to read and split, the time the tool has
+// to do 4096 ranks in
+static const double MAX_LARGE_SECONDS= 60.0;
+
+static const char* const METRICS[]= { "haswell.papi.memory_bound", "gpfs_iops", "muscle2.send_rate" };
+static const int NUM_METRICS= 3;
+
+// Phase boundaries of the synthetic run, in seconds
+static const double FIRST_BOUNDARY= 30.0;
+static const double SECOND_BOUNDARY= 70.0;
+
+static void check_change_points()
+{
+  std::mt19937 random(1);
+  std::normal_distribution<double> noise(0.0, 1.0);
+
+  // Means of 0, 5 and 1 over 300, 200 and 500 samples
+  std::vector<double> steps;
+  for (int i= 0; i < 1000; ++i)
+    steps.push_back((i < 300 ? 0.0 : i < 500 ? 5.0 : 1.0) + noise(random));
+  std::vector<std::size_t> changes= Phases::change_points(steps.data(), steps.size(), 3.0, 5);
+  if (changes.size() != 2 || std::labs(static_cast<long>(changes[0]) - 300) > 3 ||
+      std::labs(static_cast<long>(changes[1]) - 500) > 3)
+    FAIL("expected changes at 300 and 500, got %zu changes, the first at %zu", changes.size(),
+         changes.empty() ? 0 : changes[0]);
+
+  // Noise alone has no changes
+  std::vector<double> flat;
+  for (int i= 0; i < 5000; ++i)
+    flat.push_back(10.0 + noise(random));
+  changes= Phases::change_points(flat.data(), flat.size(), 3.0, 5);
+  if (!changes.empty())
+    FAIL("expected no changes in noise, got %zu, the first at %zu", changes.size(), changes[0]);
+
+  // Steps without noise, and a constant series
+  std::vector<double> clean(100, 2.0);
+  for (int i= 60; i < 100; ++i)
+    clean[i]= 3.0;
+  changes= Phases::change_points(clean.data(), clean.size(), 3.0, 5);
+  if (changes.size() != 1 || changes[0] != 60)
+    FAIL("expected one change at 60 without noise, got %zu", changes.size());
+  std::vector<double> constant(100, 1.0);
+  if (!Phases::change_points(constant.data(), constant.size(), 3.0, 5).empty())
+    FAIL("expected no changes in a constant series");
+
+  // Changes closer than the fewest samples in a phase are not split
+  std::vector<double> blip(200, 0.0);
+  blip[100]= blip[101]= 50.0;
+  changes= Phases::change_points(blip.data(), blip.size(), 3.0, 5);
+  for (std::size_t c= 1; c < changes.size(); ++c)
+    if (changes[c] - changes[c - 1] < 5)
+      FAIL("expected changes at least 5 samples apart");
+}
+
+// Writes a run with a sample every 0.1 s of each rank, at slightly different
+// times on each rank, with the lines of the ranks interleaved. The memory
+// bound fraction is high in the second phase and the IO rate in the third
+static void write_run(const char* path, int numRanks, int numSamples, bool withGaps)
+{
+  FILE* file= fopen(path, "w");
+  if (file == NULL)
+    FAIL("could not write %s", path);
+  std::mt19937 random(2);
+  std::normal_distribution<double> noise(0.0, 1.0);
+  fprintf(file, "# A synthetic run\nrank,time");
+  for (int m= 0; m < NUM_METRICS; ++m)
+    fprintf(file, ",%s", METRICS[m]);
+  fprintf(file, "\n");
+  for (int i= 0; i < numSamples; ++i) {
+    for (int r= 0; r < numRanks; ++r) {
+      // Rank 3 drifts a little in when it crosses each boundary
+      const double time= 0.1 * (i + 1) + 0.001 * (r % 7);
+      const int phase= time < FIRST_BOUNDARY ? 0 : time < SECOND_BOUNDARY ? 1 : 2;
+      const double memoryBound= (phase == 1 ? 0.6 : 0.2) + 0.03 * noise(random);
+      const double iops= (phase == 2 ? 5000.0 : 1000.0) + 100.0 * noise(random);
+      const double sendRate= 1e8 + 1e6 * noise(random);
+      if (withGaps && r == 5 && i % 50 == 7)
+        fprintf(file, "%d,%.4f,,%.3f,%.1f\n", r, time, iops, sendRate);
+      else
+        fprintf(file, "%d, %.4f, %.5f, %.3f, %.1f\n", r, time, memoryBound, iops, sendRate);
+    }
+  }
+  fclose(file);
+}
+
+static void check_run(ThreadPool& pool)
+{
+  char path[]= "/tmp/phases-test-XXXXXX";
+  const int fd= mkstemp(path);
+  if (fd == -1)
+    FAIL("mkstemp");
+  close(fd);
+  write_run(path, 64, 1000, true);
+
+  Phases::Profile profile;
+  std::string error;
+  if (!Phases::read_csv(path, pool, &profile, &error))
+    FAIL("could not read the run: %s", error.c_str());
+  if (profile.metrics.size() != 3 || profile.metrics[1] != "gpfs_iops")
+    FAIL("expected the three metrics of the header");
+  if (profile.ranks.size() != 64 || profile.ranks[5].times.size() != 1000 || profile.ranks[5].rank != 5)
+    FAIL("expected 1000 samples of each of 64 ranks");
+  if (!std::isnan(profile.ranks[5].values[0][7]))
+    FAIL("expected an empty field to read as NaN");
+
+  Phases::Options options;
+  options.bottlenecks= { "haswell.papi.memory_bound", "gpfs_iops" };
+  const std::vector<Phases::Phase> phases= Phases::detect(profile, options, pool);
+  Phases::print_phases(stderr, profile, phases, false);
+  if (phases.size() != 3)
+    FAIL("expected 3 phases, found %zu", phases.size());
+  if (std::fabs(phases[0].end - FIRST_BOUNDARY) > 0.3 || std::fabs(phases[1].end - SECOND_BOUNDARY) > 0.3)
+    FAIL("expected boundaries at %g and %g s, found %g and %g", FIRST_BOUNDARY, SECOND_BOUNDARY,
+         phases[0].end, phases[1].end);
+  if (phases[1].agreement < 0.9 || phases[2].agreement < 0.9)
+    FAIL("expected every rank to agree on the boundaries");
+  if (phases[1].dominant != 0 || phases[2].dominant != 1)
+    FAIL("expected the memory bound fraction to dominate the second phase and the IO rate the third");
+  if (std::fabs(phases[1].means[0] - 0.6) > 0.01 || std::fabs(phases[2].means[1] - 5000.0) > 50.0)
+    FAIL("expected the means of the phases");
+
+  // The CSV output has a line per phase
+  char* text;
+  std::size_t size;
+  FILE* out= open_memstream(&text, &size);
+  Phases::print_phases(out, profile, phases, true);
+  fclose(out);
+  if (strncmp(text, "phase,start,end,agreement,samples,haswell.papi.memory_bound", 59) != 0 ||
+      strstr(text, "\n3,") == NULL)
+    FAIL("expected the phases as CSV, got %s", text);
+  free(text);
+
+  // Malformed input is reported, not guessed at
+  FILE* bad= fopen(path, "w");
+  fprintf(bad, "rank,time,a\n0,0.1,1\n0,0.2\n");
+  fclose(bad);
+  if (Phases::read_csv(path, pool, &profile, &error) || error.find("malformed line: 0,0.2") == std::string::npos)
+    FAIL("expected a short line to be an error, got \"%s\"", error.c_str());
+  bad= fopen(path, "w");
+  fprintf(bad, "time,rank,a\n");
+  fclose(bad);
+  if (Phases::read_csv(path, pool, &profile, &error))
+    FAIL("expected a header without rank,time to be an error");
+  unlink(path);
+}
+
+static void time_large_run(ThreadPool& pool)
+{
+  char path[]= "/tmp/phases-test-XXXXXX";
+  const int fd= mkstemp(path);
+  if (fd == -1)
+    FAIL("mkstemp");
+  close(fd);
+  write_run(path, 4096, 1000, false);
+
+  const auto start= std::chrono::steady_clock::now();
+  Phases::Profile profile;
+  std::string error;
+  if (!Phases::read_csv(path, pool, &profile, &error))
+    FAIL("could not read the large run: %s", error.c_str());
+  const std::vector<Phases::Phase> phases= Phases::detect(profile, Phases::Options(), pool);
+  const double seconds= std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  unlink(path);
+  fprintf(stderr, "4096 ranks of 1000 samples: %zu phases in %.2f s with %u threads\n",
+          phases.size(), seconds, pool.size());
+  if (phases.size() != 3)
+    FAIL("expected 3 phases in the large run, found %zu", phases.size());
+  if (seconds > MAX_LARGE_SECONDS)
+    FAIL("expected 4096 ranks to take under %g s", MAX_LARGE_SECONDS);
+}
+
+int main()
+{
+  check_change_points();
+  ThreadPool pool(0);
+  check_run(pool);
+  ThreadPool single(1);
+  check_run(single);
+  time_large_run(pool);
+  printf("PASS\n");
+  return 0;
+}
@@ -0,0 +1,655 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "phases.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <numeric>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace Phases {
+
+  // The longest field that is parsed as a number
+  static const std::size_t MAX_FIELD= 63;
+
+  // How often PELT prunes the starts of the last segment, in samples
+  static const std::size_t PRUNE_INTERVAL= 8;
+
+  // The input, mapped if it is a file and read into memory otherwise
+  struct Input {
+    const char* data= nullptr;
+    std::size_t size= 0;
+    void* mapping= nullptr;
+    std::string buffer;
+
+    ~Input()
+    {
+      if (mapping != nullptr)
+        munmap(mapping, size);
+    }
+  };
+
+  static bool load(const char* path, Input* input, std::string* error)
+  {
+    if (strcmp(path, "-") == 0) {
+      char chunk[1 << 16];
+      std::size_t n;
+      while ((n= fread(chunk, 1, sizeof(chunk), stdin)) > 0)
+        input->buffer.append(chunk, n);
+      input->data= input->buffer.data();
+      input->size= input->buffer.size();
+      return true;
+    }
+    const int fd= open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+      *error= std::string(path) + ": " + strerror(errno);
+      if (fd != -1)
+        close(fd);
+      return false;
+    }
+    input->size= static_cast<std::size_t>(st.st_size);
+    if (input->size > 0) {
+      input->mapping= mmap(NULL, input->size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (input->mapping == MAP_FAILED) {
+        input->mapping= nullptr;
+        *error= std::string(path) + ": " + strerror(errno);
+        close(fd);
+        return false;
+      }
+      // The file is read once, from start to end
+      madvise(input->mapping, input->size, MADV_SEQUENTIAL);
+      input->data= static_cast<const char*>(input->mapping);
+    }
+    close(fd);
+    return true;
+  }
+
+  // Splits the line from begin to end at commas, without the spaces around
+  // each field
+  static void split(const char* begin, const char* end,
+                    std::vector<std::pair<const char*, const char*>>* fields)
+  {
+    fields->clear();
+    while (end > begin && (end[-1] == '\r' || end[-1] == ' '))
+      --end;
+    const char* field= begin;
+    for (const char* p= begin; ; ++p) {
+      if (p == end || *p == ',') {
+        const char* a= field;
+        const char* b= p;
+        while (a < b && *a == ' ')
+          ++a;
+        while (b > a && b[-1] == ' ')
+          --b;
+        fields->emplace_back(a, b);
+        if (p == end)
+          break;
+        field= p + 1;
+      }
+    }
+  }
+
+  // Parses a field as a number. An empty field is NaN. Returns false if the
+  // field is not a number
+  static bool parse_number(const std::pair<const char*, const char*>& field, double* value)
+  {
+    const std::size_t length= field.second - field.first;
+    if (length == 0) {
+      *value= std::numeric_limits<double>::quiet_NaN();
+      return true;
+    }
+    if (length > MAX_FIELD)
+      return false;
+    // Copied, as the input is not terminated and strtod would read past it
+    char buffer[MAX_FIELD + 1];
+    memcpy(buffer, field.first, length);
+    buffer[length]= '\0';
+    char* parsed;
+    *value= strtod(buffer, &parsed);
+    return parsed == buffer + length;
+  }
+
+  // The samples of each rank in one chunk of the input, in input order
+  struct ChunkRank {
+    std::vector<double> times;
+    // numMetrics values per sample
+    std::vector<double> values;
+  };
+
+  struct Chunk {
+    const char* begin;
+    const char* end;
+    std::unordered_map<int, ChunkRank> ranks;
+    std::string error;
+  };
+
+  static void parse_chunk(Chunk* chunk, std::size_t numMetrics)
+  {
+    std::vector<std::pair<const char*, const char*>> fields;
+    const char* line= chunk->begin;
+    int lastRank= 0;
+    ChunkRank* current= nullptr;
+    while (line < chunk->end) {
+      const char* newline= static_cast<const char*>(memchr(line, '\n', chunk->end - line));
+      const char* lineEnd= newline != nullptr ? newline : chunk->end;
+      if (lineEnd > line && *line != '#' && *line != '\r') {
+        split(line, lineEnd, &fields);
+        double rank, time;
+        bool ok= fields.size() == numMetrics + 2 &&
+          parse_number(fields[0], &rank) && !std::isnan(rank) &&
+          parse_number(fields[1], &time) && !std::isnan(time);
+        if (ok) {
+          // Lines of the same rank tend to come together
+          if (current == nullptr || static_cast<int>(rank) != lastRank) {
+            lastRank= static_cast<int>(rank);
+            current= &chunk->ranks[lastRank];
+          }
+          current->times.push_back(time);
+          for (std::size_t m= 0; ok && m < numMetrics; ++m) {
+            double value;
+            ok= parse_number(fields[m + 2], &value);
+            current->values.push_back(value);
+          }
+        }
+        if (!ok) {
+          chunk->error= "malformed line: " + std::string(line, std::min<std::size_t>(lineEnd - line, 80));
+          return;
+        }
+      }
+      line= lineEnd + 1;
+    }
+  }
+
+  bool read_csv(const char* path, ThreadPool& pool, Profile* profile, std::string* error)
+  {
+    Input input;
+    if (!load(path, &input, error))
+      return false;
+    const char* const end= input.data + input.size;
+
+    // The header, after any comments
+    const char* line= input.data;
+    const char* lineEnd= line;
+    for (; line < end; line= lineEnd + 1) {
+      lineEnd= static_cast<const char*>(memchr(line, '\n', end - line));
+      if (lineEnd == nullptr)
+        lineEnd= end;
+      if (lineEnd > line && *line != '#')
+        break;
+    }
+    std::vector<std::pair<const char*, const char*>> fields;
+    if (line < end)
+      split(line, lineEnd, &fields);
+    if (fields.size() < 3 ||
+        std::string(fields[0].first, fields[0].second) != "rank" ||
+        std::string(fields[1].first, fields[1].second) != "time") {
+      *error= std::string(path) + ": expected a header of rank,time and the metrics";
+      return false;
+    }
+    profile->metrics.clear();
+    for (std::size_t f= 2; f < fields.size(); ++f)
+      profile->metrics.emplace_back(fields[f].first, fields[f].second);
+    const std::size_t numMetrics= profile->metrics.size();
+
+    // The rest is split into chunks at line ends, several per thread to even
+    // out the work
+    const char* body= std::min(lineEnd + 1, end);
+    const std::size_t numChunks= std::max<std::size_t>(1, std::min<std::size_t>(pool.size() * 4, (end - body) / 65536 + 1));
+    std::vector<Chunk> chunks(numChunks);
+    const char* begin= body;
+    for (std::size_t c= 0; c < numChunks; ++c) {
+      const char* chunkEnd= c + 1 == numChunks ? end : body + (end - body) * (c + 1) / numChunks;
+      if (chunkEnd < begin)
+        chunkEnd= begin;
+      const char* newline= static_cast<const char*>(memchr(chunkEnd, '\n', end - chunkEnd));
+      chunkEnd= newline != nullptr ? newline + 1 : end;
+      chunks[c].begin= begin;
+      chunks[c].end= chunkEnd;
+      begin= chunkEnd;
+    }
+    pool.parallel_for(numChunks, [&](std::size_t c, unsigned) {
+      parse_chunk(&chunks[c], numMetrics);
+    });
+    for (const Chunk& chunk : chunks) {
+      if (!chunk.error.empty()) {
+        *error= std::string(path) + ": " + chunk.error;
+        return false;
+      }
+    }
+
+    // Gathers each rank from the chunks, in input order
+    std::vector<int> rankIds;
+    for (const Chunk& chunk : chunks)
+      for (const auto& rank : chunk.ranks)
+        rankIds.push_back(rank.first);
+    std::sort(rankIds.begin(), rankIds.end());
+    rankIds.erase(std::unique(rankIds.begin(), rankIds.end()), rankIds.end());
+    profile->ranks.assign(rankIds.size(), Rank());
+    pool.parallel_for(rankIds.size(), [&](std::size_t r, unsigned) {
+      Rank& rank= profile->ranks[r];
+      rank.rank= rankIds[r];
+      rank.values.assign(numMetrics, std::vector<double>());
+      std::vector<double> times, values;
+      for (const Chunk& chunk : chunks) {
+        auto found= chunk.ranks.find(rankIds[r]);
+        if (found == chunk.ranks.end())
+          continue;
+        times.insert(times.end(), found->second.times.begin(), found->second.times.end());
+        values.insert(values.end(), found->second.values.begin(), found->second.values.end());
+      }
+      // In time order, if the input was not
+      std::vector<std::size_t> order(times.size());
+      std::iota(order.begin(), order.end(), 0);
+      if (!std::is_sorted(times.begin(), times.end()))
+        std::stable_sort(order.begin(), order.end(),
+                         [&](std::size_t a, std::size_t b) { return times[a] < times[b]; });
+      rank.times.resize(times.size());
+      for (std::size_t m= 0; m < numMetrics; ++m)
+        rank.values[m].resize(times.size());
+      for (std::size_t i= 0; i < order.size(); ++i) {
+        rank.times[i]= times[order[i]];
+        for (std::size_t m= 0; m < numMetrics; ++m)
+          rank.values[m][i]= values[order[i] * numMetrics + m];
+      }
+    });
+    return true;
+  }
+
+  static double median(std::vector<double>* values)
+  {
+    if (values->empty())
+      return 0.0;
+    auto middle= values->begin() + values->size() / 2;
+    std::nth_element(values->begin(), middle, values->end());
+    return *middle;
+  }
+
+  std::vector<std::size_t> change_points(const double* values, std::size_t n,
+                                         double penalty, std::size_t minSamples)
+  {
+    std::vector<std::size_t> changes;
+    minSamples= std::max<std::size_t>(1, minSamples);
+    if (n < 2 * minSamples)
+      return changes;
+
+    // The noise, from the median absolute difference of successive samples.
+    // For Gaussian noise it is 0.6745 * sqrt(2) standard deviations
+    double mean= 0.0;
+    for (std::size_t i= 0; i < n; ++i)
+      mean+= values[i];
+    mean/= n;
+    std::vector<double> differences(n - 1);
+    for (std::size_t i= 0; i + 1 < n; ++i)
+      differences[i]= std::fabs(values[i + 1] - values[i]);
+    double noiseVariance= std::pow(median(&differences) / (0.6745 * std::sqrt(2.0)), 2);
+    if (noiseVariance <= 0.0) {
+      // Steps without noise. Any change is real, but one sample that differs
+      // from the rest is not a phase
+      double variance= 0.0;
+      for (std::size_t i= 0; i < n; ++i)
+        variance+= (values[i] - mean) * (values[i] - mean);
+      variance/= n;
+      if (variance <= 0.0)
+        return changes;
+      noiseVariance= variance * 1e-3;
+    }
+    const double beta= penalty * std::log(static_cast<double>(n)) * noiseVariance;
+
+    // Sums of the centred values and of their squares, for the squared error
+    // of any segment in constant time
+    std::vector<double> sum(n + 1, 0.0), sumSquares(n + 1, 0.0);
+    for (std::size_t i= 0; i < n; ++i) {
+      const double x= values[i] - mean;
+      sum[i + 1]= sum[i] + x;
+      sumSquares[i + 1]= sumSquares[i] + x * x;
+    }
+
+    // best[t] is the least penalised cost of the first t samples, and
+    // last[t] where its last segment starts
+    std::vector<double> best(n + 1, std::numeric_limits<double>::infinity());
+    std::vector<std::size_t> last(n + 1, 0);
+    best[0]= -beta;
+
+    // The starts of the last segment still worth trying, with what the cost
+    // of a segment from each needs side by side, so that the loop over them
+    // vectorises. With few changes few starts are pruned, so that loop is
+    // most of the time
+    std::vector<std::size_t> starts;
+    std::vector<double> startAt, startBest, startSum, startSquares, totals;
+    for (std::size_t t= minSamples; t <= n; ++t) {
+      // A segment may end at s = t - minSamples, if the samples before it
+      // can be split into segments
+      const std::size_t s= t - minSamples;
+      if (s == 0 || s >= minSamples) {
+        starts.push_back(s);
+        startAt.push_back(static_cast<double>(s));
+        startBest.push_back(best[s]);
+        startSum.push_back(sum[s]);
+        startSquares.push_back(sumSquares[s]);
+      }
+      const std::size_t numStarts= starts.size();
+      totals.resize(numStarts);
+      const double tAt= static_cast<double>(t), tSum= sum[t], tSquares= sumSquares[t];
+      const double* at= startAt.data();
+      const double* previous= startBest.data();
+      const double* sums= startSum.data();
+      const double* squares= startSquares.data();
+      double* total= totals.data();
+      for (std::size_t c= 0; c < numStarts; ++c) {
+        const double segmentSum= tSum - sums[c];
+        total[c]= previous[c] + (tSquares - squares[c]) - segmentSum * segmentSum / (tAt - at[c]);
+      }
+      std::size_t lowest= 0;
+      for (std::size_t c= 1; c < numStarts; ++c)
+        if (total[c] < total[lowest])
+          lowest= c;
+      best[t]= total[lowest] + beta;
+      last[t]= starts[lowest];
+
+      // A start that cannot beat the best now never will, as the squared
+      // error of a segment only grows when it is split. Pruning at any time
+      // is exact, so it is only done every few samples
+      if (t % PRUNE_INTERVAL == 0) {
+        std::size_t kept= 0;
+        for (std::size_t c= 0; c < numStarts; ++c) {
+          if (total[c] <= best[t]) {
+            starts[kept]= starts[c];
+            startAt[kept]= startAt[c];
+            startBest[kept]= startBest[c];
+            startSum[kept]= startSum[c];
+            startSquares[kept]= startSquares[c];
+            ++kept;
+          }
+        }
+        starts.resize(kept);
+        startAt.resize(kept);
+        startBest.resize(kept);
+        startSum.resize(kept);
+        startSquares.resize(kept);
+      }
+    }
+    for (std::size_t t= last[n]; t > 0; t= last[t])
+      changes.push_back(t);
+    std::reverse(changes.begin(), changes.end());
+    return changes;
+  }
+
+  // The series with gaps filled by the last value before them, or the first
+  // after them at the start. Returns false if there are no values
+  static bool fill_gaps(const std::vector<double>& values, std::vector<double>* filled)
+  {
+    filled->assign(values.begin(), values.end());
+    std::size_t first= 0;
+    while (first < values.size() && std::isnan(values[first]))
+      ++first;
+    if (first == values.size())
+      return false;
+    for (std::size_t i= 0; i < first; ++i)
+      (*filled)[i]= values[first];
+    for (std::size_t i= first + 1; i < values.size(); ++i)
+      if (std::isnan((*filled)[i]))
+        (*filled)[i]= (*filled)[i - 1];
+    return true;
+  }
+
+  std::vector<Phase> detect(const Profile& profile, const Options& options, ThreadPool& pool)
+  {
+    const std::size_t numRanks= profile.ranks.size();
+    const std::size_t numMetrics= profile.metrics.size();
+    std::vector<Phase> phases;
+    if (numRanks == 0)
+      return phases;
+
+    // The times at which each rank changes in any metric
+    std::vector<std::vector<double>> rankChanges(numRanks);
+    std::vector<double> rankIntervals(numRanks, 0.0);
+    pool.parallel_for(numRanks, [&](std::size_t r, unsigned) {
+      const Rank& rank= profile.ranks[r];
+      std::vector<double> filled;
+      for (std::size_t m= 0; m < numMetrics; ++m) {
+        if (!fill_gaps(rank.values[m], &filled))
+          continue;
+        for (std::size_t c : change_points(filled.data(), filled.size(), options.penalty, options.minSamples))
+          rankChanges[r].push_back(0.5 * (rank.times[c - 1] + rank.times[c]));
+      }
+      std::sort(rankChanges[r].begin(), rankChanges[r].end());
+      std::vector<double> intervals;
+      for (std::size_t i= 1; i < rank.times.size(); ++i)
+        intervals.push_back(rank.times[i] - rank.times[i - 1]);
+      rankIntervals[r]= median(&intervals);
+    });
+
+    // Votes are counted in bins of one sample interval, and each change
+    // votes for the bins within half the shortest phase of it, so that ranks
+    // that change a sample or two apart agree
+    double start= std::numeric_limits<double>::infinity();
+    double end= -std::numeric_limits<double>::infinity();
+    for (const Rank& rank : profile.ranks) {
+      if (!rank.times.empty()) {
+        start= std::min(start, rank.times.front());
+        end= std::max(end, rank.times.back());
+      }
+    }
+    if (!(end >= start))
+      return phases;
+    double binWidth= median(&rankIntervals);
+    if (binWidth <= 0.0)
+      binWidth= 1.0;
+    const std::size_t numBins= static_cast<std::size_t>((end - start) / binWidth) + 1;
+    const long reach= std::max<long>(1, static_cast<long>(options.minSamples / 2));
+    auto bin_of= [&](double time) {
+      return std::min<long>(static_cast<long>((time - start) / binWidth), static_cast<long>(numBins) - 1);
+    };
+
+    std::vector<std::vector<unsigned>> workerVotes(pool.size(), std::vector<unsigned>(numBins, 0));
+    std::vector<std::vector<std::size_t>> workerLastRank(pool.size(), std::vector<std::size_t>(numBins, numRanks));
+    pool.parallel_for(numRanks, [&](std::size_t r, unsigned worker) {
+      std::vector<unsigned>& votes= workerVotes[worker];
+      std::vector<std::size_t>& lastRank= workerLastRank[worker];
+      for (double time : rankChanges[r]) {
+        const long bin= bin_of(time);
+        for (long b= std::max(0L, bin - reach); b <= std::min<long>(numBins - 1, bin + reach); ++b) {
+          // Each rank votes once for each bin
+          if (lastRank[b] != r) {
+            lastRank[b]= r;
+            ++votes[b];
+          }
+        }
+      }
+    });
+    std::vector<unsigned> votes(numBins, 0);
+    for (const auto& counts : workerVotes)
+      for (std::size_t b= 0; b < numBins; ++b)
+        votes[b]+= counts[b];
+
+    // The boundaries are the bins with the most votes, no closer together
+    // than the shortest phase
+    const double needed= std::max(1.0, options.agreement * numRanks);
+    std::vector<std::size_t> candidates;
+    for (std::size_t b= 0; b < numBins; ++b)
+      if (votes[b] >= needed)
+        candidates.push_back(b);
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [&](std::size_t a, std::size_t b) { return votes[a] > votes[b]; });
+    const long separation= std::max<long>(1, static_cast<long>(options.minSamples));
+    std::vector<std::size_t> accepted;
+    for (std::size_t b : candidates) {
+      bool clear= true;
+      for (std::size_t a : accepted)
+        clear= clear && std::labs(static_cast<long>(a) - static_cast<long>(b)) >= separation;
+      if (clear)
+        accepted.push_back(b);
+    }
+    std::sort(accepted.begin(), accepted.end());
+
+    // Each boundary is at the median time of the changes that voted for it
+    std::vector<double> boundaries, agreements;
+    for (std::size_t b : accepted) {
+      const double from= start + (static_cast<long>(b) - reach) * binWidth;
+      const double to= start + (static_cast<long>(b) + reach + 1) * binWidth;
+      std::vector<double> times;
+      for (const auto& changes : rankChanges)
+        for (auto it= std::lower_bound(changes.begin(), changes.end(), from);
+             it != changes.end() && *it < to; ++it)
+          times.push_back(*it);
+      const double time= median(&times);
+      if (time > start && time < end && (boundaries.empty() || time > boundaries.back())) {
+        boundaries.push_back(time);
+        agreements.push_back(static_cast<double>(votes[b]) / numRanks);
+      }
+    }
+
+    phases.resize(boundaries.size() + 1);
+    for (std::size_t p= 0; p < phases.size(); ++p) {
+      phases[p].start= p == 0 ? start : boundaries[p - 1];
+      phases[p].end= p == boundaries.size() ? end : boundaries[p];
+      phases[p].agreement= p == 0 ? 1.0 : agreements[p - 1];
+    }
+
+    // The sums of each metric in each phase and over the run, per worker
+    const std::size_t numPhases= phases.size();
+    struct Sums {
+      std::vector<double> sum, count, runSum, runSquares, runCount;
+      std::vector<std::size_t> samples;
+    };
+    std::vector<Sums> workerSums(pool.size());
+    for (Sums& sums : workerSums) {
+      sums.sum.assign(numPhases * numMetrics, 0.0);
+      sums.count.assign(numPhases * numMetrics, 0.0);
+      sums.runSum.assign(numMetrics, 0.0);
+      sums.runSquares.assign(numMetrics, 0.0);
+      sums.runCount.assign(numMetrics, 0.0);
+      sums.samples.assign(numPhases, 0);
+    }
+    pool.parallel_for(numRanks, [&](std::size_t r, unsigned worker) {
+      const Rank& rank= profile.ranks[r];
+      Sums& sums= workerSums[worker];
+      std::size_t p= 0;
+      for (std::size_t i= 0; i < rank.times.size(); ++i) {
+        while (p + 1 < numPhases && rank.times[i] >= phases[p].end)
+          ++p;
+        ++sums.samples[p];
+        for (std::size_t m= 0; m < numMetrics; ++m) {
+          const double value= rank.values[m][i];
+          if (std::isnan(value))
+            continue;
+          sums.sum[p * numMetrics + m]+= value;
+          sums.count[p * numMetrics + m]+= 1.0;
+          sums.runSum[m]+= value;
+          sums.runSquares[m]+= value * value;
+          sums.runCount[m]+= 1.0;
+        }
+      }
+    });
+    Sums total= workerSums[0];
+    for (std::size_t w= 1; w < workerSums.size(); ++w) {
+      for (std::size_t i= 0; i < total.sum.size(); ++i) {
+        total.sum[i]+= workerSums[w].sum[i];
+        total.count[i]+= workerSums[w].count[i];
+      }
+      for (std::size_t m= 0; m < numMetrics; ++m) {
+        total.runSum[m]+= workerSums[w].runSum[m];
+        total.runSquares[m]+= workerSums[w].runSquares[m];
+        total.runCount[m]+= workerSums[w].runCount[m];
+      }
+      for (std::size_t p= 0; p < numPhases; ++p)
+        total.samples[p]+= workerSums[w].samples[p];
+    }
+
+    std::vector<bool> isBottleneck(numMetrics, options.bottlenecks.empty());
+    for (const std::string& name : options.bottlenecks)
+      for (std::size_t m= 0; m < numMetrics; ++m)
+        if (profile.metrics[m] == name)
+          isBottleneck[m]= true;
+    for (std::size_t p= 0; p < numPhases; ++p) {
+      Phase& phase= phases[p];
+      phase.samples= total.samples[p];
+      phase.means.assign(numMetrics, std::numeric_limits<double>::quiet_NaN());
+      phase.dominant= -1;
+      phase.dominantScore= 0.0;
+      for (std::size_t m= 0; m < numMetrics; ++m) {
+        const double count= total.count[p * numMetrics + m];
+        if (count == 0.0)
+          continue;
+        phase.means[m]= total.sum[p * numMetrics + m] / count;
+        if (!isBottleneck[m] || total.runCount[m] == 0.0)
+          continue;
+        const double runMean= total.runSum[m] / total.runCount[m];
+        const double runVariance= total.runSquares[m] / total.runCount[m] - runMean * runMean;
+        if (runVariance <= 0.0)
+          continue;
+        const double score= (phase.means[m] - runMean) / std::sqrt(runVariance);
+        if (phase.dominant == -1 || score > phase.dominantScore) {
+          phase.dominant= static_cast<int>(m);
+          phase.dominantScore= score;
+        }
+      }
+    }
+    return phases;
+  }
+
+  void print_phases(FILE* out, const Profile& profile, const std::vector<Phase>& phases, bool csv)
+  {
+    const std::size_t numMetrics= profile.metrics.size();
+    if (csv) {
+      fprintf(out, "phase,start,end,agreement,samples");
+      for (const std::string& metric : profile.metrics)
+        fprintf(out, ",%s", metric.c_str());
+      fprintf(out, ",dominant,dominant_score\n");
+      for (std::size_t p= 0; p < phases.size(); ++p) {
+        const Phase& phase= phases[p];
+        fprintf(out, "%zu,%.6f,%.6f,%.3f,%zu", p + 1, phase.start, phase.end, phase.agreement, phase.samples);
+        for (std::size_t m= 0; m < numMetrics; ++m)
+          fprintf(out, ",%.9g", phase.means[m]);
+        fprintf(out, ",%s,%.3f\n", phase.dominant < 0 ? "" : profile.metrics[phase.dominant].c_str(),
+                phase.dominantScore);
+      }
+      return;
+    }
+
+    std::vector<int> widths;
+    fprintf(out, "%5s %12s %12s %9s %10s", "phase", "start (s)", "end (s)", "agreement", "samples");
+    for (const std::string& metric : profile.metrics) {
+      widths.push_back(std::max<int>(12, static_cast<int>(metric.size())));
+      fprintf(out, "  %*s", widths.back(), metric.c_str());
+    }
+    fprintf(out, "  dominant\n");
+    for (std::size_t p= 0; p < phases.size(); ++p) {
+      const Phase& phase= phases[p];
+      fprintf(out, "%5zu %12.3f %12.3f %8.0f%% %10zu", p + 1, phase.start, phase.end,
+              100.0 * phase.agreement, phase.samples);
+      for (std::size_t m= 0; m < numMetrics; ++m)
+        fprintf(out, "  %*.4g", widths[m], phase.means[m]);
+      if (phase.dominant < 0)
+        fprintf(out, "  -\n");
+      else
+        fprintf(out, "  %s (%+.1f sd)\n", profile.metrics[phase.dominant].c_str(), phase.dominantScore);
+    }
+  }
+
+} // namespace Phases
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PHASES_H
+#define PHASES_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+///////////////////////////////////////////////////////////////////////////////
+// Finds the phases of a run from the metric time series of every rank.
+//
+// Each metric of each rank is split where its mean changes by PELT (Killick,
+// Fearnhead and Eckley, 2012), with a squared error cost and a penalty of
+// penalty * log(n) times the noise variance of the series, estimated from the
+// median absolute difference of successive samples so that the changes
+// themselves do not inflate it. Pruning keeps PELT close to linear in the
+// number of samples.
+//
+// The change points of all of the ranks then vote for the times they fall
+// in, and a phase boundary is placed wherever at least the agreement
+// fraction of the ranks changed close together. The phases are the times
+// between the boundaries, with the mean of each metric over every sample of
+// every rank in them.
+///////////////////////////////////////////////////////////////////////////////
+
+namespace Phases {
+
+  // The samples of one rank, in time order
+  struct Rank {
+    int rank;
+    std::vector<double> times;
+    // One series per metric, the same length as times
+    std::vector<std::vector<double>> values;
+  };
+
+  struct Profile {
+    std::vector<std::string> metrics;
+    std::vector<Rank> ranks;
+  };
+
+  struct Options {
+    // Multiplies the log(n) times noise variance penalty for each change
+    double penalty= 3.0;
+    // The fewest samples between two changes
+    std::size_t minSamples= 5;
+    // The fraction of the ranks that must change together for a boundary
+    double agreement= 0.25;
+    // The metrics the dominant bottleneck is chosen from, or all of them
+    std::vector<std::string> bottlenecks;
+  };
+
+  struct Phase {
+    double start;
+    double end;
+    // The fraction of the ranks that changed at the start of the phase, 1
+    // for the first phase
+    double agreement;
+    std::size_t samples;
+    // The mean of each metric over the phase
+    std::vector<double> means;
+    // The index of the metric furthest above its mean over the run, in run
+    // standard deviations, or -1
+    int dominant;
+    double dominantScore;
+  };
+
+  // Reads a CSV file with a header line of "rank,time," and the metric ids,
+  // then a line per sample of a rank, in any order of ranks. "-" is the
+  // standard input. The file is parsed in parallel chunks. Returns false with
+  // a message in error if it cannot be read
+  bool read_csv(const char* path, ThreadPool& pool, Profile* profile, std::string* error);
+
+  // The indices at which the mean of the n values changes, in order
+  std::vector<std::size_t> change_points(const double* values, std::size_t n,
+                                         double penalty, std::size_t minSamples);
+
+  // Finds the phases of the profile
+  std::vector<Phase> detect(const Profile& profile, const Options& options, ThreadPool& pool);
+
+  // Prints the phases as a table, or as CSV if csv is true
+  void print_phases(FILE* out, const Profile& profile, const std::vector<Phase>& phases, bool csv);
+
+} // namespace Phases
+
+#endif // PHASES_H
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// A fixed set of worker threads that run the iterations of a loop. The
+// iterations are handed out one at a time from a shared counter, so a few
+// long ones (ranks with many samples) do not hold up the others.
+///////////////////////////////////////////////////////////////////////////////
+
+class ThreadPool {
+public:
+  // 0 threads is one per hardware thread
+  explicit ThreadPool(unsigned numThreads)
+    : mNumThreads(numThreads != 0 ? numThreads : std::max(1u, std::thread::hardware_concurrency())),
+      mNext(0), mGeneration(0), mBusy(0), mStop(false)
+  {
+    // The calling thread is one of the workers
+    for (unsigned w= 1; w < mNumThreads; ++w)
+      mThreads.emplace_back(&ThreadPool::worker, this, w);
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mStop= true;
+    }
+    mStart.notify_all();
+    for (auto& thread : mThreads)
+      thread.join();
+  }
+
+  unsigned size() const { return mNumThreads; }
+
+  // Runs body(i, worker) for i from 0 to n - 1 and returns when all have
+  // run. worker is from 0 to size() - 1, for per-worker scratch space
+  void parallel_for(std::size_t n, const std::function<void(std::size_t, unsigned)>& body)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mBody= &body;
+      mCount= n;
+      mNext.store(0);
+      mBusy= mNumThreads - 1;
+      ++mGeneration;
+    }
+    mStart.notify_all();
+    run(0);
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [this] { return mBusy == 0; });
+    mBody= nullptr;
+  }
+
+private:
+  void run(unsigned worker)
+  {
+    for (std::size_t i= mNext.fetch_add(1); i < mCount; i= mNext.fetch_add(1))
+      (*mBody)(i, worker);
+  }
+
+  void worker(unsigned worker)
+  {
+    unsigned long seen= 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mStart.wait(lock, [&] { return mStop || mGeneration != seen; });
+        if (mStop)
+          return;
+        seen= mGeneration;
+      }
+      run(worker);
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (--mBusy == 0)
+        mDone.notify_one();
+    }
+  }
+
+  const unsigned mNumThreads;
+  std::vector<std::thread> mThreads;
+  std::mutex mMutex;
+  std::condition_variable mStart;
+  std::condition_variable mDone;
+  const std::function<void(std::size_t, unsigned)>* mBody= nullptr;
+  std::size_t mCount= 0;
+  std::atomic<std::size_t> mNext;
+  unsigned long mGeneration;
+  unsigned mBusy;
+  bool mStop;
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,135 @@
+#!/bin/bash
+#
+# Copyright (c) 2018, Arm Limited and affiliates.
+# SPDX-License-Identifier: Apache-2.0
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Generates common/telemetry_ids.h, the table of the metrics that can be
+# published to a telemetry page, from the metric definitions of every plugin.
+#
+# Usage: gen-telemetry-ids.sh <repository root> <output header>
+
+set -e
+
+root=${1:-../..}
+output=${2:-$root/common/telemetry_ids.h}
+
+# One line per metric: id, data type, divideBySampleTime, units, display name
+metrics=$(for xml in $(cd "$root" && ls */*.xml | sort); do
+    awk '
+        # Joins the lines of each <metric> element, as attributes may be on lines of their own
+        /<metric id=/ { inMetric = 1; text = "" }
+        inMetric { text = text " " $0 }
+        /<\/metric>/ && inMetric {
+            inMetric = 0
+            id = element_attribute(text, "metric id")
+            type = element_text(text, "dataType")
+            divide = element_attribute(text, "divideBySampleTime") == "true" ? 1 : 0
+            printf "%s\t%s\t%d\t%s\t%s\n", id, type, divide, element_text(text, "units"), element_text(text, "displayName")
+        }
+        function element_attribute(text, name,    start) {
+            if (!match(text, name "=\"[^\"]*\""))
+                return ""
+            start = RSTART + length(name) + 2
+            return substr(text, start, RSTART + RLENGTH - 1 - start)
+        }
+        function element_text(text, name,    start) {
+            if (!match(text, "<" name ">[^<]*</" name ">"))
+                return ""
+            start = RSTART + length(name) + 2
+            return substr(text, start, RLENGTH - 2 * length(name) - 5)
+        }
+    ' "$root/$xml"
+done)
+
+duplicates=$(echo "$metrics" | cut -f1 | sort | uniq -d)
+if [ -n "$duplicates" ]; then
+    echo "$0: metrics defined more than once: $duplicates" >&2
+    exit 1
+fi
+
+# Readers only accept pages published with the same table
+hash=$(echo "$metrics" | cut -f1-3 | cksum | cut -d' ' -f1)
+
+{
+    cat <<HEADER
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The metrics that can be published to a telemetry page, one for each metric
+ * of every plugin's XML definitions, in the order of the files and of the
+ * metrics in them.
+ *
+ * Generated by tools/telemetry/gen-telemetry-ids.sh. Do not edit; run
+ * make ids in tools/telemetry after changing the metric definitions.
+ */
+
+#ifndef TELEMETRY_IDS_H
+#define TELEMETRY_IDS_H
+
+/*! Changes whenever a metric is added, removed, moved or changes type. */
+#define TELEMETRY_TABLE_HASH ${hash}u
+
+enum telemetry_metric_id {
+HEADER
+    echo "$metrics" | awk -F'\t' '{
+        name = toupper($1)
+        gsub(/[^A-Z0-9]/, "_", name)
+        printf "    TELEMETRY_%s%s,\n", name, NR == 1 ? " = 0" : ""
+    }'
+    cat <<HEADER
+    TELEMETRY_NUM_METRICS
+};
+
+#ifdef TELEMETRY_METRIC_TABLE
+
+/*! The definition of a metric, for readers of telemetry pages. */
+struct telemetry_metric {
+    const char *id;
+    const char *displayName;
+    const char *units;
+    /*! Non-zero if the value is a double, else a uint64_t. */
+    int isDouble;
+    /*! Non-zero if the value is a count to be divided by the sample time to give a rate. */
+    int divideBySampleTime;
+};
+
+static const struct telemetry_metric telemetryMetrics[TELEMETRY_NUM_METRICS] = {
+HEADER
+    echo "$metrics" | awk -F'\t' '
+        function quote(s) { gsub(/\\/, "\\\\", s); gsub(/"/, "\\\"", s); return "\"" s "\"" }
+        { printf "    { %s, %s, %s, %d, %d },\n", quote($1), quote($5), quote($4), $2 == "double", $3 }'
+    cat <<HEADER
+};
+
+#endif /* TELEMETRY_METRIC_TABLE */
+
+#endif /* TELEMETRY_IDS_H */
+HEADER
+} > "$output"
@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Reads the telemetry pages that the plugins of every process on this node
+ * publish (see common/telemetry.h), and prints one snapshot of the metrics of
+ * all of them, or writes it as a Prometheus text file.
+ *
+ * The pages are only read, so the processes never wait for this tool.
+ */
+
+#define TELEMETRY_METRIC_TABLE
+
+#include "telemetry.h"
+
+#include <dirent.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*! How many times to try to read a page that is being published to before skipping it. */
+#define READ_TRIES 100
+
+/*! A page read from a process. */
+struct process {
+    char name[NAME_MAX + 1];
+    struct telemetry_page page;
+};
+
+/*! The options. */
+static const char *prometheusFile = NULL;
+static double intervalSeconds = 0.0;
+static int perProcess = 0;
+static int allUsers = 0;
+static int clean = 0;
+
+static void usage(FILE *out)
+{
+    fprintf(out,
+            "Usage: map-telemetry [options]\n"
+            "Prints the metrics that the processes on this node publish with ARM_MAP_TELEMETRY=1.\n"
+            "\n"
+            "  -p, --prometheus FILE   write a Prometheus text file instead, replacing FILE atomically\n"
+            "  -i, --interval SECONDS  repeat every SECONDS rather than once\n"
+            "  -a, --per-process       also report the value of each process\n"
+            "  -u, --all-users         read the pages of every user, not just this one\n"
+            "  -c, --clean             remove the pages of processes that have exited\n"
+            "  -h, --help              print this help\n");
+}
+
+/*! \return non-zero if \a name is the name of a telemetry page to read */
+static int is_page_name(const char *name)
+{
+    char prefix[64];
+    if (allUsers)
+        snprintf(prefix, sizeof(prefix), "%s-", TELEMETRY_PREFIX);
+    else
+        snprintf(prefix, sizeof(prefix), "%s-%u-", TELEMETRY_PREFIX, (unsigned) getuid());
+    return strncmp(name, prefix, strlen(prefix)) == 0 && strstr(name, ".lock") == NULL;
+}
+
+/*! Reads the page called \a name in /dev/shm into \a process. */
+/*!
+ *  \return 0 on success, or -1 if it is not a page of this version and
+ *  metric table, or cannot be read
+ */
+static int read_page(const char *name, struct process *process)
+{
+    char shmName[NAME_MAX + 2];
+    snprintf(shmName, sizeof(shmName), "/%s", name);
+    int fd = shm_open(shmName, O_RDONLY, 0);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(struct telemetry_page)) {
+        close(fd);
+        return -1;
+    }
+    const struct telemetry_page *page = (const struct telemetry_page *) mmap(NULL, sizeof(struct telemetry_page),
+                                                                               PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED)
+        return -1;
+    int ret = telemetry_read(page, &process->page, READ_TRIES);
+    munmap((void *) page, sizeof(struct telemetry_page));
+    if (ret != 0 || process->page.magic != TELEMETRY_MAGIC || process->page.version != TELEMETRY_VERSION)
+        return -1;
+    if (process->page.tableHash != TELEMETRY_TABLE_HASH) {
+        fprintf(stderr, "map-telemetry: skipping %s, which was published by plugins built from other metric definitions\n", name);
+        return -1;
+    }
+    snprintf(process->name, sizeof(process->name), "%s", name);
+    return 0;
+}
+
+/*! Reads the pages of the running processes. */
+/*!
+ *  \return the number read into \a *processes, which the caller frees
+ */
+static size_t read_pages(struct process **processes)
+{
+    size_t count = 0, capacity = 0;
+    *processes = NULL;
+    DIR *dir = opendir("/dev/shm");
+    if (dir == NULL) {
+        perror("map-telemetry: /dev/shm");
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!is_page_name(entry->d_name))
+            continue;
+        if (count == capacity) {
+            capacity = capacity == 0 ? 64 : 2 * capacity;
+            struct process *more = (struct process *) realloc(*processes, capacity * sizeof(struct process));
+            if (more == NULL)
+                break;
+            *processes = more;
+        }
+        struct process *process = &(*processes)[count];
+        if (read_page(entry->d_name, process) != 0)
+            continue;
+        if (!telemetry_publisher_alive(&process->page)) {
+            if (clean) {
+                char shmName[NAME_MAX + 2];
+                snprintf(shmName, sizeof(shmName), "/%s", entry->d_name);
+                shm_unlink(shmName);
+            }
+            continue;
+        }
+        ++count;
+    }
+    closedir(dir);
+    return count;
+}
+
+/*! The value of metric \a m in \a page, as a rate if it is divided by the sample time. */
+/*!
+ *  \return 0 on success, or -1 if the process has not published it (or has
+ *  only published one sample of a rate)
+ */
+static int metric_value(const struct telemetry_page *page, int m, double *value)
+{
+    const struct telemetry_value *v = &page->values[m];
+    if (v->sampleNs == 0)
+        return -1;
+    if (telemetryMetrics[m].isDouble) {
+        memcpy(value, &v->bits, sizeof(*value));
+    } else {
+        *value = (double) v->bits;
+    }
+    if (telemetryMetrics[m].divideBySampleTime) {
+        if (v->intervalNs == 0)
+            return -1;
+        *value /= (double) v->intervalNs / 1e9;
+    }
+    return 0;
+}
+
+/*! The statistics of one metric over the processes that published it. */
+struct summary {
+    size_t count;
+    double min, max, sum;
+};
+
+static struct summary summarise(const struct process *processes, size_t numProcesses, int m)
+{
+    struct summary s = { 0, INFINITY, -INFINITY, 0.0 };
+    for (size_t p = 0; p < numProcesses; ++p) {
+        double value;
+        if (metric_value(&processes[p].page, m, &value) != 0)
+            continue;
+        ++s.count;
+        s.sum += value;
+        s.min = value < s.min ? value : s.min;
+        s.max = value > s.max ? value : s.max;
+    }
+    return s;
+}
+
+/*! Writes \a id as a Prometheus metric name: arm_map_ followed by the id with other characters replaced by _. */
+static void print_prometheus_name(FILE *out, const char *id)
+{
+    fputs("arm_map_", out);
+    for (const char *c = id; *c != '\0'; ++c)
+        fputc((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') ? *c : '_', out);
+}
+
+static void print_prometheus(FILE *out, const struct process *processes, size_t numProcesses)
+{
+    fprintf(out, "# HELP arm_map_processes Processes publishing telemetry on this node\n");
+    fprintf(out, "# TYPE arm_map_processes gauge\n");
+    fprintf(out, "arm_map_processes %zu\n", numProcesses);
+    for (int m = 0; m < TELEMETRY_NUM_METRICS; ++m) {
+        const struct summary s = summarise(processes, numProcesses, m);
+        if (s.count == 0)
+            continue;
+        fputs("# HELP ", out);
+        print_prometheus_name(out, telemetryMetrics[m].id);
+        fprintf(out, " %s%s%s%s\n", telemetryMetrics[m].displayName, telemetryMetrics[m].units[0] != '\0' ? " (" : "",
+                telemetryMetrics[m].units, telemetryMetrics[m].units[0] != '\0' ? ")" : "");
+        fputs("# TYPE ", out);
+        print_prometheus_name(out, telemetryMetrics[m].id);
+        fputs(" gauge\n", out);
+        static const char *const stats[] = { "min", "mean", "max", "sum" };
+        const double values[] = { s.min, s.sum / (double) s.count, s.max, s.sum };
+        for (int i = 0; i < 4; ++i) {
+            print_prometheus_name(out, telemetryMetrics[m].id);
+            fprintf(out, "{stat=\"%s\"} %.17g\n", stats[i], values[i]);
+        }
+        for (size_t p = 0; perProcess && p < numProcesses; ++p) {
+            double value;
+            if (metric_value(&processes[p].page, m, &value) != 0)
+                continue;
+            print_prometheus_name(out, telemetryMetrics[m].id);
+            fprintf(out, "{rank=\"%d\",pid=\"%d\"} %.17g\n", (int) processes[p].page.rank, (int) processes[p].page.pid, value);
+        }
+    }
+}
+
+static void print_snapshot(FILE *out, const struct process *processes, size_t numProcesses)
+{
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    const uint64_t now = node_shm_now_ns();
+    fprintf(out, "%s: %zu processes\n", host, numProcesses);
+    if (numProcesses == 0)
+        return;
+    for (size_t p = 0; perProcess && p < numProcesses; ++p) {
+        const struct telemetry_page *page = &processes[p].page;
+        fprintf(out, "  rank %d, pid %d: published %.1f s ago\n", (int) page->rank, (int) page->pid,
+                page->updatedNs != 0 && now > page->updatedNs ? (double) (now - page->updatedNs) / 1e9 : 0.0);
+    }
+    fprintf(out, "%-52s %-10s %5s %14s %14s %14s %14s\n", "metric", "units", "procs", "min", "mean", "max", "sum");
+    for (int m = 0; m < TELEMETRY_NUM_METRICS; ++m) {
+        const struct summary s = summarise(processes, numProcesses, m);
+        if (s.count == 0)
+            continue;
+        fprintf(out, "%-52s %-10s %5zu %14.6g %14.6g %14.6g %14.6g\n", telemetryMetrics[m].id, telemetryMetrics[m].units,
+                s.count, s.min, s.sum / (double) s.count, s.max, s.sum);
+    }
+}
+
+/*! Writes the Prometheus file to a temporary file and renames it over \a prometheusFile, so it is never seen half written. */
+static int write_prometheus_file(const struct process *processes, size_t numProcesses)
+{
+    char temporary[4096];
+    if (snprintf(temporary, sizeof(temporary), "%s.%d.tmp", prometheusFile, (int) getpid()) >= (int) sizeof(temporary))
+        return -1;
+    FILE *out = fopen(temporary, "w");
+    if (out == NULL) {
+        perror(temporary);
+        return -1;
+    }
+    print_prometheus(out, processes, numProcesses);
+    if (fclose(out) != 0 || rename(temporary, prometheusFile) != 0) {
+        perror(prometheusFile);
+        unlink(temporary);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {
+        { "prometheus", required_argument, NULL, 'p' },
+        { "interval", required_argument, NULL, 'i' },
+        { "per-process", no_argument, NULL, 'a' },
+        { "all-users", no_argument, NULL, 'u' },
+        { "clean", no_argument, NULL, 'c' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int option;
+    while ((option = getopt_long(argc, argv, "p:i:auch", options, NULL)) != -1) {
+        switch (option) {
+        case 'p':
+            prometheusFile = optarg;
+            break;
+        case 'i':
+            intervalSeconds = atof(optarg);
+            break;
+        case 'a':
+            perProcess = 1;
+            break;
+        case 'u':
+            allUsers = 1;
+            break;
+        case 'c':
+            clean = 1;
+            break;
+        case 'h':
+            usage(stdout);
+            return 0;
+        default:
+            usage(stderr);
+            return 1;
+        }
+    }
+
+    for (;;) {
+        struct process *processes;
+        const size_t numProcesses = read_pages(&processes);
+        int ret = 0;
+        if (prometheusFile != NULL)
+            ret = write_prometheus_file(processes, numProcesses);
+        else
+            print_snapshot(stdout, processes, numProcesses);
+        free(processes);
+        if (intervalSeconds <= 0.0)
+            return ret == 0 ? 0 : 1;
+        fflush(stdout);
+        usleep((useconds_t) (intervalSeconds * 1e6));
+    }
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2018, Arm Limited and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Publishes from child processes as two ranks would, and checks what
+ * map-telemetry reports for them, that readers never see a sample half
+ * published, and that the pages are removed when the processes are done.
+ */
+
+#include "telemetry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PROMETHEUS_FILE "telemetry-test.prom"
+
+/*! How many times to read a page while it is being published to. */
+#define CONSISTENCY_READS 20000
+
+static void check(int ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        exit(1);
+    }
+}
+
+/*! Publishes as rank \a rank would over two samples a second apart, then waits until \a doneFd is closed. */
+static void publish_as_rank(int rank, int readyFd, int doneFd, int closePage)
+{
+    char value[16];
+    snprintf(value, sizeof(value), "%d", rank);
+    setenv("OMPI_COMM_WORLD_RANK", value, 1);
+    struct telemetry_page *page = telemetry_open();
+    check(page != NULL, "telemetry_open failed");
+    for (int second = 1; second <= 2; ++second) {
+        struct timespec sampleTime = { second, 0 };
+        telemetry_publish_begin(page);
+        telemetry_set_uint64(page, TELEMETRY_GPFS_IOPS, 100 * (rank + 1), &sampleTime);
+        telemetry_set_double(page, TELEMETRY_HASWELL_PAPI_MEMORY_BOUND, 0.25 * (rank + 1), &sampleTime);
+        telemetry_publish_end(page);
+    }
+    check(write(readyFd, "r", 1) == 1, "write to the parent failed");
+    char c;
+    while (read(doneFd, &c, 1) > 0)
+        ;
+    if (closePage)
+        telemetry_close(page);
+    _exit(0);
+}
+
+/*! Publishes the same count to two metrics in every sample, until killed. */
+static void publish_pairs(int readyFd)
+{
+    struct telemetry_page *page = telemetry_open();
+    check(page != NULL, "telemetry_open failed");
+    check(write(readyFd, "r", 1) == 1, "write to the parent failed");
+    for (uint64_t i = 1;; ++i) {
+        struct timespec sampleTime = { (time_t) i, 0 };
+        telemetry_publish_begin(page);
+        telemetry_set_uint64(page, TELEMETRY_GPFS_READS, i, &sampleTime);
+        telemetry_set_uint64(page, TELEMETRY_GPFS_WRITES, i, &sampleTime);
+        telemetry_publish_end(page);
+    }
+}
+
+static char *read_file(const char *path)
+{
+    static char contents[1 << 16];
+    FILE *in = fopen(path, "r");
+    check(in != NULL, "could not open the Prometheus file");
+    size_t n = fread(contents, 1, sizeof(contents) - 1, in);
+    contents[n] = '\0';
+    fclose(in);
+    return contents;
+}
+
+static void check_contains(const char *text, const char *line)
+{
+    if (strstr(text, line) == NULL) {
+        fprintf(stderr, "FAIL: expected \"%s\" in:\n%s\n", line, text);
+        exit(1);
+    }
+}
+
+static int page_exists(pid_t pid)
+{
+    char name[64];
+    telemetry_name(name, sizeof(name), pid);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1)
+        return 0;
+    close(fd);
+    return 1;
+}
+
+int main(void)
+{
+    setenv("ARM_MAP_TELEMETRY", "1", 1);
+    int ready[2], done[2];
+    check(pipe(ready) == 0 && pipe(done) == 0, "pipe failed");
+
+    /* Two ranks, and a third process that exits without closing its page */
+    pid_t ranks[3];
+    for (int rank = 0; rank < 3; ++rank) {
+        ranks[rank] = fork();
+        if (ranks[rank] == 0) {
+            close(done[1]);
+            publish_as_rank(rank, ready[1], done[0], rank < 2);
+        }
+    }
+    close(done[0]);
+    char c;
+    for (int i = 0; i < 3; ++i)
+        check(read(ready[0], &c, 1) == 1, "a child failed to publish");
+
+    /* The third process is gone, so only the ranks are reported, and --clean removes its page */
+    kill(ranks[2], SIGKILL);
+    waitpid(ranks[2], NULL, 0);
+    check(page_exists(ranks[2]), "expected the page of a killed process to be left behind");
+    check(system("./map-telemetry --per-process --clean --prometheus " PROMETHEUS_FILE) == 0, "map-telemetry failed");
+    check(!page_exists(ranks[2]), "expected --clean to remove the page of a killed process");
+    const char *text = read_file(PROMETHEUS_FILE);
+    check_contains(text, "arm_map_processes 2\n");
+    /* 100 and 200 operations in a second */
+    check_contains(text, "# TYPE arm_map_gpfs_iops gauge\n");
+    check_contains(text, "arm_map_gpfs_iops{stat=\"sum\"} 300\n");
+    check_contains(text, "arm_map_gpfs_iops{stat=\"min\"} 100\n");
+    check_contains(text, "arm_map_haswell_papi_memory_bound{stat=\"mean\"} 0.375\n");
+    check_contains(text, "arm_map_haswell_papi_memory_bound{stat=\"max\"} 0.5\n");
+    char line[128];
+    snprintf(line, sizeof(line), "arm_map_gpfs_iops{rank=\"1\",pid=\"%d\"} 200\n", (int) ranks[1]);
+    check_contains(text, line);
+    check(strstr(text, "arm_map_gpfs_reads") == NULL, "expected only the published metrics");
+    unlink(PROMETHEUS_FILE);
+    check(system("./map-telemetry > /dev/null") == 0, "map-telemetry failed to print a snapshot");
+
+    /* The ranks remove their pages as the last plugin closes them */
+    close(done[1]);
+    for (int rank = 0; rank < 2; ++rank) {
+        waitpid(ranks[rank], NULL, 0);
+        check(!page_exists(ranks[rank]), "expected the page to be removed when closed");
+    }
+
+    /* Every copy a reader takes while a process publishes is of one whole sample */
+    pid_t publisher = fork();
+    if (publisher == 0)
+        publish_pairs(ready[1]);
+    check(read(ready[0], &c, 1) == 1, "the publisher failed to start");
+    char name[64];
+    telemetry_name(name, sizeof(name), publisher);
+    int fd = shm_open(name, O_RDONLY, 0);
+    check(fd != -1, "could not open the publisher's page");
+    const struct telemetry_page *page = (const struct telemetry_page *) mmap(NULL, sizeof(struct telemetry_page),
+                                                                               PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    check(page != MAP_FAILED, "could not map the publisher's page");
+    static struct telemetry_page copy;
+    int consistent = 0;
+    for (int i = 0; i < CONSISTENCY_READS; ++i) {
+        if (telemetry_read(page, &copy, 1000) != 0)
+            continue;
+        ++consistent;
+        check(copy.values[TELEMETRY_GPFS_READS].bits == copy.values[TELEMETRY_GPFS_WRITES].bits,
+              "expected both metrics of a sample in every copy");
+    }
+    kill(publisher, SIGKILL);
+    waitpid(publisher, NULL, 0);
+    check(consistent > CONSISTENCY_READS / 2, "expected most reads to succeed");
+    fprintf(stderr, "%d consistent copies, last of sample %llu\n", consistent,
+            (unsigned long long) copy.values[TELEMETRY_GPFS_READS].bits);
+    munmap((void *) page, sizeof(struct telemetry_page));
+    shm_unlink(name);
+
+    printf("PASS\n");
+    return 0;
+}